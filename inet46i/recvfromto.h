@@ -18,6 +18,25 @@ union sockaddr_in46;
  */
 
 
+__attribute__((nonnull(1), access(read_only, 1), access(write_only, 2),
+               access(write_only, 3)))
+/**
+ * @brief Extract destination address from ancillary data of a received
+ *  message.
+ *
+ * The socket should have @c IP_PKTINFO / @c IPV6_RECVPKTINFO (or
+ * @c *_ORIGDSTADDR) enabled.
+ *
+ * @param mh Message header filled by @c recvmsg() or @c recvmmsg().
+ * @param[out] dst_addr Header destination address. Can be @c NULL.
+ * @param[out] recv_dst Local address that received the packet. Can be @c NULL.
+ *  Ignored when address family is IPv6.
+ */
+void recvfromto_dst(
+  const struct msghdr * __restrict mh,
+  union sockaddr_in46 * __restrict dst_addr,
+  struct in_addr * __restrict recv_dst);
+
 __attribute__((
   nonnull(2), access(write_only, 2, 3), access(write_only, 5),
   access(read_write, 6), access(write_only, 7), access(write_only, 8)))
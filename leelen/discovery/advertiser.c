@@ -1,7 +1,7 @@
 #include <regex.h>
 #include <stdbool.h>
 #include <stddef.h>
-#include <stdio.h>  // snprintf
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arpa/inet.h>
@@ -15,39 +15,120 @@
 #include "../config.h"
 #include "../number.h"
 #include "protocol.h"
+#include "identity.h"
 #include "advertiser.h"
 
 
-bool LeelenAdvertiser_should_reply (
+__attribute__((const, warn_unused_result))
+/**
+ * @brief Hash a phone number key.
+ *
+ * @param key Key of phone number.
+ * @return Hash value.
+ */
+static inline unsigned int leelen_advertiser_hash (uint32_t key) {
+  // Fibonacci hashing
+  return (key * UINT32_C(2654435761)) >> 16;
+}
+
+
+const struct LeelenIdentity *LeelenAdvertiser_match (
     const struct LeelenAdvertiser *self, const char *number) {
-  return_if (self->number_regex_set)
-    regexec(&self->number_regex, number, 0, NULL, 0) == 0;
-  return_if (self->config->number.str[0] != 0)
-    LeelenNumber_should_reply(&self->config->number, number);
-  // No phone number rules set, return false
-  return false;
+  // --reply-to decides alone for own identity
+  if (self->number_regex_set) {
+    return_if (regexec(&self->number_regex, number, 0, NULL, 0) == 0)
+      &self->identity;
+  }
+
+  uint32_t key = Leelen_number_key(number);
+  if likely (key != LEELEN_NUMBER_KEY_INVALID) {
+    // single numbers
+    if likely (self->hash != NULL) {
+      for (unsigned int i = leelen_advertiser_hash(key);; i++) {
+        const struct LeelenAdvertiserSlot *slot =
+          &self->hash[i & self->hash_mask];
+        break_if (slot->key == LEELEN_NUMBER_KEY_INVALID);
+        return_if (slot->key == key) slot->identity;
+      }
+    }
+
+    // ranges, find the last range starting no later than key
+    int lo = 0;
+    int hi = self->n_range;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (self->ranges[mid]->first <= key) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return_if (lo > 0 && key <= self->ranges[lo - 1]->last)
+      self->ranges[lo - 1];
+  }
+
+  // No phone number rules matched
+  return NULL;
+}
+
+
+__attribute__((nonnull, access(read_only, 3)))
+/**
+ * @memberof LeelenAdvertiser
+ * @private
+ * @brief Get string form of the address receiving solicitations.
+ *
+ * @param self Advertiser.
+ * @param af Address family.
+ * @param addr Address.
+ * @return Cache entry.
+ */
+static const struct LeelenAdvertiserAddr *LeelenAdvertiser_addr (
+    struct LeelenAdvertiser *self, int af, const void *addr) {
+  if (af == AF_INET6 && IN6_IS_ADDR_V4MAPPED(addr)) {
+    af = AF_INET;
+    addr = &((const struct in64_addr *) addr)->addr;
+  }
+  size_t addrlen =
+    af == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+
+  for (int i = 0; i < LEELEN_ADVERTISER_ADDR_CACHE; i++) {
+    struct LeelenAdvertiserAddr *entry = &self->addrs[i];
+    return_if (entry->af == af && memcmp(&entry->addr, addr, addrlen) == 0)
+      entry;
+  }
+
+  struct LeelenAdvertiserAddr *entry = &self->addrs[self->addrs_next];
+  self->addrs_next = (self->addrs_next + 1) % LEELEN_ADVERTISER_ADDR_CACHE;
+  entry->af = af;
+  memcpy(&entry->addr, addr, addrlen);
+  inet_ntop(af, addr, entry->str, sizeof(entry->str));
+  entry->len = strlen(entry->str);
+  return entry;
 }
 
 
 int LeelenAdvertiser_reply (
-    const struct LeelenAdvertiser *self, int sockfd,
-    const struct sockaddr *addr, const void *ouraddr) {
+    struct LeelenAdvertiser *self, const struct LeelenIdentity *identity,
+    int sockfd, const struct sockaddr *addr, const void *ouraddr) {
+  const char *buf = identity->advertisement;
+  int buflen = identity->advertisement_len;
+
   // get our addr, if not pre-defined
-  char s_ouraddr[INET6_ADDRSTRLEN];
-  if (self->report_addr[0] == '\0') {
+  char s_buf[self->mtu];
+  if (!identity->advertisement_has_addr) {
     return_if_fail (ouraddr != NULL) 255;
-    inet_ntop(addr->sa_family,
-              addr->sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(ouraddr) ?
-                &((const struct in64_addr *) ouraddr)->addr : ouraddr,
-              s_ouraddr, sizeof(s_ouraddr));
-  }
-
-  char buf[self->mtu];
-  int buflen = snprintf(
-    buf, sizeof(buf), LEELEN_DISCOVERY_FORMAT,
-    self->report_addr[0] == '\0' ? s_ouraddr : self->report_addr,
-    self->config->type, self->config->desc);
-  LOG(LOG_LEVEL_INFO, "I'm %s", buf);
+    const struct LeelenAdvertiserAddr *entry =
+      LeelenAdvertiser_addr(self, addr->sa_family, ouraddr);
+    int addrlen = min(entry->len, self->mtu);
+    memcpy(s_buf, entry->str, addrlen);
+    buflen = min(buflen, self->mtu - addrlen);
+    memcpy(s_buf + addrlen, identity->advertisement, buflen);
+    buf = s_buf;
+    buflen += addrlen;
+  }
+
+  LOG(LOG_LEVEL_INFO, "I'm %.*s", buflen, buf);
   return sendto(
     sockfd, buf, buflen, MSG_CONFIRM, addr, addr->sa_family == AF_INET ?
       sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)
@@ -56,14 +137,130 @@ int LeelenAdvertiser_reply (
 
 
 int LeelenAdvertiser_receive (
-    const struct LeelenAdvertiser *self, const char *msg, int sockfd,
+    struct LeelenAdvertiser *self, const char *msg, int sockfd,
     const struct sockaddr *src, const void *dst, int ifindex) {
-  bool should_reply =
-    !Leelen_discovery_is_advertisement(msg) &&
-    LeelenAdvertiser_should_reply(self, msg);
-  Leelen_discovery_logger(msg, src, dst, ifindex, should_reply);
-  return !should_reply ?
-    254 : LeelenAdvertiser_reply(self, sockfd, src, dst);
+  const struct LeelenIdentity *identity =
+    Leelen_discovery_is_advertisement(msg) ? NULL :
+    LeelenAdvertiser_match(self, msg);
+  Leelen_discovery_logger(msg, src, dst, ifindex, identity != NULL);
+  return identity == NULL ?
+    254 : LeelenAdvertiser_reply(self, identity, sockfd, src, dst);
+}
+
+
+int LeelenAdvertiser_add_identity (
+    struct LeelenAdvertiser *self, const char *spec,
+    const struct LeelenNumber *base) {
+  struct LeelenIdentity identity;
+  int res = LeelenIdentity_init(&identity, spec, base);
+  return_if_fail (res == 0) res;
+
+  struct LeelenIdentity *identities = realloc(
+    self->identities, sizeof(identity) * (self->n_identity + 1));
+  should (identities != NULL) otherwise {
+    LeelenIdentity_destroy(&identity);
+    return -1;
+  }
+  identities[self->n_identity] = identity;
+  self->identities = identities;
+  self->n_identity++;
+  return 0;
+}
+
+
+static int LeelenIdentity_cmp (const void *a, const void *b) {
+  uint32_t first_a = (*(const struct LeelenIdentity * const *) a)->first;
+  uint32_t first_b = (*(const struct LeelenIdentity * const *) b)->first;
+  return first_a < first_b ? -1 : first_a > first_b;
+}
+
+
+int LeelenAdvertiser_compile (struct LeelenAdvertiser *self) {
+  // own identity
+  self->identity.first = self->config->number.str[0] == '\0' ?
+    LEELEN_NUMBER_KEY_INVALID : LeelenNumber_key(&self->config->number);
+  self->identity.last = self->identity.first;
+
+  // pre-render advertisements
+  for (int i = -1; i < self->n_identity; i++) {
+    return_nonzero (LeelenIdentity_render(
+      i < 0 ? &self->identity : &self->identities[i], self->config->type,
+      self->config->desc, self->report_addr, self->mtu));
+  }
+
+  // count, own number is left to the regex if set
+  bool own = !self->number_regex_set &&
+    self->identity.first != LEELEN_NUMBER_KEY_INVALID;
+  int n_single = own;
+  int n_range = 0;
+  for (int i = 0; i < self->n_identity; i++) {
+    if (LeelenIdentity_is_range(&self->identities[i])) {
+      n_range++;
+    } else {
+      n_single++;
+    }
+  }
+
+  unsigned int hash_size = 4;
+  while (hash_size < 2 * (unsigned int) n_single) {
+    hash_size *= 2;
+  }
+  struct LeelenAdvertiserSlot *hash = malloc(sizeof(hash[0]) * hash_size);
+  return_if_fail (hash != NULL) -1;
+  // at least one slot, so that the table is never NULL
+  const struct LeelenIdentity **ranges =
+    malloc(sizeof(ranges[0]) * (n_range > 0 ? n_range : 1));
+  should (ranges != NULL) otherwise {
+    free(hash);
+    return -1;
+  }
+
+  // fill single numbers, the first identity wins
+  for (unsigned int i = 0; i < hash_size; i++) {
+    hash[i].key = LEELEN_NUMBER_KEY_INVALID;
+  }
+  n_range = 0;
+  for (int i = own ? -1 : 0; i < self->n_identity; i++) {
+    const struct LeelenIdentity *identity =
+      i < 0 ? &self->identity : &self->identities[i];
+    continue_if (identity->first == LEELEN_NUMBER_KEY_INVALID);
+    if (LeelenIdentity_is_range(identity)) {
+      ranges[n_range] = identity;
+      n_range++;
+      continue;
+    }
+    for (unsigned int j = leelen_advertiser_hash(identity->first);; j++) {
+      struct LeelenAdvertiserSlot *slot = &hash[j & (hash_size - 1)];
+      if (slot->key == LEELEN_NUMBER_KEY_INVALID) {
+        slot->key = identity->first;
+        slot->identity = identity;
+        break;
+      }
+      break_if (slot->key == identity->first);
+    }
+  }
+
+  // sort ranges and reject overlapping
+  if (n_range > 0) {
+    qsort(ranges, n_range, sizeof(ranges[0]), LeelenIdentity_cmp);
+    for (int i = 1; i < n_range; i++) {
+      should (ranges[i]->first > ranges[i - 1]->last) otherwise {
+        LOG(LOG_LEVEL_ERROR, "Identity ranges overlap at %04u-%04u",
+            ranges[i]->first / 10000, ranges[i]->first % 10000);
+        free(hash);
+        free(ranges);
+        return 1;
+      }
+    }
+  }
+
+  free(self->hash);
+  self->hash = hash;
+  self->hash_mask = hash_size - 1;
+  free(self->ranges);
+  self->ranges = ranges;
+  self->n_range = n_range;
+  return 0;
 }
 
 
@@ -98,7 +295,22 @@ unset:
 
 int LeelenAdvertiser_sync (struct LeelenAdvertiser *self) {
   self->mtu = self->config->mtu;
-  return LeelenAdvertiser_set_report_addr(
+  return_nonzero (LeelenAdvertiser_set_report_addr(
     self, self->config->addr.sa_family,
-    sockaddr_addr(&self->config->addr.sock));
+    sockaddr_addr(&self->config->addr.sock)));
+  return LeelenAdvertiser_compile(self);
+}
+
+
+void LeelenAdvertiser_destroy (struct LeelenAdvertiser *self) {
+  if (self->number_regex_set) {
+    regfree(&self->number_regex);
+  }
+  LeelenIdentity_destroy(&self->identity);
+  for (int i = 0; i < self->n_identity; i++) {
+    LeelenIdentity_destroy(&self->identities[i]);
+  }
+  free(self->identities);
+  free(self->hash);
+  free(self->ranges);
 }
@@ -7,21 +7,37 @@ extern "C" {
 
 #include <regex.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <netinet/in.h>
 
 #include "../config.h"
+#include "identity.h"
+
+
+/**
+ * @ingroup leelen-discovery
+ * @brief number of cached string forms of addresses receiving solicitations
+ */
+#define LEELEN_ADVERTISER_ADDR_CACHE 4
 
 
 /**
  * @ingroup leelen-discovery
  * @brief Handle and reply LEELEN peer solicitations.
+ *
+ * The advertiser answers for its own phone number (from the device config, or
+ * any number matching LeelenAdvertiser::number_regex if set) and any
+ * additional identities. Identities are compiled by
+ * LeelenAdvertiser_compile() into a hash table of single numbers and a sorted
+ * table of number ranges, with advertisements pre-rendered.
  */
 struct LeelenAdvertiser {
   /// device config
   const struct LeelenConfig *config;
 
-  /// phone number regex for solicitation matching
+  /// phone number regex for solicitation matching, replied with own identity;
+  /// if set, it replaces the own phone number
   regex_t number_regex;
   /// @c true if LeelenAdvertiser::number_regex is set
   bool number_regex_set;
@@ -31,8 +47,57 @@ struct LeelenAdvertiser {
 
   /// maximum transmission unit for UDP packet
   unsigned short mtu;
+
+  /// additional identities
+  struct LeelenIdentity *identities;
+  /// number of additional identities
+  int n_identity;
+
+  /** @privatesection */
+  /// own identity
+  struct LeelenIdentity identity;
+  /// hash table of single-number identities, size LeelenAdvertiser::hash_mask
+  /// + 1
+  struct LeelenAdvertiserSlot {
+    /// key of phone number, or @ref LEELEN_NUMBER_KEY_INVALID if empty
+    uint32_t key;
+    /// identity
+    const struct LeelenIdentity *identity;
+  } *hash;
+  /// hash table size minus 1
+  unsigned int hash_mask;
+  /// range identities, sorted by LeelenIdentity::first
+  const struct LeelenIdentity **ranges;
+  /// number of range identities
+  int n_range;
+
+  /// cache of string forms of addresses receiving solicitations
+  struct LeelenAdvertiserAddr {
+    /// address family, or @c AF_UNSPEC if empty
+    int af;
+    /// address
+    struct in6_addr addr;
+    /// length of LeelenAdvertiserAddr::str
+    unsigned char len;
+    /// string form of address
+    char str[INET6_ADDRSTRLEN];
+  } addrs[LEELEN_ADVERTISER_ADDR_CACHE];
+  /// next slot to be replaced in LeelenAdvertiser::addrs
+  unsigned char addrs_next;
 };
 
+__attribute__((pure, warn_unused_result, nonnull,
+               access(read_only, 1), access(read_only, 2)))
+/**
+ * @memberof LeelenAdvertiser
+ * @brief Find the identity answering a phone number solicitation.
+ *
+ * @param self Advertiser instance.
+ * @param number Requested phone number.
+ * @return Identity, or @c NULL if the solicitation should not be replied.
+ */
+const struct LeelenIdentity *LeelenAdvertiser_match (
+  const struct LeelenAdvertiser *self, const char *number);
 __attribute__((nonnull, access(read_only, 1), access(read_only, 2)))
 /**
  * @memberof LeelenAdvertiser
@@ -42,26 +107,32 @@ __attribute__((nonnull, access(read_only, 1), access(read_only, 2)))
  * @param number Requested phone number.
  * @return @c true if the solicitation should be replied.
  */
-bool LeelenAdvertiser_should_reply (
-  const struct LeelenAdvertiser *self, const char *number);
-__attribute__((nonnull(1, 3), access(read_only, 1), access(read_only, 3)))
+static inline bool LeelenAdvertiser_should_reply (
+    const struct LeelenAdvertiser *self, const char *number) {
+  return LeelenAdvertiser_match(self, number) != NULL;
+}
+__attribute__((nonnull(1, 2, 4), access(read_only, 2), access(read_only, 4)))
 /**
  * @memberof LeelenAdvertiser
  * @brief Reply to a peer solicitation.
  *
+ * This function is not thread-safe, as it caches the string form of
+ * @p ouraddr.
+ *
  * @param self Advertiser instance.
+ * @param identity Identity to reply as, from LeelenAdvertiser_match().
  * @param sockfd Socket file descriptor to send the reply on.
  * @param addr Destination address.
- * @param ouraddr Report address when @p self->report_addr is empty.
+ * @param ouraddr Report address when the identity has no report address.
  *  Can be @c NULL.
  * @return 0 on success, 255 if our address can not be determined, -1 if
  *  @c sendto() error.
  */
 int LeelenAdvertiser_reply (
-  const struct LeelenAdvertiser *self, int sockfd,
-  const struct sockaddr *addr, const void *ouraddr);
-__attribute__((nonnull(1, 2, 4), access(read_only, 1), access(read_only, 2),
-               access(read_only, 4), access(read_only, 5)))
+  struct LeelenAdvertiser *self, const struct LeelenIdentity *identity,
+  int sockfd, const struct sockaddr *addr, const void *ouraddr);
+__attribute__((nonnull(1, 2, 4), access(read_only, 2), access(read_only, 4),
+               access(read_only, 5)))
 /**
  * @memberof LeelenAdvertiser
  * @brief Process a discovery message and reply if appropriate.
@@ -76,7 +147,7 @@ __attribute__((nonnull(1, 2, 4), access(read_only, 1), access(read_only, 2),
  *  our address can not be determined, -1 if @c sendto() error.
  */
 int LeelenAdvertiser_receive (
-  const struct LeelenAdvertiser *self, const char *msg, int sockfd,
+  struct LeelenAdvertiser *self, const char *msg, int sockfd,
   const struct sockaddr *src, const void *dst, int ifindex);
 
 __attribute__((nonnull, access(read_only, 3)))
@@ -91,10 +162,37 @@ __attribute__((nonnull, access(read_only, 3)))
  */
 int LeelenAdvertiser_set_report_addr (
   struct LeelenAdvertiser *self, int af, const void *addr);
+__attribute__((nonnull(1, 2), access(read_only, 2), access(read_only, 3)))
+/**
+ * @memberof LeelenAdvertiser
+ * @brief Add an identity from specification.
+ *
+ * The identity takes effect after LeelenAdvertiser_compile().
+ *
+ * @param[in,out] self Advertiser.
+ * @param spec Identity specification, see LeelenIdentity_init().
+ * @param base Base phone number, can be @c NULL.
+ * @return 0 on success, 1 if @p spec is malformed, -1 on error.
+ */
+int LeelenAdvertiser_add_identity (
+  struct LeelenAdvertiser *self, const char *spec,
+  const struct LeelenNumber *base);
 __attribute__((nonnull))
 /**
  * @memberof LeelenAdvertiser
- * @brief Sync properties from @p self->config.
+ * @brief Build the identity matcher and pre-render advertisements.
+ *
+ * Must be called again whenever identities, @p self->report_addr,
+ * @p self->mtu or the device config change.
+ *
+ * @param[in,out] self Advertiser.
+ * @return 0 on success, 1 if identities overlap, -1 on error.
+ */
+int LeelenAdvertiser_compile (struct LeelenAdvertiser *self);
+__attribute__((nonnull))
+/**
+ * @memberof LeelenAdvertiser
+ * @brief Sync properties from @p self->config, then compile identities.
  *
  * @param[in,out] self Advertiser.
  * @return 0 on success, error otherwise.
@@ -108,11 +206,7 @@ __attribute__((nonnull))
  *
  * @param self Advertiser.
  */
-static inline void LeelenAdvertiser_destroy (struct LeelenAdvertiser *self) {
-  if (self->number_regex_set) {
-    regfree(&self->number_regex);
-  }
-}
+void LeelenAdvertiser_destroy (struct LeelenAdvertiser *self);
 
 __attribute__((nonnull(1), access(write_only, 1), access(read_only, 2)))
 /**
@@ -127,6 +221,17 @@ static inline int LeelenAdvertiser_init (
     struct LeelenAdvertiser *self, const struct LeelenConfig *config) {
   self->config = config;
   self->number_regex_set = false;
+  self->identities = NULL;
+  self->n_identity = 0;
+  LeelenIdentity_init_number(&self->identity, &config->number);
+  self->hash = NULL;
+  self->hash_mask = 0;
+  self->ranges = NULL;
+  self->n_range = 0;
+  for (int i = 0; i < LEELEN_ADVERTISER_ADDR_CACHE; i++) {
+    self->addrs[i].af = AF_UNSPEC;
+  }
+  self->addrs_next = 0;
   LeelenAdvertiser_sync(self);
   return 0;
 }
@@ -1,10 +1,16 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <stdatomic.h>
 #include <threads.h>
 #include <time.h>
 #include <unistd.h>
+#include <ifaddrs.h>
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 
@@ -14,30 +20,154 @@
 #include <inet46i/socket46.h>
 
 #include "utils/macro.h"
+#include "utils/histogram.h"
 #include "utils/log.h"
 #include "utils/single.h"
 #include "utils/threadname.h"
+#include "utils/timeval.h"
+#include "utils/tokenbucket.h"
+#include "utils/trace.h"
 #include "../config.h"
+#include "../number.h"
 #include "advertiser.h"
 #include "host.h"
 #include "protocol.h"
+#include "rtt.h"
 #include "discovery.h"
 
 
-int LeelenDiscovery_discovery (
-    struct LeelenDiscovery *self, struct LeelenHost *host, const char *phone) {
-  return_if_fail (single_is_running(&self->state)) 255;
+unsigned int LeelenDiscovery_timeout (const struct LeelenDiscovery *self) {
+  // wait for the slowest known interface
+  unsigned int timeout = 0;
+  for (int i = 0; i < LEELEN_DISCOVERY_MAX_LINKS; i++) {
+    const struct LeelenRTT *rtt = &self->rtts[i];
+    break_if (rtt->ifindex == 0);
+    unsigned int link_timeout = LeelenRTT_timeout(
+      rtt, LEELEN_DISCOVERY_TIMEOUT_MIN, self->timeout);
+    if (link_timeout > timeout) {
+      timeout = link_timeout;
+    }
+  }
+  return timeout == 0 ? self->timeout : timeout;
+}
 
-  mtx_lock(&self->mutex);
 
-  // write output parameters
-  self->initres = 254;  // timeout reached
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Feed RTT sample from an accepted advertisement into the estimators.
+ *
+ * @note Caller should hold @p self->mutex.
+ *
+ * @param self Discovery daemon.
+ * @param ifindex Interface index that received the advertisement.
+ */
+static void LeelenDiscovery_sample (
+    struct LeelenDiscovery *self, unsigned int ifindex) {
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  long long latency = timespec_diff_us(&now, &self->start);
+  Histogram_add(&self->latency, latency < 0 ? 0 : latency);
+
+  // Karn's algorithm: ambiguous samples from retransmissions are discarded
+  return_if_fail (self->n_sent == 1);
+  // interface 0 is used as a catch-all slot
+  if unlikely (ifindex == 0) {
+    ifindex = ~0u;
+  }
 
-  // send solicitation
+  struct LeelenRTT *rtt = NULL;
+  for (int i = 0; i < LEELEN_DISCOVERY_MAX_LINKS; i++) {
+    rtt = &self->rtts[i];
+    break_if (rtt->ifindex == ifindex);
+    if (rtt->ifindex == 0) {
+      LeelenRTT_init(rtt, ifindex);
+      break;
+    }
+  }
+  // table full, reuse the last slot
+  if unlikely (rtt->ifindex != ifindex) {
+    LeelenRTT_init(rtt, ifindex);
+  }
+  LeelenRTT_update(rtt, latency < 0 ? 0 : latency);
+}
+
+
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Find the directory entry of a phone number.
+ *
+ * @param self Discovery daemon.
+ * @param key Key of phone number.
+ * @return Directory entry.
+ */
+static inline struct LeelenDiscoveryRoute *LeelenDiscovery_route (
+    struct LeelenDiscovery *self, uint32_t key) {
+  return &self->routes[
+    (key * UINT32_C(2654435761)) >> 16 & (LEELEN_DISCOVERY_ROUTES - 1)];
+}
+
+
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Send solicitation on per-interface sockets.
+ *
+ * @param self Discovery daemon.
+ * @param phone Peer phone number.
+ * @param ifindex Interface to send on, or 0 for all interfaces.
+ * @return 0 on success, 255 if no socket available, -1 if @c sendto() error.
+ */
+static int LeelenDiscovery_solicit_links (
+    struct LeelenDiscovery *self, const char *phone, unsigned int ifindex) {
+  int res = 255;
+  for (int i = 0; i < self->n_link; i++) {
+    const struct LeelenDiscoveryLink *link = &self->links[i];
+    continue_if (ifindex != 0 && link->ifindex != ifindex);
+    int link_res = LeelenHost__discovery(
+      link->addr.sa_family, link->sockfd, self->port, phone);
+    if (res != 0) {
+      res = link_res;
+    }
+  }
+  return res;
+}
+
+
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Send solicitation.
+ *
+ * @note Caller should hold @p self->mutex.
+ *
+ * @param self Discovery daemon.
+ * @param phone Peer phone number.
+ * @return 0 on success, 255 if no socket available, -1 if @c sendto() error.
+ */
+static int LeelenDiscovery_solicit (
+    struct LeelenDiscovery *self, const char *phone) {
   int res;
   if (self->spec_sockfd >= 0) {
     res = LeelenHost__discovery(
       self->addr.sa_family, self->spec_sockfd, self->port, phone);
+  } else if (self->n_link > 0) {
+    // go out the known interface first
+    res = 255;
+    if (self->n_sent == 0) {
+      const struct LeelenDiscoveryRoute *route =
+        LeelenDiscovery_route(self, self->key);
+      if (route->ifindex != 0 && route->key == self->key) {
+        res = LeelenDiscovery_solicit_links(self, phone, route->ifindex);
+      }
+      atomic_fetch_add_explicit(
+        res == 255 ? &self->n_route_miss : &self->n_route_hit, 1,
+        memory_order_relaxed);
+    }
+    if (res == 255) {
+      res = LeelenDiscovery_solicit_links(self, phone, 0);
+    }
   } else {
     res = likely (self->sockfd6 < 0) ? 255 : LeelenHost__discovery(
       AF_INET6, self->sockfd6, self->port, phone);
@@ -51,23 +181,332 @@ int LeelenDiscovery_discovery (
   }
 
   if likely (res == 0) {
-    // wait for reply
-    struct timespec ts;
-    timespec_get(&ts, TIME_UTC);
-    ts.tv_nsec += self->timeout * 1000000;
-    ts.tv_sec += ts.tv_nsec / 1000000000;  // handle nsec overflow
-    ts.tv_nsec %= 1000000000;
-    cnd_timedwait(&self->cond, &self->mutex, &ts);
+    timespec_get(&self->sent, TIME_UTC);
+    if (self->n_sent == 0) {
+      self->start = self->sent;
+    }
+    self->n_sent++;
+  }
+  return res;
+}
+
+
+int LeelenDiscovery_discovery (
+    struct LeelenDiscovery *self, struct LeelenHost *host, const char *phone,
+    uint32_t trace_id) {
+  return_if_fail (single_is_running(&self->state)) 255;
+  TRACE_SPAN("discovery", trace_id);
+
+  mtx_lock(&self->mutex);
+
+  // write output parameters
+  self->initres = 254;  // timeout reached
+  self->n_sent = 0;
+  self->waiting = true;
+  self->key = Leelen_number_key(phone);
+
+  // send solicitation
+  unsigned int timeout = LeelenDiscovery_timeout(self);
+  int res = LeelenDiscovery_solicit(self, phone);
+
+  if likely (res == 0) {
+    // wait for reply, retransmit at every 1/(retransmit + 1) of timeout
+    struct timespec start = self->start;
+    for (unsigned int i = 1; ; i++) {
+      struct timespec ts = start;
+      timespec_add_ms(&ts, timeout * i / (self->retransmit + 1u));
+      while (self->initres > 8 && cnd_timedwait(
+        &self->cond, &self->mutex, &ts) == thrd_success) { }
+      break_if (self->initres <= 8 || i > self->retransmit);
+
+      LOG(LOG_LEVEL_DEBUG, "No advertisement for %s in %u ms, retransmit",
+          phone, timeout * i / (self->retransmit + 1u));
+      should (LeelenDiscovery_solicit(self, phone) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_INFO, "Cannot retransmit solicitation");
+      }
+    }
     // fetch result
     *host = self->host;
     res = self->initres;
+    if (res == 0) {
+      atomic_fetch_add_explicit(&self->n_found, 1, memory_order_relaxed);
+    } else if (res == 254) {
+      atomic_fetch_add_explicit(&self->n_timeout, 1, memory_order_relaxed);
+      // forget stale route
+      struct LeelenDiscoveryRoute *route =
+        LeelenDiscovery_route(self, self->key);
+      if (route->key == self->key) {
+        route->ifindex = 0;
+      }
+    }
+  }
+  self->waiting = false;
+
+  mtx_unlock(&self->mutex);
+  return res;
+}
+
+
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Send solicitations for several phone numbers.
+ *
+ * @note Caller should hold @p self->mutex.
+ *
+ * @param self Discovery daemon.
+ * @param phones Peer phone numbers.
+ * @param n_phone Number of @p phones.
+ * @return 0 if any solicitation was sent, 255 if no socket available, -1 if
+ *  @c sendto() error.
+ */
+static int LeelenDiscovery_solicit_group (
+    struct LeelenDiscovery *self, const char * const *phones,
+    unsigned int n_phone) {
+  int res = 255;
+  for (unsigned int i = 0; i < n_phone; i++) {
+    int phone_res = LeelenDiscovery_solicit(self, phones[i]);
+    if (res != 0) {
+      res = phone_res;
+    }
+  }
+  return res;
+}
+
+
+int LeelenDiscovery_discovery_group (
+    struct LeelenDiscovery *self, const char * const *phones,
+    unsigned int n_phone, struct LeelenHost *hosts, unsigned int n_host,
+    int (*found)(void *arg, struct LeelenHost *host), void *arg,
+    uint32_t trace_id) {
+  return_if_fail (single_is_running(&self->state)) -1;
+  TRACE_SPAN("discovery group", trace_id);
+
+  mtx_lock(&self->mutex);
+
+  // write output parameters
+  self->n_sent = 0;
+  self->waiting = true;
+  // advertisements do not tell which number they answer, so learn no route
+  self->key = LEELEN_NUMBER_KEY_INVALID;
+  self->group = hosts;
+  self->group_size = n_host;
+  self->n_group = 0;
+
+  // send solicitations
+  unsigned int timeout = LeelenDiscovery_timeout(self);
+  int res = LeelenDiscovery_solicit_group(self, phones, n_phone);
+
+  if likely (res == 0) {
+    // unlike single discovery, wait until timeout, since we do not know how
+    // many hosts would answer
+    struct timespec start = self->start;
+    unsigned int n_found = 0;
+    for (unsigned int i = 1; ; i++) {
+      struct timespec ts = start;
+      timespec_add_ms(&ts, timeout * i / (self->retransmit + 1u));
+      while (true) {
+        for (; n_found < self->n_group; n_found++) {
+          goto_if (found(arg, &hosts[n_found]) != 0) end;
+        }
+        break_if (self->n_group >= n_host || cnd_timedwait(
+          &self->cond, &self->mutex, &ts) != thrd_success);
+      }
+      break_if (self->n_group >= n_host || i > self->retransmit);
+
+      LOG(LOG_LEVEL_DEBUG, "%u advertisements for %s group in %u ms, "
+          "retransmit", self->n_group, phones[0],
+          timeout * i / (self->retransmit + 1u));
+      should (LeelenDiscovery_solicit_group(
+          self, phones, n_phone) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_INFO, "Cannot retransmit solicitation");
+      }
+    }
+    // report hosts arrived during the last wait
+    for (; n_found < self->n_group; n_found++) {
+      break_if (found(arg, &hosts[n_found]) != 0);
+    }
+end:
+    res = self->n_group;
+    atomic_fetch_add_explicit(
+      res > 0 ? &self->n_found : &self->n_timeout, 1, memory_order_relaxed);
+  } else {
+    res = -1;
   }
+  self->waiting = false;
+  self->group = NULL;
 
   mtx_unlock(&self->mutex);
   return res;
 }
 
 
+/**
+ * @ingroup leelen-discovery
+ * @brief Reply rate limiter of a discovery source.
+ */
+struct LeelenDiscoverySource {
+  /// source address, IPv4 mapped into IPv6
+  struct in6_addr addr;
+  /// reply token bucket
+  struct TokenBucket bucket;
+};
+
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Test if a reply to the source is within rate limit.
+ *
+ * @param sources Rate limiter table, with @ref LEELEN_DISCOVERY_SOURCES
+ *  entries.
+ * @param src Source address.
+ * @param now Current monotonic time, in milliseconds.
+ * @return @c true if the reply can be sent.
+ */
+static bool LeelenDiscovery_ratelimit (
+    struct LeelenDiscoverySource *sources, const struct sockaddr *src,
+    unsigned long long now) {
+  struct in64_addr addr = {0};
+  in64_set(src->sa_family, &addr, sockaddr_addr(src));
+
+  uint32_t hash = addr.addr6.s6_addr32[0] ^ addr.addr6.s6_addr32[1] ^
+                  addr.addr6.s6_addr32[2] ^ addr.addr6.s6_addr32[3];
+  struct LeelenDiscoverySource *source = &sources[
+    (hash * UINT32_C(2654435761)) >> 16 & (LEELEN_DISCOVERY_SOURCES - 1)];
+  // evict on collision
+  if unlikely (!IN6_ARE_ADDR_EQUAL(&source->addr, &addr.addr6)) {
+    source->addr = addr.addr6;
+    TokenBucket_init(&source->bucket, now, LEELEN_DISCOVERY_REPLY_BURST);
+  }
+  return TokenBucket_consume(
+    &source->bucket, now, LEELEN_DISCOVERY_REPLY_RATE,
+    LEELEN_DISCOVERY_REPLY_BURST);
+}
+
+
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Collect an advertisement for the current group discovery.
+ *
+ * @note Caller should hold @p self->mutex.
+ *
+ * @param self Discovery daemon.
+ * @param buf Advertisement, null-terminated.
+ * @param src Source address.
+ * @param ifindex Interface index that received the advertisement.
+ */
+static void LeelenDiscovery_collect (
+    struct LeelenDiscovery *self, const char *buf, const struct sockaddr *src,
+    unsigned int ifindex) {
+  should (self->n_group < self->group_size) otherwise {
+    atomic_fetch_add_explicit(&self->n_late, 1, memory_order_relaxed);
+    return;
+  }
+
+  struct LeelenHost *host = &self->group[self->n_group];
+  should (LeelenHost_init(host, buf, src) == 0) otherwise {
+    LOG(LOG_LEVEL_INFO, "Cannot parse advertisement %s", buf);
+    LeelenHost_destroy(host);
+    return;
+  }
+  // drop answers to retransmissions
+  for (unsigned int i = 0; i < self->n_group; i++) {
+    if (sockaddr_same(&self->group[i].sock, &host->sock)) {
+      LeelenHost_destroy(host);
+      return;
+    }
+  }
+
+  if (self->n_group == 0) {
+    LeelenDiscovery_sample(self, ifindex);
+  }
+  self->n_group++;
+  cnd_signal(&self->cond);
+}
+
+
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Process a received discovery packet.
+ *
+ * @param self Discovery daemon.
+ * @param sockfd Socket the packet was received on.
+ * @param is_spec @c true if @p sockfd is @p self->spec_sockfd.
+ * @param buf Packet, null-terminated.
+ * @param src Source address.
+ * @param dst Destination address.
+ * @param recv_dst Local address that received the packet.
+ * @param sources Reply rate limiter table.
+ * @param now Current monotonic time, in milliseconds.
+ */
+static void LeelenDiscovery_process (
+    struct LeelenDiscovery *self, int sockfd, bool is_spec, const char *buf,
+    const struct sockaddr *src, const union sockaddr_in46 *dst,
+    const struct in_addr *recv_dst, struct LeelenDiscoverySource *sources,
+    unsigned long long now) {
+  // log
+  bool is_advertisement = Leelen_discovery_is_advertisement(buf);
+  const struct LeelenIdentity *identity = is_advertisement ? NULL :
+    LeelenAdvertiser_match((struct LeelenAdvertiser *) self, buf);
+  unsigned int ifindex = is_spec ? self->addr.sa_scope_id : dst->sa_scope_id;
+  Leelen_discovery_logger(
+    buf, src, is_spec ? sockaddr_addr(&self->addr.sock) : recv_dst, ifindex,
+    identity != NULL);
+
+  // process
+  if (is_advertisement) {
+    bool has_spec = self->spec_sockfd >= 0;
+    // filter destination address
+    if (has_spec && !is_spec) {
+      LOGEVENT (LOG_LEVEL_INFO) {
+        char s_dst[SOCKADDR_STRLEN];
+        sockaddr46_toa(dst, s_dst, sizeof(s_dst));
+        LOGEVENT_LOG(
+          "Got advertisement to %s, which is not the sending address", s_dst);
+      }
+      return;
+    }
+
+    mtx_lock(&self->mutex);
+    if (self->waiting && self->group != NULL) {
+      LeelenDiscovery_collect(self, buf, src, ifindex);
+    } else if likely (self->waiting && self->initres > 8) {
+      self->initres = LeelenHost_init(&self->host, buf, src);
+      // unparseable replies are not successful discoveries
+      if (self->initres == 0) {
+        LeelenDiscovery_sample(self, ifindex);
+        // record the winning interface
+        if (ifindex != 0 && self->key != LEELEN_NUMBER_KEY_INVALID) {
+          struct LeelenDiscoveryRoute *route =
+            LeelenDiscovery_route(self, self->key);
+          route->key = self->key;
+          route->ifindex = ifindex;
+        }
+      }
+      cnd_signal(&self->cond);
+    } else {
+      atomic_fetch_add_explicit(&self->n_late, 1, memory_order_relaxed);
+    }
+    mtx_unlock(&self->mutex);
+  } else if (identity != NULL) {
+    should (LeelenDiscovery_ratelimit(sources, src, now)) otherwise {
+      atomic_fetch_add_explicit(&self->n_dropped, 1, memory_order_relaxed);
+      LOG(LOG_LEVEL_DEBUG, "Too many solicitations, reply dropped");
+      return;
+    }
+    should (LeelenAdvertiser_reply(
+        (struct LeelenAdvertiser *) self, identity, sockfd, src,
+        recv_dst) == 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING, "sendto() failed");
+    }
+  }
+}
+
+
 /**
  * @memberof LeelenDiscovery
  * @private
@@ -80,12 +519,9 @@ static int LeelenDiscovery_mainloop (void *arg) {
   threadname_set("Discovery");
 
   struct LeelenDiscovery *self = arg;
-  void *spec_dst = sockaddr_addr(&self->addr.sock);
-  uint32_t spec_ifindex = self->addr.sa_scope_id;
 
-  struct pollfd pollfds[3];
+  struct pollfd pollfds[3 + LEELEN_DISCOVERY_MAX_LINKS];
   int n_pollfd = 0;
-  bool has_spec = self->spec_sockfd >= 0;
 
   if (self->spec_sockfd >= 0) {
     pollfds[n_pollfd].fd = self->spec_sockfd;
@@ -102,6 +538,33 @@ static int LeelenDiscovery_mainloop (void *arg) {
     pollfds[n_pollfd].events = POLLIN;
     n_pollfd++;
   }
+  for (int i = 0; i < self->n_link; i++) {
+    pollfds[n_pollfd].fd = self->links[i].sockfd;
+    pollfds[n_pollfd].events = POLLIN;
+    n_pollfd++;
+  }
+
+  // receive buffers
+  size_t bufsize = self->mtu + 1;
+  char *bufs = malloc(bufsize * LEELEN_DISCOVERY_BATCH);
+  should (bufs != NULL) otherwise {
+    LOG_PERROR(LOG_LEVEL_ERROR, "malloc()");
+    return 0;
+  }
+  struct mmsghdr msgs[LEELEN_DISCOVERY_BATCH];
+  struct iovec iovs[LEELEN_DISCOVERY_BATCH];
+  union sockaddr_in46 srcs[LEELEN_DISCOVERY_BATCH];
+  unsigned char cmbufs[LEELEN_DISCOVERY_BATCH][256];
+  for (int j = 0; j < LEELEN_DISCOVERY_BATCH; j++) {
+    iovs[j].iov_base = bufs + bufsize * j;
+    iovs[j].iov_len = bufsize - 1;
+    msgs[j].msg_hdr.msg_name = &srcs[j];
+    msgs[j].msg_hdr.msg_iov = &iovs[j];
+    msgs[j].msg_hdr.msg_iovlen = 1;
+    msgs[j].msg_hdr.msg_control = cmbufs[j];
+  }
+
+  struct LeelenDiscoverySource sources[LEELEN_DISCOVERY_SOURCES] = {0};
 
   while (single_continue(&self->state)) {
     int pollres = poll(pollfds, n_pollfd, 1000);
@@ -112,63 +575,53 @@ static int LeelenDiscovery_mainloop (void *arg) {
     continue_if (likely (pollres <= 0));
 
     // process received packets
-    for (int i = 0; i < 2; i++) {
+    for (int i = 0; i < n_pollfd; i++) {
       continue_if (pollfds[i].revents == 0);
-
-      // read incoming packet
-      char buf[self->mtu + 1];
-      union sockaddr_in46 src;
-      socklen_t srclen = sizeof(src);
-      union sockaddr_in46 dst;
-      struct in_addr recv_dst;
-      int buflen = recvfromto(pollfds[i].fd, buf, sizeof(buf) - 1, 0, &src.sock,
-                              &srclen, &dst, &recv_dst);
-      should (buflen >= 0) otherwise {
-        LOG_PERROR(LOG_LEVEL_WARNING, "recvfromto() failed");
-        continue;
-      }
-      continue_if_fail (buflen > 0);
-      buf[buflen] = '\0';
-
-      // log
-      bool is_advertisement = Leelen_discovery_is_advertisement(buf);
-      bool should_reply = !is_advertisement && LeelenAdvertiser_should_reply(
-        (struct LeelenAdvertiser *) self, buf);
-      Leelen_discovery_logger(
-        buf, &src.sock, has_spec && i == 0 ? spec_dst : &recv_dst,
-        has_spec && i == 0 ? spec_ifindex : dst.sa_scope_id, should_reply);
-
-      // process
-      if (is_advertisement) {
-        if likely (self->initres > 8) {
-          // filter destination address
-          if (has_spec && i != 0) {
-            LOGEVENT (LOG_LEVEL_INFO) {
-              char s_dst[SOCKADDR_STRLEN];
-              sockaddr46_toa(&dst, s_dst, sizeof(s_dst));
-              LOGEVENT_LOG(
-                "Got advertisement to %s, which is not the sending address",
-                s_dst);
-            }
-          } else {
-            mtx_lock(&self->mutex);
-            if likely (self->initres > 8) {
-              self->initres = LeelenHost_init(&self->host, buf, &src.sock);
-              cnd_signal(&self->cond);
-            }
-            mtx_unlock(&self->mutex);
+      bool is_spec = pollfds[i].fd == self->spec_sockfd;
+
+      // drain the socket, but give other sockets a chance
+      for (int round = 0; round < LEELEN_DISCOVERY_DRAIN; round++) {
+        for (int j = 0; j < LEELEN_DISCOVERY_BATCH; j++) {
+          msgs[j].msg_hdr.msg_namelen = sizeof(srcs[j]);
+          msgs[j].msg_hdr.msg_controllen = sizeof(cmbufs[j]);
+          msgs[j].msg_hdr.msg_flags = 0;
+        }
+        int n_msg = recvmmsg(
+          pollfds[i].fd, msgs, LEELEN_DISCOVERY_BATCH, MSG_DONTWAIT, NULL);
+        should (n_msg >= 0) otherwise {
+          if unlikely (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_PERROR(LOG_LEVEL_WARNING, "recvmmsg() failed");
           }
+          break;
         }
-      } else if (should_reply) {
-        should (LeelenAdvertiser_reply(
-            (struct LeelenAdvertiser *) self, pollfds[i].fd, &src.sock,
-            &recv_dst) == 0) otherwise {
-          LOG_PERROR(LOG_LEVEL_WARNING, "sendto() failed");
+
+        unsigned long long now = monotonic_ms();
+        for (int j = 0; j < n_msg; j++) {
+          struct msghdr *mh = &msgs[j].msg_hdr;
+          int buflen = msgs[j].msg_len;
+          continue_if_fail (buflen > 0);
+          should (!(mh->msg_flags & MSG_TRUNC)) otherwise {
+            atomic_fetch_add_explicit(
+              &self->n_dropped, 1, memory_order_relaxed);
+            LOG(LOG_LEVEL_INFO, "Discovery packet truncated, dropped");
+            continue;
+          }
+          char *buf = iovs[j].iov_base;
+          buf[buflen] = '\0';
+
+          union sockaddr_in46 dst;
+          struct in_addr recv_dst = {0};
+          recvfromto_dst(mh, &dst, &recv_dst);
+          LeelenDiscovery_process(
+            self, pollfds[i].fd, is_spec, buf, &srcs[j].sock, &dst,
+            &recv_dst, sources, now);
         }
+        break_if (n_msg < LEELEN_DISCOVERY_BATCH);
       }
     }
   }
 
+  free(bufs);
   return 0;
 }
 
@@ -190,6 +643,93 @@ int LeelenDiscovery_start (struct LeelenDiscovery *self) {
 }
 
 
+/**
+ * @memberof LeelenDiscovery
+ * @private
+ * @brief Open a socket for each multicast-capable interface.
+ *
+ * Interfaces whose sockets cannot be opened are skipped.
+ *
+ * @param self Discovery daemon.
+ * @param listen_v4 Open sockets for IPv4 addresses.
+ * @param listen_v6 Open sockets for IPv6 addresses.
+ * @return 0 on success, -1 if @c getifaddrs() error.
+ */
+static int LeelenDiscovery_connect_links (
+    struct LeelenDiscovery *self, bool listen_v4, bool listen_v6) {
+  struct ifaddrs *ifaddrs;
+  return_if_fail (getifaddrs(&ifaddrs) == 0) -1;
+
+  const int on = 1;
+  for (const struct ifaddrs *ifa = ifaddrs;
+       ifa != NULL && self->n_link < LEELEN_DISCOVERY_MAX_LINKS;
+       ifa = ifa->ifa_next) {
+    continue_if (ifa->ifa_addr == NULL);
+    continue_if ((ifa->ifa_flags & (IFF_UP | IFF_MULTICAST | IFF_LOOPBACK)) !=
+                 (IFF_UP | IFF_MULTICAST));
+    int af = ifa->ifa_addr->sa_family;
+    continue_if_not ((af == AF_INET && listen_v4) ||
+                     (af == AF_INET6 && listen_v6));
+
+    struct LeelenDiscoveryLink *link = &self->links[self->n_link];
+    link->ifindex = if_nametoindex(ifa->ifa_name);
+    continue_if (link->ifindex == 0);
+    // one link per interface and family, however many addresses it has, so
+    // that each solicitation is sent once
+    bool known = false;
+    for (int i = 0; i < self->n_link; i++) {
+      known = self->links[i].ifindex == link->ifindex &&
+        self->links[i].addr.sa_family == af;
+      break_if (known);
+    }
+    continue_if (known);
+    sockaddr46_set(
+      &link->addr, af, sockaddr_addr(ifa->ifa_addr),
+      ntohs(self->addr.sa_port));
+    link->addr.sa_scope_id = link->ifindex;
+
+    int flags = OPENADDR_REUSEADDR | (af == AF_INET6 ? OPENADDR_V6ONLY : 0);
+    link->sockfd = openaddr46(&link->addr, SOCK_DGRAM, flags);
+    if (link->sockfd < 0 && af == AF_INET) {
+      // SO_BINDTODEVICE needs privilege, rely on the bound address
+      link->addr.sa_scope_id = 0;
+      link->sockfd = openaddr46(&link->addr, SOCK_DGRAM, flags);
+      link->addr.sa_scope_id = link->ifindex;
+    }
+    should (link->sockfd >= 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_INFO, "Cannot open discovery socket on %s",
+                 ifa->ifa_name);
+      continue;
+    }
+
+    // route multicast out this interface
+    int res = af == AF_INET ?
+      setsockopt(
+        link->sockfd, IPPROTO_IP, IP_MULTICAST_IF, &link->addr.v4.sin_addr,
+        sizeof(link->addr.v4.sin_addr)) |
+      setsockopt(link->sockfd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) :
+      setsockopt(
+        link->sockfd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &link->ifindex,
+        sizeof(link->ifindex)) |
+      setsockopt(
+        link->sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+    should (res == 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_INFO, "Cannot set up discovery socket on %s",
+                 ifa->ifa_name);
+      close(link->sockfd);
+      continue;
+    }
+
+    LOG(LOG_LEVEL_DEBUG, "Discovery on %s (%s)", ifa->ifa_name,
+        af == AF_INET ? "IPv4" : "IPv6");
+    self->n_link++;
+  }
+
+  freeifaddrs(ifaddrs);
+  return 0;
+}
+
+
 int LeelenDiscovery_connect (struct LeelenDiscovery *self) {
   union sockaddr_in46 leelen_addr_local = {
     .sa_scope_id = self->addr.sa_scope_id,
@@ -253,6 +793,11 @@ int LeelenDiscovery_connect (struct LeelenDiscovery *self) {
     self->spec_sockfd = openaddr46(
       &leelen_addr_local, SOCK_DGRAM, OPENADDR_REUSEADDR);
     return_if_fail (self->spec_sockfd >= 0) -1;
+  } else if (self->n_link == 0) {
+    should (LeelenDiscovery_connect_links(self, listen_v4, listen_v6) == 0
+    ) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING, "Cannot enumerate interfaces");
+    }
   }
 
   return 0;
@@ -283,12 +828,23 @@ int LeelenDiscovery_sync (struct LeelenDiscovery *self) {
 
 void LeelenDiscovery_destroy (struct LeelenDiscovery *self) {
   LeelenDiscovery_stop(self);
+  LOGEVENT (LOG_LEVEL_DEBUG) {
+    char s_latency[128];
+    Histogram_tostring(&self->latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG(
+      "Discovery latency (us): %s, %lu timeout, %lu dropped, %lu late",
+      s_latency, atomic_load(&self->n_timeout), atomic_load(&self->n_dropped),
+      atomic_load(&self->n_late));
+  }
   if likely (self->sockfd >= 0) {
     close(self->sockfd);
   }
   if unlikely (self->sockfd6 >= 0) {
     close(self->sockfd6);
   }
+  for (int i = 0; i < self->n_link; i++) {
+    close(self->links[i].sockfd);
+  }
   cnd_broadcast(&self->cond);
   single_join(&self->state);
 
@@ -313,10 +869,31 @@ int LeelenDiscovery_init (
   self->spec_sockfd = -1;
   self->sockfd = -1;
   self->sockfd6 = -1;
+  self->n_link = 0;
 
   self->timeout = LEELEN_DISCOVERY_TIMEOUT;
+  self->retransmit = LEELEN_DISCOVERY_RETRANSMIT;
 
   self->initres = 0;
+  self->n_sent = 0;
+  self->waiting = false;
+  self->key = LEELEN_NUMBER_KEY_INVALID;
+  self->group = NULL;
+  self->group_size = 0;
+  self->n_group = 0;
+  for (int i = 0; i < LEELEN_DISCOVERY_ROUTES; i++) {
+    self->routes[i].ifindex = 0;
+  }
+  for (int i = 0; i < LEELEN_DISCOVERY_MAX_LINKS; i++) {
+    LeelenRTT_init(&self->rtts[i], 0);
+  }
+  Histogram_reset(&self->latency);
+  atomic_init(&self->n_found, 0);
+  atomic_init(&self->n_timeout, 0);
+  atomic_init(&self->n_dropped, 0);
+  atomic_init(&self->n_late, 0);
+  atomic_init(&self->n_route_hit, 0);
+  atomic_init(&self->n_route_miss, 0);
 
   LeelenAdvertiser_init((struct LeelenAdvertiser *) self, config);
   return LeelenDiscovery_syncown(self);
@@ -5,16 +5,70 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <threads.h>
+#include <time.h>
 
 #include <inet46i/in46.h>
 
+#include "utils/histogram.h"
 #include "utils/single.h"
 // #include "../number.h"
 struct LeelenNumber;
 #include "advertiser.h"
 #include "host.h"
+#include "rtt.h"
+
+
+/**
+ * @ingroup leelen-discovery
+ * @brief maximum number of interfaces whose RTT are tracked
+ */
+#define LEELEN_DISCOVERY_MAX_LINKS 8
+/**
+ * @ingroup leelen-discovery
+ * @brief number of sources whose reply rates are limited, must be a power of 2
+ */
+#define LEELEN_DISCOVERY_SOURCES 64
+/**
+ * @ingroup leelen-discovery
+ * @brief maximum number of batches drained from a socket per wakeup
+ */
+#define LEELEN_DISCOVERY_DRAIN 8
+/**
+ * @ingroup leelen-discovery
+ * @brief number of entries in the interface directory, must be a power of 2
+ */
+#define LEELEN_DISCOVERY_ROUTES 64
+
+
+/**
+ * @ingroup leelen-discovery
+ * @brief Discovery socket bound to a single interface.
+ */
+struct LeelenDiscoveryLink {
+  /// interface index
+  unsigned int ifindex;
+  /// socket bound to LeelenDiscoveryLink::addr
+  int sockfd;
+  /// first address of the interface in its family, with sockaddr_in46::sa_port
+  /// set
+  union sockaddr_in46 addr;
+};
+
+
+/**
+ * @ingroup leelen-discovery
+ * @brief Directory entry of the interface a phone number was found on.
+ */
+struct LeelenDiscoveryRoute {
+  /// key of phone number, see Leelen_number_key()
+  uint32_t key;
+  /// interface index, or 0 if the entry is unused
+  unsigned int ifindex;
+};
 
 
 /**
@@ -35,9 +89,16 @@ struct LeelenDiscovery {
   int sockfd;
   /// IPv6 socket
   int sockfd6;
+  /// per-interface sockets, used to fan out solicitations when no sending
+  /// address is specified
+  struct LeelenDiscoveryLink links[LEELEN_DISCOVERY_MAX_LINKS];
+  /// number of LeelenDiscovery::links
+  int n_link;
 
-  /// device discovery timeout, in milliseconds
+  /// upper bound of device discovery timeout, in milliseconds
   unsigned int timeout;
+  /// maximum number of early retransmissions of a solicitation
+  unsigned char retransmit;
   /// port for device discovery
   in_port_t port;
   /// address for outgoing data, with sockaddr_in46::sa_port set
@@ -52,21 +113,114 @@ struct LeelenDiscovery {
   struct LeelenHost host;
   /// return value of LeelenHost_init()
   int initres;
+  /// time when the first solicitation of current discovery was sent
+  struct timespec start;
+  /// time when the last solicitation of current discovery was sent
+  struct timespec sent;
+  /// number of solicitations sent for current discovery
+  unsigned char n_sent;
+  /// @c true if a discovery is waiting for advertisement
+  bool waiting;
+  /// key of the phone number of current discovery
+  uint32_t key;
+  /// hosts found by current group discovery, or @c NULL if not a group
+  /// discovery
+  struct LeelenHost *group;
+  /// capacity of LeelenDiscovery::group
+  unsigned int group_size;
+  /// number of hosts in LeelenDiscovery::group
+  unsigned int n_group;
+  /// directory of interfaces where phone numbers were found
+  struct LeelenDiscoveryRoute routes[LEELEN_DISCOVERY_ROUTES];
+  /// RTT estimators, one per interface
+  struct LeelenRTT rtts[LEELEN_DISCOVERY_MAX_LINKS];
+
+  /** @publicsection */
+  /// histogram of discovery latency, in microseconds
+  struct Histogram latency;
+  /// number of discoveries which found the peer, once per discovery however
+  /// many hosts answered
+  atomic_ulong n_found;
+  /// number of discoveries which reached timeout
+  atomic_ulong n_timeout;
+  /// number of discovery packets dropped, either truncated or exceeding the
+  /// reply rate limit of its source
+  atomic_ulong n_dropped;
+  /// number of advertisements arrived when no discovery is waiting
+  atomic_ulong n_late;
+  /// number of discoveries sent on the interface where the phone number was
+  /// found before
+  atomic_ulong n_route_hit;
+  /// number of discoveries sent on all interfaces, since no interface known
+  atomic_ulong n_route_miss;
 };
 
+__attribute__((pure, warn_unused_result, nonnull))
+/**
+ * @memberof LeelenDiscovery
+ * @brief Get current discovery timeout derived from observed round-trip times.
+ *
+ * @note Caller should hold @p self->mutex.
+ *
+ * @param self Discovery daemon.
+ * @return Timeout, in milliseconds.
+ */
+unsigned int LeelenDiscovery_timeout (const struct LeelenDiscovery *self);
+
 __attribute__((nonnull, access(write_only, 2), access(read_only, 3)))
 /**
  * @memberof LeelenDiscovery
  * @brief Do a peer discovery.
  *
+ * The solicitation is retransmitted up to @p self->retransmit times, evenly
+ * spaced within the timeout given by LeelenDiscovery_timeout().
+ *
+ * With per-interface sockets, the first solicitation goes out the interface
+ * where @p phone was last found, if any; otherwise, and for retransmissions,
+ * solicitations are sent on all interfaces, and the first advertisement wins.
+ *
  * @param self Discovery daemon.
  * @param[out] host Host object.
  * @param phone Peer phone number.
+ * @param trace_id Correlation ID of trace spans, or 0 if none.
  * @return 0 on success, 254 if timeout reached, 255 if discovery daemon not set
  *  up, -1 if LeelenHost__discovery() error.
  */
 int LeelenDiscovery_discovery (
-  struct LeelenDiscovery *self, struct LeelenHost *host, const char *phone);
+  struct LeelenDiscovery *self, struct LeelenHost *host, const char *phone,
+  uint32_t trace_id);
+__attribute__((nonnull(1, 2, 4, 6), access(read_only, 2, 3),
+               access(write_only, 4, 5)))
+/**
+ * @memberof LeelenDiscovery
+ * @brief Discover several phone numbers at once.
+ *
+ * Solicitations for all phone numbers are sent together, and every distinct
+ * host advertising within the timeout is collected, since advertisements do
+ * not tell which phone number they answer. @p found is called as soon as each
+ * host arrives, so the caller can start working with the fastest host before
+ * the timeout is reached.
+ *
+ * @note @p found is called with @p self->mutex held, and should return
+ *  quickly.
+ *
+ * @param self Discovery daemon.
+ * @param phones Peer phone numbers.
+ * @param n_phone Number of @p phones.
+ * @param[out] hosts Host objects, to be destroyed by the caller.
+ * @param n_host Capacity of @p hosts.
+ * @param found Callback on each new host. A nonzero return value stops the
+ *  discovery.
+ * @param arg Argument of @p found.
+ * @param trace_id Correlation ID of trace spans, or 0 if none.
+ * @return Number of hosts found, or -1 if discovery daemon not set up or
+ *  LeelenHost__discovery() error.
+ */
+int LeelenDiscovery_discovery_group (
+  struct LeelenDiscovery *self, const char * const *phones,
+  unsigned int n_phone, struct LeelenHost *hosts, unsigned int n_host,
+  int (*found)(void *arg, struct LeelenHost *host), void *arg,
+  uint32_t trace_id);
 
 __attribute__((nonnull))
 /**
@@ -106,6 +260,9 @@ __attribute__((nonnull))
  * @memberof LeelenDiscovery
  * @brief Set up sockets.
  *
+ * If no sending address is specified, a socket is also bound to each
+ * multicast-capable interface, so that solicitations go out all of them.
+ *
  * @param self Discovery daemon.
  * @return 0 on success, -1 on error and @c errno is set appropriately.
  */
@@ -0,0 +1,131 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>  // snprintf
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "utils/macro.h"
+#include "../config.h"
+#include "../number.h"
+#include "protocol.h"
+#include "identity.h"
+
+
+int LeelenIdentity_render (
+    struct LeelenIdentity *self, unsigned char type, const char *desc,
+    const char *report_addr, unsigned short mtu) {
+  if (self->type != 0) {
+    type = self->type;
+  }
+  if (self->desc != NULL) {
+    desc = self->desc;
+  }
+  if (self->report_addr[0] != '\0') {
+    report_addr = self->report_addr;
+  } else if (report_addr != NULL && report_addr[0] == '\0') {
+    report_addr = NULL;
+  }
+
+  char buf[mtu + 1];
+  int buflen = snprintf(
+    buf, sizeof(buf), LEELEN_DISCOVERY_FORMAT,
+    report_addr == NULL ? "" : report_addr, type, desc == NULL ? "" : desc);
+  return_if_fail (buflen >= 0) -1;
+  if (buflen > mtu) {
+    buflen = mtu;
+  }
+
+  char *advertisement = malloc(buflen + 1);
+  return_if_fail (advertisement != NULL) -1;
+  memcpy(advertisement, buf, buflen);
+  advertisement[buflen] = '\0';
+
+  free(self->advertisement);
+  self->advertisement = advertisement;
+  self->advertisement_len = buflen;
+  self->advertisement_has_addr = report_addr != NULL;
+  return 0;
+}
+
+
+int LeelenIdentity_init (
+    struct LeelenIdentity *self, const char *spec,
+    const struct LeelenNumber *base) {
+  char buf[strlen(spec) + 1];
+  memcpy(buf, spec, sizeof(buf));
+
+  // split fields
+  char *fields[4] = {buf};
+  int n_field = 1;
+  for (char *p = buf; *p != '\0'; p++) {
+    continue_if (*p != ',');
+    return_if_fail (n_field < 4) 1;
+    *p = '\0';
+    fields[n_field] = p + 1;
+    n_field++;
+  }
+
+  // number or range
+  char *last = strchr(fields[0], '~');
+  if (last != NULL) {
+    *last = '\0';
+    last++;
+  }
+  struct LeelenNumber number;
+  return_if_fail (LeelenNumber_init(&number, fields[0], base) == 0) 1;
+  self->first = LeelenNumber_key(&number);
+  if (last == NULL) {
+    self->last = self->first;
+  } else {
+    return_if_fail (LeelenNumber_init(&number, last, base) == 0) 1;
+    self->last = LeelenNumber_key(&number);
+    return_if_fail (self->first <= self->last) 1;
+  }
+
+  // type
+  self->type = 0;
+  if (n_field > 1 && fields[1][0] != '\0') {
+    char *end;
+    long type = strtol(fields[1], &end, 10);
+    return_if_fail (*end == '\0' && type >= 1 && type <= 127) 1;
+    self->type = type;
+  }
+
+  // address
+  self->report_addr[0] = '\0';
+  if (n_field > 3 && fields[3][0] != '\0') {
+    struct in6_addr addr;
+    return_if_fail (
+      inet_pton(AF_INET, fields[3], &addr) == 1 ||
+      inet_pton(AF_INET6, fields[3], &addr) == 1) 1;
+    return_if_fail (strlen(fields[3]) < sizeof(self->report_addr)) 1;
+    strcpy(self->report_addr, fields[3]);
+  }
+
+  // desc
+  self->desc = NULL;
+  if (n_field > 2 && fields[2][0] != '\0') {
+    self->desc = strdup(fields[2]);
+    return_if_fail (self->desc != NULL) -1;
+  }
+
+  self->advertisement = NULL;
+  self->advertisement_len = 0;
+  self->advertisement_has_addr = false;
+  return 0;
+}
+
+
+void LeelenIdentity_init_number (
+    struct LeelenIdentity *self, const struct LeelenNumber *number) {
+  self->first = LeelenNumber_key(number);
+  self->last = self->first;
+  self->type = 0;
+  self->desc = NULL;
+  self->report_addr[0] = '\0';
+  self->advertisement = NULL;
+  self->advertisement_len = 0;
+  self->advertisement_has_addr = false;
+}
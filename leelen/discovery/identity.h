@@ -0,0 +1,124 @@
+#ifndef LEELEN_DISCOVERY_IDENTITY_H
+#define LEELEN_DISCOVERY_IDENTITY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+
+// #include "../number.h"
+struct LeelenNumber;
+
+
+/**
+ * @ingroup leelen-discovery
+ * @brief A device identity the advertiser answers for.
+ *
+ * An identity covers either a single phone number, or a range of phone numbers
+ * sharing the same device type, description and report address.
+ */
+struct LeelenIdentity {
+  /// key of the first phone number, see Leelen_number_key()
+  uint32_t first;
+  /// key of the last phone number (inclusive), equal to LeelenIdentity::first
+  /// if single
+  uint32_t last;
+  /// device type, or 0 to use the device config
+  unsigned char type;
+  /// device description, or @c NULL to use the device config
+  char *desc;
+  /// IP address to be reported, or empty to use the advertiser's
+  char report_addr[INET6_ADDRSTRLEN];
+
+  /** @privatesection */
+  /// pre-rendered advertisement
+  char *advertisement;
+  /// length of LeelenIdentity::advertisement
+  unsigned short advertisement_len;
+  /// @c false if LeelenIdentity::advertisement lacks the leading address, which
+  /// has to be filled from the address receiving the solicitation
+  bool advertisement_has_addr;
+};
+
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @memberof LeelenIdentity
+ * @brief Test if the identity covers a range of phone numbers.
+ *
+ * @param self Identity.
+ * @return @c true if range.
+ */
+static inline bool LeelenIdentity_is_range (
+    const struct LeelenIdentity *self) {
+  return self->first != self->last;
+}
+
+__attribute__((nonnull(1), access(read_only, 3), access(read_only, 4)))
+/**
+ * @memberof LeelenIdentity
+ * @brief Pre-render the advertisement.
+ *
+ * @param[in,out] self Identity.
+ * @param type Device type, if LeelenIdentity::type is 0.
+ * @param desc Device description, if LeelenIdentity::desc is @c NULL.
+ * @param report_addr IP address to be reported, if LeelenIdentity::report_addr
+ *  is empty. Can be @c NULL.
+ * @param mtu Maximum transmission unit for UDP packet.
+ * @return 0 on success, -1 on error.
+ */
+int LeelenIdentity_render (
+  struct LeelenIdentity *self, unsigned char type, const char *desc,
+  const char *report_addr, unsigned short mtu);
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenIdentity
+ * @brief Destroy an identity.
+ *
+ * @param self Identity.
+ */
+static inline void LeelenIdentity_destroy (struct LeelenIdentity *self) {
+  free(self->desc);
+  free(self->advertisement);
+}
+
+__attribute__((nonnull(1, 2), warn_unused_result, access(write_only, 1),
+               access(read_only, 2), access(read_only, 3)))
+/**
+ * @memberof LeelenIdentity
+ * @brief Parse an identity specification.
+ *
+ * The specification is `<number>[~<number>][,<type>[,<desc>[,<address>]]]`,
+ * where empty fields take the device config.
+ *
+ * @param[out] self Identity.
+ * @param spec Identity specification.
+ * @param base Base phone number, can be @c NULL.
+ * @return 0 on success, 1 if @p spec is malformed, -1 on error.
+ */
+int LeelenIdentity_init (
+  struct LeelenIdentity *self, const char *spec,
+  const struct LeelenNumber *base);
+
+__attribute__((nonnull, access(write_only, 1), access(read_only, 2)))
+/**
+ * @memberof LeelenIdentity
+ * @brief Initialize an identity of a single phone number, with all properties
+ *  from the device config.
+ *
+ * @param[out] self Identity.
+ * @param number Phone number.
+ */
+void LeelenIdentity_init_number (
+  struct LeelenIdentity *self, const struct LeelenNumber *number);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEELEN_DISCOVERY_IDENTITY_H */
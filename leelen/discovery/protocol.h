@@ -23,6 +23,16 @@ extern "C" {
 #define LEELEN_DISCOVERY_FORMAT "%s?%d*%s"
 /// discovery timeout, in milliseconds
 #define LEELEN_DISCOVERY_TIMEOUT 200
+/// lower bound of adaptive discovery timeout, in milliseconds
+#define LEELEN_DISCOVERY_TIMEOUT_MIN 20
+/// number of early retransmissions of a solicitation
+#define LEELEN_DISCOVERY_RETRANSMIT 2
+/// maximum number of discovery messages received at once
+#define LEELEN_DISCOVERY_BATCH 16
+/// rate of replies per source, in replies per second
+#define LEELEN_DISCOVERY_REPLY_RATE 4
+/// burst of replies per source
+#define LEELEN_DISCOVERY_REPLY_BURST 8
 
 /// IPv4 address to send discovery messages on
 extern const struct in_addr leelen_discovery_groupaddr;
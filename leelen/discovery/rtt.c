@@ -0,0 +1,27 @@
+#include "utils/macro.h"
+#include "rtt.h"
+
+
+void LeelenRTT_update (struct LeelenRTT *self, unsigned int rtt) {
+  if unlikely (self->n_sample == 0) {
+    self->srtt = rtt;
+    self->rttvar = rtt / 2;
+  } else {
+    unsigned int delta = self->srtt > rtt ? self->srtt - rtt : rtt - self->srtt;
+    // rttvar = 3/4 rttvar + 1/4 |srtt - rtt|
+    self->rttvar = self->rttvar - self->rttvar / 4 + delta / 4;
+    // srtt = 7/8 srtt + 1/8 rtt
+    self->srtt = self->srtt - self->srtt / 8 + rtt / 8;
+  }
+  if likely (self->n_sample < ~0u) {
+    self->n_sample++;
+  }
+}
+
+
+unsigned int LeelenRTT_timeout (
+    const struct LeelenRTT *self, unsigned int min, unsigned int max) {
+  return_if_fail (self->n_sample > 0) max;
+  unsigned int timeout = (self->srtt + 4 * self->rttvar + 999) / 1000;
+  return timeout < min ? min : timeout > max ? max : timeout;
+}
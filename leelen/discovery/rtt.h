@@ -0,0 +1,73 @@
+#ifndef LEELEN_DISCOVERY_RTT_H
+#define LEELEN_DISCOVERY_RTT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * @ingroup leelen-discovery
+ * @brief Round-trip time estimator of solicitation/advertisement, per
+ *  interface.
+ *
+ * The estimator follows RFC 6298: a smoothed RTT and its mean deviation, both
+ * as exponentially weighted moving averages.
+ */
+struct LeelenRTT {
+  /// interface index, or 0 if the slot is unused
+  unsigned int ifindex;
+  /// number of samples
+  unsigned int n_sample;
+  /// smoothed round-trip time, in microseconds
+  unsigned int srtt;
+  /// round-trip time variation, in microseconds
+  unsigned int rttvar;
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenRTT
+ * @brief Feed a round-trip time sample.
+ *
+ * @param[in,out] self RTT estimator.
+ * @param rtt Round-trip time, in microseconds.
+ */
+void LeelenRTT_update (struct LeelenRTT *self, unsigned int rtt);
+
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @memberof LeelenRTT
+ * @brief Get retransmission timeout.
+ *
+ * @param self RTT estimator.
+ * @param min Lower bound of timeout, in milliseconds.
+ * @param max Upper bound of timeout, in milliseconds. Also returned if no
+ *  samples.
+ * @return Timeout, in milliseconds.
+ */
+unsigned int LeelenRTT_timeout (
+  const struct LeelenRTT *self, unsigned int min, unsigned int max);
+
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof LeelenRTT
+ * @brief Initialize a RTT estimator.
+ *
+ * @param[out] self RTT estimator.
+ * @param ifindex Interface index.
+ */
+static inline void LeelenRTT_init (
+    struct LeelenRTT *self, unsigned int ifindex) {
+  self->ifindex = ifindex;
+  self->n_sample = 0;
+  self->srtt = 0;
+  self->rttvar = 0;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEELEN_DISCOVERY_RTT_H */
@@ -1,8 +1,5 @@
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 #include "utils/macro.h"
@@ -10,23 +7,9 @@
 #include "number.h"
 
 
-union LeelenNumberInt {
-  struct {
-    uint32_t block : 14;
-    uint32_t room : 14;
-    uint32_t extension : 4;
-  };
-  uint32_t int_;
-};
-
-
-uint32_t LeelenNumber_toint (const struct LeelenNumber *src) {
-  union LeelenNumberInt packed = {
-    .block = atoi(src->block),
-    .room = atoi(src->room),
-    .extension = LeelenNumber_has_extension(src) ? src->extension - '0' : 0xf
-  };
-  return packed.int_;
+__attribute__((const, warn_unused_result))
+static inline bool isdigit_ (char c) {
+  return (unsigned char) (c - '0') < 10;
 }
 
 
@@ -43,17 +26,19 @@ static char *itoa4 (int value, char str[static 4]) {
 
 
 char *LeelenNumber_fromint (struct LeelenNumber *dest, uint32_t src) {
-  union LeelenNumberInt packed = {.int_ = src};
-  itoa4(packed.block, dest->block);
+  unsigned int mask = (1 << LEELEN_NUMBER_INT_ROOM_SHIFT) - 1;
+  unsigned int extension = src >> LEELEN_NUMBER_INT_EXTENSION_SHIFT;
+  itoa4(src & mask, dest->block);
   dest->sep1 = '-';
-  itoa4(packed.room, dest->room);
-  if (packed.extension >= 10) {
+  itoa4((src >> LEELEN_NUMBER_INT_ROOM_SHIFT) & mask, dest->room);
+  if (extension >= 10) {
     dest->sep2 = '\0';
+    dest->extension = '\0';
   } else {
     dest->sep2 = '-';
-    dest->extension = '0' + packed.extension;
-    dest->sep3 = '\0';
+    dest->extension = '0' + extension;
   }
+  dest->sep3 = '\0';
   return dest->str;
 }
 
@@ -101,11 +86,12 @@ char *LeelenNumber_frombytes (struct LeelenNumber *dest, uint64_t src) {
   byte2int(dest->room + 2, packed.room[1]);
   if (packed.extension == 0xff) {
     dest->sep2 = '\0';
+    dest->extension = '\0';
   } else {
     dest->sep2 = '-';
     dest->extension = packed.extension + '0';
-    dest->sep3 = '\0';
   }
+  dest->sep3 = '\0';
   return dest->str;
 }
 
@@ -113,24 +99,49 @@ char *LeelenNumber_frombytes (struct LeelenNumber *dest, uint64_t src) {
 int LeelenNumber_init (
     struct LeelenNumber *dest, const char *src,
     const struct LeelenNumber *base) {
-  return_if_fail (isdigit(src[0])) 1;
+  return_if_fail (isdigit_(src[0])) 1;
+
+  // fast path: block-room[-extension] or blockroom[extension]
+  unsigned int src_len = strnlen(src, LEELEN_NUMBER_STRLEN);
+  if likely (src_len >= 8 && src_len <= 11) {
+    bool has_sep = src[4] == '-';
+    bool has_extension;
+    if (has_sep) {
+      has_extension = src_len == 11 && src[9] == '-';
+      goto_if_fail (src_len == 9 || has_extension) slow;
+    } else {
+      goto_if_fail (src_len <= 9) slow;
+      has_extension = src_len == 9;
+    }
+    char extension = has_extension ? src[src_len - 1] : '\0';
+    goto_if_fail (!has_extension || isdigit_(extension)) slow;
+    goto_if_fail (Leelen_number_isdigits(
+      Leelen_number_load(src, src + 4 + has_sep))) slow;
+
+    // src may be dest->str
+    memmove(dest->room, src + 4 + has_sep, 4);
+    memmove(dest->block, src, 4);
+    dest->sep1 = '-';
+    dest->sep2 = has_extension ? '-' : '\0';
+    dest->extension = extension;
+    dest->sep3 = '\0';
+    return 0;
+  }
+
+slow:;
+  // too long
+  return_if_fail (src_len < LEELEN_NUMBER_STRLEN) 1;
 
   int n_sep = 0;
   int i_sep[2];
-  int src_len = -1;
-  for (int i = 0; src[i] != '\0'; i++) {
-    // too long
-    return_if_fail (i < LEELEN_NUMBER_STRLEN - 1) 1;
-    src_len = i;
-    if (!isdigit(src[i])) {
+  for (unsigned int i = 0; i < src_len; i++) {
+    if (!isdigit_(src[i])) {
+      // too many separators
+      return_if_fail (n_sep < 2) 1;
       i_sep[n_sep] = i;
       n_sep++;
-      // to many separators
-      return_if_fail (n_sep <= 2) 1;
     }
   }
-  src_len++;
-  return_if_fail (src_len > 0) 1;
   // .*-$
   if (n_sep != 0) {
     return_if_fail (src[i_sep[n_sep - 1] + 1] != '\0') 1;
@@ -155,9 +166,9 @@ int LeelenNumber_init (
         i_sep[1] = strlen(src);
 block_room:
         return_if_fail (i_sep[0] <= 4 && i_sep[1] - i_sep[0] - 1 <= 4) 1;
-        memcpy(block + 4 - i_sep[0], src, 4);
+        memcpy(block + 4 - i_sep[0], src, i_sep[0]);
         memcpy(room + 4 - (i_sep[1] - i_sep[0] - 1), src + i_sep[0] + 1,
-               4);
+               i_sep[1] - i_sep[0] - 1);
         break;
       }
       // [block]room-extension
@@ -171,7 +182,7 @@ block_room:
         return_if_fail (base != NULL) 2;
         memcpy(block, base, 4);
         if (src_len <= 4) {
-          memcpy(room + 4 - src_len, src, 4);
+          memcpy(room + 4 - src_len, src, src_len);
         } else {
           memcpy(room, src, 4);
           extension = src[4];
@@ -192,12 +203,8 @@ block_room:
   memcpy(dest->block, block, 4);
   dest->sep1 = '-';
   memcpy(dest->room, room, 4);
-  if (extension == '\0') {
-    dest->sep2 = '\0';
-  } else {
-    dest->sep2 = '-';
-    dest->extension = extension;
-    dest->sep3 = '\0';
-  }
+  dest->sep2 = extension == '\0' ? '\0' : '-';
+  dest->extension = extension;
+  dest->sep3 = '\0';
   return 0;
 }
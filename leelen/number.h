@@ -40,6 +40,132 @@ struct LeelenNumber {
   };
 };
 
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @memberof LeelenNumber
+ * @brief Test if a phone number has extension.
+ *
+ * @param self Phone number.
+ * @return @c true if the phone number has extension.
+ */
+static inline bool LeelenNumber_has_extension (
+    const struct LeelenNumber *self) {
+  return (self->sep2 | self->extension) != '\0';
+}
+
+__attribute__((pure, warn_unused_result, nonnull,
+               access(read_only, 1), access(read_only, 2)))
+/**
+ * @ingroup leelen
+ * @private
+ * @brief Load block and room parts of phone number into one word.
+ *
+ * Byte `i` of the word (in the order of significance) is `block[i]` for
+ * `i < 4`, and `room[i - 4]` otherwise.
+ *
+ * @param block Block part, 4 characters.
+ * @param room Room part, 4 characters.
+ * @return Word.
+ */
+static inline uint64_t Leelen_number_load (
+    const char *block, const char *room) {
+  uint32_t lo;
+  uint32_t hi;
+  memcpy(&lo, block, sizeof(lo));
+  memcpy(&hi, room, sizeof(hi));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  lo = __builtin_bswap32(lo);
+  hi = __builtin_bswap32(hi);
+#endif
+  return lo | (uint64_t) hi << 32;
+}
+
+__attribute__((const, warn_unused_result))
+/**
+ * @ingroup leelen
+ * @private
+ * @brief Test if all 8 characters in a word are decimal digits.
+ *
+ * @param word Word from Leelen_number_load().
+ * @return @c true if all characters are digits.
+ */
+static inline bool Leelen_number_isdigits (uint64_t word) {
+  // 0x30-0x39 is the only range whose high nibble is 3 both before and after
+  // adding 6
+  return ((word & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+          (((word + UINT64_C(0x0606060606060606)) &
+            UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) ==
+         UINT64_C(0x3333333333333333);
+}
+
+__attribute__((const, warn_unused_result))
+/**
+ * @ingroup leelen
+ * @private
+ * @brief Convert 8 digits in a word into block and room numbers.
+ *
+ * @param word Word from Leelen_number_load(), all digits.
+ * @return Block number in the lower 32 bits, room number in the upper 32 bits.
+ */
+static inline uint64_t Leelen_number_atoi (uint64_t word) {
+  word &= UINT64_C(0x0F0F0F0F0F0F0F0F);
+  word = (word * 10 + (word >> 8)) & UINT64_C(0x00FF00FF00FF00FF);
+  word = (word * 100 + (word >> 16)) & UINT64_C(0x0000FFFF0000FFFF);
+  return word;
+}
+
+/// bit offset of room number in packed phone number, see LeelenNumber_toint()
+#define LEELEN_NUMBER_INT_ROOM_SHIFT 14
+/// bit offset of extension in packed phone number, see LeelenNumber_toint()
+#define LEELEN_NUMBER_INT_EXTENSION_SHIFT 28
+/// extension field of packed phone number without extension
+#define LEELEN_NUMBER_INT_NO_EXTENSION 0xf
+
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @memberof LeelenNumber
+ * @brief Pack phone number into a single integer.
+ *
+ * The integer is `block | room << 14 | extension << 28`, where `extension` is
+ * @ref LEELEN_NUMBER_INT_NO_EXTENSION if the phone number has no extension.
+ * Two phone numbers are equal if and only if their packed integers are equal.
+ *
+ * @param phone Phone number.
+ * @return Converted integer.
+ */
+static inline uint32_t LeelenNumber_toint (const struct LeelenNumber *phone) {
+  uint64_t parts = Leelen_number_atoi(
+    Leelen_number_load(phone->block, phone->room));
+  uint32_t extension = LeelenNumber_has_extension(phone) ?
+    (uint32_t) (phone->extension - '0') : LEELEN_NUMBER_INT_NO_EXTENSION;
+  return (uint32_t) parts |
+    (uint32_t) (parts >> 32) << LEELEN_NUMBER_INT_ROOM_SHIFT |
+    extension << LEELEN_NUMBER_INT_EXTENSION_SHIFT;
+}
+
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @memberof LeelenNumber
+ * @brief Pack digits of phone number into nibbles.
+ *
+ * Nibble `i` (from the least significant) is the `i`-th digit of block and
+ * room for `i < 8`, and nibble 8 is the extension, or
+ * @ref LEELEN_NUMBER_INT_NO_EXTENSION if the phone number has no extension.
+ *
+ * @param phone Phone number.
+ * @return Packed digits.
+ */
+static inline uint64_t LeelenNumber_tobcd (const struct LeelenNumber *phone) {
+  uint64_t word = Leelen_number_load(phone->block, phone->room) &
+    UINT64_C(0x0F0F0F0F0F0F0F0F);
+  word = (word | word >> 4) & UINT64_C(0x00FF00FF00FF00FF);
+  word = (word | word >> 8) & UINT64_C(0x0000FFFF0000FFFF);
+  word = (word | word >> 16) & UINT64_C(0x00000000FFFFFFFF);
+  uint64_t extension = LeelenNumber_has_extension(phone) ?
+    (uint64_t) (phone->extension - '0') : LEELEN_NUMBER_INT_NO_EXTENSION;
+  return word | extension << 32;
+}
+
 __attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
 /**
  * @memberof LeelenNumber
@@ -52,25 +178,63 @@ __attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
 static inline bool LeelenNumber_equal (
     const struct LeelenNumber * __restrict self,
     const struct LeelenNumber * __restrict other) {
-  return
-    memcmp(self->block, other->block, sizeof(self->block)) == 0 &&
-    memcmp(self->room, other->room, sizeof(self->room)) == 0 &&
-    self->sep2 == other->sep2 && (
-      self->sep2 != '\0' || self->extension == other->extension);
+  return LeelenNumber_toint(self) == LeelenNumber_toint(other);
 }
 
 __attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
 /**
  * @memberof LeelenNumber
- * @brief Test if a phone number has extension.
+ * @brief Hash a phone number.
  *
  * @param self Phone number.
- * @return @c true if the phone number has extension.
+ * @return Hash value.
  */
-static inline bool LeelenNumber_has_extension (
-    const struct LeelenNumber *self) {
-  return (self->sep2 | self->extension) != '\0';
+static inline uint32_t LeelenNumber_hash (const struct LeelenNumber *self) {
+  // Fibonacci hashing
+  return LeelenNumber_toint(self) * UINT32_C(2654435761);
 }
+
+/// invalid key of phone number, see Leelen_number_key()
+#define LEELEN_NUMBER_KEY_INVALID UINT32_MAX
+
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @ingroup leelen
+ * @brief Get ordered key of phone number, ignoring extension.
+ *
+ * The key is `block * 10000 + room`, so that phone numbers of the same block
+ * are consecutive.
+ *
+ * @param str Phone number string, in the format XXXX-XXXX[...].
+ * @return Key, or @ref LEELEN_NUMBER_KEY_INVALID if @p str is malformed.
+ */
+static inline uint32_t Leelen_number_key (const char *str) {
+  // do not read past a short string
+  if (strnlen(str, 9) < 9 || str[4] != '-') {
+    return LEELEN_NUMBER_KEY_INVALID;
+  }
+  uint64_t word = Leelen_number_load(str, str + 5);
+  if (!Leelen_number_isdigits(word)) {
+    return LEELEN_NUMBER_KEY_INVALID;
+  }
+  uint64_t parts = Leelen_number_atoi(word);
+  return (uint32_t) parts * 10000 + (uint32_t) (parts >> 32);
+}
+
+__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
+/**
+ * @memberof LeelenNumber
+ * @brief Get ordered key of phone number, ignoring extension.
+ *
+ * @param self Phone number.
+ * @return Key.
+ */
+static inline uint32_t LeelenNumber_key (const struct LeelenNumber *self) {
+  uint64_t parts = Leelen_number_atoi(
+    Leelen_number_load(self->block, self->room));
+  return (uint32_t) parts * 10000 + (uint32_t) (parts >> 32);
+}
+
 __attribute__((pure, warn_unused_result, nonnull,
                access(read_only, 1), access(read_only, 2)))
 /**
@@ -83,18 +247,9 @@ __attribute__((pure, warn_unused_result, nonnull,
  */
 static inline bool LeelenNumber_should_reply (
     const struct LeelenNumber *self, const char *request) {
-  return memcmp(self->str, request, 9) == 0;
+  return Leelen_number_key(request) == LeelenNumber_key(self);
 }
 
-__attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
-/**
- * @memberof LeelenNumber
- * @brief Pack phone number into a single integer.
- *
- * @param phone Phone number.
- * @return Converted integer.
- */
-uint32_t LeelenNumber_toint (const struct LeelenNumber *phone);
 __attribute__((returns_nonnull, nonnull, access(write_only, 1)))
 /**
  * @memberof LeelenNumber
@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <inet46i/sockaddr46.h>
+
+#include "utils/macro.h"
+#include "number.h"
+#include "route.h"
+
+
+const struct LeelenRoute *LeelenDialPlan_lookup (
+    const struct LeelenDialPlan *self, const struct LeelenNumber *number) {
+  return_if_fail (self->nodes != NULL) NULL;
+
+  uint64_t key = LeelenNumber_tobcd(number);
+  uint32_t node = 0;
+  for (int i = 0; i < LEELEN_DIAL_PLAN_DEPTH; i++) {
+    uint32_t entry = self->nodes[node].next[key & 0xf];
+    return_if (entry & LEELEN_DIAL_PLAN_LEAF)
+      &self->routes[entry & ~LEELEN_DIAL_PLAN_LEAF];
+    return_if_fail (entry != 0) NULL;
+    node = entry;
+    key >>= 4;
+  }
+  return NULL;
+}
+
+
+static int LeelenDialPlanRule_compare (const void *a, const void *b) {
+  const struct LeelenDialPlanRule *rule_a = a;
+  const struct LeelenDialPlanRule *rule_b = b;
+  if (rule_a->len != rule_b->len) {
+    return rule_a->len < rule_b->len ? -1 : 1;
+  }
+  return rule_a->order < rule_b->order ? -1 : rule_a->order > rule_b->order;
+}
+
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDialPlan
+ * @private
+ * @brief Create a new trie node.
+ *
+ * @param self Dial plan.
+ * @param entry Entry to fill the node with.
+ * @return Index of the new node, or 0 on error.
+ */
+static uint32_t LeelenDialPlan_new_node (
+    struct LeelenDialPlan *self, uint32_t entry) {
+  return_if_fail (self->n_node < LEELEN_DIAL_PLAN_LEAF) 0;
+  // grow when the count reaches a power of 2
+  if ((self->n_node & (self->n_node - 1)) == 0) {
+    unsigned int size = self->n_node == 0 ? 1 : self->n_node * 2;
+    struct LeelenDialPlanNode *nodes =
+      realloc(self->nodes, size * sizeof(self->nodes[0]));
+    return_if_fail (nodes != NULL) 0;
+    self->nodes = nodes;
+  }
+
+  uint32_t node = self->n_node;
+  for (int i = 0; i < 16; i++) {
+    self->nodes[node].next[i] = entry;
+  }
+  self->n_node++;
+  // the root is never referred to, so 0 is free to mean error
+  return node == 0 ? UINT32_MAX : node;
+}
+
+
+int LeelenDialPlan_compile (struct LeelenDialPlan *self) {
+  free(self->nodes);
+  self->nodes = NULL;
+  self->n_node = 0;
+  return_if_fail (LeelenDialPlan_new_node(self, 0) != 0) -1;
+
+  // shorter prefixes first, so that longer ones override them
+  if (self->n_rule > 1) {
+    qsort(self->rules, self->n_rule, sizeof(self->rules[0]),
+          LeelenDialPlanRule_compare);
+  }
+
+  for (unsigned int i = 0; i < self->n_rule; i++) {
+    const struct LeelenDialPlanRule *rule = &self->rules[i];
+    uint32_t leaf = LEELEN_DIAL_PLAN_LEAF | rule->route;
+
+    if (rule->len == 0) {
+      for (int j = 0; j < 16; j++) {
+        self->nodes[0].next[j] = leaf;
+      }
+      continue;
+    }
+
+    uint64_t prefix = rule->prefix;
+    uint32_t node = 0;
+    for (int depth = 0; depth < rule->len - 1; depth++) {
+      uint32_t entry = self->nodes[node].next[prefix & 0xf];
+      if (entry == 0 || (entry & LEELEN_DIAL_PLAN_LEAF)) {
+        // push the shorter route down
+        uint32_t child = LeelenDialPlan_new_node(self, entry);
+        goto_if_fail (child != 0) fail;
+        self->nodes[node].next[prefix & 0xf] = child;
+        entry = child;
+      }
+      node = entry;
+      prefix >>= 4;
+    }
+    self->nodes[node].next[prefix & 0xf] = leaf;
+  }
+
+  return 0;
+
+fail:
+  free(self->nodes);
+  self->nodes = NULL;
+  self->n_node = 0;
+  return -1;
+}
+
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDialPlan
+ * @private
+ * @brief Add a rule.
+ *
+ * @param self Dial plan.
+ * @param prefix Phone number prefix.
+ * @param len Number of nibbles in @p prefix.
+ * @return 0 on success, -1 on error.
+ */
+static int LeelenDialPlan_add_rule (
+    struct LeelenDialPlan *self, uint64_t prefix, unsigned char len) {
+  // grow when the count reaches a power of 2
+  if ((self->n_rule & (self->n_rule - 1)) == 0) {
+    unsigned int size = self->n_rule == 0 ? 1 : self->n_rule * 2;
+    struct LeelenDialPlanRule *rules =
+      realloc(self->rules, size * sizeof(self->rules[0]));
+    return_if_fail (rules != NULL) -1;
+    self->rules = rules;
+  }
+
+  self->rules[self->n_rule] = (struct LeelenDialPlanRule) {
+    .prefix = prefix & ((UINT64_C(1) << (4 * len)) - 1), .len = len,
+    .route = self->n_route - 1, .order = self->n_rule,
+  };
+  self->n_rule++;
+  return 0;
+}
+
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDialPlan
+ * @private
+ * @brief Add rules covering a range of phone number keys, with any extension.
+ *
+ * The range is split into the fewest aligned decimal blocks, each of which is
+ * a prefix.
+ *
+ * @param self Dial plan.
+ * @param first Key of the first phone number, see Leelen_number_key().
+ * @param last Key of the last phone number (inclusive).
+ * @return 0 on success, -1 on error.
+ */
+static int LeelenDialPlan_add_range (
+    struct LeelenDialPlan *self, uint32_t first, uint32_t last) {
+  while (first <= last) {
+    // largest aligned block starting at first and within range
+    int k = 0;
+    uint32_t size = 1;
+    while (k < 8 && first % (size * 10) == 0 && first + size * 10 - 1 <= last) {
+      k++;
+      size *= 10;
+    }
+
+    uint64_t prefix = 0;
+    uint32_t digits = first;
+    for (int i = 7; i >= 0; i--) {
+      prefix |= (uint64_t) (digits % 10) << (4 * i);
+      digits /= 10;
+    }
+    return_nonzero (LeelenDialPlan_add_rule(self, prefix, 8 - k));
+
+    break_if (last - first < size);
+    first += size;
+  }
+  return 0;
+}
+
+
+__attribute__((nonnull, access(write_only, 1), access(read_only, 2)))
+/**
+ * @memberof LeelenRoute
+ * @private
+ * @brief Parse route target.
+ *
+ * @param[out] self Route.
+ * @param target Route target.
+ * @return 0 on success, 1 if @p target is malformed.
+ */
+static int LeelenRoute_init (struct LeelenRoute *self, const char *target) {
+  return_if_fail (target[0] != '\0') 1;
+  return_if_fail (strlen(target) < sizeof(self->target)) 1;
+  strcpy(self->target, target);
+
+  if (strcmp(target, "discover") == 0) {
+    self->action = LEELEN_ROUTE_DISCOVER;
+  } else if (strcmp(target, "reject") == 0) {
+    self->action = LEELEN_ROUTE_REJECT;
+  } else if (strncmp(target, "sip:", 4) == 0 ||
+             strncmp(target, "sips:", 5) == 0) {
+    self->action = LEELEN_ROUTE_REDIRECT;
+  } else {
+    int af = sockaddr46_aton(target, &self->addr);
+    return_if_fail (af == AF_INET || af == AF_INET6) 1;
+    self->action = LEELEN_ROUTE_ADDRESS;
+  }
+  return 0;
+}
+
+
+int LeelenDialPlan_add (
+    struct LeelenDialPlan *self, const char *spec,
+    const struct LeelenNumber *base) {
+  const char *target = strchr(spec, '=');
+  return_if_fail (target != NULL) 1;
+  unsigned int pattern_len = target - spec;
+  target++;
+
+  struct LeelenRoute route;
+  return_nonzero (LeelenRoute_init(&route, target));
+
+  char pattern[pattern_len + 1];
+  memcpy(pattern, spec, pattern_len);
+  pattern[pattern_len] = '\0';
+  return_if_fail (pattern_len > 0) 1;
+
+  struct LeelenRoute *routes =
+    realloc(self->routes, (self->n_route + 1) * sizeof(self->routes[0]));
+  return_if_fail (routes != NULL) -1;
+  self->routes = routes;
+  self->routes[self->n_route] = route;
+  self->n_route++;
+
+  unsigned int n_rule = self->n_rule;
+  int ret;
+  char *last = strchr(pattern, '~');
+  if (pattern[pattern_len - 1] == '*') {
+    // prefix
+    uint64_t prefix = 0;
+    unsigned char len = 0;
+    for (unsigned int i = 0; i < pattern_len - 1; i++) {
+      continue_if (pattern[i] == '-' && i > 0);
+      goto_if_fail ((unsigned char) (pattern[i] - '0') < 10) malformed;
+      goto_if_fail (len < LEELEN_DIAL_PLAN_DEPTH) malformed;
+      prefix |= (uint64_t) (pattern[i] - '0') << (4 * len);
+      len++;
+    }
+    ret = LeelenDialPlan_add_rule(self, prefix, len);
+  } else if (last != NULL) {
+    // range
+    *last = '\0';
+    last++;
+    struct LeelenNumber number;
+    goto_if_fail (LeelenNumber_init(&number, pattern, base) == 0) malformed;
+    uint32_t first_key = LeelenNumber_key(&number);
+    goto_if_fail (LeelenNumber_init(&number, last, base) == 0) malformed;
+    uint32_t last_key = LeelenNumber_key(&number);
+    goto_if_fail (first_key <= last_key) malformed;
+    ret = LeelenDialPlan_add_range(self, first_key, last_key);
+  } else {
+    // exact
+    struct LeelenNumber number;
+    goto_if_fail (LeelenNumber_init(&number, pattern, base) == 0) malformed;
+    ret = LeelenDialPlan_add_rule(
+      self, LeelenNumber_tobcd(&number), LEELEN_DIAL_PLAN_DEPTH);
+  }
+  goto_if_fail (ret == 0) fail;
+  return 0;
+
+malformed:
+  ret = 1;
+fail:
+  self->n_rule = n_rule;
+  self->n_route--;
+  return ret;
+}
+
+
+int LeelenDialPlan_load (
+    struct LeelenDialPlan *self, FILE *file, const struct LeelenNumber *base,
+    unsigned int *lineno) {
+  char *line = NULL;
+  size_t line_size = 0;
+  int ret = 0;
+
+  for (unsigned int i = 1; ; i++) {
+    ssize_t line_len = getline(&line, &line_size, file);
+    break_if (line_len < 0);
+
+    // strip
+    while (line_len > 0 && (line[line_len - 1] == '\n' ||
+                            line[line_len - 1] == '\r' ||
+                            line[line_len - 1] == ' ' ||
+                            line[line_len - 1] == '\t')) {
+      line_len--;
+    }
+    line[line_len] = '\0';
+    char *spec = line + strspn(line, " \t");
+    continue_if (spec[0] == '\0' || spec[0] == '#');
+
+    ret = LeelenDialPlan_add(self, spec, base);
+    if unlikely (ret != 0) {
+      if (lineno != NULL) {
+        *lineno = i;
+      }
+      break;
+    }
+  }
+
+  if (ret == 0 && ferror(file)) {
+    ret = -1;
+  }
+  free(line);
+  return ret;
+}
+
+
+void LeelenDialPlan_destroy (struct LeelenDialPlan *self) {
+  free(self->routes);
+  free(self->rules);
+  free(self->nodes);
+}
+
+
+bool LeelenRouter_lookup (
+    struct LeelenRouter *self, const struct LeelenNumber *number,
+    struct LeelenRoute *route) {
+  unsigned int epoch = atomic_load(&self->epoch);
+  atomic_fetch_add(&self->readers[epoch], 1);
+  // loaded after announcing, so a retired plan is never seen
+  const struct LeelenDialPlan *plan = atomic_load(&self->plan);
+  const struct LeelenRoute *found =
+    plan == NULL ? NULL : LeelenDialPlan_lookup(plan, number);
+  if (found != NULL) {
+    *route = *found;
+  }
+  atomic_fetch_sub(&self->readers[epoch], 1);
+  return found != NULL;
+}
+
+
+void LeelenRouter_swap (struct LeelenRouter *self, struct LeelenDialPlan *plan) {
+  struct LeelenDialPlan *old = atomic_exchange(&self->plan, plan);
+  return_if (old == NULL);
+
+  // wait for readers that might have seen the old plan, in both epochs; new
+  // readers go to the other epoch, so each wait is bounded
+  for (int i = 0; i < 2; i++) {
+    unsigned int epoch = atomic_load(&self->epoch);
+    atomic_store(&self->epoch, epoch ^ 1);
+    while (atomic_load(&self->readers[epoch]) != 0) {
+      sched_yield();
+    }
+  }
+
+  LeelenDialPlan_destroy(old);
+  free(old);
+}
@@ -0,0 +1,280 @@
+#ifndef LEELEN_ROUTE_H
+#define LEELEN_ROUTE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <inet46i/sockaddr46.h>
+
+// #include "number.h"
+struct LeelenNumber;
+
+
+/// maximum length of route target
+#define LEELEN_ROUTE_TARGET_SIZE 128
+/// number of nibbles in a dial plan key, 8 digits and extension
+#define LEELEN_DIAL_PLAN_DEPTH 9
+
+
+/**
+ * @ingroup leelen
+ * @brief Action of a route.
+ */
+enum LeelenRouteAction {
+  /// find the callee by LEELEN discovery
+  LEELEN_ROUTE_DISCOVER = 0,
+  /// call the address in LeelenRoute::addr, such as another gateway
+  LEELEN_ROUTE_ADDRESS,
+  /// redirect the caller to the SIP URI in LeelenRoute::target
+  LEELEN_ROUTE_REDIRECT,
+  /// reject the call
+  LEELEN_ROUTE_REJECT,
+};
+
+
+/**
+ * @ingroup leelen
+ * @brief Destination of a call.
+ */
+struct LeelenRoute {
+  /// action, see LeelenRouteAction
+  unsigned char action;
+  /// address, if LeelenRoute::action is @ref LEELEN_ROUTE_ADDRESS
+  union sockaddr_in46 addr;
+  /// target as specified
+  char target[LEELEN_ROUTE_TARGET_SIZE];
+};
+
+
+/**
+ * @ingroup leelen
+ * @brief Rule of dial plan.
+ */
+struct LeelenDialPlanRule {
+  /// phone number prefix, see LeelenNumber_tobcd()
+  uint64_t prefix;
+  /// number of nibbles in LeelenDialPlanRule::prefix
+  unsigned char len;
+  /// index of route
+  unsigned int route;
+  /// order of rule, later rules take precedence
+  unsigned int order;
+};
+
+
+/**
+ * @ingroup leelen
+ * @brief Node of compiled dial plan.
+ *
+ * An entry is 0 if no route, @ref LEELEN_DIAL_PLAN_LEAF with the route index
+ * if matched, or the index of the next node otherwise.
+ */
+struct LeelenDialPlanNode {
+  /// entries, indexed by nibble
+  uint32_t next[16];
+};
+
+/// flag of leaf entries in LeelenDialPlanNode::next
+#define LEELEN_DIAL_PLAN_LEAF UINT32_C(0x80000000)
+
+
+/**
+ * @ingroup leelen
+ * @brief Dial plan, mapping phone number patterns to routes.
+ *
+ * Rules are compiled into a trie keyed by digits of phone numbers (block,
+ * room, then extension), with routes pushed to leaves, so that a lookup walks
+ * at most 9 nodes and never allocates. The longest matching prefix wins; of
+ * equal prefixes, the last added one wins.
+ */
+struct LeelenDialPlan {
+  /// routes
+  struct LeelenRoute *routes;
+  /// number of routes
+  unsigned int n_route;
+
+  /** @privatesection */
+  /// rules
+  struct LeelenDialPlanRule *rules;
+  /// number of rules
+  unsigned int n_rule;
+  /// trie nodes, node 0 is the root, or @c NULL if not compiled
+  struct LeelenDialPlanNode *nodes;
+  /// number of trie nodes
+  unsigned int n_node;
+};
+
+__attribute__((pure, warn_unused_result, nonnull))
+/**
+ * @memberof LeelenDialPlan
+ * @brief Find the route of a phone number.
+ *
+ * @param self Compiled dial plan.
+ * @param number Phone number.
+ * @return Route, or @c NULL if no rules match.
+ */
+const struct LeelenRoute *LeelenDialPlan_lookup (
+  const struct LeelenDialPlan *self, const struct LeelenNumber *number);
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDialPlan
+ * @brief Compile rules into trie.
+ *
+ * @param self Dial plan.
+ * @return 0 on success, -1 on error.
+ */
+int LeelenDialPlan_compile (struct LeelenDialPlan *self);
+__attribute__((nonnull(1, 2), warn_unused_result, access(read_only, 2),
+               access(read_only, 3)))
+/**
+ * @memberof LeelenDialPlan
+ * @brief Add a rule.
+ *
+ * The specification is `<pattern>=<target>`. @p pattern is one of:
+ *   - `*`: any phone number
+ *   - digits followed by `*`, such as `0002-*` or `0001-01*`: any phone number
+ *     starting with the digits, with separators ignored
+ *   - `<number>~<number>`: any phone number in range, with any extension
+ *   - `<number>`: exactly this phone number
+ *
+ * @p target is one of:
+ *   - `discover`: find the callee by LEELEN discovery
+ *   - `reject`: reject the call
+ *   - `sip:...` or `sips:...`: redirect the caller to the SIP URI
+ *   - an address: call the device or gateway at the address
+ *
+ * @param self Dial plan.
+ * @param spec Rule specification.
+ * @param base Base phone number, can be @c NULL.
+ * @return 0 on success, 1 if @p spec is malformed, -1 on error.
+ */
+int LeelenDialPlan_add (
+  struct LeelenDialPlan *self, const char *spec,
+  const struct LeelenNumber *base);
+__attribute__((nonnull(1, 2), warn_unused_result, access(read_only, 3),
+               access(write_only, 4)))
+/**
+ * @memberof LeelenDialPlan
+ * @brief Add rules from a file, one rule per line.
+ *
+ * Empty lines and lines starting with `#` are ignored.
+ *
+ * @param self Dial plan.
+ * @param file File.
+ * @param base Base phone number, can be @c NULL.
+ * @param[out] lineno Line number of the malformed rule. Can be @c NULL.
+ * @return 0 on success, 1 if a rule is malformed, -1 on error.
+ */
+int LeelenDialPlan_load (
+  struct LeelenDialPlan *self, FILE *file, const struct LeelenNumber *base,
+  unsigned int *lineno);
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDialPlan
+ * @brief Destroy a dial plan.
+ *
+ * @param self Dial plan.
+ */
+void LeelenDialPlan_destroy (struct LeelenDialPlan *self);
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof LeelenDialPlan
+ * @brief Initialize an empty dial plan.
+ *
+ * @param[out] self Dial plan.
+ */
+static inline void LeelenDialPlan_init (struct LeelenDialPlan *self) {
+  self->routes = NULL;
+  self->n_route = 0;
+  self->rules = NULL;
+  self->n_rule = 0;
+  self->nodes = NULL;
+  self->n_node = 0;
+}
+
+
+/**
+ * @ingroup leelen
+ * @brief Holder of the active dial plan, which can be replaced while being
+ *  looked up.
+ *
+ * Readers announce themselves in the counter of the current epoch before
+ * loading the dial plan. A writer publishes the new dial plan, then flips the
+ * epoch and drains the readers of the old epoch, twice, before freeing the
+ * old dial plan.
+ */
+struct LeelenRouter {
+  /** @privatesection */
+  /// active dial plan, or @c NULL if none
+  struct LeelenDialPlan * _Atomic plan;
+  /// current epoch, 0 or 1
+  atomic_uint epoch;
+  /// number of readers in each epoch
+  atomic_uint readers[2];
+};
+
+__attribute__((warn_unused_result, nonnull, access(write_only, 3)))
+/**
+ * @memberof LeelenRouter
+ * @brief Find the route of a phone number.
+ *
+ * This function is lock-free.
+ *
+ * @param self Router.
+ * @param number Phone number.
+ * @param[out] route Route.
+ * @return @c true if found.
+ */
+bool LeelenRouter_lookup (
+  struct LeelenRouter *self, const struct LeelenNumber *number,
+  struct LeelenRoute *route);
+__attribute__((nonnull(1)))
+/**
+ * @memberof LeelenRouter
+ * @brief Replace the active dial plan, and destroy the old one.
+ *
+ * Calls to this function must be serialized.
+ *
+ * @param self Router.
+ * @param plan New compiled dial plan, allocated by @c malloc(). Can be
+ *  @c NULL.
+ */
+void LeelenRouter_swap (struct LeelenRouter *self, struct LeelenDialPlan *plan);
+
+__attribute__((nonnull))
+/**
+ * @memberof LeelenRouter
+ * @brief Destroy a router.
+ *
+ * @param self Router.
+ */
+static inline void LeelenRouter_destroy (struct LeelenRouter *self) {
+  LeelenRouter_swap(self, NULL);
+}
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof LeelenRouter
+ * @brief Initialize a router with no dial plan.
+ *
+ * @param[out] self Router.
+ */
+static inline void LeelenRouter_init (struct LeelenRouter *self) {
+  atomic_init(&self->plan, NULL);
+  atomic_init(&self->epoch, 0);
+  atomic_init(&self->readers[0], 0);
+  atomic_init(&self->readers[1], 0);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEELEN_ROUTE_H */
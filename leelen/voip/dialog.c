@@ -1,5 +1,4 @@
 #include <endian.h>
-#include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -7,18 +6,27 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <inet46i/sockaddr46.h>
 
 #include "utils/macro.h"
+#include "utils/histogram.h"
 #include "utils/log.h"
+#include "utils/pcaptap.h"
 #include "utils/timeval.h"
+#include "utils/trace.h"
 #include "../config.h"
 #include "message.h"
 #include "protocol.h"
 #include "dialog.h"
 
 
+const char * const LeelenDialogState_names[LEELEN_DIALOG_STATE_COUNT] = {
+  "disconnected", "connecting", "connected", "disconnecting",
+};
+
+
 // Update state after receiving code AND acking it
 static enum LeelenDialogState LeelenDialogState_receive (
     enum LeelenDialogState state, enum LeelenCode code) {
@@ -81,60 +89,222 @@ static enum LeelenDialogState LeelenDialogState_nak (
 }
 
 
+/**
+ * @memberof LeelenDialog
+ * @private
+ * @brief Get the interval before a retransmission.
+ *
+ * Like SIP Timer A/E, the interval starts from LeelenDialog::timeout and
+ * doubles on each retransmission, up to
+ * @ref LEELEN_VOIP_RETRANSMIT_CAP times LeelenDialog::timeout.
+ *
+ * @param self Dialog.
+ * @param n Number of retransmissions done.
+ * @return Interval, in milliseconds.
+ */
+static unsigned int LeelenDialog_interval (
+    const struct LeelenDialog *self, unsigned int n) {
+  unsigned int factor = 1u << (n < 16 ? n : 16);
+  return self->timeout * (
+    factor < LEELEN_VOIP_RETRANSMIT_CAP ? factor : LEELEN_VOIP_RETRANSMIT_CAP);
+}
+
+
+/**
+ * @memberof LeelenDialog
+ * @private
+ * @brief Get the time from the first transmission until the last
+ *  retransmission is given up, like SIP Timer B/F.
+ *
+ * @param self Dialog.
+ * @return Time, in milliseconds.
+ */
+static unsigned int LeelenDialog_ack_budget (const struct LeelenDialog *self) {
+  unsigned int budget = 0;
+  for (unsigned int i = 0; i <= LEELEN_VOIP_RETRANSMITS; i++) {
+    budget += LeelenDialog_interval(self, i);
+  }
+  return budget;
+}
+
+
+/**
+ * @brief Hash the code and body of a raw message, for duplicate detection.
+ *
+ * @param msg Message.
+ * @return FNV-1a hash.
+ */
+static uint32_t leelen_dialog_digest (const char *msg) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < LEELEN_MESSAGE_HEADER_SIZE; i++) {
+    hash = (hash ^ (unsigned char) msg[i]) * 16777619u;
+  }
+  for (const char *p = msg + LEELEN_MESSAGE_HEADER_SIZE; *p != '\0'; p++) {
+    hash = (hash ^ (unsigned char) *p) * 16777619u;
+  }
+  return hash;
+}
+
+
 bool LeelenDialog_ack_timeout (struct LeelenDialog *self) {
   return_if (self->last_sent.tv_sec == 0) true;
 
   struct timespec now;
   timespec_get(&now, TIME_UTC);
+  unsigned int budget = LeelenDialog_ack_budget(self);
   return_if_not (timeout_reached(
     now.tv_sec, now.tv_nsec,
     self->last_sent.tv_sec, self->last_sent.tv_nsec,
-    self->timeout / 1000, (self->timeout % 1000) * 1000000l)) false;
+    budget / 1000, (budget % 1000) * 1000000l)) false;
 
   self->last_sent.tv_sec = 0;
+  self->last_code = LEELEN_CODE_OK;
   self->state = LeelenDialogState_nak(self->state);
   return true;
 }
 
 
-int LeelenDialog_sendmsg (
-    struct LeelenDialog *self, void *buf, unsigned int len, int sockfd) {
+/**
+ * @memberof LeelenDialog
+ * @private
+ * @brief Send a message in two parts to peer device and update dialog state.
+ *
+ * @param self Dialog.
+ * @param head Raw message head, including code and dialog ID.
+ * @param head_len Length of @p head.
+ * @param body Rest of the message. Can be @c NULL if @p body_len is 0.
+ * @param body_len Length of @p body.
+ * @param sockfd Socket for sending reply.
+ * @return 0 on success, -1 if @c sendmsg() error.
+ */
+static int LeelenDialog_sendparts (
+    struct LeelenDialog *self, const void *head, unsigned int head_len,
+    const void *body, unsigned int body_len, int sockfd) {
+  TRACE_SPAN("leelen send", self->id);
+
   // log
   if (LOG_WOULD_LOG(LOG_LEVEL_VERBOSE)) {
     char s_dst[SOCKADDR_STRLEN];
     sockaddr_toa(&self->theirs.sock, s_dst, sizeof(s_dst));
     LOG(
       LOG_LEVEL_VERBOSE,
-      "To %s, dialog " PRI_LEELEN_ID ", code " PRI_LEELEN_CODE ":\n%.*s",
-      s_dst, LEELEN_MESSAGE_ID(buf), le32toh(LEELEN_MESSAGE_CODE(buf)),
-      len - LEELEN_MESSAGE_HEADER_SIZE,
-      (char *) buf + LEELEN_MESSAGE_HEADER_SIZE);
+      "To %s, dialog " PRI_LEELEN_ID ", code " PRI_LEELEN_CODE ":\n%.*s%.*s",
+      s_dst, LEELEN_MESSAGE_ID(head), le32toh(LEELEN_MESSAGE_CODE(head)),
+      head_len - LEELEN_MESSAGE_HEADER_SIZE,
+      (const char *) head + LEELEN_MESSAGE_HEADER_SIZE,
+      body_len, body_len == 0 ? "" : (const char *) body);
   }
   // send
-  return_if_fail (sendto(
-    sockfd, buf, len, 0, &self->theirs.sock,
-    self->theirs.sa_family == AF_INET ?
-      sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)) == len) -1;
-  // update state
-  enum LeelenCode code = le32toh(LEELEN_MESSAGE_CODE(buf));
-  if (code != LEELEN_CODE_OK) {
-    self->state = LeelenDialogState_send(self->state, code);
-    timespec_get(&self->last_sent, TIME_UTC);
-    self->last_activity = self->last_sent.tv_sec + 1;
+  struct iovec iov[2] = {
+    {.iov_base = (void *) head, .iov_len = head_len},
+    {.iov_base = (void *) body, .iov_len = body_len},
+  };
+  struct msghdr msg = {
+    .msg_name = &self->theirs.sock,
+    .msg_namelen = self->theirs.sa_family == AF_INET ?
+      sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
+    .msg_iov = iov, .msg_iovlen = body_len == 0 ? 1 : 2,
+  };
+  return_if_fail (
+    sendmsg(sockfd, &msg, 0) == (ssize_t) (head_len + body_len)) -1;
+  if unlikely (self->tap != NULL) {
+    // VoIP port is the same on both sides
+    union sockaddr_in46 ours = self->ours;
+    ours.sa_port = self->theirs.sa_port;
+    PcapTap_writev(self->tap, iov, msg.msg_iovlen, &ours.sock,
+                   &self->theirs.sock);
   }
   return 0;
 }
 
 
-int LeelenDialog_sendcode (
-    struct LeelenDialog *self, unsigned int code, int sockfd) {
-  char buf[LEELEN_MESSAGE_MIN_SIZE];
+/**
+ * @memberof LeelenDialog
+ * @private
+ * @brief Update dialog state and arm retransmission after sending a message.
+ *
+ * @param self Dialog.
+ * @param code VoIP code.
+ * @param retransmit Number of retransmissions allowed.
+ */
+static void LeelenDialog_sent (
+    struct LeelenDialog *self, enum LeelenCode code, unsigned int retransmit) {
+  return_if (code == LEELEN_CODE_OK);
+  self->state = LeelenDialogState_send(self->state, code);
+  timespec_get(&self->last_sent, TIME_UTC);
+  self->last_activity = self->last_sent.tv_sec + 1;
+  self->last_code = code;
+  self->n_retransmit = LEELEN_VOIP_RETRANSMITS - retransmit;
+  self->next_retransmit = LeelenDialog_interval(self, 0);
+}
+
+
+int LeelenDialog_sendmsg (
+    struct LeelenDialog *self, void *buf, unsigned int len, int sockfd) {
+  return_nonzero (LeelenDialog_sendparts(self, buf, len, NULL, 0, sockfd));
+  // raw messages are not kept, thus not retransmitted
+  LeelenDialog_sent(self, le32toh(LEELEN_MESSAGE_CODE(buf)), 0);
+  return 0;
+}
+
+
+/**
+ * @memberof LeelenDialog
+ * @private
+ * @brief Pre-render the message header after dialog ID or phone numbers
+ *  changed.
+ *
+ * @param self Dialog.
+ */
+static void LeelenDialog_render_header (struct LeelenDialog *self) {
   struct LeelenMessage message = {
-    .id = self->id, .code = code,
+    .id = self->id, .code = LEELEN_CODE_OK,
     .from = self->our, .from_type = self->our_type, .to = self->their,
   };
-  int len = LeelenMessage_tostring(&message, buf, sizeof(buf)) + 1;
-  return LeelenDialog_sendmsg(self, buf, len, sockfd);
+  unsigned int len = LeelenMessage_tostring_header(
+    &message, self->header, sizeof(self->header));
+  // cannot overflow, since phone numbers are bounded
+  self->header_len = len < sizeof(self->header) ?
+    len : sizeof(self->header) - 1;
+}
+
+
+int LeelenDialog_sendcode (
+    struct LeelenDialog *self, unsigned int code, int sockfd) {
+  LEELEN_MESSAGE_CODE(self->header) = htole32(code);
+  return_nonzero (LeelenDialog_sendparts(
+    self, self->header, self->header_len + 1, NULL, 0, sockfd));
+  if (code != LEELEN_CODE_OK) {
+    self->last_has_media = false;
+    LeelenDialog_sent(self, code, LEELEN_VOIP_RETRANSMITS);
+  }
+  return 0;
+}
+
+
+int LeelenDialog_retransmit (struct LeelenDialog *self, int sockfd) {
+  return_if (self->last_code == LEELEN_CODE_OK) 0;
+  return_if (self->last_sent.tv_sec == 0) 0;
+  return_if (self->n_retransmit >= LEELEN_VOIP_RETRANSMITS) 0;
+
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return_if (
+    timespec_diff_us(&now, &self->last_sent) / 1000 < self->next_retransmit) 0;
+
+  self->n_retransmit++;
+  self->next_retransmit += LeelenDialog_interval(self, self->n_retransmit);
+  self->retransmits++;
+  LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Retransmit code "
+      PRI_LEELEN_CODE ", attempt %d", self->id, self->last_code,
+      self->n_retransmit + 1);
+
+  LEELEN_MESSAGE_CODE(self->header) = htole32(self->last_code);
+  return_nonzero (self->last_has_media ? LeelenDialog_sendparts(
+    self, self->header, self->header_len, self->media, self->media_len + 1,
+    sockfd) : LeelenDialog_sendparts(
+    self, self->header, self->header_len + 1, NULL, 0, sockfd));
+  return 1;
 }
 
 
@@ -157,34 +327,53 @@ int LeelenDialog_send (
   return_if_fail (self->id != 0) 255;
   return_if_fail (self->mtu >= LEELEN_MESSAGE_MIN_SIZE) 255;
 
-  char buf[self->mtu];
+  // render media description
   struct LeelenMessage message = {
-    .id = self->id, .code = code,
-    .from = self->our, .from_type = self->our_type, .to = self->their,
     .audio_formats = (char **) audio_formats,
     .video_formats = (char **) video_formats,
     .audio_port = self->our_audio_port, .video_port = self->our_video_port,
   };
-  unsigned int len = LeelenMessage_tostring(&message, buf, sizeof(buf)) + 1;
-  should (len <= sizeof(buf)) otherwise {
+  unsigned int size = self->mtu - self->header_len;
+  if (size > sizeof(self->media)) {
+    size = sizeof(self->media);
+  }
+  unsigned int len = LeelenMessage_tostring_media(&message, self->media, size);
+  should (len < size) otherwise {
     LOG(LOG_LEVEL_WARNING, "Message too long, would be %d bytes, "
-        "but only capable of hodling %ld bytes", len + 1, sizeof(buf));
-    len = sizeof(buf);
-    buf[len - 1] = '\0';
+        "but only capable of hodling %d bytes",
+        self->header_len + len + 1, self->mtu);
+    len = size - 1;
+    self->media[len] = '\0';
   }
-  return LeelenDialog_sendmsg(self, buf, len, sockfd);
+  self->media_len = len;
+
+  LEELEN_MESSAGE_CODE(self->header) = htole32(code);
+  return_nonzero (LeelenDialog_sendparts(
+    self, self->header, self->header_len, self->media, self->media_len + 1,
+    sockfd));
+  self->last_has_media = true;
+  LeelenDialog_sent(self, code, LEELEN_VOIP_RETRANSMITS);
+  return 0;
 }
 
 
 int LeelenDialog_receive (
     struct LeelenDialog *self, char *msg, int sockfd,
-    char ***audio_formats, char ***video_formats) {
+    char **audio_formats, char **video_formats) {
   return_if_fail (LEELEN_MESSAGE_ID(msg) == self->id) 255;
+  TRACE_SPAN("leelen receive", self->id);
 
   enum LeelenCode code = le32toh(LEELEN_MESSAGE_CODE(msg));
   if (code == LEELEN_CODE_OK) {
     return_if_fail (!LeelenDialog_ack_timeout(self)) 254;
+    if (self->last_code == LEELEN_CODE_CALL && self->ack_latency != NULL) {
+      struct timespec now;
+      timespec_get(&now, TIME_UTC);
+      Histogram_add(
+        self->ack_latency, timespec_diff_us(&now, &self->last_sent));
+    }
     self->state = LeelenDialogState_ack(self->state);
+    self->last_code = LEELEN_CODE_OK;
     // special case: handle ACK quickly
     // note that also means that we do not parse (and save) fields from SDP
     if (audio_formats == NULL && video_formats == NULL) {
@@ -193,10 +382,27 @@ int LeelenDialog_receive (
     }
   }
 
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  if (code != LEELEN_CODE_OK) {
+    // retransmitted request, since our ACK was lost; ACK again, idempotently
+    // keyed on code and body, so that a new request with the same code passes
+    uint32_t digest = leelen_dialog_digest(msg);
+    if (digest == self->last_received_digest &&
+        timespec_diff_us(&now, &self->last_received) / 1000 <
+          LeelenDialog_ack_budget(self)) {
+      return_nonzero (LeelenDialog_sendcode(self, LEELEN_CODE_OK, sockfd));
+      self->duplicates++;
+      self->last_activity = now.tv_sec;
+      return 253;
+    }
+    self->last_received_digest = digest;
+    self->last_received = now;
+  }
+
   // parse sdp
   struct LeelenMessage message;
-  return_nonzero (LeelenMessage_init(
-    &message, msg, audio_formats == NULL, video_formats == NULL));
+  LeelenMessage_init(&message, msg, audio_formats, video_formats);
 
   // verify
   if unlikely (message.from.str[0] == '\0') {
@@ -204,11 +410,13 @@ int LeelenDialog_receive (
   } else {
     if (self->their.str[0] == '\0') {
       self->their = message.from;
+      LeelenDialog_render_header(self);
     } else {
       should (strcmp(self->their.str, message.from.str) == 0) otherwise {
         LOG(LOG_LEVEL_INFO, "Expect their number %s, got %s",
             self->their.str, message.from.str);
         self->their = message.from;
+        LeelenDialog_render_header(self);
       }
     }
   }
@@ -259,26 +467,13 @@ int LeelenDialog_receive (
 
   if (code != LEELEN_CODE_OK) {
     // ack
-    int ret = LeelenDialog_sendcode(self, LEELEN_CODE_OK, sockfd);
-    should (ret == 0) otherwise {
-      int saved_errno = errno;
-      LeelenMessage_destroy(&message);
-      errno = saved_errno;
-      return ret;
-    }
+    return_nonzero (LeelenDialog_sendcode(self, LEELEN_CODE_OK, sockfd));
 
     // update state
     self->state = LeelenDialogState_receive(self->state, code);
   }
 
-  // return
-  if (audio_formats != NULL) {
-    *audio_formats = message.audio_formats;
-  }
-  if (video_formats != NULL) {
-    *video_formats = message.video_formats;
-  }
-  self->last_activity = time(NULL);
+  self->last_activity = now.tv_sec;
   return 0;
 }
 
@@ -315,6 +510,19 @@ int LeelenDialog_init (
   self->mtu = config->mtu;
 
   self->state = LEELEN_DIALOG_DISCONNECTED;
+  self->last_sent.tv_sec = 0;
+  self->last_code = LEELEN_CODE_OK;
+  self->n_retransmit = 0;
+  self->next_retransmit = 0;
+  self->last_received_digest = 0;
+  self->last_received.tv_sec = 0;
+  self->retransmits = 0;
+  self->duplicates = 0;
+  LeelenDialog_render_header(self);
+  self->media_len = 0;
+  self->last_has_media = false;
+  self->tap = NULL;
+  self->ack_latency = NULL;
   self->userdata = NULL;
   return 0;
 }
@@ -5,6 +5,8 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <threads.h>
 #include <time.h>
 #include <netinet/in.h>
@@ -17,6 +19,10 @@ struct LeelenConfig;
 // #include "message.h"
 struct LeelenMessage;
 #include "protocol.h"
+// #include "utils/histogram.h"
+struct Histogram;
+// #include "utils/pcaptap.h"
+struct PcapTap;
 
 
 /**
@@ -34,6 +40,12 @@ enum LeelenDialogState {
   LEELEN_DIALOG_DISCONNECTING,
 };
 
+/// number of dialog states
+#define LEELEN_DIALOG_STATE_COUNT 4
+
+/// names of dialog states
+extern const char * const LeelenDialogState_names[LEELEN_DIALOG_STATE_COUNT];
+
 
 /**
  * @ingroup leelen-voip
@@ -57,7 +69,7 @@ struct LeelenDialog {
   /// device type of peer device
   unsigned char their_type;
 
-  /// ACK timeout, in milliseconds
+  /// initial retransmission interval, in milliseconds
   unsigned int timeout;
   /// dialog duration, in seconds
   unsigned int duration;
@@ -78,17 +90,52 @@ struct LeelenDialog {
   /// maximum length of the message
   unsigned short mtu;
 
+  /// number of retransmissions sent
+  unsigned int retransmits;
+  /// number of duplicated messages received, which are ACKed again
+  unsigned int duplicates;
+
   /** @privatesection */
 
   /// dialog state, see #LeelenDialogState
   unsigned char state;
-  /// last sent time
+  /// first transmission time of the message waiting for ACK
   struct timespec last_sent;
+  /// code of the message waiting for ACK, or #LEELEN_CODE_OK if none
+  unsigned int last_code;
+  /// number of retransmissions of the message waiting for ACK
+  unsigned char n_retransmit;
+  /// time of next retransmission, in milliseconds since
+  /// LeelenDialog::last_sent
+  unsigned int next_retransmit;
+  /// whether the message waiting for ACK has LeelenDialog::media
+  bool last_has_media;
+  /// hash of code and body of the last message received, for duplicate
+  /// detection
+  uint32_t last_received_digest;
+  /// time of the last message received
+  struct timespec last_received;
   /// last activity time
   time_t last_activity;
+  /// pre-rendered dialog ID, @c From= and @c To= lines, with code patched on
+  /// each send
+  char header[LEELEN_MESSAGE_MIN_SIZE];
+  /// length of LeelenDialog::header, not counting the terminating null
+  /// character
+  unsigned char header_len;
+  /// pre-rendered media description of the last LeelenDialog_send()
+  char media[LEELEN_MAX_MESSAGE_LENGTH - LEELEN_MESSAGE_MIN_SIZE];
+  /// length of LeelenDialog::media, not counting the terminating null
+  /// character
+  unsigned short media_len;
 
   /** @publicsection */
 
+  /// capture tap of sent messages, can be @c NULL
+  struct PcapTap *tap;
+  /// histogram of latency from sending #LEELEN_CODE_CALL to its ACK, in
+  /// microseconds, can be @c NULL
+  struct Histogram *ack_latency;
   /// user data
   void *userdata;
 };
@@ -96,12 +143,28 @@ struct LeelenDialog {
 __attribute__((nonnull))
 /**
  * @memberof LeelenDialog
- * @brief Check if peer does not reply the message within timeout.
+ * @brief Check if peer does not reply the message within timeout, after all
+ *  retransmissions.
  *
  * @param self Dialog.
  * @return @c true if timeout reached.
  */
 bool LeelenDialog_ack_timeout (struct LeelenDialog *self);
+__attribute__((nonnull))
+/**
+ * @memberof LeelenDialog
+ * @brief Retransmit the message waiting for ACK if its retransmission timer
+ *  fired.
+ *
+ * The interval starts from LeelenDialog::timeout and doubles on each
+ * retransmission, up to @ref LEELEN_VOIP_RETRANSMITS retransmissions. Should
+ * be called periodically, at a granularity finer than LeelenDialog::timeout.
+ *
+ * @param self Dialog.
+ * @param sockfd Socket for sending.
+ * @return 1 if retransmitted, 0 if nothing to do, -1 if @c sendto() error.
+ */
+int LeelenDialog_retransmit (struct LeelenDialog *self, int sockfd);
 __attribute__((pure, warn_unused_result, nonnull, access(read_only, 1)))
 /**
  * @memberof LeelenDialog
@@ -188,14 +251,19 @@ __attribute__((nonnull(1, 2), access(write_only, 4), access(write_only, 5)))
  * @param self Dialog.
  * @param[in,out] msg Raw message.
  * @param sockfd Socket for sending reply.
- * @param[out] audio_formats Parsed audio description. Can be @c NULL.
- * @param[out] video_formats Parsed video description. Can be @c NULL.
- * @return 0 on success, 255 if dialog ID mismatched, 254 if ACK timeout, -1 on
- *  error and @c errno is set appropriately.
+ * @param[out] audio_formats Array of at least
+ *  @ref LEELEN_MESSAGE_MAX_FORMATS + 1 elements to hold parsed audio
+ *  description, pointing into @p msg. Can be @c NULL.
+ * @param[out] video_formats Array of at least
+ *  @ref LEELEN_MESSAGE_MAX_FORMATS + 1 elements to hold parsed video
+ *  description, pointing into @p msg. Can be @c NULL.
+ * @return 0 on success, 255 if dialog ID mismatched, 254 if ACK timeout, 253 if
+ *  the message duplicates the code and body of the last one and has been
+ *  ACKed again, -1 on error and @c errno is set appropriately.
  */
 int LeelenDialog_receive (
   struct LeelenDialog *self, char *msg, int sockfd,
-  char ***audio_formats, char ***video_formats);
+  char **audio_formats, char **video_formats);
 
 __attribute__((nonnull))
 /**
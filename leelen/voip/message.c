@@ -1,11 +1,13 @@
+#define _GNU_SOURCE
+
 #include <endian.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "utils/macro.h"
-#include "utils/array.h"
 #include "utils/log.h"
 #include "../config.h"
 #include "../family.h"
@@ -13,11 +15,12 @@
 #include "message.h"
 
 
-#define stricmp(s1, s2) strncmp(s1, s2, sizeof(s2) - 1)
 #define remain0(total, used) ((total) < (used) ? 0 : (total) - (used))
+#define keyis(key, key_len, s) \
+  ((key_len) == sizeof(s) - 1 && memcmp(key, s, sizeof(s) - 1) == 0)
 
 
-unsigned int LeelenMessage_tostring (
+unsigned int LeelenMessage_tostring_header (
     const struct LeelenMessage *self, char *buf, unsigned int len) {
   if likely (len >= 4) {
     LEELEN_MESSAGE_CODE(buf) = htole32(self->code);
@@ -28,6 +31,16 @@ unsigned int LeelenMessage_tostring (
   unsigned int cur = LEELEN_MESSAGE_HEADER_SIZE;
   cur += snprintf(buf + cur, remain0(len, cur), "From=%s?%d\nTo=%s\n",
                   self->from.str, self->from_type, self->to.str);
+  return cur;
+}
+
+
+unsigned int LeelenMessage_tostring_media (
+    const struct LeelenMessage *self, char *buf, unsigned int len) {
+  unsigned int cur = 0;
+  if (len > 0) {
+    buf[0] = '\0';
+  }
 
   if (self->audio_formats != NULL && self->audio_formats[0] != NULL) {
     for (int i = 0; self->audio_formats[i] != NULL; i++) {
@@ -51,6 +64,14 @@ unsigned int LeelenMessage_tostring (
 }
 
 
+unsigned int LeelenMessage_tostring (
+    const struct LeelenMessage *self, char *buf, unsigned int len) {
+  unsigned int cur = LeelenMessage_tostring_header(self, buf, len);
+  return cur + LeelenMessage_tostring_media(
+    self, buf + cur, remain0(len, cur));
+}
+
+
 void LeelenMessage_copy_config (
     struct LeelenMessage *self, const struct LeelenConfig *config) {
   self->from = config->number;
@@ -60,12 +81,6 @@ void LeelenMessage_copy_config (
 }
 
 
-void LeelenMessage_destroy (struct LeelenMessage *self) {
-  strvfree(self->audio_formats);
-  strvfree(self->video_formats);
-}
-
-
 int LeelenMessage_init_reply (
     struct LeelenMessage *self, const struct LeelenMessage *request,
     int from_type) {
@@ -82,9 +97,52 @@ int LeelenMessage_init_reply (
 }
 
 
+/**
+ * @relates LeelenMessage
+ * @private
+ * @brief Parse a port number.
+ *
+ * @param value Port string.
+ * @param what Port name, for logging.
+ * @return Port number, or 0 if malformed.
+ */
+static in_port_t leelen_message_parse_port (
+    const char *value, const char *what) {
+  char *end;
+  long port = strtol(value, &end, 10);
+  should (*end == '\0' && port >= 0 && port <= 65535) otherwise {
+    LOG(LOG_LEVEL_INFO, "Cannot parse %s port '%s'", what, value);
+    return 0;
+  }
+  return port;
+}
+
+
+/**
+ * @relates LeelenMessage
+ * @private
+ * @brief Append a media format view.
+ *
+ * @param formats Format array, can be @c NULL to discard.
+ * @param[in,out] n_format Number of formats in @p formats.
+ * @param value Format string.
+ */
+static void leelen_message_push_format (
+    char **formats, int *n_format, char *value) {
+  return_if_fail (formats != NULL);
+  should (*n_format < LEELEN_MESSAGE_MAX_FORMATS) otherwise {
+    LOG(LOG_LEVEL_INFO, "Too many media formats, '%s' dropped", value);
+    return;
+  }
+  formats[*n_format] = value;
+  (*n_format)++;
+  formats[*n_format] = NULL;
+}
+
+
 int LeelenMessage_init (
     struct LeelenMessage *self, char *msg,
-    bool no_audio_formats, bool no_video_formats) {
+    char **audio_formats, char **video_formats) {
   self->id = LEELEN_MESSAGE_ID(msg);
   self->code = le32toh(LEELEN_MESSAGE_CODE(msg));
   self->from.str[0] = '\0';
@@ -93,89 +151,95 @@ int LeelenMessage_init (
   self->audio_port = 0;
   self->video_port = 0;
 
-  self->audio_formats = NULL;
-  self->video_formats = NULL;
+  self->audio_formats = audio_formats;
+  self->video_formats = video_formats;
   int n_audio_format = 0;
   int n_video_format = 0;
+  if (audio_formats != NULL) {
+    audio_formats[0] = NULL;
+  }
+  if (video_formats != NULL) {
+    video_formats[0] = NULL;
+  }
 
-  for (char *saved, *line =
-        strtok_r(msg + LEELEN_MESSAGE_HEADER_SIZE, "\n", &saved); line != NULL;
-       line = strtok_r(NULL, "\n", &saved)) {
-    if (stricmp(line, "From=") == 0) {
-      line += strlen("From=");
-      char *type_sep = strchr(line, '?');
-      unsigned int number_len =
-        type_sep != NULL ? (unsigned int) (type_sep - line) : strlen(line);
-      // number
-      if unlikely (number_len >= sizeof(self->to)) {
-        LOG(LOG_LEVEL_INFO, "Source phone number '%.*s' too long",
-            number_len, line);
-        self->from.str[0] = '\0';
-      } else {
-        memcpy(self->from.str, line, number_len);
-        self->from.str[number_len] = '\0';
-      }
-      // type
-      if (type_sep == NULL || type_sep[1] == '\0') {
-        LOG(LOG_LEVEL_INFO,
-            "From description '%s' does not contain device type", line);
-      } else {
-        type_sep++;
-        char *end;
-        self->from_type = strtol(type_sep, &end, 10);
-        should (*end == '\0') otherwise {
-          LOG(LOG_LEVEL_INFO, "Cannot parse device type '%s'", type_sep);
-          self->from_type = LEELEN_DEVICE_UNKNOWN;
-        }
-      }
-    } else if (stricmp(line, "To=") == 0) {
-      line += strlen("To=");
-      unsigned int number_len = strlen(line);
-      if unlikely (number_len >= sizeof(self->from)) {
-        LOG(LOG_LEVEL_INFO, "Destination phone number '%.*s' too long",
-            number_len, line);
-      } else {
-        memcpy(self->to.str, line, number_len);
-        self->to.str[number_len] = '\0';
-      }
-    } else if (stricmp(line, "Audio=") == 0) {
-      if (!no_audio_formats) {
-        line += strlen("Audio=");
-        goto_if_fail (
-          strvpush(&self->audio_formats, &n_audio_format, line) >= 0) fail;
-      }
-    } else if (stricmp(line, "AudioPort=") == 0) {
-      line += strlen("AudioPort=");
-      char *end;
-      self->audio_port = strtol(line, &end, 10);
-      should (*end == '\0') otherwise {
-        LOG(LOG_LEVEL_INFO, "Cannot parse audio port '%s'", line);
-        self->audio_port = 0;
-      }
-    } else if (stricmp(line, "Video=") == 0) {
-      if (!no_video_formats) {
-        line += strlen("Video=");
-        goto_if_fail (
-          strvpush(&self->video_formats, &n_video_format, line) >= 0) fail;
-      }
-    } else if (stricmp(line, "VideoPort=") == 0) {
-      line += strlen("VideoPort=");
-      char *end;
-      self->video_port = strtol(line, &end, 10);
-      should (*end == '\0') otherwise {
-        LOG(LOG_LEVEL_INFO, "Cannot parse video port '%s'", line);
-        self->video_port = 0;
-      }
-    } else if (stricmp(line, "Resolution=") == 0) {
-      line += strlen("Resolution=");
-    } else {
+  // single pass, lines are terminated in place and values point into msg
+  for (char *line = msg + LEELEN_MESSAGE_HEADER_SIZE, *next;
+       *line != '\0'; line = next) {
+    char *eol = strchrnul(line, '\n');
+    next = *eol == '\0' ? eol : eol + 1;
+    *eol = '\0';
+    continue_if (line == eol);
+
+    char *value = memchr(line, '=', eol - line);
+    should (value != NULL) otherwise {
       LOG(LOG_LEVEL_INFO, "Unknown description '%s'", line);
+      continue;
     }
+    unsigned int key_len = value - line;
+    value++;
+    unsigned int value_len = eol - value;
+
+    switch (line[0]) {
+      case 'F':
+        break_if_fail (keyis(line, key_len, "From"));
+        {
+          char *type_sep = memchr(value, '?', value_len);
+          unsigned int number_len =
+            type_sep != NULL ? (unsigned int) (type_sep - value) : value_len;
+          // number
+          if unlikely (number_len >= sizeof(self->from)) {
+            LOG(LOG_LEVEL_INFO, "Source phone number '%.*s' too long",
+                number_len, value);
+          } else {
+            memcpy(self->from.str, value, number_len);
+            self->from.str[number_len] = '\0';
+          }
+          // type
+          if (type_sep == NULL || type_sep[1] == '\0') {
+            LOG(LOG_LEVEL_INFO,
+                "From description '%s' does not contain device type", value);
+          } else {
+            type_sep++;
+            char *end;
+            self->from_type = strtol(type_sep, &end, 10);
+            should (*end == '\0') otherwise {
+              LOG(LOG_LEVEL_INFO, "Cannot parse device type '%s'", type_sep);
+              self->from_type = LEELEN_DEVICE_UNKNOWN;
+            }
+          }
+        }
+        continue;
+      case 'T':
+        break_if_fail (keyis(line, key_len, "To"));
+        if unlikely (value_len >= sizeof(self->to)) {
+          LOG(LOG_LEVEL_INFO, "Destination phone number '%s' too long",
+              value);
+        } else {
+          memcpy(self->to.str, value, value_len + 1);
+        }
+        continue;
+      case 'A':
+        if (keyis(line, key_len, "Audio")) {
+          leelen_message_push_format(audio_formats, &n_audio_format, value);
+          continue;
+        }
+        break_if_fail (keyis(line, key_len, "AudioPort"));
+        self->audio_port = leelen_message_parse_port(value, "audio");
+        continue;
+      case 'V':
+        if (keyis(line, key_len, "Video")) {
+          leelen_message_push_format(video_formats, &n_video_format, value);
+          continue;
+        }
+        break_if_fail (keyis(line, key_len, "VideoPort"));
+        self->video_port = leelen_message_parse_port(value, "video");
+        continue;
+      case 'R':
+        break_if_fail (keyis(line, key_len, "Resolution"));
+        continue;
+    }
+    LOG(LOG_LEVEL_INFO, "Unknown description '%s'", line);
   }
 
   return 0;
-
-fail:
-  LeelenMessage_destroy(self);
-  return -1;
 }
@@ -14,6 +14,13 @@ struct LeelenConfig;
 #include "protocol.h"
 
 
+/**
+ * @ingroup leelen-voip
+ * @brief Maximum number of audio or video formats kept from a message.
+ */
+#define LEELEN_MESSAGE_MAX_FORMATS 16
+
+
 /**
  * @ingroup leelen-voip
  * @brief VoIP message.
@@ -35,12 +42,40 @@ struct LeelenMessage {
   in_port_t audio_port;
   /// video port, if any
   in_port_t video_port;
-  /// audio descriptor, if any
+  /// audio descriptor, @c NULL terminated, if any; when parsed, strings point
+  /// into the raw message
   char **audio_formats;
-  /// video descriptor, if any
+  /// video descriptor, @c NULL terminated, if any; when parsed, strings point
+  /// into the raw message
   char **video_formats;
 };
 
+__attribute__((nonnull, access(read_only, 1), access(write_only, 2, 3)))
+/**
+ * @memberof LeelenMessage
+ * @brief Render code, dialog ID, and the @c From= and @c To= lines.
+ *
+ * @param self Message.
+ * @param[out] buf Buffer.
+ * @param len Length of the buffer.
+ * @return The number of characters that would have been written if buffer had
+ *  been sufficiently large, not counting the terminating null character.
+ */
+unsigned int LeelenMessage_tostring_header (
+  const struct LeelenMessage *self, char *buf, unsigned int len);
+__attribute__((nonnull, access(read_only, 1), access(write_only, 2, 3)))
+/**
+ * @memberof LeelenMessage
+ * @brief Render media description, which follows the header.
+ *
+ * @param self Message.
+ * @param[out] buf Buffer.
+ * @param len Length of the buffer.
+ * @return The number of characters that would have been written if buffer had
+ *  been sufficiently large, not counting the terminating null character.
+ */
+unsigned int LeelenMessage_tostring_media (
+  const struct LeelenMessage *self, char *buf, unsigned int len);
 __attribute__((nonnull, access(read_only, 1), access(write_only, 2, 3)))
 /**
  * @memberof LeelenMessage
@@ -65,15 +100,6 @@ __attribute__((nonnull, access(write_only, 1), access(read_only, 2)))
 void LeelenMessage_copy_config (
   struct LeelenMessage *self, const struct LeelenConfig *config);
 
-__attribute__((nonnull))
-/**
- * @memberof LeelenMessage
- * @brief Destroy a VoIP message.
- *
- * @param self Message.
- */
-void LeelenMessage_destroy (struct LeelenMessage *self);
-
 __attribute__((nonnull, access(write_only, 1), access(read_only, 2)))
 /**
  * @memberof LeelenMessage
@@ -87,20 +113,28 @@ __attribute__((nonnull, access(write_only, 1), access(read_only, 2)))
 int LeelenMessage_init_reply (
   struct LeelenMessage *self, const struct LeelenMessage *request,
   int from_type);
-__attribute__((warn_unused_result, nonnull, access(write_only, 1)))
+__attribute__((nonnull(1, 2), access(write_only, 1), access(write_only, 3),
+               access(write_only, 4)))
 /**
  * @memberof LeelenMessage
  * @brief Parse and initialize a VoIP reply message.
  *
+ * Parsing does not allocate. Lines of @p msg are terminated in place, and
+ * formats are pointers into @p msg, so @p msg must outlive @p self.
+ *
  * @param[out] self Message.
- * @param[in,out] msg Raw message.
- * @param no_audio_formats If @c true, discard @p self->audio_formats.
- * @param no_video_formats If @c true, discard @p self->video_formats.
- * @return 0 on success, -1 if out of memory.
+ * @param[in,out] msg Raw message, null-terminated.
+ * @param[out] audio_formats Array of at least
+ *  @ref LEELEN_MESSAGE_MAX_FORMATS + 1 elements to hold audio formats. Can be
+ *  @c NULL to discard.
+ * @param[out] video_formats Array of at least
+ *  @ref LEELEN_MESSAGE_MAX_FORMATS + 1 elements to hold video formats. Can be
+ *  @c NULL to discard.
+ * @return 0.
  */
 int LeelenMessage_init (
   struct LeelenMessage *self, char *msg,
-  bool no_audio_formats, bool no_video_formats);
+  char **audio_formats, char **video_formats);
 
 
 #ifdef __cplusplus
@@ -17,6 +17,16 @@ extern "C" {
  * @brief VoIP timeout, in milliseconds
  */
 #define LEELEN_VOIP_TIMEOUT 500
+/**
+ * @ingroup leelen-voip
+ * @brief maximum number of retransmissions of an unacknowledged message
+ */
+#define LEELEN_VOIP_RETRANSMITS 3
+/**
+ * @ingroup leelen-voip
+ * @brief cap of retransmission interval, in multiples of VoIP timeout
+ */
+#define LEELEN_VOIP_RETRANSMIT_CAP 4
 /**
  * @ingroup leelen-voip
  * @brief default dialog duration, in seconds
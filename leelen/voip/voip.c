@@ -1,5 +1,6 @@
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -12,51 +13,318 @@ struct LeelenNumber;
 #include "voip.h"
 
 
-static void LeelenVoIP_shrink (struct LeelenVoIP *self) {
-  int n_dialog = 0;
-  for (int i = 0; i < self->n_dialog; i++) {
-    struct LeelenDialog *dialog = self->dialogs[i];
-    continue_if_fail (dialog != NULL);
-    if likely (dialog->id != 0) {
-      n_dialog = i;
-    } else {
-      LeelenDialog_destroy(dialog);
-      free(dialog);
-      self->dialogs[i] = NULL;
+/// initial number of slots of dialog index
+#define LEELEN_VOIP_INDEX_SIZE 64
+
+
+static inline unsigned int leelen_voip_hash (leelen_id_t id) {
+  return id * 2654435761u;
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Begin modifying the index.
+ *
+ * @param self Controller.
+ */
+static inline void LeelenVoIP_write_begin (struct LeelenVoIP *self) {
+  atomic_fetch_add_explicit(&self->seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief End modifying the index.
+ *
+ * @param self Controller.
+ */
+static inline void LeelenVoIP_write_end (struct LeelenVoIP *self) {
+  atomic_fetch_add_explicit(&self->seq, 1, memory_order_release);
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Find the slot of a dialog ID. Must hold LeelenVoIP::lock.
+ *
+ * @param index Index.
+ * @param id Dialog ID.
+ * @return Slot, or @c NULL if not found.
+ */
+static struct LeelenVoIPSlot *LeelenVoIPIndex_find (
+    struct LeelenVoIPIndex *index, leelen_id_t id) {
+  for (unsigned int i = leelen_voip_hash(id);; i++) {
+    struct LeelenVoIPSlot *slot = &index->slots[i & index->mask];
+    leelen_id_t key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+    return_if (key == 0) NULL;
+    return_if (key == id) slot;
+  }
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Insert a dialog into the index, without checking duplicates and
+ *  capacity.
+ *
+ * @param index Index.
+ * @param id Dialog ID.
+ * @param dialog Dialog.
+ */
+static void LeelenVoIPIndex_insert (
+    struct LeelenVoIPIndex *index, leelen_id_t id,
+    struct LeelenDialog *dialog) {
+  for (unsigned int i = leelen_voip_hash(id);; i++) {
+    struct LeelenVoIPSlot *slot = &index->slots[i & index->mask];
+    continue_if (atomic_load_explicit(
+      &slot->key, memory_order_relaxed) != 0);
+    atomic_store_explicit(&slot->dialog, dialog, memory_order_relaxed);
+    atomic_store_explicit(&slot->key, id, memory_order_relaxed);
+    return;
+  }
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Remove a dialog ID from the index, with backward shift deletion. Must
+ *  be in write section.
+ *
+ * @param index Index.
+ * @param id Dialog ID.
+ */
+static void LeelenVoIPIndex_remove (
+    struct LeelenVoIPIndex *index, leelen_id_t id) {
+  struct LeelenVoIPSlot *hole = LeelenVoIPIndex_find(index, id);
+  return_if_fail (hole != NULL);
+
+  unsigned int i = hole - index->slots;
+  for (unsigned int j = (i + 1) & index->mask;; j = (j + 1) & index->mask) {
+    struct LeelenVoIPSlot *slot = &index->slots[j];
+    leelen_id_t key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+    break_if (key == 0);
+    // move back if its home is not cyclically in (i, j]
+    unsigned int home = leelen_voip_hash(key) & index->mask;
+    continue_if (i <= j ? i < home && home <= j : i < home || home <= j);
+    atomic_store_explicit(
+      &index->slots[i].dialog,
+      atomic_load_explicit(&slot->dialog, memory_order_relaxed),
+      memory_order_relaxed);
+    atomic_store_explicit(&index->slots[i].key, key, memory_order_relaxed);
+    i = j;
+  }
+  atomic_store_explicit(&index->slots[i].key, 0, memory_order_relaxed);
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Make room for one more dialog in the index. Must hold
+ *  LeelenVoIP::lock.
+ *
+ * @param self Controller.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int LeelenVoIP_reserve (struct LeelenVoIP *self) {
+  struct LeelenVoIPIndex *index =
+    atomic_load_explicit(&self->index, memory_order_relaxed);
+  unsigned int size = index == NULL ? 0 : index->mask + 1;
+  // keep load factor <= 1/2
+  return_if (2 * (unsigned int) (self->n_dialog + 1) <= size) 0;
+
+  unsigned int new_size = size == 0 ? LEELEN_VOIP_INDEX_SIZE : 2 * size;
+  struct LeelenVoIPIndex *new_index = malloc(
+    sizeof(struct LeelenVoIPIndex) +
+    new_size * sizeof(struct LeelenVoIPSlot));
+  return_if_fail (new_index != NULL) -1;
+  new_index->retired = index;
+  new_index->mask = new_size - 1;
+  for (unsigned int i = 0; i < new_size; i++) {
+    atomic_init(&new_index->slots[i].key, 0);
+    atomic_init(&new_index->slots[i].dialog, NULL);
+  }
+  for (unsigned int i = 0; i < size; i++) {
+    leelen_id_t key =
+      atomic_load_explicit(&index->slots[i].key, memory_order_relaxed);
+    continue_if (key == 0);
+    LeelenVoIPIndex_insert(new_index, key, atomic_load_explicit(
+      &index->slots[i].dialog, memory_order_relaxed));
+  }
+
+  // the old index is kept, since readers may still be walking it
+  atomic_store_explicit(&self->index, new_index, memory_order_release);
+  return 0;
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Reclaim records of dialogs destroyed with LeelenDialog_destroy().
+ *  Must hold LeelenVoIP::lock.
+ *
+ * @param self Controller.
+ */
+static void LeelenVoIP_reclaim (struct LeelenVoIP *self) {
+  struct LeelenVoIPIndex *index =
+    atomic_load_explicit(&self->index, memory_order_relaxed);
+  bool writing = false;
+
+  for (struct LeelenVoIPChunk *chunk = self->chunks; chunk != NULL;
+       chunk = chunk->next) {
+    for (int i = 0; i < LEELEN_VOIP_CHUNK_SIZE; i++) {
+      continue_if (chunk->keys[i] == 0);
+      continue_if (chunk->dialogs[i].id == chunk->keys[i]);
+      if (!writing) {
+        LeelenVoIP_write_begin(self);
+        writing = true;
+      }
+      LeelenVoIPIndex_remove(index, chunk->keys[i]);
+      self->n_dialog--;
+      chunk->keys[i] = 0;
+      // frees has capacity for all records
+      self->frees[self->n_free] = &chunk->dialogs[i];
+      self->n_free++;
     }
   }
-  n_dialog++;
 
-  if unlikely (self->n_dialog != n_dialog) {
-    struct LeelenDialog **dialogs = realloc(
-      self->dialogs, n_dialog * sizeof(struct LeelenDialog *));
-    if likely (dialogs != NULL || n_dialog == 0) {
-      self->n_dialog = n_dialog;
-      self->dialogs = dialogs;
+  if (writing) {
+    LeelenVoIP_write_end(self);
+  }
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Take a free record from the slab. Must hold LeelenVoIP::lock.
+ *
+ * @param self Controller.
+ * @return Record, or @c NULL if out of memory.
+ */
+static struct LeelenDialog *LeelenVoIP_alloc (struct LeelenVoIP *self) {
+  if (self->n_free == 0) {
+    LeelenVoIP_reclaim(self);
+  }
+  if (self->n_free == 0) {
+    struct LeelenVoIPChunk *chunk = malloc(sizeof(struct LeelenVoIPChunk));
+    return_if_fail (chunk != NULL) NULL;
+    struct LeelenDialog **frees = realloc(
+      self->frees,
+      (self->frees_size + LEELEN_VOIP_CHUNK_SIZE) * sizeof(self->frees[0]));
+    should (frees != NULL) otherwise {
+      free(chunk);
+      return NULL;
+    }
+    self->frees = frees;
+    self->frees_size += LEELEN_VOIP_CHUNK_SIZE;
+
+    chunk->next = self->chunks;
+    self->chunks = chunk;
+    for (int i = LEELEN_VOIP_CHUNK_SIZE - 1; i >= 0; i--) {
+      chunk->keys[i] = 0;
+      chunk->dialogs[i].id = 0;
+      self->frees[self->n_free] = &chunk->dialogs[i];
+      self->n_free++;
     }
   }
+
+  self->n_free--;
+  return self->frees[self->n_free];
 }
 
 
-int LeelenVoIP_receive (
-    struct LeelenVoIP *self, char *msg, int sockfd,
-    char ***audio_formats, char ***video_formats, const struct sockaddr *src) {
-  struct LeelenDialog *dialog;
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Get the slab key of a record.
+ *
+ * @param self Controller.
+ * @param dialog Record.
+ * @return Pointer to key, or @c NULL if @p dialog is not in the slab.
+ */
+static leelen_id_t *LeelenVoIP_key (
+    struct LeelenVoIP *self, const struct LeelenDialog *dialog) {
+  for (struct LeelenVoIPChunk *chunk = self->chunks; chunk != NULL;
+       chunk = chunk->next) {
+    continue_if_not (
+      dialog >= chunk->dialogs &&
+      dialog < chunk->dialogs + LEELEN_VOIP_CHUNK_SIZE);
+    return &chunk->keys[dialog - chunk->dialogs];
+  }
+  return NULL;
+}
+
+
+/**
+ * @memberof LeelenVoIP
+ * @private
+ * @brief Set the slab key of a record.
+ *
+ * @param self Controller.
+ * @param dialog Record.
+ * @param key Dialog ID the record is indexed with, or 0 if free.
+ */
+static void LeelenVoIP_set_key (
+    struct LeelenVoIP *self, const struct LeelenDialog *dialog,
+    leelen_id_t key) {
+  leelen_id_t *p = LeelenVoIP_key(self, dialog);
+  if likely (p != NULL) {
+    *p = key;
+  }
+}
+
+
+struct LeelenDialog *LeelenVoIP_find (struct LeelenVoIP *self, leelen_id_t id) {
+  return_if_fail (id != 0) NULL;
 
-  pthread_rwlock_rdlock(&self->lock);
-  for (int i = 0; i < self->n_dialog; i++) {
-    if unlikely (self->dialogs[i]->id == LEELEN_MESSAGE_ID(msg)) {
-      dialog = self->dialogs[i];
-      pthread_rwlock_unlock(&self->lock);
-      goto end;
+  while (true) {
+    unsigned int seq = atomic_load_explicit(&self->seq, memory_order_acquire);
+    continue_if (unlikely (seq & 1));
+
+    struct LeelenDialog *dialog = NULL;
+    struct LeelenVoIPIndex *index =
+      atomic_load_explicit(&self->index, memory_order_acquire);
+    if likely (index != NULL) {
+      // bounded, since the index may be torn under concurrent writes
+      for (unsigned int i = leelen_voip_hash(id), n = 0; n <= index->mask;
+           i++, n++) {
+        struct LeelenVoIPSlot *slot = &index->slots[i & index->mask];
+        leelen_id_t key =
+          atomic_load_explicit(&slot->key, memory_order_relaxed);
+        break_if (key == 0);
+        if (key == id) {
+          dialog = atomic_load_explicit(&slot->dialog, memory_order_relaxed);
+          break;
+        }
+      }
     }
+
+    atomic_thread_fence(memory_order_acquire);
+    return_if (
+      atomic_load_explicit(&self->seq, memory_order_relaxed) == seq) dialog;
   }
-  pthread_rwlock_unlock(&self->lock);
+}
 
-  dialog = LeelenVoIP_connect(self, src, NULL, LEELEN_MESSAGE_ID(msg));
-  return_if_fail (dialog != NULL) -1;
 
-end:
+int LeelenVoIP_receive (
+    struct LeelenVoIP *self, char *msg, int sockfd,
+    char **audio_formats, char **video_formats, const struct sockaddr *src) {
+  leelen_id_t id = LEELEN_MESSAGE_ID(msg);
+  struct LeelenDialog *dialog = LeelenVoIP_find(self, id);
+  if unlikely (dialog == NULL || dialog->id != id) {
+    dialog = LeelenVoIP_connect(self, src, NULL, id);
+    return_if_fail (dialog != NULL) -1;
+  }
+
   return LeelenDialog_receive(
     dialog, msg, sockfd, audio_formats, video_formats);
 }
@@ -65,46 +333,98 @@ end:
 struct LeelenDialog *LeelenVoIP_connect (
     struct LeelenVoIP *self, const struct sockaddr *dst,
     const struct LeelenNumber *to, leelen_id_t id) {
-  pthread_rwlock_wrlock(&self->lock);
+  pthread_mutex_lock(&self->lock);
 
-  LeelenVoIP_shrink(self);
+  struct LeelenVoIPIndex *index;
+  struct LeelenVoIPSlot *slot;
+  struct LeelenDialog *dialog;
 
-  int i;
-  for (i = 0; i < self->n_dialog; i++) {
-    goto_if_fail (self->dialogs[i] != NULL) init;
-  }
-  {
-    struct LeelenDialog **dialogs = realloc(
-      self->dialogs, (self->n_dialog + 1) * sizeof(struct LeelenDialog *));
-    should (dialogs != NULL) otherwise {
-      pthread_rwlock_unlock(&self->lock);
-      return NULL;
+  // someone else may have created it
+  index = atomic_load_explicit(&self->index, memory_order_relaxed);
+  if (id != 0 && index != NULL) {
+    slot = LeelenVoIPIndex_find(index, id);
+    if (slot != NULL) {
+      dialog = atomic_load_explicit(&slot->dialog, memory_order_relaxed);
+      goto_if (dialog->id == id) end;
     }
-    self->n_dialog++;
-    self->dialogs = dialogs;
   }
 
-init:
-  self->dialogs[i] = malloc(sizeof(struct LeelenDialog));
-  struct LeelenDialog *dialog = self->dialogs[i];
-  should (dialog != NULL) otherwise {
-    pthread_rwlock_unlock(&self->lock);
-    return NULL;
+  dialog = LeelenVoIP_alloc(self);
+  goto_if_fail (dialog != NULL) end;
+  should (LeelenVoIP_reserve(self) == 0) otherwise {
+    self->frees[self->n_free] = dialog;
+    self->n_free++;
+    dialog = NULL;
+    goto end;
+  }
+  index = atomic_load_explicit(&self->index, memory_order_relaxed);
+
+  // pick an unused ID
+  do {
+    LeelenDialog_init(dialog, self->config, dst, to, id);
+    slot = LeelenVoIPIndex_find(index, dialog->id);
+  } while (id == 0 && slot != NULL);
+
+  LeelenVoIP_write_begin(self);
+  if (slot != NULL) {
+    // stale entry of a dialog destroyed directly
+    struct LeelenDialog *stale =
+      atomic_load_explicit(&slot->dialog, memory_order_relaxed);
+    LeelenVoIP_set_key(self, stale, 0);
+    self->frees[self->n_free] = stale;
+    self->n_free++;
+    LeelenVoIPIndex_remove(index, dialog->id);
+    self->n_dialog--;
   }
-  LeelenDialog_init(dialog, self->config, dst, to, id);
+  LeelenVoIPIndex_insert(index, dialog->id, dialog);
+  LeelenVoIP_write_end(self);
+  self->n_dialog++;
+  LeelenVoIP_set_key(self, dialog, dialog->id);
 
-  pthread_rwlock_unlock(&self->lock);
+end:
+  pthread_mutex_unlock(&self->lock);
   return dialog;
 }
 
 
+void LeelenVoIP_close (struct LeelenVoIP *self, struct LeelenDialog *dialog) {
+  pthread_mutex_lock(&self->lock);
+
+  leelen_id_t *key = LeelenVoIP_key(self, dialog);
+  if likely (key != NULL && *key != 0) {
+    LeelenVoIP_write_begin(self);
+    LeelenVoIPIndex_remove(
+      atomic_load_explicit(&self->index, memory_order_relaxed), *key);
+    LeelenVoIP_write_end(self);
+    self->n_dialog--;
+    *key = 0;
+    LeelenDialog_destroy(dialog);
+    self->frees[self->n_free] = dialog;
+    self->n_free++;
+  }
+
+  pthread_mutex_unlock(&self->lock);
+}
+
+
 void LeelenVoIP_destroy (struct LeelenVoIP *self) {
-  pthread_rwlock_destroy(&self->lock);
-  return_if_fail (self->dialogs != NULL);
-  for (int i = 0; i < self->n_dialog; i++) {
-    continue_if (self->dialogs[i] == NULL);
-    LeelenDialog_destroy(self->dialogs[i]);
-    free(self->dialogs[i]);
-  }
-  free(self->dialogs);
+  pthread_mutex_destroy(&self->lock);
+
+  for (struct LeelenVoIPChunk *chunk = self->chunks, *next; chunk != NULL;
+       chunk = next) {
+    next = chunk->next;
+    for (int i = 0; i < LEELEN_VOIP_CHUNK_SIZE; i++) {
+      continue_if (chunk->keys[i] == 0);
+      LeelenDialog_destroy(&chunk->dialogs[i]);
+    }
+    free(chunk);
+  }
+  free(self->frees);
+
+  for (struct LeelenVoIPIndex *index =
+         atomic_load_explicit(&self->index, memory_order_relaxed), *retired;
+       index != NULL; index = retired) {
+    retired = index->retired;
+    free(index);
+  }
 }
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -13,8 +14,7 @@ extern "C" {
 struct LeelenConfig;
 // #include "../number.h"
 struct LeelenNumber;
-// #include "dialog.h"
-struct LeelenDialog;
+#include "dialog.h"
 #include "protocol.h"
 
 /**
@@ -24,21 +24,93 @@ struct LeelenDialog;
  */
 
 
+/// number of dialogs in a slab chunk
+#define LEELEN_VOIP_CHUNK_SIZE 32
+
+
+/**
+ * @ingroup leelen-voip
+ * @brief Slot of dialog index.
+ */
+struct LeelenVoIPSlot {
+  /// dialog ID, or 0 if empty
+  _Atomic leelen_id_t key;
+  /// dialog
+  struct LeelenDialog * _Atomic dialog;
+};
+
+
+/**
+ * @ingroup leelen-voip
+ * @brief Open-addressing index of dialogs by ID.
+ */
+struct LeelenVoIPIndex {
+  /// previous, smaller index, kept for lock-free readers until destroyed
+  struct LeelenVoIPIndex *retired;
+  /// number of slots minus 1
+  unsigned int mask;
+  /// slots
+  struct LeelenVoIPSlot slots[];
+};
+
+
+/**
+ * @ingroup leelen-voip
+ * @brief Chunk of dialog records. Records never move, so dialog pointers stay
+ *  valid.
+ */
+struct LeelenVoIPChunk {
+  /// next chunk
+  struct LeelenVoIPChunk *next;
+  /// ID each record is indexed with, or 0 if free
+  leelen_id_t keys[LEELEN_VOIP_CHUNK_SIZE];
+  /// dialog records
+  struct LeelenDialog dialogs[LEELEN_VOIP_CHUNK_SIZE];
+};
+
+
 /**
  * @ingroup leelen-voip
  * @brief LEELEN VoIP controller.
+ *
+ * Dialogs live in a slab of fixed-size records, indexed by dialog ID. Lookups
+ * are lock-free under a sequence lock; creation and removal are serialized by
+ * LeelenVoIP::lock.
  */
 struct LeelenVoIP {
-  /// VoIP dialogs
-  struct LeelenDialog **dialogs;
-  /// length of LeelenVoIP::dialogs
+  /// number of dialogs in the index
   int n_dialog;
-  /// lock for LeelenVoIP::dialogs
-  pthread_rwlock_t lock;
   /// device config
   const struct LeelenConfig *config;
+
+  /** @privatesection */
+  /// lock for writers
+  pthread_mutex_t lock;
+  /// sequence number, odd while the index is being modified
+  atomic_uint seq;
+  /// dialog index
+  struct LeelenVoIPIndex * _Atomic index;
+  /// slab chunks
+  struct LeelenVoIPChunk *chunks;
+  /// free records
+  struct LeelenDialog **frees;
+  /// length of LeelenVoIP::frees
+  int n_free;
+  /// capacity of LeelenVoIP::frees
+  int frees_size;
 };
 
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof LeelenVoIP
+ * @brief Find a dialog by ID, without locking.
+ *
+ * @param self Controller.
+ * @param id Dialog ID.
+ * @return Dialog, or @c NULL if not found.
+ */
+struct LeelenDialog *LeelenVoIP_find (struct LeelenVoIP *self, leelen_id_t id);
+
 __attribute__((nonnull(1, 2), access(write_only, 4), access(write_only, 5),
                access(read_only, 6)))
 /**
@@ -48,15 +120,17 @@ __attribute__((nonnull(1, 2), access(write_only, 4), access(write_only, 5),
  * @param self Controller.
  * @param msg VoIP message.
  * @param sockfd Socket to reply with.
- * @param[out] audio_formats Parsed audio description.
- * @param[out] video_formats Parsed video description.
+ * @param[out] audio_formats Parsed audio description, see
+ *  LeelenDialog_receive().
+ * @param[out] video_formats Parsed video description, see
+ *  LeelenDialog_receive().
  * @param src Source address. Used to create new dialog when no dialog matches.
  *  Can be @c NULL.
  * @return 0 on success, -1 if out of memory.
  */
 int LeelenVoIP_receive (
   struct LeelenVoIP *self, char *msg, int sockfd,
-  char ***audio_formats, char ***video_formats, const struct sockaddr *src);
+  char **audio_formats, char **video_formats, const struct sockaddr *src);
 __attribute__((nonnull(1, 2), access(read_only, 2), access(read_only, 3)))
 /**
  * @memberof LeelenVoIP
@@ -69,12 +143,25 @@ __attribute__((nonnull(1, 2), access(read_only, 2), access(read_only, 3)))
  * @param dst Peer address.
  * @param to Peer phone number. If @c NULL, the phone number is waiting to be
  *  filled by LeelenDialog_receive().
- * @param id Dialog ID. If 0, a random ID will be generated.
+ * @param id Dialog ID. If 0, a random ID will be generated. If a dialog with
+ *  the same ID exists, it is returned.
  * @return New dialog object, or @c NULL if out of memory.
  */
 struct LeelenDialog *LeelenVoIP_connect (
   struct LeelenVoIP *self, const struct sockaddr *dst,
   const struct LeelenNumber *to, leelen_id_t id);
+__attribute__((nonnull))
+/**
+ * @memberof LeelenVoIP
+ * @brief Destroy a dialog and return its record to the slab.
+ *
+ * Dialogs destroyed with LeelenDialog_destroy() directly are reclaimed later,
+ * when the slab runs out of records.
+ *
+ * @param self Controller.
+ * @param dialog Dialog.
+ */
+void LeelenVoIP_close (struct LeelenVoIP *self, struct LeelenDialog *dialog);
 
 __attribute__((nonnull))
 /**
@@ -94,16 +181,21 @@ __attribute__((nonnull, access(write_only, 1)))
  *
  * @param[out] self Controller.
  * @param config Device config.
- * @return 0 on success, -1 if `pthread_rwlock_init()` error.
+ * @return 0 on success, -1 if `pthread_mutex_init()` error.
  */
 static inline int LeelenVoIP_init (
     struct LeelenVoIP *self, const struct LeelenConfig *config) {
-  if (pthread_rwlock_init(&self->lock, NULL) != 0) {
+  if (pthread_mutex_init(&self->lock, NULL) != 0) {
     return -1;
   }
-  self->dialogs = NULL;
   self->n_dialog = 0;
   self->config = config;
+  atomic_init(&self->seq, 0);
+  atomic_init(&self->index, NULL);
+  self->chunks = NULL;
+  self->frees = NULL;
+  self->n_free = 0;
+  self->frees_size = 0;
   return 0;
 }
 
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
 #include <regex.h>
@@ -19,18 +20,47 @@
 
 #include "utils/macro.h"
 #include "utils/arg.h"
+#include "utils/control.h"
 #include "utils/log.h"
+#include "utils/logasync.h"
+#include "utils/metrics.h"
+#include "utils/pcaptap.h"
+#include "utils/rtp.h"
 #include "utils/single.h"
+#include "utils/trace.h"
 #include "leelen/config.h"
 #include "leelen/family.h"
 #include "leelen/number.h"
 #include "leelen/discovery/discovery.h"
 #include "leelen/discovery/protocol.h"
+#include "sipleelen/control.h"
+#include "sipleelen/shmstats.h"
+#include "sipleelen/cdr.h"
 #include "sipleelen/sipleelen.h"
 #include "leelen2sip.h"
 
 
 struct SIPLeelen *sipleelen = NULL;
+/// log stream written by background thread, if --async-log
+static struct LoggerAsync log_async;
+/// whether LEELEN2SIP::log_async is initialized
+static bool log_async_enabled = false;
+/// packet capture tap, if --capture
+static struct PcapTap capture;
+/// scrape endpoint, if --metrics
+static struct MetricsServer metrics_server;
+/// control endpoint, if --control-socket
+static struct ControlServer control_server;
+/// statistics segment, if --stats-shm
+static struct ShmStatsWriter stats_writer;
+/// writer of call detail records, if --cdr
+static struct CdrWriter cdr_writer;
+
+
+static void reload_leelen2sip (int sig) {
+  (void) sig;
+  SIPLeelen_reload(sipleelen);
+}
 
 
 static void shutdown_leelen2sip (int sig) {
@@ -119,13 +149,26 @@ static int start_leelen2sip (
   }
 
   // set up LEELEN discovery
-  if likely (device->report_addr[0] == '\0') {
-    LeelenAdvertiser_sync((struct LeelenAdvertiser *) device);
+  res = device->report_addr[0] == '\0' ?
+    LeelenAdvertiser_sync((struct LeelenAdvertiser *) device) :
+    LeelenAdvertiser_compile((struct LeelenAdvertiser *) device);
+  should (res == 0) otherwise {
+    fprintf(stderr, "error: failed to set up LEELEN identities\n");
+    return -1;
   }
   LOG(LOG_LEVEL_INFO, "Phone number: %s", config->number.str);
   LOG(LOG_LEVEL_INFO, "Device desc: " LEELEN_DISCOVERY_FORMAT,
       device->report_addr[0] == '\0' ? "<unspecified>" : device->report_addr,
       config->type, config->desc);
+  if (device->n_identity > 0) {
+    LOG(LOG_LEVEL_INFO, "Additional identities: %d", device->n_identity);
+  }
+
+  // set up routing
+  should (SIPLeelen_load_dial_plan(sip) == 0) otherwise {
+    fprintf(stderr, "error: failed to load dial plan\n");
+    return -1;
+  }
 
   // daemonize
   if (daemonize) {
@@ -135,11 +178,33 @@ static int start_leelen2sip (
     }
   }
 
+  // logging thread must be started after daemon()
+  if (log_async_enabled) {
+    should (LoggerAsync_start(&log_async) == 0) otherwise {
+      perror("error: failed to start logging thread");
+      return -1;
+    }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-write-to-const"
+    // fatal levels stay synchronous
+    for (int i = LOG_LEVEL_ERROR; i < LOG_LEVEL_COUNT; i++) {
+      LOGGER_SET_ATTRIBUTE(formatted[i].stream, &log_async.stream);
+    }
+#pragma GCC diagnostic pop
+  }
+  if (sip->cdr != NULL) {
+    should (CdrWriter_start(sip->cdr) == 0) otherwise {
+      perror("error: failed to start CDR thread");
+      return -1;
+    }
+  }
+
   // main loop
   srand(time(NULL));
   LOG(LOG_LEVEL_NOTICE, "Start " LEELEN2SIP_NAME);
   sipleelen = sip;
   signal(SIGINT, shutdown_leelen2sip);
+  signal(SIGHUP, reload_leelen2sip);
   should (SIPLeelen_run(sip) == 0) otherwise {
     LOG(LOG_LEVEL_ERROR, "Cannot start SIP thread");
     return -1;
@@ -153,6 +218,15 @@ static int start_leelen2sip (
 }
 
 
+#ifdef USE_TRACE
+#define LEELEN2SIP_TRACE_USAGE \
+"  --trace <file>      write trace spans as Chrome trace JSON into <file> on\n" \
+"                      exit\n" \
+"  --trace-dir <dir>   let control command 'trace <name>' write into <dir>\n"
+#else
+#define LEELEN2SIP_TRACE_USAGE ""
+#endif
+
 static void usage (const char progname[]) {
   fprintf(stdout, "Usage: %s [OPTIONS...] <number> [<interface>]\n",
           progname);
@@ -177,6 +251,36 @@ static void usage (const char progname[]) {
 "                      WARNING: this option does not check for IP validness\n"
 "  --ua <ua>           SIP user agent (default: " LEELEN2SIP_USER_AGENT ")\n"
 "  --reply-to <regex>  reply to LEELEN discovery when phone number match <regex>\n"
+"  --identity <number>[~<number>][,<type>[,<desc>[,<address>]]]\n"
+"                      also reply to LEELEN discovery for <number> (or range of\n"
+"                      numbers) as another device; empty fields take this\n"
+"                      device's values; can be repeated\n"
+"  --dial-plan <file>  route calls by rules in <file>, one\n"
+"                      <pattern>=<target> per line; reloaded on SIGHUP\n"
+"  --open-gate <digit> open the gate when the SIP caller presses DTMF <digit>\n"
+"  --async-log         write logs from a background thread; lines are dropped\n"
+"                      rather than blocking when it falls behind\n"
+"  --capture <file>    capture traffic into pcapng <file>\n"
+"  --capture-classes <class>[,<class>...]\n"
+"                      traffic to capture: sip, leelen, media (default: all)\n"
+"  --capture-filter <id>\n"
+"                      capture only the call of LEELEN dialog ID or SIP\n"
+"                      Call-ID <id>\n"
+"  --capture-size <MiB>\n"
+"                      size of each capture file (default: 16)\n"
+"  --capture-files <n> number of capture files to rotate, named\n"
+"                      <file>.<index> if more than 1 (default: 2)\n"
+"  --metrics <port>|<path>\n"
+"                      serve Prometheus metrics on loopback TCP <port>, or on\n"
+"                      Unix socket <path> if containing '/'\n"
+"  --control-socket <path>\n"
+"                      answer commands in JSON lines on Unix socket <path>\n"
+"  --stats-shm <name>  publish live statistics in POSIX shared memory <name>,\n"
+"                      like /leelen2sip, for leelen2sip-top\n"
+"  --cdr <file>        append call detail records to CSV <file>\n"
+"  --relay-timestamps  measure latency of relayed media packets from kernel\n"
+"                      receive timestamps\n"
+LEELEN2SIP_TRACE_USAGE
 "\n");
   fprintf(stdout,
 "LEELEN SIP options:\n"
@@ -196,6 +300,34 @@ static void usage (const char progname[]) {
 }
 
 
+/**
+ * @ingroup leelen2sip
+ * @brief Parse traffic classes of --capture-classes.
+ *
+ * @param s Comma-separated list of @c sip, @c leelen and @c media.
+ * @return Bitmask of ::PcapTapClass, or 0 on error.
+ */
+static unsigned char argtocaptureclasses (const char s[]) {
+  static const char * const names[] = {"sip", "leelen", "media"};
+  unsigned char classes = 0;
+  while (true) {
+    size_t len = strcspn(s, ",");
+    int i = 0;
+    for (; i < (int) arraysize(names); i++) {
+      break_if (strlen(names[i]) == len && strncmp(names[i], s, len) == 0);
+    }
+    should (i < (int) arraysize(names)) otherwise {
+      fprintf(stderr, "error: unknown traffic class '%.*s'\n", (int) len, s);
+      return 0;
+    }
+    classes |= 1 << i;
+    break_if (s[len] == '\0');
+    s += len + 1;
+  }
+  return classes;
+}
+
+
 /**
  * @ingroup leelen2sip
  * @brief Main entrcpoint.
@@ -226,12 +358,42 @@ int main (int argc, char *argv[]) {
   union sockaddr_in46 *sip_addr = &sip.addr;
   sip_addr->sa_family = AF_UNSPEC;
   struct LeelenDiscovery *device = &sip.leelen;
+  char *capture_path = NULL;
+  unsigned char capture_classes = PCAP_TAP_ALL;
+  const char *capture_filter = NULL;
+  int capture_size = 16;
+  int capture_files = 2;
+  const char *metrics_spec = NULL;
+  const char *control_path = NULL;
+  const char *stats_name = NULL;
+  const char *cdr_path = NULL;
+#ifdef USE_TRACE
+  FILE *trace_file = NULL;
+#endif
 
   // parse options
   static const struct option long_options[] = {
     {"report-addr", required_argument, 0, 256},
     {"ua", required_argument, 0, 257},
     {"reply-to", required_argument, 0, 258},
+    {"identity", required_argument, 0, 259},
+    {"dial-plan", required_argument, 0, 260},
+    {"open-gate", required_argument, 0, 261},
+    {"async-log", no_argument, 0, 262},
+    {"capture", required_argument, 0, 263},
+    {"capture-classes", required_argument, 0, 264},
+    {"capture-filter", required_argument, 0, 265},
+    {"capture-size", required_argument, 0, 266},
+    {"capture-files", required_argument, 0, 267},
+    {"metrics", required_argument, 0, 268},
+    {"control-socket", required_argument, 0, 269},
+    {"stats-shm", required_argument, 0, 271},
+    {"cdr", required_argument, 0, 272},
+    {"relay-timestamps", no_argument, 0, 273},
+#ifdef USE_TRACE
+    {"trace", required_argument, 0, 270},
+    {"trace-dir", required_argument, 0, 274},
+#endif
 
     {"desc", required_argument, 0, 512},
     {"type", required_argument, 0, 513},
@@ -345,6 +507,123 @@ int main (int argc, char *argv[]) {
         device->number_regex_set = true;
         break;
       }
+      case 259:
+        switch (LeelenAdvertiser_add_identity(
+            (struct LeelenAdvertiser *) device, optarg,
+            config.number.str[0] == '\0' ? NULL : &config.number)) {
+          case 0:
+            break;
+          case 1:
+            fprintf(stderr, "error: invalid identity '%s'\n", optarg);
+            goto fail;
+          default:
+            perror("error: failed to add identity");
+            goto fail;
+        }
+        break;
+      case 260:
+        should (sip.dial_plan == NULL) otherwise {
+          fprintf(stderr, "error: duplicated --%s option\n",
+                  long_options[longindex].name);
+          goto fail;
+        }
+        // resolved before daemon() changes directory, and must exist
+        sip.dial_plan = realpath(optarg, NULL);
+        should (sip.dial_plan != NULL) otherwise {
+          perror(optarg);
+          goto fail;
+        }
+        break;
+      case 261: {
+        const char *digit = strchr(RTP_DTMF_DIGITS, toupper(optarg[0]));
+        should (optarg[0] != '\0' && optarg[1] == '\0' &&
+                digit != NULL) otherwise {
+          fprintf(stderr, "error: invalid DTMF digit '%s'\n", optarg);
+          goto fail;
+        }
+        sip.open_gate_event = digit - RTP_DTMF_DIGITS;
+        break;
+      }
+      case 262:
+        break_if (log_async_enabled);
+        should (LoggerAsync_init(
+            &log_async, STDOUT_FILENO, 1024) == 0) otherwise {
+          perror("error: failed to initialize logging");
+          goto fail;
+        }
+        log_async_enabled = true;
+        break;
+      case 263:
+        should (capture_path == NULL) otherwise {
+          fprintf(stderr, "error: duplicated --%s option\n",
+                  long_options[longindex].name);
+          goto fail;
+        }
+        capture_path = argtoabspath(optarg);
+        should (capture_path != NULL) otherwise {
+          perror(optarg);
+          goto fail;
+        }
+        break;
+      case 264:
+        capture_classes = argtocaptureclasses(optarg);
+        goto_if_fail (capture_classes != 0) fail;
+        break;
+      case 265:
+        capture_filter = optarg;
+        break;
+      case 266:
+        goto_if_fail (argtoi(
+          optarg, &capture_size, 1, 1024, long_options[longindex].name, NULL
+        ) == 0) fail;
+        break;
+      case 267:
+        goto_if_fail (argtoi(
+          optarg, &capture_files, 1, 1000, long_options[longindex].name, NULL
+        ) == 0) fail;
+        break;
+      case 268:
+        metrics_spec = optarg;
+        break;
+      case 269:
+        control_path = optarg;
+        break;
+      case 271:
+        stats_name = optarg;
+        break;
+      case 272:
+        cdr_path = optarg;
+        break;
+      case 273:
+        sip.relay_timestamps = true;
+        break;
+#ifdef USE_TRACE
+      case 270:
+        should (trace_file == NULL) otherwise {
+          fprintf(stderr, "error: duplicated --%s option\n",
+                  long_options[longindex].name);
+          goto fail;
+        }
+        trace_file = fopen(optarg, "w");
+        should (trace_file != NULL) otherwise {
+          perror(optarg);
+          goto fail;
+        }
+        break;
+      case 274:
+        should (sip.trace_dir == NULL) otherwise {
+          fprintf(stderr, "error: duplicated --%s option\n",
+                  long_options[longindex].name);
+          goto fail;
+        }
+        // resolved before daemon() changes directory, and must exist
+        sip.trace_dir = realpath(optarg, NULL);
+        should (sip.trace_dir != NULL) otherwise {
+          perror(optarg);
+          goto fail;
+        }
+        break;
+#endif
       case 512:
         should (config.desc == NULL) otherwise {
           fprintf(stderr, "error: duplicated --%s option\n",
@@ -442,6 +721,72 @@ int main (int argc, char *argv[]) {
   if (config.addr.sa_family == AF_LOCAL) {
     config.addr.sa_family = use_v6 ? AF_INET6 : AF_INET;
   }
+  if (capture_path != NULL) {
+    should (PcapTap_init(
+        &capture, capture_path, capture_size << 20, capture_files
+    ) == 0) otherwise {
+      perror("error: failed to open capture file");
+      goto fail;
+    }
+    sip.tap = &capture;
+    capture.classes = capture_classes;
+    if (capture_filter != NULL) {
+      // either LEELEN dialog ID or SIP Call-ID
+      if (strlen(capture_filter) == 8 &&
+          strspn(capture_filter, "0123456789abcdefABCDEF") == 8) {
+        capture.filter_id = strtoul(capture_filter, NULL, 16);
+      }
+      capture.filter_call_id = strdup(capture_filter);
+      should (capture.filter_call_id != NULL) otherwise {
+        perror("strdup");
+        goto fail;
+      }
+    }
+  }
+  if (metrics_spec != NULL) {
+    switch (MetricsServer_init(
+        &metrics_server, metrics_spec, SIPLeelen_collect_metrics, &sip)) {
+      case 0:
+        break;
+      case 1:
+        fprintf(stderr, "error: invalid metrics endpoint '%s'\n",
+                metrics_spec);
+        goto fail;
+      default:
+        perror("error: failed to open metrics endpoint");
+        goto fail;
+    }
+    sip.metrics_server = &metrics_server;
+  }
+  if (control_path != NULL) {
+    switch (ControlServer_init(
+        &control_server, control_path, SIPLeelen_control, &sip)) {
+      case 0:
+        break;
+      case 1:
+        fprintf(stderr, "error: control socket path '%s' too long\n",
+                control_path);
+        goto fail;
+      default:
+        perror("error: failed to open control socket");
+        goto fail;
+    }
+    sip.control_server = &control_server;
+  }
+  if (stats_name != NULL) {
+    should (ShmStatsWriter_init(&stats_writer, stats_name) == 0) otherwise {
+      perror("error: failed to create statistics segment");
+      goto fail;
+    }
+    sip.stats_writer = &stats_writer;
+  }
+  if (cdr_path != NULL) {
+    should (CdrWriter_init(&cdr_writer, cdr_path) == 0) otherwise {
+      perror(cdr_path);
+      goto fail;
+    }
+    sip.cdr = &cdr_writer;
+  }
 
   int ret = start_leelen2sip(&sip, daemonize) == 0 ?
     EXIT_SUCCESS : EXIT_FAILURE;
@@ -456,5 +801,39 @@ fail:
   }
   SIPLeelen_destroy(&sip);
   LeelenConfig_destroy(&config);
+  // after sessions are destroyed
+  if (sip.cdr != NULL) {
+    CdrWriter_destroy(sip.cdr);
+  }
+  if (sip.tap != NULL) {
+    PcapTap_destroy(sip.tap);
+  }
+  if (sip.metrics_server != NULL) {
+    MetricsServer_destroy(sip.metrics_server);
+  }
+  if (sip.control_server != NULL) {
+    ControlServer_destroy(sip.control_server);
+  }
+  if (sip.stats_writer != NULL) {
+    ShmStatsWriter_destroy(sip.stats_writer);
+  }
+  free(capture_path);
+#ifdef USE_TRACE
+  if (trace_file != NULL) {
+    should (trace_export(trace_file) >= 0) otherwise {
+      fputs("error: out of memory when writing trace\n", stderr);
+    }
+    fclose(trace_file);
+  }
+#endif
+  if (log_async_enabled) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-write-to-const"
+    for (int i = LOG_LEVEL_ERROR; i < LOG_LEVEL_COUNT; i++) {
+      LOGGER_SET_ATTRIBUTE(formatted[i].stream, &logger_stream_stdout);
+    }
+#pragma GCC diagnostic pop
+    LoggerAsync_destroy(&log_async);
+  }
   return ret;
 }
@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/macro.h"
+#include "utils/log.h"
+#include "utils/single.h"
+#include "utils/threadname.h"
+#include "utils/timeval.h"
+#include "cdr.h"
+
+
+/// maximum length of a CSV line, quoted strings doubling in the worst case
+#define CDR_LINE_SIZE (2 * (CDR_CALL_ID_SIZE + 2 * CDR_USER_SIZE) + 512)
+
+/// header of CDR file
+static const char cdr_header[] =
+  "setup,answer,end,duration,direction,dialog_id,call_id,caller,callee,"
+  "reason,audio_bytes_leelen_to_sip,audio_bytes_sip_to_leelen,"
+  "video_bytes_leelen_to_sip,video_bytes_sip_to_leelen\n";
+
+const char * const CdrReason_names[CDR_REASON_COUNT] = {
+  "unknown", "leelen_bye", "sip_bye", "sip_cancel", "sip_reject", "no_answer",
+  "dial_timeout", "session_timeout", "shutdown",
+};
+
+
+/**
+ * @relates CdrRecord
+ * @private
+ * @brief Format a time as ISO 8601 in UTC, or nothing if 0.
+ *
+ * @param[out] buf Buffer.
+ * @param size Size of buffer.
+ * @param us Real time in microseconds.
+ * @return Number of characters written.
+ */
+static int cdr_format_time (char *buf, size_t size, unsigned long long us) {
+  return_if (us == 0) 0;
+  time_t sec = us / 1000000;
+  struct tm tm;
+  return_if_fail (gmtime_r(&sec, &tm) != NULL) 0;
+  int len = strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm);
+  len += snprintf(buf + len, size - len, ".%03uZ",
+                  (unsigned int) (us / 1000 % 1000));
+  return len;
+}
+
+
+/**
+ * @relates CdrRecord
+ * @private
+ * @brief Format a CSV string field, quoting it if needed.
+ *
+ * @param[out] buf Buffer, at least twice as long as @p str plus 3.
+ * @param str String.
+ * @return Number of characters written.
+ */
+static int cdr_format_string (char *buf, const char *str) {
+  return_if (str[strcspn(str, ",\"\r\n")] == '\0') stpcpy(buf, str) - buf;
+
+  char *p = buf;
+  *p++ = '"';
+  for (; *str != '\0'; str++) {
+    if (*str == '"') {
+      *p++ = '"';
+    }
+    *p++ = *str;
+  }
+  *p++ = '"';
+  *p = '\0';
+  return p - buf;
+}
+
+
+/**
+ * @memberof CdrRecord
+ * @private
+ * @brief Format a record as a CSV line.
+ *
+ * @param self Call detail record.
+ * @param[out] buf Buffer of #CDR_LINE_SIZE.
+ * @return Number of characters written.
+ */
+static int CdrRecord_format (const struct CdrRecord *self, char *buf) {
+  char *p = buf;
+  const unsigned long long times[3] = {self->setup, self->answer, self->end};
+  for (int i = 0; i < 3; i++) {
+    p += cdr_format_time(p, 32, times[i]);
+    *p++ = ',';
+  }
+  unsigned long long duration =
+    self->answer == 0 || self->end < self->answer ?
+      0 : (self->end - self->answer) / 1000;
+  p += sprintf(p, "%llu.%03llu,%s,%08x,", duration / 1000, duration % 1000,
+               self->outgoing ? "leelen_to_sip" : "sip_to_leelen", self->id);
+  p += cdr_format_string(p, self->call_id);
+  *p++ = ',';
+  p += cdr_format_string(p, self->caller);
+  *p++ = ',';
+  p += cdr_format_string(p, self->callee);
+  p += sprintf(
+    p, ",%s,%llu,%llu,%llu,%llu\n",
+    CdrReason_names[self->reason < CDR_REASON_COUNT ? self->reason : 0],
+    (unsigned long long) self->bytes[0][0],
+    (unsigned long long) self->bytes[0][1],
+    (unsigned long long) self->bytes[1][0],
+    (unsigned long long) self->bytes[1][1]);
+  return p - buf;
+}
+
+
+/**
+ * @memberof CdrWriter
+ * @private
+ * @brief Write a batch of records and sync them to disk.
+ *
+ * @param self CDR writer.
+ * @param records Records.
+ * @param n Number of records.
+ * @param buf Buffer of @p n lines.
+ * @return 0 on success, -1 on error and @c errno is set appropriately.
+ */
+static int CdrWriter_write (
+    struct CdrWriter *self, const struct CdrRecord *records, unsigned int n,
+    char *buf) {
+  size_t len = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    len += CdrRecord_format(&records[i], buf + len);
+  }
+
+  for (size_t written = 0; written < len; ) {
+    ssize_t res = write(self->fd, buf + written, len - written);
+    if unlikely (res < 0) {
+      continue_if (errno == EINTR);
+      return -1;
+    }
+    written += res;
+  }
+  return fdatasync(self->fd);
+}
+
+
+/**
+ * @memberof CdrWriter
+ * @private
+ * @brief Take queued records.
+ *
+ * @note Caller should hold @p self->mtx.
+ *
+ * @param self CDR writer.
+ * @param[out] records Buffer of #CDR_CAPACITY records.
+ * @return Number of records taken.
+ */
+static unsigned int CdrWriter_take (
+    struct CdrWriter *self, struct CdrRecord *records) {
+  unsigned int n = self->n_record;
+  for (unsigned int i = 0; i < n; i++) {
+    records[i] = self->records[(self->head + i) % CDR_CAPACITY];
+  }
+  self->head = (self->head + n) % CDR_CAPACITY;
+  self->n_record = 0;
+  return n;
+}
+
+
+/**
+ * @memberof CdrWriter
+ * @private
+ * @brief Writer thread.
+ *
+ * @param arg CDR writer.
+ * @return 0.
+ */
+static int CdrWriter_mainloop (void *arg) {
+  struct CdrWriter *self = arg;
+  threadname_set("CDR");
+
+  struct CdrRecord *records = malloc(sizeof(records[0]) * CDR_CAPACITY);
+  char *buf = malloc(CDR_LINE_SIZE * CDR_CAPACITY);
+  should (records != NULL && buf != NULL) otherwise {
+    LOG(LOG_LEVEL_ERROR, "Out of memory, CDR writer stopped");
+    free(records);
+    free(buf);
+    single_finish(&self->state);
+    return 0;
+  }
+
+  unsigned long reported = 0;
+  bool running = true;
+  while (running) {
+    mtx_lock(&self->mtx);
+    while (single_is_running(&self->state) && self->n_record == 0) {
+      cnd_wait(&self->cnd, &self->mtx);
+    }
+    // batch records arriving meanwhile
+    struct timespec deadline;
+    timespec_get(&deadline, TIME_UTC);
+    timespec_add_ms(&deadline, CDR_BATCH_DELAY);
+    while (single_is_running(&self->state) &&
+           self->n_record < CDR_BATCH_SIZE) {
+      break_if (cnd_timedwait(
+        &self->cnd, &self->mtx, &deadline) == thrd_timedout);
+    }
+    running = single_is_running(&self->state);
+    unsigned int n = CdrWriter_take(self, records);
+    unsigned long dropped = self->dropped;
+    mtx_unlock(&self->mtx);
+
+    if unlikely (dropped != reported) {
+      LOG(LOG_LEVEL_WARNING, "%lu call detail records dropped",
+          dropped - reported);
+      reported = dropped;
+    }
+    continue_if (n == 0);
+    should (CdrWriter_write(self, records, n, buf) == 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING, "Cannot write call detail records");
+    }
+  }
+
+  free(records);
+  free(buf);
+  single_finish(&self->state);
+  return 0;
+}
+
+
+bool CdrWriter_push (struct CdrWriter *self, const struct CdrRecord *record) {
+  mtx_lock(&self->mtx);
+  bool ret = self->n_record < CDR_CAPACITY;
+  if likely (ret) {
+    self->records[(self->head + self->n_record) % CDR_CAPACITY] = *record;
+    self->n_record++;
+    // wake up to start the batch, or to write a full batch
+    if (self->n_record == 1 || self->n_record == CDR_BATCH_SIZE) {
+      cnd_signal(&self->cnd);
+    }
+  } else {
+    self->dropped++;
+  }
+  mtx_unlock(&self->mtx);
+  return ret;
+}
+
+
+int CdrWriter_start (struct CdrWriter *self) {
+  return single_start(&self->state, CdrWriter_mainloop, self);
+}
+
+
+void CdrWriter_destroy (struct CdrWriter *self) {
+  single_stop(&self->state);
+  mtx_lock(&self->mtx);
+  cnd_signal(&self->cnd);
+  mtx_unlock(&self->mtx);
+  single_join(&self->state);
+
+  // writer thread not started, or records queued after it stopped
+  if (self->n_record > 0) {
+    struct CdrRecord *records = malloc(sizeof(records[0]) * CDR_CAPACITY);
+    char *buf = malloc(CDR_LINE_SIZE * CDR_CAPACITY);
+    if likely (records != NULL && buf != NULL) {
+      unsigned int n = CdrWriter_take(self, records);
+      should (CdrWriter_write(self, records, n, buf) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_WARNING, "Cannot write call detail records");
+      }
+    }
+    free(records);
+    free(buf);
+  }
+
+  cnd_destroy(&self->cnd);
+  mtx_destroy(&self->mtx);
+  close(self->fd);
+}
+
+
+int CdrWriter_init (struct CdrWriter *self, const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+  return_if_fail (fd >= 0) -1;
+  off_t size = lseek(fd, 0, SEEK_END);
+  bool ok = size >= 0;
+  if (ok && size == 0) {
+    ok = write(fd, cdr_header, sizeof(cdr_header) - 1) ==
+      sizeof(cdr_header) - 1;
+  }
+  goto_if_fail (ok) fail;
+  goto_if_fail (mtx_init(&self->mtx, mtx_plain) == thrd_success) fail;
+  should (cnd_init(&self->cnd) == thrd_success) otherwise {
+    mtx_destroy(&self->mtx);
+    goto fail;
+  }
+
+  self->fd = fd;
+  self->dropped = 0;
+  self->head = 0;
+  self->n_record = 0;
+  self->state = SINGLE_FLAG_INIT;
+  return 0;
+
+fail:
+  {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+  }
+  return -1;
+}
@@ -0,0 +1,186 @@
+#ifndef SIPLEELEN_CDR_H
+#define SIPLEELEN_CDR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+#include "utils/single.h"
+
+/**
+ * @file
+ * Call detail records, appended to a CSV file by a background thread.
+ *
+ * This header does not depend on OSIP.
+ */
+
+
+/// size of CdrRecord::call_id
+#define CDR_CALL_ID_SIZE 128
+/// size of CdrRecord::caller and CdrRecord::callee
+#define CDR_USER_SIZE 64
+/// number of records queued before dropping
+#define CDR_CAPACITY 256
+/// longest time a record waits to be batched, in milliseconds
+#define CDR_BATCH_DELAY 1000
+/// number of queued records that triggers a write immediately
+#define CDR_BATCH_SIZE 32
+
+
+/**
+ * @ingroup sip
+ * @brief Why a session ended.
+ */
+enum CdrReason {
+  /// unknown, usually an error before the call was set up
+  CDR_REASON_NONE = 0,
+  /// LEELEN peer hung up
+  CDR_REASON_LEELEN_BYE,
+  /// SIP peer hung up
+  CDR_REASON_SIP_BYE,
+  /// SIP caller cancelled before answer
+  CDR_REASON_SIP_CANCEL,
+  /// SIP callee rejected the call
+  CDR_REASON_SIP_REJECT,
+  /// no extension of ring group answered
+  CDR_REASON_NO_ANSWER,
+  /// LEELEN callee did not acknowledge
+  CDR_REASON_DIAL_TIMEOUT,
+  /// LEELEN dialog went silent
+  CDR_REASON_SESSION_TIMEOUT,
+  /// gateway shut down
+  CDR_REASON_SHUTDOWN,
+  CDR_REASON_COUNT,
+};
+
+/// names of ::CdrReason
+extern const char * const CdrReason_names[CDR_REASON_COUNT];
+
+/**
+ * @ingroup sip
+ * @brief Call detail record.
+ *
+ * Times are real time in microseconds since the Epoch, or 0 if not reached.
+ */
+struct CdrRecord {
+  /// LEELEN dialog ID, or 0 if not connected
+  uint32_t id;
+  /// @c true if called from LEELEN to SIP
+  bool outgoing;
+  /// ::CdrReason, only the first one set is kept
+  unsigned char reason;
+  /// when the session was created
+  unsigned long long setup;
+  /// when media started to be relayed
+  unsigned long long answer;
+  /// when the session was destroyed
+  unsigned long long end;
+  /// relayed bytes, by media (audio, video) and direction (LEELEN to SIP, SIP
+  /// to LEELEN)
+  uint64_t bytes[2][2];
+  /// SIP Call-ID
+  char call_id[CDR_CALL_ID_SIZE];
+  /// user of SIP From
+  char caller[CDR_USER_SIZE];
+  /// user of SIP To
+  char callee[CDR_USER_SIZE];
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof CdrRecord
+ * @brief Set why the session ended, unless already set.
+ *
+ * @param[in,out] self Call detail record.
+ * @param reason ::CdrReason.
+ */
+static inline void CdrRecord_set_reason (
+    struct CdrRecord *self, enum CdrReason reason) {
+  if (self->reason == CDR_REASON_NONE) {
+    self->reason = reason;
+  }
+}
+
+
+/**
+ * @ingroup sip
+ * @brief Writer of call detail records.
+ *
+ * Records are queued under a mutex held only for copying them, so that call
+ * handling never waits on disk. The writer thread waits up to
+ * #CDR_BATCH_DELAY for more records, then writes the batch with a single
+ * @c write() and a single @c fdatasync(). When the queue is full, records are
+ * dropped and counted.
+ */
+struct CdrWriter {
+  /// output file descriptor, opened with @c O_APPEND
+  int fd;
+  /// number of dropped records, protected by CdrWriter::mtx
+  unsigned long dropped;
+
+  /** @privatesection */
+  /// queued records
+  struct CdrRecord records[CDR_CAPACITY];
+  /// index of oldest record in CdrWriter::records
+  unsigned int head;
+  /// number of queued records
+  unsigned int n_record;
+  /// protects queue
+  mtx_t mtx;
+  /// signaled when records are queued or writer is stopping
+  cnd_t cnd;
+  /// writer thread state
+  single_flag state;
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof CdrWriter
+ * @brief Queue a record.
+ *
+ * @param self CDR writer.
+ * @param record Call detail record.
+ * @return @c true if queued, @c false if dropped.
+ */
+bool CdrWriter_push (struct CdrWriter *self, const struct CdrRecord *record);
+__attribute__((nonnull))
+/**
+ * @memberof CdrWriter
+ * @brief Start writer thread.
+ *
+ * Call it after @c daemon(), as threads do not survive @c fork().
+ *
+ * @param self CDR writer.
+ * @return 0 on success, -1 on error.
+ */
+int CdrWriter_start (struct CdrWriter *self);
+
+__attribute__((nonnull))
+/**
+ * @memberof CdrWriter
+ * @brief Stop writer thread, write remaining records, and close the file.
+ *
+ * @param self CDR writer.
+ */
+void CdrWriter_destroy (struct CdrWriter *self);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof CdrWriter
+ * @brief Open a CDR file, writing the CSV header if empty.
+ *
+ * @param[out] self CDR writer.
+ * @param path File path.
+ * @return 0 on success, -1 on error and @c errno is set appropriately.
+ */
+int CdrWriter_init (struct CdrWriter *self, const char *path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIPLEELEN_CDR_H */
@@ -0,0 +1,456 @@
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <threads.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/time.h>  // osip
+
+#include <inet46i/sockaddr46.h>
+#include <osip2/osip.h>
+#include <osip2/osip_dialog.h>
+
+#include "utils/macro.h"
+#include "utils/array.h"
+#include "utils/control.h"
+#include "utils/histogram.h"
+#include "utils/log.h"
+#include "utils/pcaptap.h"
+#include "utils/single.h"
+#include "utils/trace.h"
+#include "leelen/discovery/discovery.h"
+#include "leelen/discovery/protocol.h"
+#include "leelen/discovery/rtt.h"
+#include "leelen/voip/dialog.h"
+#include "leelen/voip/protocol.h"
+#include "forwarder.h"
+#include "session.h"
+#include "sipleelen.h"
+#include "control.h"
+
+
+/**
+ * @relates SIPLeelen
+ * @private
+ * @brief Write an error answer.
+ *
+ * @param f Output.
+ * @param msg Error message.
+ */
+static void control_write_error (FILE *f, const char *msg) {
+  fputs("{\"error\":", f);
+  control_write_string(f, msg);
+  fputc('}', f);
+}
+
+
+/**
+ * @relates Forwarder
+ * @private
+ * @brief Write forwarder state and statistics as JSON object.
+ *
+ * @param f Output.
+ * @param forwarder Socket forwarder.
+ */
+static void control_write_forwarder (
+    FILE *f, const struct Forwarder *forwarder) {
+  static const char * const direction_names[2] = {
+    "leelen_to_sip", "sip_to_leelen"};
+
+  fprintf(f, "{\"running\":%s",
+          single_is_running(&forwarder->state) ? "true" : "false");
+  for (int i = 0; i < 2; i++) {
+    const struct ForwarderStats *stats = &forwarder->stats[i];
+    fprintf(
+      f, ",\"%s\":{\"packets\":%lu,\"bytes\":%lu", direction_names[i],
+      atomic_load_explicit(&stats->packets, memory_order_relaxed),
+      atomic_load_explicit(&stats->bytes, memory_order_relaxed));
+    unsigned long count =
+      atomic_load_explicit(&stats->latency.count, memory_order_relaxed);
+    if (count > 0) {
+      fprintf(
+        f, ",\"latency_us\":{\"count\":%lu,\"p50\":%lu,\"p99\":%lu,"
+        "\"max\":%lu}", count, Histogram_percentile(&stats->latency, 500),
+        Histogram_percentile(&stats->latency, 990),
+        atomic_load_explicit(&stats->latency.max, memory_order_relaxed));
+    }
+    fputc('}', f);
+  }
+  fputc('}', f);
+}
+
+
+/**
+ * @memberof SIPLeelen
+ * @private
+ * @brief Answer @c sessions command.
+ *
+ * @param self LEELEN2SIP object.
+ * @param f Output.
+ */
+static void SIPLeelen_control_sessions (struct SIPLeelen *self, FILE *f) {
+  fputs("{\"sessions\":[", f);
+  mtx_lock(&self->mtx_sessions);
+  forindex (int, i, self->sessions, self->n_session) {
+    const struct SIPLeelenSession *session = self->sessions[i];
+    const struct LeelenDialog *leelen = &session->leelen;
+
+    fprintf(f, "%s{\"id\":\"" PRI_LEELEN_ID "\",\"state\":",
+            i == 0 ? "" : ",", leelen->id);
+    control_write_string(
+      f, leelen->state < LEELEN_DIALOG_STATE_COUNT ?
+        LeelenDialogState_names[leelen->state] : "unknown");
+    fputs(",\"number\":", f);
+    control_write_string(f, session->number.str);
+    if (leelen->id != 0) {
+      char s_theirs[SOCKADDR_STRLEN];
+      sockaddr_toa(&leelen->theirs.sock, s_theirs, sizeof(s_theirs));
+      fputs(",\"peer\":", f);
+      control_write_string(f, s_theirs);
+      fprintf(f, ",\"retransmits\":%u,\"duplicates\":%u",
+              leelen->retransmits, leelen->duplicates);
+    }
+
+    // SIP Call-ID, from dialog if established, or from transaction
+    const osip_transaction_t *tr = session->transaction;
+    if (session->sip != NULL && session->sip->call_id != NULL) {
+      fputs(",\"call_id\":", f);
+      control_write_string(f, session->sip->call_id);
+    } else if (tr != NULL && tr->callid != NULL &&
+               tr->callid->number != NULL) {
+      char *call_id;
+      if (osip_call_id_to_str(tr->callid, &call_id) == OSIP_SUCCESS) {
+        fputs(",\"call_id\":", f);
+        control_write_string(f, call_id);
+        osip_free(call_id);
+      }
+    }
+
+    fprintf(f, ",\"inviting\":%s,\"ringing\":%s",
+            single_still_running(&session->invite_state) ? "true" : "false",
+            session->ring != NULL ? "true" : "false");
+    fputs(",\"audio\":", f);
+    control_write_forwarder(f, &session->audio);
+    fputs(",\"video\":", f);
+    control_write_forwarder(f, &session->video);
+    fputc('}', f);
+  }
+  mtx_unlock(&self->mtx_sessions);
+  fputs("]}", f);
+}
+
+
+/**
+ * @relates LeelenDiscovery
+ * @private
+ * @brief Write an interface index and its name as JSON members.
+ *
+ * @param f Output.
+ * @param ifindex Interface index, or 0 if any.
+ */
+static void control_write_ifindex (FILE *f, unsigned int ifindex) {
+  char ifname[IF_NAMESIZE];
+  fprintf(f, "\"ifindex\":%u", ifindex);
+  if (ifindex != 0 && if_indextoname(ifindex, ifname) != NULL) {
+    fputs(",\"interface\":", f);
+    control_write_string(f, ifname);
+  }
+}
+
+
+/**
+ * @memberof SIPLeelen
+ * @private
+ * @brief Answer @c directory command.
+ *
+ * @param self LEELEN2SIP object.
+ * @param f Output.
+ */
+static void SIPLeelen_control_directory (struct SIPLeelen *self, FILE *f) {
+  struct LeelenDiscovery *leelen = &self->leelen;
+
+  // take a snapshot, not to block discovery while writing
+  struct LeelenDiscoveryRoute routes[LEELEN_DISCOVERY_ROUTES];
+  struct LeelenRTT rtts[LEELEN_DISCOVERY_MAX_LINKS];
+  mtx_lock(&leelen->mutex);
+  memcpy(routes, leelen->routes, sizeof(routes));
+  memcpy(rtts, leelen->rtts, sizeof(rtts));
+  mtx_unlock(&leelen->mutex);
+
+  // links are only set up at start
+  fputs("{\"links\":[", f);
+  for (int i = 0; i < leelen->n_link; i++) {
+    const struct LeelenDiscoveryLink *link = &leelen->links[i];
+    char s_addr[SOCKADDR_STRLEN];
+    sockaddr_toa(&link->addr.sock, s_addr, sizeof(s_addr));
+    fputs(i == 0 ? "{" : ",{", f);
+    control_write_ifindex(f, link->ifindex);
+    fputs(",\"addr\":", f);
+    control_write_string(f, s_addr);
+    fputc('}', f);
+  }
+
+  fputs("],\"rtts\":[", f);
+  for (int i = 0; i < LEELEN_DISCOVERY_MAX_LINKS; i++) {
+    const struct LeelenRTT *rtt = &rtts[i];
+    break_if (rtt->ifindex == 0);
+    fputs(i == 0 ? "{" : ",{", f);
+    // catch-all slot
+    control_write_ifindex(f, rtt->ifindex == ~0u ? 0 : rtt->ifindex);
+    fprintf(
+      f, ",\"samples\":%u,\"srtt_us\":%u,\"rttvar_us\":%u,\"timeout_ms\":%u}",
+      rtt->n_sample, rtt->srtt, rtt->rttvar, LeelenRTT_timeout(
+        rtt, LEELEN_DISCOVERY_TIMEOUT_MIN, leelen->timeout));
+  }
+
+  fputs("],\"routes\":[", f);
+  bool first = true;
+  for (int i = 0; i < LEELEN_DISCOVERY_ROUTES; i++) {
+    const struct LeelenDiscoveryRoute *route = &routes[i];
+    continue_if (route->ifindex == 0);
+    // key is block * 10000 + room
+    fprintf(f, "%s{\"number\":\"%04" PRIu32 "-%04" PRIu32 "\",",
+            first ? "" : ",", route->key / 10000, route->key % 10000);
+    control_write_ifindex(f, route->ifindex);
+    fputc('}', f);
+    first = false;
+  }
+  fputs("]}", f);
+}
+
+
+/**
+ * @relates SIPLeelen
+ * @private
+ * @brief Answer @c log-level command.
+ *
+ * @param f Output.
+ * @param arg New log level, or @c NULL to query.
+ */
+static void control_log_level (FILE *f, const char *arg) {
+  if (arg != NULL) {
+    int level = -1;
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+      if (strcasecmp(arg, LogLevel_names[i]) == 0) {
+        level = i;
+        break;
+      }
+    }
+    if (level < 0) {
+      char *end;
+      long n = strtol(arg, &end, 10);
+      if (arg[0] != '\0' && *end == '\0' && 0 <= n && n < LOG_LEVEL_COUNT) {
+        level = n;
+      }
+    }
+    should (level >= 0) otherwise {
+      control_write_error(f, "unknown log level");
+      return;
+    }
+    LOG(LOG_LEVEL_NOTICE, "Log level set to %s by control socket",
+        LogLevel_names[level]);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-write-to-const"
+    LOGGER_SET_ATTRIBUTE(level, level);
+#pragma GCC diagnostic pop
+  }
+
+  fputs("{\"level\":", f);
+  control_write_string(f, LogLevel_names[LogLevel_clamp(app_logger.level)]);
+  fputc('}', f);
+}
+
+
+/**
+ * @memberof SIPLeelen
+ * @private
+ * @brief Answer @c close command.
+ *
+ * @param self LEELEN2SIP object.
+ * @param f Output.
+ * @param arg LEELEN dialog ID.
+ */
+static void SIPLeelen_control_close (
+    struct SIPLeelen *self, FILE *f, const char *arg) {
+  char *end;
+  unsigned long id = arg == NULL ? 0 : strtoul(arg, &end, 16);
+  should (id != 0 && id <= UINT32_MAX && *end == '\0') otherwise {
+    control_write_error(f, "invalid dialog ID");
+    return;
+  }
+
+  const char *error = "no such session";
+  mtx_lock(&self->mtx_sessions);
+  forindex (int, i, self->sessions, self->n_session) {
+    struct SIPLeelenSession *session = self->sessions[i];
+    continue_if (session->leelen.id != id);
+
+    // same as session timeout, other states are handled by transactions
+    should (!single_still_running(&session->invite_state) &&
+            session->leelen.state == LEELEN_DIALOG_CONNECTED &&
+            session->transaction == NULL) otherwise {
+      error = "session not established";
+      break;
+    }
+    LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID ": Closed by control socket",
+        session->leelen.id);
+    int res = SIPLeelenSession_bye(session, true);
+    should ((res & 1) == 0) otherwise {
+      SIPLeelen_decref_session(self, session, i, 0);
+    }
+    error = res == 0 ? NULL : "cannot send BYE";
+    break;
+  }
+  mtx_unlock(&self->mtx_sessions);
+
+  should (error == NULL) otherwise {
+    control_write_error(f, error);
+    return;
+  }
+  fprintf(f, "{\"closed\":\"" PRI_LEELEN_ID "\"}", (uint32_t) id);
+}
+
+
+/**
+ * @memberof SIPLeelen
+ * @private
+ * @brief Answer @c capture command.
+ *
+ * The capture tap cannot be created or destroyed at run time, since sessions
+ * keep pointers to it; it is paused instead.
+ *
+ * @param self LEELEN2SIP object.
+ * @param f Output.
+ * @param arg @c start, @c stop, or @c NULL to query.
+ */
+static void SIPLeelen_control_capture (
+    struct SIPLeelen *self, FILE *f, const char *arg) {
+  struct PcapTap *tap = self->tap;
+  should (tap != NULL) otherwise {
+    control_write_error(f, "capture not configured");
+    return;
+  }
+
+  if (arg != NULL) {
+    bool paused;
+    if (strcmp(arg, "start") == 0) {
+      paused = false;
+    } else if (strcmp(arg, "stop") == 0) {
+      paused = true;
+    } else {
+      control_write_error(f, "expect start or stop");
+      return;
+    }
+    atomic_store_explicit(&tap->paused, paused, memory_order_relaxed);
+    LOG(LOG_LEVEL_NOTICE, "Capture %s by control socket",
+        paused ? "paused" : "resumed");
+  }
+
+  fprintf(f, "{\"capture\":\"%s\",\"dropped\":%lu}",
+          atomic_load_explicit(&tap->paused, memory_order_relaxed) ?
+            "paused" : "running",
+          atomic_load_explicit(&tap->dropped, memory_order_relaxed));
+}
+
+
+#ifdef USE_TRACE
+/**
+ * @relates SIPLeelen
+ * @private
+ * @brief Answer @c trace command.
+ *
+ * @param self LEELEN2SIP object.
+ * @param f Output.
+ * @param name Output file of Chrome trace JSON, in SIPLeelen::trace_dir.
+ */
+static void SIPLeelen_control_trace (
+    const struct SIPLeelen *self, FILE *f, const char *name) {
+  should (self->trace_dir != NULL) otherwise {
+    control_write_error(f, "trace directory not set");
+    return;
+  }
+  should (name != NULL) otherwise {
+    control_write_error(f, "expect file name");
+    return;
+  }
+  // clients name a file, not a path
+  should (name[0] != '.' && strchr(name, '/') == NULL) otherwise {
+    control_write_error(f, "invalid file name");
+    return;
+  }
+  char path[PATH_MAX];
+  should (snprintf(
+      path, sizeof(path), "%s/%s", self->trace_dir, name
+  ) < (int) sizeof(path)) otherwise {
+    control_write_error(f, "file name too long");
+    return;
+  }
+  int fd = open(
+    path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+  FILE *out = fd < 0 ? NULL : fdopen(fd, "w");
+  should (out != NULL) otherwise {
+    control_write_error(f, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+  long n_event = trace_export(out);
+  fclose(out);
+  should (n_event >= 0) otherwise {
+    control_write_error(f, "out of memory");
+    return;
+  }
+
+  fputs("{\"trace\":", f);
+  control_write_string(f, path);
+  fprintf(f, ",\"events\":%ld}", n_event);
+}
+
+#define CONTROL_TRACE_HELP ",\"trace <name>\""
+#else
+#define CONTROL_TRACE_HELP ""
+#endif
+
+
+void SIPLeelen_control (void *arg, FILE *f, char *line) {
+  struct SIPLeelen *self = arg;
+
+  static const char delim[] = " \t";
+  char *saveptr;
+  const char *cmd = strtok_r(line, delim, &saveptr);
+  const char *cmd_arg = strtok_r(NULL, delim, &saveptr);
+
+  if (cmd == NULL) {
+    control_write_error(f, "empty command");
+  } else if (strcmp(cmd, "sessions") == 0) {
+    SIPLeelen_control_sessions(self, f);
+  } else if (strcmp(cmd, "directory") == 0) {
+    SIPLeelen_control_directory(self, f);
+  } else if (strcmp(cmd, "log-level") == 0) {
+    control_log_level(f, cmd_arg);
+  } else if (strcmp(cmd, "close") == 0) {
+    SIPLeelen_control_close(self, f, cmd_arg);
+  } else if (strcmp(cmd, "capture") == 0) {
+    SIPLeelen_control_capture(self, f, cmd_arg);
+#ifdef USE_TRACE
+  } else if (strcmp(cmd, "trace") == 0) {
+    SIPLeelen_control_trace(self, f, cmd_arg);
+#endif
+  } else if (strcmp(cmd, "help") == 0) {
+    fputs(
+      "{\"commands\":[\"sessions\",\"directory\",\"log-level [<level>]\","
+      "\"close <id>\",\"capture [start|stop]\"" CONTROL_TRACE_HELP
+      ",\"help\"]}", f);
+  } else {
+    control_write_error(f, "unknown command");
+  }
+}
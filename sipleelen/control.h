@@ -0,0 +1,45 @@
+#ifndef SIPLEELEN_CONTROL_H
+#define SIPLEELEN_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+// #include "sipleelen.h"
+struct SIPLeelen;
+
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelen
+ * @brief Answer a control command as a line of JSON.
+ *
+ * Commands are:
+ * - @c sessions: list sessions with their forwarder statistics
+ * - @c directory: dump interfaces, RTT estimators and the phone number
+ *   directory of LEELEN discovery
+ * - <tt>log-level [\<level\>]</tt>: get or set the log level, by name or
+ *   number
+ * - <tt>close \<id\></tt>: hang up the established session of LEELEN dialog
+ *   ID
+ * - <tt>capture [start|stop]</tt>: get, resume or pause packet capture
+ * - <tt>trace \<file\></tt>: write recorded trace spans into \<file\>, if
+ *   built with @c USE_TRACE; relative to @c / if daemonized
+ * - @c help: list commands
+ *
+ * Must be called in executer thread, which owns OSIP stack.
+ *
+ * @param arg LEELEN2SIP object.
+ * @param f Output.
+ * @param line Command line.
+ */
+void SIPLeelen_control (void *arg, FILE *f, char *line);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIPLEELEN_CONTROL_H */
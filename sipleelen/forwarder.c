@@ -1,14 +1,28 @@
+#include <errno.h>
 #include <poll.h>
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <threads.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include <inet46i/sockaddr46.h>
 
 #include "utils/macro.h"
+#include "utils/histogram.h"
 #include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/pcaptap.h"
 #include "utils/single.h"
 #include "utils/threadname.h"
+#include "utils/timeval.h"
+#include "utils/trace.h"
 #include "forwarder.h"
 
 
@@ -17,9 +31,47 @@ struct HalfForwarder {
   int from;
   int to;
   unsigned short mtu;
+  bool latch;
+  int (*filter) (void *arg, const void *buf, int len);
+  void *filter_arg;
+  struct PcapTap *tap;
+  union sockaddr_in46 local;
+  struct MetricCounter *packets;
+  struct MetricCounter *bytes;
+  struct MetricGauge *threads;
+  atomic_ullong *media_start;
+  struct Histogram *media_latency;
+  struct Histogram *relay_latency;
+  uint32_t trace_id;
+  struct ForwarderStats *stats;
 };
 
 
+/**
+ * @relates HalfForwarder
+ * @private
+ * @brief Get software receive timestamp of a packet.
+ *
+ * @param msg Received message.
+ * @param[out] ts Timestamp, in real time.
+ * @return @c true if found.
+ */
+static bool forwarder_rx_timestamp (
+    const struct msghdr *msg, struct timespec *ts) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR((struct msghdr *) msg, cmsg)) {
+    continue_if_fail (cmsg->cmsg_level == SOL_SOCKET &&
+                      cmsg->cmsg_type == SCM_TIMESTAMPING);
+    // ts[0] is the software timestamp
+    const struct scm_timestamping *tss =
+      (const struct scm_timestamping *) CMSG_DATA(cmsg);
+    *ts = tss->ts[0];
+    return ts->tv_sec != 0 || ts->tv_nsec != 0;
+  }
+  return false;
+}
+
+
 /**
  * @memberof HalfForwarder
  * @brief HalfForwarder main thread.
@@ -33,10 +85,41 @@ static int HalfForwarder_mainloop (void *arg) {
   unsigned char buf[self->mtu];
   int from = self->from;
   int to = self->to;
+  bool latch = self->latch;
+  int (*filter) (void *arg, const void *buf, int len) = self->filter;
+  void *filter_arg = self->filter_arg;
+  struct PcapTap *tap = self->tap;
+  union sockaddr_in46 local = self->local;
+  struct MetricCounter *packets = self->packets;
+  struct MetricCounter *bytes = self->bytes;
+  struct MetricGauge *threads = self->threads;
+  atomic_ullong *media_start = self->media_start;
+  struct Histogram *media_latency = self->media_latency;
+  struct Histogram *relay_latency = self->relay_latency;
+  uint32_t trace_id = self->trace_id;
+  struct ForwarderStats *stats = self->stats;
   free(self);
 
+  if (threads != NULL) {
+    MetricGauge_add(threads, 1);
+  }
+
   threadname_format("%d => %d", from, to);
 
+  if (relay_latency != NULL) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    should (setsockopt(
+        from, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)
+    ) == 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING, "Cannot enable receive timestamps");
+      relay_latency = NULL;
+    }
+  }
+  union {
+    char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct cmsghdr align;
+  } control;
+
   struct pollfd pollfd = {.fd = from, .events = POLLIN};
 
   while (single_continue(state)) {
@@ -46,18 +129,79 @@ static int HalfForwarder_mainloop (void *arg) {
       continue;
     }
     continue_if (pollres <= 0);
+    TRACE_SPAN("relay", trace_id);
 
-    int buflen = recv(from, buf, sizeof(buf), MSG_DONTWAIT);
+    union sockaddr_in46 src;
+    bool want_src = latch || tap != NULL;
+    struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf)};
+    struct msghdr msg = {
+      .msg_name = want_src ? &src : NULL,
+      .msg_namelen = want_src ? sizeof(src) : 0,
+      .msg_iov = &iov, .msg_iovlen = 1,
+      .msg_control = relay_latency == NULL ? NULL : control.buf,
+      .msg_controllen = relay_latency == NULL ? 0 : sizeof(control.buf),
+    };
+    int buflen = recvmsg(from, &msg, MSG_DONTWAIT);
     should (buflen >= 0) otherwise {
-      LOG_PERROR(LOG_LEVEL_WARNING, "recv() failed");
+      LOG_PERROR(LOG_LEVEL_WARNING, "recvmsg() failed");
       continue;
     }
+    socklen_t srclen = msg.msg_namelen;
+    if unlikely (tap != NULL) {
+      PcapTap_write(tap, buf, buflen, &src.sock, &local.sock);
+    }
+    continue_if (filter != NULL && filter(filter_arg, buf, buflen) != 0);
+
+    if unlikely (latch) {
+      // symmetric RTP: reply to where the peer sends from
+      should (connect(from, &src.sock, srclen) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_WARNING, "connect() failed");
+      }
+      latch = false;
+    }
+
     should (send(to, buf, buflen, 0) == buflen) otherwise {
+      // peer address not learned yet
+      continue_if (errno == EDESTADDRREQ);
       LOG_PERROR(LOG_LEVEL_WARNING, "send() failed");
       continue;
     }
+    // single writer, no need of atomic read-modify-write
+    atomic_store_explicit(
+      &stats->packets,
+      atomic_load_explicit(&stats->packets, memory_order_relaxed) + 1,
+      memory_order_relaxed);
+    atomic_store_explicit(
+      &stats->bytes,
+      atomic_load_explicit(&stats->bytes, memory_order_relaxed) + buflen,
+      memory_order_relaxed);
+    if likely (packets != NULL) {
+      MetricCounter_inc(packets);
+      MetricCounter_add(bytes, buflen);
+    }
+    struct timespec received;
+    if (relay_latency != NULL && forwarder_rx_timestamp(&msg, &received)) {
+      struct timespec sent;
+      clock_gettime(CLOCK_REALTIME, &sent);
+      long long latency = timespec_diff_us(&sent, &received);
+      // clock stepped back
+      if likely (latency >= 0) {
+        Histogram_add(&stats->latency, latency);
+        Histogram_add(relay_latency, latency);
+      }
+    }
+    if (media_start != NULL &&
+        atomic_load_explicit(media_start, memory_order_relaxed) != 0) {
+      unsigned long long start = atomic_exchange(media_start, 0);
+      if likely (start != 0) {
+        Histogram_add(media_latency, monotonic_us() - start);
+      }
+    }
   }
 
+  if (threads != NULL) {
+    MetricGauge_add(threads, -1);
+  }
   return 0;
 }
 
@@ -67,6 +211,10 @@ int Forwarder_start (struct Forwarder *self) {
 
   return_if_fail (single_acquire(&self->state)) 0;
 
+  union sockaddr_in46 peer;
+  socklen_t peerlen = sizeof(peer);
+  bool connected = getpeername(self->socket2, &peer.sock, &peerlen) == 0;
+
   for (int i = 0; i < 2; i++) {
     struct HalfForwarder *half = malloc(sizeof(struct HalfForwarder));
     goto_if_fail (half != NULL) fail;
@@ -74,11 +222,32 @@ int Forwarder_start (struct Forwarder *self) {
     if (i == 0) {
       half->from = self->socket1;
       half->to = self->socket2;
+      half->latch = false;
+      half->filter = NULL;
     } else {
       half->from = self->socket2;
       half->to = self->socket1;
+      half->latch = !connected;
+      half->filter = self->filter;
     }
+    half->filter_arg = self->filter_arg;
     half->mtu = self->mtu;
+    half->tap = self->tap;
+    half->packets = self->packets == NULL ? NULL : &self->packets[i];
+    half->bytes = self->bytes == NULL ? NULL : &self->bytes[i];
+    half->threads = self->threads;
+    half->media_start = self->media_start;
+    half->media_latency = self->media_latency;
+    half->relay_latency = self->relay_latency;
+    half->trace_id = self->trace_id;
+    half->stats = &self->stats[i];
+    if (self->tap != NULL) {
+      socklen_t locallen = sizeof(half->local);
+      should (getsockname(
+          half->from, &half->local.sock, &locallen) == 0) otherwise {
+        half->local.sa_family = AF_UNSPEC;
+      }
+    }
     should (thrd_execute(
         HalfForwarder_mainloop, half) == thrd_success) otherwise {
       free(half);
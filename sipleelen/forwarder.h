@@ -5,8 +5,32 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "utils/histogram.h"
 #include "utils/single.h"
+// #include "utils/metrics.h"
+struct MetricCounter;
+struct MetricGauge;
+// #include "utils/pcaptap.h"
+struct PcapTap;
+
 
+/**
+ * @ingroup sip
+ * @brief Statistics of one direction of Forwarder, written by its thread
+ *  only.
+ */
+struct ForwarderStats {
+  /// forwarded packets
+  _Alignas(64) atomic_ulong packets;
+  /// forwarded bytes
+  atomic_ulong bytes;
+  /// latency from kernel receive to send, in microseconds, if
+  /// Forwarder::relay_latency is set
+  struct Histogram latency;
+};
 
 /**
  * @ingroup sip
@@ -22,8 +46,37 @@ struct Forwarder {
   unsigned short mtu;
   /// socket 1
   int socket1;
-  /// socket 2
+  /// socket 2, connected to the source of its first packet if not connected
   int socket2;
+  /// inspector of packets from socket 2, returns nonzero to drop the packet,
+  /// called in forwarder thread; can be @c NULL
+  int (*filter) (void *arg, const void *buf, int len);
+  /// argument of Forwarder::filter
+  void *filter_arg;
+  /// capture tap of received packets, can be @c NULL
+  struct PcapTap *tap;
+  /// counters of forwarded packets, from socket 1 and from socket 2; can be
+  /// @c NULL
+  struct MetricCounter *packets;
+  /// counters of forwarded bytes, from socket 1 and from socket 2; must be set
+  /// if Forwarder::packets is set
+  struct MetricCounter *bytes;
+  /// gauge of running threads, can be @c NULL
+  struct MetricGauge *threads;
+  /// start time of relaying, in microseconds, cleared by the first forwarded
+  /// packet of any forwarder sharing it; can be @c NULL
+  atomic_ullong *media_start;
+  /// histogram of latency from Forwarder::media_start to the first forwarded
+  /// packet; must be set if Forwarder::media_start is set
+  struct Histogram *media_latency;
+  /// histogram of latency from kernel receive to send of every forwarded
+  /// packet, shared by all forwarders; if set, sockets are timestamped with
+  /// @c SO_TIMESTAMPING; can be @c NULL
+  struct Histogram *relay_latency;
+  /// correlation ID of trace spans
+  uint32_t trace_id;
+  /// statistics, from socket 1 and from socket 2
+  struct ForwarderStats stats[2];
 };
 
 __attribute__((nonnull))
@@ -75,6 +128,21 @@ static inline int Forwarder_init (struct Forwarder *self, unsigned short mtu) {
   self->mtu = mtu;
   self->socket1 = -1;
   self->socket2 = -1;
+  self->filter = NULL;
+  self->filter_arg = NULL;
+  self->tap = NULL;
+  self->packets = NULL;
+  self->bytes = NULL;
+  self->threads = NULL;
+  self->media_start = NULL;
+  self->media_latency = NULL;
+  self->relay_latency = NULL;
+  self->trace_id = 0;
+  for (int i = 0; i < 2; i++) {
+    atomic_init(&self->stats[i].packets, 0);
+    atomic_init(&self->stats[i].bytes, 0);
+    Histogram_reset(&self->stats[i].latency);
+  }
   return 0;
 }
 
@@ -0,0 +1,270 @@
+#include <dirent.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <sys/resource.h>
+#include <sys/time.h>  // osip
+
+#include <osip2/osip.h>
+
+#include "utils/macro.h"
+#include "utils/array.h"
+#include "utils/histogram.h"
+#include "utils/metrics.h"
+#include "leelen/voip/dialog.h"
+#include "session.h"
+#include "sipleelen.h"
+#include "metrics.h"
+
+
+/// names of ::SIPLeelenMethod
+static const char * const sipleelen_method_names[SIPLEELEN_METHOD_COUNT] = {
+  "INVITE", "ACK", "BYE", "CANCEL", "OPTIONS", "REGISTER", "INFO", "other",
+};
+
+/// names of ::SIPLeelenDirection for SIP messages
+static const char * const sipleelen_sip_direction_names[
+    SIPLEELEN_DIRECTION_COUNT] = {"received", "sent"};
+
+/// names of ::SIPLeelenDirection for media
+static const char * const sipleelen_relay_direction_names[
+    SIPLEELEN_DIRECTION_COUNT] = {"leelen_to_sip", "sip_to_leelen"};
+
+
+void SIPLeelenMetrics_count_sip (
+    struct SIPLeelenMetrics *self, const osip_message_t *msg, int direction) {
+  if (MSG_IS_RESPONSE(msg)) {
+    int class = msg->status_code / 100;
+    return_if_fail (1 <= class && class <= 6);
+    MetricCounter_inc(&self->sip_responses[direction][class - 1]);
+    return;
+  }
+
+  int method = 0;
+  for (; method < SIPLEELEN_METHOD_OTHER; method++) {
+    break_if (msg->sip_method != NULL &&
+              strcmp(msg->sip_method, sipleelen_method_names[method]) == 0);
+  }
+  MetricCounter_inc(&self->sip_requests[direction][method]);
+}
+
+
+void SIPLeelenMetrics_reset (struct SIPLeelenMetrics *self) {
+  for (int i = 0; i < SIPLEELEN_DIRECTION_COUNT; i++) {
+    for (int j = 0; j < SIPLEELEN_METHOD_COUNT; j++) {
+      MetricCounter_reset(&self->sip_requests[i][j]);
+    }
+    for (int j = 0; j < 6; j++) {
+      MetricCounter_reset(&self->sip_responses[i][j]);
+    }
+    for (int j = 0; j < 2; j++) {
+      MetricCounter_reset(&self->relay_packets[j][i]);
+      MetricCounter_reset(&self->relay_bytes[j][i]);
+    }
+  }
+  MetricGauge_reset(&self->forwarders);
+}
+
+
+/**
+ * @brief Count open file descriptors of this process.
+ *
+ * @return Number of file descriptors, or -1 on error.
+ */
+static int count_fds (void) {
+  DIR *dir = opendir("/proc/self/fd");
+  return_if_fail (dir != NULL) -1;
+  int n = 0;
+  for (struct dirent *ent; (ent = readdir(dir)) != NULL; ) {
+    continue_if (ent->d_name[0] == '.');
+    n++;
+  }
+  closedir(dir);
+  // not counting the descriptor of dir itself
+  return n - 1;
+}
+
+
+void SIPLeelen_collect_metrics (void *arg, FILE *f) {
+  struct SIPLeelen *self = arg;
+  const struct SIPLeelenMetrics *metrics = &self->metrics;
+  char labels[96];
+
+  // SIP
+  metrics_write_family(
+    f, "leelen2sip_sip_requests_total", "counter", "SIP requests.");
+  for (int i = 0; i < SIPLEELEN_DIRECTION_COUNT; i++) {
+    for (int j = 0; j < SIPLEELEN_METHOD_COUNT; j++) {
+      snprintf(labels, sizeof(labels), "direction=\"%s\",method=\"%s\"",
+               sipleelen_sip_direction_names[i], sipleelen_method_names[j]);
+      metrics_write_sample(
+        f, "leelen2sip_sip_requests_total", labels,
+        MetricCounter_get(&metrics->sip_requests[i][j]));
+    }
+  }
+  metrics_write_family(
+    f, "leelen2sip_sip_responses_total", "counter", "SIP responses.");
+  for (int i = 0; i < SIPLEELEN_DIRECTION_COUNT; i++) {
+    for (int j = 0; j < 6; j++) {
+      snprintf(labels, sizeof(labels), "direction=\"%s\",code=\"%dxx\"",
+               sipleelen_sip_direction_names[i], j + 1);
+      metrics_write_sample(
+        f, "leelen2sip_sip_responses_total", labels,
+        MetricCounter_get(&metrics->sip_responses[i][j]));
+    }
+  }
+
+  // OSIP transactions
+  const struct {
+    const char *name;
+    osip_list_t *list;
+  } fsms[] = {
+    {"ict", &self->osip->osip_ict_transactions},
+    {"ist", &self->osip->osip_ist_transactions},
+    {"nict", &self->osip->osip_nict_transactions},
+    {"nist", &self->osip->osip_nist_transactions},
+  };
+  metrics_write_family(
+    f, "leelen2sip_sip_transactions", "gauge",
+    "SIP transactions, by state machine.");
+  for (int i = 0; i < (int) arraysize(fsms); i++) {
+    snprintf(labels, sizeof(labels), "type=\"%s\"", fsms[i].name);
+    metrics_write_sample(
+      f, "leelen2sip_sip_transactions", labels, osip_list_size(fsms[i].list));
+  }
+
+  // sessions
+  int n_state[LEELEN_DIALOG_STATE_COUNT] = {0};
+  int n_ringing = 0;
+  mtx_lock(&self->mtx_sessions);
+  forindex (int, i, self->sessions, self->n_session) {
+    const struct SIPLeelenSession *session = self->sessions[i];
+    if (session->leelen.state < arraysize(n_state)) {
+      n_state[session->leelen.state]++;
+    }
+    if (session->ring != NULL) {
+      n_ringing++;
+    }
+  }
+  mtx_unlock(&self->mtx_sessions);
+  metrics_write_family(
+    f, "leelen2sip_sessions", "gauge", "Sessions, by LEELEN dialog state.");
+  for (int i = 0; i < (int) arraysize(n_state); i++) {
+    snprintf(labels, sizeof(labels), "state=\"%s\"",
+             LeelenDialogState_names[i]);
+    metrics_write_sample(f, "leelen2sip_sessions", labels, n_state[i]);
+  }
+  metrics_write_family(
+    f, "leelen2sip_ring_groups", "gauge", "Sessions calling a ring group.");
+  metrics_write_sample(f, "leelen2sip_ring_groups", NULL, n_ringing);
+
+  // discovery
+  const struct LeelenDiscovery *leelen = &self->leelen;
+  metrics_write_family(
+    f, "leelen2sip_discoveries_total", "counter",
+    "Peer discoveries, by result.");
+  metrics_write_sample(
+    f, "leelen2sip_discoveries_total", "result=\"found\"",
+    atomic_load_explicit(&leelen->n_found, memory_order_relaxed));
+  metrics_write_sample(
+    f, "leelen2sip_discoveries_total", "result=\"timeout\"",
+    atomic_load_explicit(&leelen->n_timeout, memory_order_relaxed));
+  metrics_write_family(
+    f, "leelen2sip_discovery_routes_total", "counter",
+    "Lookups of the interface a phone number was found on.");
+  metrics_write_sample(
+    f, "leelen2sip_discovery_routes_total", "result=\"hit\"",
+    atomic_load_explicit(&leelen->n_route_hit, memory_order_relaxed));
+  metrics_write_sample(
+    f, "leelen2sip_discovery_routes_total", "result=\"miss\"",
+    atomic_load_explicit(&leelen->n_route_miss, memory_order_relaxed));
+  metrics_write_family(
+    f, "leelen2sip_discovery_dropped_total", "counter",
+    "Discovery packets dropped, either truncated or rate limited.");
+  metrics_write_sample(
+    f, "leelen2sip_discovery_dropped_total", NULL,
+    atomic_load_explicit(&leelen->n_dropped, memory_order_relaxed));
+  metrics_write_family(
+    f, "leelen2sip_discovery_late_total", "counter",
+    "Advertisements arrived when no discovery is waiting.");
+  metrics_write_sample(
+    f, "leelen2sip_discovery_late_total", NULL,
+    atomic_load_explicit(&leelen->n_late, memory_order_relaxed));
+  metrics_write_histogram(
+    f, "leelen2sip_discovery_latency_us",
+    "Latency of peer discovery, in microseconds.", &leelen->latency);
+
+  // relay
+  static const char * const media_names[2] = {"audio", "video"};
+  metrics_write_family(
+    f, "leelen2sip_relay_packets_total", "counter", "Relayed media packets.");
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < SIPLEELEN_DIRECTION_COUNT; j++) {
+      snprintf(labels, sizeof(labels), "media=\"%s\",direction=\"%s\"",
+               media_names[i], sipleelen_relay_direction_names[j]);
+      metrics_write_sample(
+        f, "leelen2sip_relay_packets_total", labels,
+        MetricCounter_get(&metrics->relay_packets[i][j]));
+    }
+  }
+  metrics_write_family(
+    f, "leelen2sip_relay_bytes_total", "counter", "Relayed media bytes.");
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < SIPLEELEN_DIRECTION_COUNT; j++) {
+      snprintf(labels, sizeof(labels), "media=\"%s\",direction=\"%s\"",
+               media_names[i], sipleelen_relay_direction_names[j]);
+      metrics_write_sample(
+        f, "leelen2sip_relay_bytes_total", labels,
+        MetricCounter_get(&metrics->relay_bytes[i][j]));
+    }
+  }
+  metrics_write_family(
+    f, "leelen2sip_relay_threads", "gauge", "Running forwarder threads.");
+  metrics_write_sample(
+    f, "leelen2sip_relay_threads", NULL,
+    MetricGauge_get(&metrics->forwarders));
+
+  // latency
+  metrics_write_histogram(
+    f, "leelen2sip_open_gate_latency_us",
+    "Latency from DTMF digit to LEELEN ack of opening the gate, in "
+    "microseconds.", &self->open_gate_latency);
+  metrics_write_histogram(
+    f, "leelen2sip_ring_latency_us",
+    "Latency from LEELEN invitation to SIP client ringing, in microseconds.",
+    &self->ring_latency);
+  metrics_write_histogram(
+    f, "leelen2sip_trying_latency_us",
+    "Latency from SIP INVITE to 100 Trying sent, in microseconds.",
+    &self->trying_latency);
+  metrics_write_histogram(
+    f, "leelen2sip_call_ack_latency_us",
+    "Latency from LEELEN invitation sent to its ACK, in microseconds.",
+    &self->call_ack_latency);
+  metrics_write_histogram(
+    f, "leelen2sip_answer_latency_us",
+    "Latency from LEELEN answer to SIP 200 OK sent, in microseconds.",
+    &self->answer_latency);
+  metrics_write_histogram(
+    f, "leelen2sip_media_latency_us",
+    "Latency from SIP 200 OK to the first relayed media packet, in "
+    "microseconds.", &self->media_latency);
+  if (self->relay_timestamps) {
+    metrics_write_histogram(
+      f, "leelen2sip_relay_latency_us",
+      "Latency from kernel receive to send of relayed media packets, in "
+      "microseconds.", &self->relay_latency);
+  }
+
+  // process
+  metrics_write_family(
+    f, "leelen2sip_open_fds", "gauge", "Open file descriptors.");
+  metrics_write_sample(f, "leelen2sip_open_fds", NULL, count_fds());
+  struct rlimit rlim;
+  if likely (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+    metrics_write_family(
+      f, "leelen2sip_max_fds", "gauge", "Maximum open file descriptors.");
+    metrics_write_sample(f, "leelen2sip_max_fds", NULL, rlim.rlim_cur);
+  }
+}
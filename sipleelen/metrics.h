@@ -0,0 +1,109 @@
+#ifndef SIPLEELEN_METRICS_H
+#define SIPLEELEN_METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <sys/time.h>  // osip
+
+#include <osip2/osip.h>
+
+#include "utils/metrics.h"
+// #include "sipleelen.h"
+struct SIPLeelen;
+
+
+/**
+ * @ingroup sip
+ * @brief SIP methods counted separately.
+ */
+enum SIPLeelenMethod {
+  SIPLEELEN_METHOD_INVITE = 0,
+  SIPLEELEN_METHOD_ACK,
+  SIPLEELEN_METHOD_BYE,
+  SIPLEELEN_METHOD_CANCEL,
+  SIPLEELEN_METHOD_OPTIONS,
+  SIPLEELEN_METHOD_REGISTER,
+  SIPLEELEN_METHOD_INFO,
+  /// any other method
+  SIPLEELEN_METHOD_OTHER,
+  SIPLEELEN_METHOD_COUNT,
+};
+
+
+/**
+ * @ingroup sip
+ * @brief Direction of counted traffic.
+ */
+enum SIPLeelenDirection {
+  /// SIP message received, or media from LEELEN to SIP
+  SIPLEELEN_DIRECTION_IN = 0,
+  /// SIP message sent, or media from SIP to LEELEN
+  SIPLEELEN_DIRECTION_OUT,
+  SIPLEELEN_DIRECTION_COUNT,
+};
+
+
+/**
+ * @ingroup sip
+ * @brief Counters of LEELEN2SIP object, summed only when scraped.
+ *
+ * Gauges that the executer thread can compute by itself, like sessions by
+ * state or transactions by FSM type, are not kept here but computed in
+ * SIPLeelen_collect_metrics().
+ */
+struct SIPLeelenMetrics {
+  /// SIP requests, by direction and method
+  struct MetricCounter sip_requests[
+    SIPLEELEN_DIRECTION_COUNT][SIPLEELEN_METHOD_COUNT];
+  /// SIP responses, by direction and status class (1xx to 6xx)
+  struct MetricCounter sip_responses[SIPLEELEN_DIRECTION_COUNT][6];
+  /// relayed packets, by media (audio, video) and direction
+  struct MetricCounter relay_packets[2][SIPLEELEN_DIRECTION_COUNT];
+  /// relayed bytes, by media (audio, video) and direction
+  struct MetricCounter relay_bytes[2][SIPLEELEN_DIRECTION_COUNT];
+  /// number of running forwarder threads
+  struct MetricGauge forwarders;
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelenMetrics
+ * @brief Count a SIP message.
+ *
+ * @param self Counters.
+ * @param msg SIP message.
+ * @param direction Direction, see ::SIPLeelenDirection.
+ */
+void SIPLeelenMetrics_count_sip (
+  struct SIPLeelenMetrics *self, const osip_message_t *msg, int direction);
+
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof SIPLeelenMetrics
+ * @brief Reset counters.
+ *
+ * @param[out] self Counters.
+ */
+void SIPLeelenMetrics_reset (struct SIPLeelenMetrics *self);
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelen
+ * @brief Write metrics as Prometheus text.
+ *
+ * Must be called in executer thread, which owns OSIP stack.
+ *
+ * @param arg LEELEN2SIP object.
+ * @param f Output.
+ */
+void SIPLeelen_collect_metrics (void *arg, FILE *f);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIPLEELEN_METRICS_H */
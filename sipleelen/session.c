@@ -1,11 +1,15 @@
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/time.h>  // osip
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
 #include <inet46i/sockaddr46.h>
@@ -16,9 +20,14 @@
 #include "utils/macro.h"
 #include "utils/log.h"
 #include "utils/osip.h"
+#include "utils/pcaptap.h"
 #include "utils/refcount.h"
+#include "utils/rtp.h"
+#include "utils/timeval.h"
 #include "leelen/config.h"
 #include "leelen/voip/dialog.h"
+#include "leelen/voip/protocol.h"
+#include "cdr.h"
 #include "forwarder.h"
 #include "sipleelen.h"
 #include "transaction.h"
@@ -33,13 +42,123 @@ bool SIPLeelenSession_established (struct SIPLeelenSession *self) {
   if (self->sip != NULL) {
     return_if (self->sip->state != DIALOG_CLOSE) true;
   }
-  return false;
+  return SIPLeelenSession_ringing(self);
+}
+
+
+bool SIPLeelenSession_ringing (struct SIPLeelenSession *self) {
+  bool ret = false;
+  mtx_lock(&self->mtx);
+  if (self->leelen.id == 0) {
+    for (int i = 0; i < self->n_ring; i++) {
+      const struct LeelenDialog *dialog = &self->ring[i];
+      continue_if (dialog->id == 0);
+      if (dialog->state == LEELEN_DIALOG_CONNECTING ||
+          dialog->state == LEELEN_DIALOG_CONNECTED) {
+        ret = true;
+        break;
+      }
+    }
+  }
+  mtx_unlock(&self->mtx);
+  return ret;
+}
+
+
+struct LeelenDialog *SIPLeelenSession_find_ring (
+    struct SIPLeelenSession *self, leelen_id_t id) {
+  return_if_fail (id != 0) NULL;
+  for (int i = 0; i < self->n_ring; i++) {
+    return_if (self->ring[i].id == id) &self->ring[i];
+  }
+  return NULL;
+}
+
+
+void SIPLeelenSession_retransmit_ring (struct SIPLeelenSession *self) {
+  mtx_lock(&self->mtx);
+  for (int i = 0; i < self->n_ring; i++) {
+    struct LeelenDialog *dialog = &self->ring[i];
+    continue_if (dialog->id == 0);
+    should (LeelenDialog_retransmit(
+        dialog, self->device->socket_leelen) >= 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+                 ": Cannot retransmit LEELEN message", dialog->id);
+    }
+  }
+  mtx_unlock(&self->mtx);
+}
+
+
+int SIPLeelenSession_expire_ring (struct SIPLeelenSession *self, time_t now) {
+  int n_open = 0;
+
+  mtx_lock(&self->mtx);
+  for (int i = 0; i < self->n_ring; i++) {
+    struct LeelenDialog *dialog = &self->ring[i];
+    continue_if (dialog->id == 0);
+
+    switch (dialog->state) {
+      case LEELEN_DIALOG_CONNECTING:
+      case LEELEN_DIALOG_DISCONNECTING:
+        // does nothing if waiting for ack
+        break_if (!LeelenDialog_ack_timeout(dialog));
+        goto close;
+      case LEELEN_DIALOG_CONNECTED:
+        // ringing for too long
+        break_if (!LeelenDialog_dialog_timeout(dialog, now));
+        LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Ring timeout",
+            dialog->id);
+        should (LeelenDialog_may_bye(
+            dialog, self->device->socket_leelen) >= 0) otherwise {
+          LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+                     ": Cannot close LEELEN session", dialog->id);
+          goto close;
+        }
+        break;
+      default:
+close:
+        LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Ring end", dialog->id);
+        LeelenDialog_destroy(dialog);
+        continue;
+    }
+    n_open++;
+  }
+
+  if (n_open == 0) {
+    free(self->ring);
+    self->ring = NULL;
+    self->n_ring = 0;
+  }
+  mtx_unlock(&self->mtx);
+  return n_open;
+}
+
+
+int SIPLeelenSession_bye_ring (
+    struct SIPLeelenSession *self, const struct LeelenDialog *except) {
+  int ret = 0;
+  for (int i = 0; i < self->n_ring; i++) {
+    struct LeelenDialog *dialog = &self->ring[i];
+    continue_if (dialog->id == 0 || dialog == except);
+    should (LeelenDialog_may_bye(
+        dialog, self->device->socket_leelen) >= 0) otherwise {
+      // nothing to wait for
+      LeelenDialog_destroy(dialog);
+      ret = -1;
+    }
+  }
+  return ret;
 }
 
 
 int SIPLeelenSession_bye_leelen (struct SIPLeelenSession *self) {
+  mtx_lock(&self->mtx);
+  int ret = SIPLeelenSession_bye_ring(self, NULL);
+  mtx_unlock(&self->mtx);
+
   return_if (likely (LeelenDialog_may_bye(
-    &self->leelen, self->device->socket_leelen) >= 0)) 0;
+    &self->leelen, self->device->socket_leelen) >= 0)) ret;
   self->leelen.state = LEELEN_DIALOG_DISCONNECTED;
   self->leelen.last_activity = time(NULL);
   return -1;
@@ -47,11 +166,18 @@ int SIPLeelenSession_bye_leelen (struct SIPLeelenSession *self) {
 
 
 int SIPLeelenSession_bye_sip (struct SIPLeelenSession *self, bool now) {
-  return_if_fail (self->sip != NULL) 255;
-
   osip_message_t *request;
-  return_if_fail (osip_message_request(
-    &request, self->sip, "BYE", self->device->ua) == OSIP_SUCCESS) -1;
+  if (self->sip != NULL) {
+    return_if_fail (osip_message_request(
+      &request, self->sip, "BYE", self->device->ua) == OSIP_SUCCESS) -1;
+  } else {
+    // our INVITE not answered yet
+    osip_transaction_t *invite_tr = self->transaction;
+    return_if_fail (invite_tr != NULL && invite_tr->ctx_type == ICT) 255;
+    return_if_fail (osip_message_cancel(
+      &request, invite_tr->orig_request, self->device->ua
+    ) == OSIP_SUCCESS) -1;
+  }
   osip_event_t *event = osip_new_outgoing_sipmessage(request);
   should (event != NULL) otherwise {
     osip_message_free(request);
@@ -74,6 +200,7 @@ int SIPLeelenSession_bye_sip (struct SIPLeelenSession *self, bool now) {
   tr->out_socket = self->device->socket_sip;
   tr->reserved1 = self;
   SIPTransactionData_get(tr, out_af) = self->device->addr.sa_family;
+  SIPTransactionData_get(tr, trace_id) = self->trace_id;
 
   // transaction needs one reference
   SIPLeelenSession_incref(self);
@@ -106,6 +233,101 @@ int SIPLeelenSession_bye (struct SIPLeelenSession *self, bool now) {
 }
 
 
+/**
+ * @memberof SIPLeelenSession
+ * @private
+ * @brief Inspect RTP packets from SIP to LEELEN for DTMF digits.
+ *
+ * Called in audio forwarder thread. Telephone events are dropped, since LEELEN
+ * devices do not understand them.
+ *
+ * @param arg LEELEN2SIP session.
+ * @param buf Packet.
+ * @param len Length of packet.
+ * @return 0 if the packet should be forwarded, 1 if dropped.
+ */
+static int SIPLeelenSession_dtmf (void *arg, const void *buf, int len) {
+  struct SIPLeelenSession *self = arg;
+
+  uint32_t timestamp;
+  int event = rtp_telephone_event(
+    buf, len, RTP_TELEPHONE_EVENT_TYPE, &timestamp);
+  return_if (likely (event < 0)) 0;
+
+  // an event spans several packets, and its end is sent 3 times
+  return_if (self->dtmf_seen && timestamp == self->dtmf_timestamp) 1;
+  self->dtmf_seen = true;
+  self->dtmf_timestamp = timestamp;
+
+  LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": DTMF %c", self->leelen.id,
+      event < (int) sizeof(RTP_DTMF_DIGITS) - 1 ?
+        RTP_DTMF_DIGITS[event] : '?');
+  return_if (event != self->device->open_gate_event) 1;
+
+  // hand over to executer thread, which owns the LEELEN dialog
+  atomic_store(&self->open_gate_start, monotonic_us());
+  atomic_store(&self->open_gate, true);
+  should (eventfd_write(self->device->socket_wakeup, 1) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "eventfd_write() failed");
+  }
+  return 1;
+}
+
+
+int SIPLeelenSession_open_gate (struct SIPLeelenSession *self) {
+  return_if_fail (atomic_exchange(&self->open_gate, false)) 0;
+  should (self->leelen.state == LEELEN_DIALOG_CONNECTED) otherwise {
+    atomic_store(&self->open_gate_start, 0);
+    return 0;
+  }
+  LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID ": Open gate", self->leelen.id);
+  return LeelenDialog_sendcode(
+    &self->leelen, LEELEN_CODE_OPEN_GATE, self->device->socket_leelen);
+}
+
+
+void SIPLeelenSession_tap (
+    struct SIPLeelenSession *self, struct LeelenDialog *dialog,
+    const osip_call_id_t *call_id) {
+  struct PcapTap *tap = self->device->tap;
+  return_if (likely (tap == NULL));
+  return_if_fail (PcapTap_match(
+    tap, dialog->id, call_id == NULL ? NULL : call_id->number,
+    call_id == NULL ? NULL : call_id->host));
+
+  if (tap->classes & PCAP_TAP_LEELEN) {
+    dialog->tap = tap;
+  }
+  if (tap->classes & PCAP_TAP_MEDIA) {
+    self->audio.tap = tap;
+    self->video.tap = tap;
+  }
+}
+
+
+void SIPLeelenSession_set_cdr (
+    struct SIPLeelenSession *self, const osip_message_t *invite,
+    bool outgoing) {
+  struct CdrRecord *cdr = &self->cdr;
+  cdr->outgoing = outgoing;
+
+  const osip_call_id_t *call_id = invite->call_id;
+  if (call_id != NULL && call_id->number != NULL) {
+    snprintf(cdr->call_id, sizeof(cdr->call_id), "%s%s%s", call_id->number,
+             call_id->host == NULL ? "" : "@",
+             call_id->host == NULL ? "" : call_id->host);
+  }
+  const char *caller = invite->from == NULL ? NULL :
+    osip_uri_get_username(osip_from_get_url(invite->from));
+  snprintf(cdr->caller, sizeof(cdr->caller), "%s",
+           caller == NULL ? "" : caller);
+  const char *callee = invite->to == NULL ? NULL :
+    osip_uri_get_username(osip_to_get_url(invite->to));
+  snprintf(cdr->callee, sizeof(cdr->callee), "%s",
+           callee == NULL ? "" : callee);
+}
+
+
 int SIPLeelenSession_connect (
     struct SIPLeelenSession *self, in_port_t *audio, in_port_t *video) {
   if (audio != NULL && (
@@ -192,16 +414,35 @@ int SIPLeelenSession_connect (
 void SIPLeelenSession_destroy (struct SIPLeelenSession *self) {
   single_stop(&self->invite_state);
 
+  // forwarder threads may use the session
+  Forwarder_destroy(&self->audio);
+  Forwarder_destroy(&self->video);
+
+  if (self->device->cdr != NULL) {
+    struct CdrRecord *cdr = &self->cdr;
+    cdr->id = self->leelen.id;
+    cdr->end = realtime_us();
+    const struct Forwarder *forwarders[2] = {&self->audio, &self->video};
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++) {
+        cdr->bytes[i][j] = atomic_load_explicit(
+          &forwarders[i]->stats[j].bytes, memory_order_relaxed);
+      }
+    }
+    should (CdrWriter_push(self->device->cdr, cdr)) otherwise {
+      LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+          ": CDR queue full, record dropped", cdr->id);
+    }
+  }
+
   LeelenDialog_destroy(&self->leelen);
+  free(self->ring);
   if (self->sip != NULL) {
     osip_dialog_free(self->sip);
   }
   // do not free self->transaction
   mtx_destroy(&self->mtx);
 
-  Forwarder_destroy(&self->audio);
-  Forwarder_destroy(&self->video);
-
   single_join(&self->invite_state);
 }
 
@@ -212,6 +453,8 @@ int SIPLeelenSession_init (
 
   self->device = device;
   self->leelen.id = 0;
+  self->leelen.state = LEELEN_DIALOG_DISCONNECTED;
+  self->trace_id = 0;
   self->sip = NULL;
   self->transaction = NULL;
 
@@ -222,8 +465,22 @@ int SIPLeelenSession_init (
   int mtu = min(device->mtu, device->leelen.config->mtu);
   Forwarder_init(&self->audio, mtu);
   Forwarder_init(&self->video, mtu);
+  self->audio.filter = SIPLeelenSession_dtmf;
+  self->audio.filter_arg = self;
+  self->audio.media_start = &self->media_start;
+  self->video.media_start = &self->media_start;
 
   self->invite_state = SINGLE_FLAG_INIT;
+  self->ring = NULL;
+  self->n_ring = 0;
+  self->dtmf_seen = false;
+  atomic_init(&self->open_gate, false);
+  atomic_init(&self->open_gate_start, 0);
+  self->invite_start = 0;
+  self->answer_start = 0;
+  atomic_init(&self->media_start, 0);
+  memset(&self->cdr, 0, sizeof(self->cdr));
+  self->cdr.setup = realtime_us();
   return 0;
 }
 
@@ -5,7 +5,9 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #include <sys/time.h>  // osip
 
@@ -15,13 +17,20 @@ extern "C" {
 
 #include "utils/refcount.h"
 #include "utils/single.h"
+#include "utils/timeval.h"
 #include "leelen/number.h"
+#include "leelen/route.h"
 #include "leelen/voip/dialog.h"
+#include "cdr.h"
 #include "forwarder.h"
 // #include "sipleelen.h"
 struct SIPLeelen;
 
 
+/// maximum number of dialogs in a ring group, one per extension
+#define SIPLEELEN_RING_SIZE 10
+
+
 /**
  * @ingroup sip
  * @brief LEELEN2SIP SIP session.
@@ -32,6 +41,10 @@ struct SIPLeelenSession {
 
   /// LEELEN dialog
   struct LeelenDialog leelen;
+  /// correlation ID of trace spans; for calls from SIP, chosen before
+  /// discovery and given to SIPLeelenSession::leelen unless calling a ring
+  /// group, otherwise the ID of SIPLeelenSession::leelen
+  leelen_id_t trace_id;
   /// SIP dialog
   osip_dialog_t *sip;
   /// SIP transaction, borrowed
@@ -56,6 +69,39 @@ struct SIPLeelenSession {
   single_flag invite_state;
   /// LEELEEN phone number (for SIP INVITE)
   struct LeelenNumber number;
+  /// route of SIPLeelenSession::number, looked up once per INVITE so that a
+  /// dial plan reload does not change it midway
+  struct LeelenRoute route;
+
+  /// dialogs of ring group, when calling all extensions of a room, protected
+  /// by SIPLeelenSession::mtx; the first one accepted is moved to
+  /// SIPLeelenSession::leelen
+  struct LeelenDialog *ring;
+  /// number of dialogs in SIPLeelenSession::ring, including closed ones
+  unsigned char n_ring;
+
+  /// RTP timestamp of the last DTMF event, for deduplication; used by audio
+  /// forwarder thread only
+  uint32_t dtmf_timestamp;
+  /// @c true if SIPLeelenSession::dtmf_timestamp is valid
+  bool dtmf_seen;
+  /// @c true if @ref LEELEN_CODE_OPEN_GATE should be sent by executer thread
+  atomic_bool open_gate;
+  /// monotonic time when the open-gate digit arrived, in microseconds, or 0
+  /// if not waiting for ack
+  atomic_ullong open_gate_start;
+  /// monotonic time when the LEELEN invitation arrived, in microseconds, or 0
+  /// if SIP client is not ringing yet
+  unsigned long long invite_start;
+  /// monotonic time when the LEELEN answer arrived, in microseconds, or 0 if
+  /// SIP 200 OK has been sent; used by executer thread only
+  unsigned long long answer_start;
+  /// monotonic time of SIP 200 OK, in microseconds, or 0 if the first media
+  /// packet has been relayed
+  atomic_ullong media_start;
+
+  /// call detail record, completed and written when destroyed
+  struct CdrRecord cdr;
 };
 
 __attribute__((warn_unused_result, nonnull))
@@ -67,6 +113,98 @@ __attribute__((warn_unused_result, nonnull))
  * @return @c true if established.
  */
 bool SIPLeelenSession_established (struct SIPLeelenSession *self);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Test if session is calling a ring group and no one has accepted.
+ *
+ * @param self LEELEN2SIP session.
+ * @return @c true if ringing.
+ */
+bool SIPLeelenSession_ringing (struct SIPLeelenSession *self);
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Find the ring group dialog of an ID.
+ *
+ * @note Caller should hold @p self->mtx.
+ *
+ * @param self LEELEN2SIP session.
+ * @param id Dialog ID.
+ * @return Dialog, or @c NULL if not found.
+ */
+struct LeelenDialog *SIPLeelenSession_find_ring (
+  struct SIPLeelenSession *self, leelen_id_t id);
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Retransmit unacknowledged messages of ring group dialogs.
+ *
+ * @param self LEELEN2SIP session.
+ */
+void SIPLeelenSession_retransmit_ring (struct SIPLeelenSession *self);
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Close timed out ring group dialogs, and free the ring group when all
+ *  dialogs are closed.
+ *
+ * @param self LEELEN2SIP session.
+ * @param now Current time.
+ * @return Number of dialogs still open.
+ */
+int SIPLeelenSession_expire_ring (struct SIPLeelenSession *self, time_t now);
+__attribute__((nonnull(1)))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Send BYE to ring group dialogs.
+ *
+ * @note Caller should hold @p self->mtx.
+ *
+ * @param self LEELEN2SIP session.
+ * @param except Dialog to skip. Can be @c NULL.
+ * @return 0 on success, -1 if any BYE was not sent and @c errno is set
+ *  appropriately.
+ */
+int SIPLeelenSession_bye_ring (
+  struct SIPLeelenSession *self, const struct LeelenDialog *except);
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Send @ref LEELEN_CODE_OPEN_GATE if requested by DTMF.
+ *
+ * @param self LEELEN2SIP session.
+ * @return 0 on success or nothing to send, -1 on error and @c errno is set
+ *  appropriately.
+ */
+int SIPLeelenSession_open_gate (struct SIPLeelenSession *self);
+__attribute__((nonnull(1, 2)))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Attach capture tap to a dialog and media forwarders, if the session
+ *  passes the filter of SIPLeelen::tap.
+ *
+ * @param self LEELEN2SIP session.
+ * @param dialog LEELEN dialog of the session, just initialized.
+ * @param call_id SIP Call-ID. Can be @c NULL.
+ */
+void SIPLeelenSession_tap (
+  struct SIPLeelenSession *self, struct LeelenDialog *dialog,
+  const osip_call_id_t *call_id);
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Record Call-ID, caller and callee of the session.
+ *
+ * @param self LEELEN2SIP session.
+ * @param invite SIP INVITE request.
+ * @param outgoing @c true if called from LEELEN to SIP.
+ */
+void SIPLeelenSession_set_cdr (
+  struct SIPLeelenSession *self, const osip_message_t *invite, bool outgoing);
 
 __attribute__((nonnull))
 /**
@@ -78,6 +216,11 @@ __attribute__((nonnull))
  */
 static inline int SIPLeelenSession_start_forward (
     struct SIPLeelenSession *self) {
+  if (self->cdr.answer == 0) {
+    self->cdr.answer = realtime_us();
+  }
+  self->audio.trace_id = self->trace_id;
+  self->video.trace_id = self->trace_id;
   return
     Forwarder_start(&self->audio) == 0 && Forwarder_start(&self->video) == 0 ?
     0 : -1;
@@ -110,11 +253,13 @@ int SIPLeelenSession_bye_leelen (struct SIPLeelenSession *self);
 __attribute__((nonnull))
 /**
  * @memberof SIPLeelen
- * @brief Disconnect session on SIP half.
+ * @brief Disconnect session on SIP half, or cancel our INVITE if not answered
+ *  yet.
  *
  * @param self LEELEN2SIP object.
  * @param now Whether to send SIP transaction now.
- * @return 0 on success, 255 if @p self->sip is @c NULL, -1 if SIP stack error.
+ * @return 0 on success, 255 if neither SIP dialog nor INVITE exists, -1 if SIP
+ *  stack error.
  */
 int SIPLeelenSession_bye_sip (struct SIPLeelenSession *self, bool now);
 __attribute__((nonnull))
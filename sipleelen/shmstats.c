@@ -0,0 +1,240 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>  // osip
+
+#include <inet46i/sockaddr46.h>
+
+#include "utils/macro.h"
+#include "utils/array.h"
+#include "utils/histogram.h"
+#include "utils/metrics.h"
+#include "utils/single.h"
+#include "utils/timeval.h"
+#include "leelen/voip/dialog.h"
+#include "forwarder.h"
+#include "metrics.h"
+#include "session.h"
+#include "sipleelen.h"
+#include "shmstats.h"
+
+
+/**
+ * @memberof ShmStatsHistogram
+ * @private
+ * @brief Summarize a histogram.
+ *
+ * @param[out] self Summary.
+ * @param hist Histogram.
+ */
+static void ShmStatsHistogram_init (
+    struct ShmStatsHistogram *self, const struct Histogram *hist) {
+  self->count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+  self->sum = atomic_load_explicit(&hist->sum, memory_order_relaxed);
+  self->max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+  self->p50 = Histogram_percentile(hist, 500);
+  self->p99 = Histogram_percentile(hist, 990);
+}
+
+
+/**
+ * @memberof ShmStatsSession
+ * @private
+ * @brief Fill session statistics.
+ *
+ * @param[out] self Session statistics.
+ * @param session LEELEN2SIP session.
+ */
+static void ShmStatsSession_init (
+    struct ShmStatsSession *self, const struct SIPLeelenSession *session) {
+  const struct LeelenDialog *leelen = &session->leelen;
+  self->id = leelen->id;
+  self->state = leelen->state;
+  self->ringing = session->ring != NULL;
+  self->retransmits = leelen->retransmits;
+  self->duplicates = leelen->duplicates;
+
+  const struct Forwarder *forwarders[2] = {&session->audio, &session->video};
+  for (int i = 0; i < 2; i++) {
+    self->running[i] = single_is_running(&forwarders[i]->state);
+    for (int j = 0; j < 2; j++) {
+      self->packets[i][j] = atomic_load_explicit(
+        &forwarders[i]->stats[j].packets, memory_order_relaxed);
+      self->bytes[i][j] = atomic_load_explicit(
+        &forwarders[i]->stats[j].bytes, memory_order_relaxed);
+    }
+  }
+
+  memcpy(self->number, session->number.str, sizeof(self->number));
+  self->number[sizeof(self->number) - 1] = '\0';
+  if (leelen->id == 0) {
+    self->peer[0] = '\0';
+  } else {
+    sockaddr_toa(&leelen->theirs.sock, self->peer, sizeof(self->peer));
+  }
+}
+
+
+void SIPLeelen_publish_stats (
+    struct SIPLeelen *self, struct ShmStatsWriter *writer) {
+  unsigned long long now = monotonic_us();
+  return_if (now / 1000 - writer->published < SHM_STATS_INTERVAL);
+  writer->published = now / 1000;
+
+  struct ShmStats *stats = writer->stats;
+  struct ShmStatsGlobal global = {.published = now};
+  bool seen[SHM_STATS_SESSIONS] = {0};
+
+  // sessions
+  mtx_lock(&self->mtx_sessions);
+  global.n_session = self->n_session;
+  forindex (int, i, self->sessions, self->n_session) {
+    const struct SIPLeelenSession *session = self->sessions[i];
+    if (session->leelen.state < LEELEN_DIALOG_STATE_COUNT) {
+      global.n_state[session->leelen.state]++;
+    }
+    if (session->ring != NULL) {
+      global.n_ringing++;
+    }
+
+    // keep slot of session, or take a free one
+    int slot = -1;
+    for (int j = 0; j < SHM_STATS_SESSIONS; j++) {
+      if (writer->owners[j] == session) {
+        slot = j;
+        break;
+      }
+      if (slot < 0 && writer->owners[j] == NULL) {
+        slot = j;
+      }
+    }
+    continue_if (slot < 0);
+
+    struct ShmStatsSession data;
+    ShmStatsSession_init(&data, session);
+    // written by this thread only
+    data.started = writer->owners[slot] == session ?
+      stats->sessions[slot].data.started : now;
+    writer->owners[slot] = session;
+    seen[slot] = true;
+
+    shm_stats_write_begin(&stats->sessions[slot].seq);
+    stats->sessions[slot].data = data;
+    shm_stats_write_end(&stats->sessions[slot].seq);
+  }
+  mtx_unlock(&self->mtx_sessions);
+
+  // free slots of ended sessions
+  for (int i = 0; i < SHM_STATS_SESSIONS; i++) {
+    continue_if (writer->owners[i] == NULL || seen[i]);
+    writer->owners[i] = NULL;
+    shm_stats_write_begin(&stats->sessions[i].seq);
+    memset(&stats->sessions[i].data, 0, sizeof(stats->sessions[i].data));
+    shm_stats_write_end(&stats->sessions[i].seq);
+  }
+
+  // counters
+  const struct SIPLeelenMetrics *metrics = &self->metrics;
+  for (int i = 0; i < SIPLEELEN_DIRECTION_COUNT; i++) {
+    for (int j = 0; j < SIPLEELEN_METHOD_COUNT; j++) {
+      global.sip_requests[i] += MetricCounter_get(&metrics->sip_requests[i][j]);
+    }
+    for (int j = 0; j < 6; j++) {
+      global.sip_responses[i] +=
+        MetricCounter_get(&metrics->sip_responses[i][j]);
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < SIPLEELEN_DIRECTION_COUNT; j++) {
+      global.relay_packets[i][j] =
+        MetricCounter_get(&metrics->relay_packets[i][j]);
+      global.relay_bytes[i][j] = MetricCounter_get(&metrics->relay_bytes[i][j]);
+    }
+  }
+  global.n_forwarder = MetricGauge_get(&metrics->forwarders);
+  global.discoveries[0] =
+    atomic_load_explicit(&self->leelen.n_found, memory_order_relaxed);
+  global.discoveries[1] =
+    atomic_load_explicit(&self->leelen.n_timeout, memory_order_relaxed);
+
+  // latency
+  const struct Histogram *hists[SHM_STATS_LATENCY_COUNT] = {
+    [SHM_STATS_LATENCY_DISCOVERY] = &self->leelen.latency,
+    [SHM_STATS_LATENCY_TRYING] = &self->trying_latency,
+    [SHM_STATS_LATENCY_CALL_ACK] = &self->call_ack_latency,
+    [SHM_STATS_LATENCY_RING] = &self->ring_latency,
+    [SHM_STATS_LATENCY_ANSWER] = &self->answer_latency,
+    [SHM_STATS_LATENCY_MEDIA] = &self->media_latency,
+    [SHM_STATS_LATENCY_OPEN_GATE] = &self->open_gate_latency,
+    [SHM_STATS_LATENCY_RELAY] = &self->relay_latency,
+  };
+  for (int i = 0; i < SHM_STATS_LATENCY_COUNT; i++) {
+    ShmStatsHistogram_init(&global.latency[i], hists[i]);
+  }
+
+  shm_stats_write_begin(&stats->global_seq);
+  stats->global = global;
+  shm_stats_write_end(&stats->global_seq);
+}
+
+
+void ShmStatsWriter_destroy (struct ShmStatsWriter *self) {
+  munmap(self->stats, sizeof(struct ShmStats));
+  shm_unlink(self->name);
+  free(self->name);
+}
+
+
+int ShmStatsWriter_init (struct ShmStatsWriter *self, const char *name) {
+  char *name_ = strdup(name);
+  return_if_fail (name_ != NULL) -1;
+
+  // monitors still mapping a stale segment keep it, and see it stop updating
+  shm_unlink(name);
+  int fd = shm_open(
+    name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  goto_if_fail (fd >= 0) fail;
+  struct ShmStats *stats = MAP_FAILED;
+  if likely (ftruncate(fd, sizeof(struct ShmStats)) == 0) {
+    stats = mmap(NULL, sizeof(struct ShmStats), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  }
+  should (stats != MAP_FAILED) otherwise {
+    int saved_errno = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = saved_errno;
+    goto fail;
+  }
+  close(fd);
+
+  // segment is zeroed
+  stats->version = SHM_STATS_VERSION;
+  stats->size = sizeof(struct ShmStats);
+  stats->pid = getpid();
+  atomic_store_explicit(&stats->magic, SHM_STATS_MAGIC, memory_order_release);
+
+  self->stats = stats;
+  self->name = name_;
+  self->published = 0;
+  for (int i = 0; i < SHM_STATS_SESSIONS; i++) {
+    self->owners[i] = NULL;
+  }
+  return 0;
+
+fail:
+  {
+    int saved_errno = errno;
+    free(name_);
+    errno = saved_errno;
+  }
+  return -1;
+}
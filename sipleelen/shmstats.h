@@ -0,0 +1,275 @@
+#ifndef SIPLEELEN_SHMSTATS_H
+#define SIPLEELEN_SHMSTATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <inet46i/sockaddr46.h>
+
+#include "leelen/family.h"
+#include "leelen/voip/dialog.h"
+// #include "sipleelen.h"
+struct SIPLeelen;
+
+/**
+ * @file
+ * Statistics published in a POSIX shared memory segment.
+ *
+ * The segment holds a ::ShmStats, written by the executer thread and mapped
+ * read-only by monitors like @c leelen2sip-top, so that watching the gateway
+ * costs it no system calls. Each section is protected by its own seqlock.
+ *
+ * This header does not depend on OSIP, and is shared with monitors.
+ */
+
+
+/// ShmStats::magic
+#define SHM_STATS_MAGIC 0x5453324c  // "L2ST"
+/// ShmStats::version, to be increased whenever the layout changes
+#define SHM_STATS_VERSION 2
+/// number of session slots
+#define SHM_STATS_SESSIONS 64
+/// minimum interval between publications, in milliseconds
+#define SHM_STATS_INTERVAL 100
+/// maximum number of attempts to read a section being written
+#define SHM_STATS_READ_RETRIES 1000
+
+
+/**
+ * @ingroup sip
+ * @brief Latency histograms published in ShmStatsGlobal::latency.
+ */
+enum ShmStatsLatency {
+  SHM_STATS_LATENCY_DISCOVERY = 0,
+  SHM_STATS_LATENCY_TRYING,
+  SHM_STATS_LATENCY_CALL_ACK,
+  SHM_STATS_LATENCY_RING,
+  SHM_STATS_LATENCY_ANSWER,
+  SHM_STATS_LATENCY_MEDIA,
+  SHM_STATS_LATENCY_OPEN_GATE,
+  SHM_STATS_LATENCY_RELAY,
+  SHM_STATS_LATENCY_COUNT,
+};
+
+/**
+ * @ingroup sip
+ * @brief Summary of a latency histogram, in microseconds.
+ */
+struct ShmStatsHistogram {
+  /// number of samples
+  uint64_t count;
+  /// sum of samples
+  uint64_t sum;
+  /// largest sample
+  uint64_t max;
+  /// upper bound of median
+  uint64_t p50;
+  /// upper bound of 99th percentile
+  uint64_t p99;
+};
+
+/**
+ * @ingroup sip
+ * @brief Global section of ShmStats.
+ */
+struct ShmStatsGlobal {
+  /// monotonic time of publication, in microseconds
+  uint64_t published;
+  /// number of sessions, including those without a slot
+  uint32_t n_session;
+  /// number of sessions by LEELEN dialog state
+  uint32_t n_state[LEELEN_DIALOG_STATE_COUNT];
+  /// number of sessions calling a ring group
+  uint32_t n_ringing;
+  /// number of running forwarder threads
+  uint32_t n_forwarder;
+  /// SIP requests, received and sent
+  uint64_t sip_requests[2];
+  /// SIP responses, received and sent
+  uint64_t sip_responses[2];
+  /// successful and timed out discoveries
+  uint64_t discoveries[2];
+  /// relayed packets, by media (audio, video) and direction (LEELEN to SIP,
+  /// SIP to LEELEN)
+  uint64_t relay_packets[2][2];
+  /// relayed bytes, by media and direction
+  uint64_t relay_bytes[2][2];
+  /// latency, indexed by ::ShmStatsLatency
+  struct ShmStatsHistogram latency[SHM_STATS_LATENCY_COUNT];
+};
+
+/**
+ * @ingroup sip
+ * @brief Session section of ShmStats.
+ */
+struct ShmStatsSession {
+  /// LEELEN dialog ID, or 0 if not connected yet; slot is free if
+  /// ShmStatsSession::started is 0
+  uint32_t id;
+  /// LEELEN dialog state
+  uint8_t state;
+  /// whether calling a ring group
+  bool ringing;
+  /// whether audio and video forwarders are running
+  bool running[2];
+  /// monotonic time when the slot was taken, in microseconds
+  uint64_t started;
+  /// retransmitted LEELEN messages
+  uint32_t retransmits;
+  /// duplicated LEELEN messages received
+  uint32_t duplicates;
+  /// relayed packets, by media and direction
+  uint64_t packets[2][2];
+  /// relayed bytes, by media and direction
+  uint64_t bytes[2][2];
+  /// phone number of peer
+  char number[LEELEN_NUMBER_STRLEN];
+  /// LEELEN address of peer
+  char peer[SOCKADDR_STRLEN];
+};
+
+/**
+ * @ingroup sip
+ * @brief Layout of statistics segment.
+ */
+struct ShmStats {
+  /// #SHM_STATS_MAGIC, written last when the segment is initialized
+  atomic_uint magic;
+  /// #SHM_STATS_VERSION
+  uint32_t version;
+  /// size of ::ShmStats
+  uint32_t size;
+  /// process ID of the gateway
+  int32_t pid;
+
+  /// seqlock of ShmStats::global, odd while writing
+  _Alignas(64) atomic_uint global_seq;
+  /// global statistics
+  struct ShmStatsGlobal global;
+
+  /// session slots
+  struct {
+    /// seqlock of ShmStats::sessions::data, odd while writing
+    _Alignas(64) atomic_uint seq;
+    /// session statistics
+    struct ShmStatsSession data;
+  } sessions[SHM_STATS_SESSIONS];
+};
+
+
+__attribute__((nonnull))
+/**
+ * @brief Begin writing a seqlock-protected section.
+ *
+ * @param seq Sequence number.
+ */
+static inline void shm_stats_write_begin (atomic_uint *seq) {
+  atomic_store_explicit(
+    seq, atomic_load_explicit(seq, memory_order_relaxed) + 1,
+    memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+__attribute__((nonnull))
+/**
+ * @brief End writing a seqlock-protected section.
+ *
+ * @param seq Sequence number.
+ */
+static inline void shm_stats_write_end (atomic_uint *seq) {
+  atomic_store_explicit(
+    seq, atomic_load_explicit(seq, memory_order_relaxed) + 1,
+    memory_order_release);
+}
+
+__attribute__((nonnull, access(write_only, 1, 3), access(read_only, 2, 3)))
+/**
+ * @brief Copy a seqlock-protected section consistently.
+ *
+ * @param[out] dst Destination.
+ * @param src Section.
+ * @param size Size of section.
+ * @param seq Sequence number.
+ * @return @c true on success, @c false if the section kept changing, or the
+ *  writer died while writing.
+ */
+static inline bool shm_stats_read (
+    void *dst, const void *src, size_t size, const atomic_uint *seq) {
+  for (int i = 0; i < SHM_STATS_READ_RETRIES; i++) {
+    unsigned int begin = atomic_load_explicit(seq, memory_order_acquire);
+    if (begin % 2 != 0) {
+      continue;
+    }
+    memcpy(dst, src, size);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(seq, memory_order_relaxed) == begin) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * @ingroup sip
+ * @brief Publisher of ShmStats.
+ */
+struct ShmStatsWriter {
+  /// mapped segment
+  struct ShmStats *stats;
+  /// name of segment, unlinked when destroyed
+  char *name;
+
+  /** @privatesection */
+  /// monotonic time of last publication, in milliseconds
+  unsigned long long published;
+  /// session owning each slot, or @c NULL if free
+  const void *owners[SHM_STATS_SESSIONS];
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelen
+ * @brief Publish statistics if #SHM_STATS_INTERVAL has elapsed.
+ *
+ * Must be called in executer thread, which is the only writer.
+ *
+ * @param self LEELEN2SIP object.
+ * @param writer Statistics publisher.
+ */
+void SIPLeelen_publish_stats (
+  struct SIPLeelen *self, struct ShmStatsWriter *writer);
+
+__attribute__((nonnull))
+/**
+ * @memberof ShmStatsWriter
+ * @brief Unmap and unlink the segment.
+ *
+ * @param self Statistics publisher.
+ */
+void ShmStatsWriter_destroy (struct ShmStatsWriter *self);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof ShmStatsWriter
+ * @brief Create and map the segment.
+ *
+ * The segment is only accessible by the owner.
+ *
+ * @param[out] self Statistics publisher.
+ * @param name Name of POSIX shared memory segment, like @c /leelen2sip.
+ * @return 0 on success, -1 on error and @c errno is set appropriately.
+ */
+int ShmStatsWriter_init (struct ShmStatsWriter *self, const char *name);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIPLEELEN_SHMSTATS_H */
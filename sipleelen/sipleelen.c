@@ -3,6 +3,7 @@
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -10,6 +11,7 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>  // osip
 #include <sys/types.h>
@@ -23,14 +25,24 @@
 
 #include "utils/macro.h"
 #include "utils/array.h"
+#include "utils/control.h"
 #include "utils/log.h"
+#include "utils/histogram.h"
+#include "utils/metrics.h"
 #include "utils/osip.h"
+#include "utils/pcaptap.h"
 #include "utils/single.h"
 #include "utils/threadname.h"
+#include "utils/timeval.h"
+#include "utils/trace.h"
 #include "leelen/config.h"
 #include "leelen/discovery/discovery.h"
+#include "leelen/route.h"
 #include "leelen/voip/protocol.h"
+#include "cdr.h"
+#include "metrics.h"
 #include "session.h"
+#include "shmstats.h"
 #include "transaction.h"
 #include "uac.h"
 #include "uas.h"
@@ -52,6 +64,18 @@ struct SIPLeelenSession *SIPLeelen_new_session (
       free(self->sessions[i]);
     } else {
       session = self->sessions[i];
+      session->audio.packets = self->metrics.relay_packets[0];
+      session->audio.bytes = self->metrics.relay_bytes[0];
+      session->audio.threads = &self->metrics.forwarders;
+      session->video.packets = self->metrics.relay_packets[1];
+      session->video.bytes = self->metrics.relay_bytes[1];
+      session->video.threads = &self->metrics.forwarders;
+      session->audio.media_latency = &self->media_latency;
+      session->video.media_latency = &self->media_latency;
+      if (self->relay_timestamps) {
+        session->audio.relay_latency = &self->relay_latency;
+        session->video.relay_latency = &self->relay_latency;
+      }
     }
   }
 
@@ -136,9 +160,24 @@ void SIPLeelen_decref_session (
 }
 
 
+void SIPLeelen_tap_sip (
+    const struct SIPLeelen *self, const osip_message_t *msg, const void *buf,
+    unsigned int len, const struct sockaddr *src, const struct sockaddr *dst) {
+  struct PcapTap *tap = self->tap;
+  return_if (likely (tap == NULL));
+  return_if_not (tap->classes & PCAP_TAP_SIP);
+  const osip_call_id_t *call_id = msg == NULL ? NULL : msg->call_id;
+  return_if_fail (PcapTap_match(
+    tap, 0, call_id == NULL ? NULL : call_id->number,
+    call_id == NULL ? NULL : call_id->host));
+  PcapTap_write(tap, buf, len, src, dst);
+}
+
+
 int SIPLeelen_receive (
     struct SIPLeelen *self, char *buf, int len, int sockfd,
     const struct sockaddr *src, const void *recv_dst) {
+  unsigned long long arrival = monotonic_us();
   LOGEVENT (LOG_LEVEL_VERBOSE) {
     char s_src[SOCKADDR_STRLEN];
     sockaddr_toa(src, s_src, sizeof(s_src));
@@ -147,6 +186,15 @@ int SIPLeelen_receive (
 
   // parse
   osip_event_t *event = osip_parse(buf, len);
+  if unlikely (self->tap != NULL) {
+    union sockaddr_in46 dst = self->addr;
+    if (src != NULL) {
+      sockaddr46_set(
+        &dst, src->sa_family, recv_dst, ntohs(self->addr.sa_port));
+    }
+    SIPLeelen_tap_sip(
+      self, event == NULL ? NULL : event->sip, buf, len, src, &dst.sock);
+  }
   should (event != NULL) otherwise {
     LOG(
       LOG_LEVEL_WARNING, LOG_WOULD_LOG(LOG_LEVEL_VERBOSE) ?
@@ -154,6 +202,8 @@ int SIPLeelen_receive (
       len, buf);
     return 1;
   }
+  SIPLeelenMetrics_count_sip(
+    &self->metrics, event->sip, SIPLEELEN_DIRECTION_IN);
 
   // fix via header
   if (!MSG_IS_RESPONSE(event->sip) && src != NULL) {
@@ -176,7 +226,10 @@ int SIPLeelen_receive (
     }
   }
 
-  if (osip_find_transaction_and_add_event(self->osip, event) == OSIP_SUCCESS) {
+  // same as osip_find_transaction_and_add_event(), but keep the transaction
+  osip_transaction_t *found_tr = __osip_find_transaction(self->osip, event, 1);
+  if (found_tr != NULL) {
+    TRACE_SPAN("osip", SIPTransactionData_get(found_tr, trace_id));
     osip_ict_execute(self->osip);
     osip_ist_execute(self->osip);
     osip_nict_execute(self->osip);
@@ -235,6 +288,10 @@ found_session:
         return 2;
       }
       session->ours = *(union in46_addr *) recv_dst;
+      // ID of the LEELEN dialog to come, so that discovery is traced as well
+      while (session->trace_id == 0) {
+        session->trace_id = rand();
+      }
     }
 
     // init data
@@ -242,6 +299,9 @@ found_session:
     tr->out_socket = sockfd;
     tr->reserved1 = session;
     SIPTransactionData_get(tr, out_af) = src->sa_family;
+    SIPTransactionData_get(tr, trace_id) =
+      session == NULL ? 0 : session->trace_id;
+    SIPTransactionData_get(tr, received) = arrival;
 
     if (session != NULL) {
       SIPLeelenSession_incref(session);
@@ -257,6 +317,7 @@ found_session:
       osip_free(from);
     }
 
+    TRACE_SPAN("osip", SIPTransactionData_get(tr, trace_id));
     for (osip_event_t *event; ;) {
       event = osip_fifo_tryget(tr->transactionff);
       break_if_fail (event != NULL);
@@ -281,11 +342,18 @@ int SIPLeelen_receive_leelen (
     struct SIPLeelen *self, char *buf, int len, int sockfd,
     const struct sockaddr *src) {
   return_if_fail (len > LEELEN_MESSAGE_HEADER_SIZE) 255;
-  buf[len - 1] = '\0';
 
   leelen_id_t id = LEELEN_MESSAGE_ID(buf);
   enum LeelenCode code = le32toh(LEELEN_MESSAGE_CODE(buf));
 
+  if unlikely (self->tap != NULL && (self->tap->classes & PCAP_TAP_LEELEN) &&
+               PcapTap_match(self->tap, id, NULL, NULL)) {
+    union sockaddr_in46 dst = self->leelen.config->addr;
+    dst.sa_port = htons(self->leelen.config->voip);
+    PcapTap_write(self->tap, buf, len, src, &dst.sock);
+  }
+  buf[len - 1] = '\0';
+
   LOGEVENT (LOG_LEVEL_VERBOSE) {
     char s_src[SOCKADDR_STRLEN];
     sockaddr_toa(src, s_src, sizeof(s_src));
@@ -300,6 +368,19 @@ int SIPLeelen_receive_leelen (
   // find session
   forindex (int, i, self->sessions, self->n_session) {
     struct SIPLeelenSession *session = self->sessions[i];
+    // ring group, which might still be growing
+    mtx_lock(&session->mtx);
+    bool in_ring = SIPLeelenSession_find_ring(session, id) != NULL;
+    mtx_unlock(&session->mtx);
+    if (in_ring) {
+      SIPLeelenSession_incref(session);
+      mtx_unlock(&self->mtx_sessions);
+      // dispatch
+      int ret = SIPLeelenSession_receive_ring(session, id, buf, sockfd, src);
+      SIPLeelen_decref_session(self, session, -1, 1);
+      return ret;
+    }
+
     continue_if_not (session->leelen.id == id);
     single_join(&session->invite_state);
     LOG(LOG_LEVEL_DEBUG,
@@ -327,6 +408,8 @@ int SIPLeelen_receive_leelen (
     return -1;
   }
   LeelenDialog_init(&session->leelen, self->leelen.config, src, NULL, id);
+  session->trace_id = id;
+  SIPLeelenSession_tap(session, &session->leelen, NULL);
 
   // dispatch
   int ret = SIPLeelenSession_receive(session, buf, sockfd, src);
@@ -339,6 +422,42 @@ int SIPLeelen_receive_leelen (
 }
 
 
+/**
+ * @memberof SIPLeelen
+ * @private
+ * @brief Record call-setup latencies after a response to INVITE is sent.
+ *
+ * @param self LEELEN2SIP object.
+ * @param tr OSIP INVITE server transaction.
+ * @param response Response sent.
+ */
+static void SIPLeelen_time_response (
+    struct SIPLeelen *self, osip_transaction_t *tr,
+    const osip_message_t *response) {
+  unsigned long long now = monotonic_us();
+
+  // the first response, usually 100 Trying
+  unsigned long long received = SIPTransactionData_get(tr, received);
+  if (received != 0) {
+    SIPTransactionData_get(tr, received) = 0;
+    if (response->status_code == 100) {
+      Histogram_add(&self->trying_latency, now - received);
+    }
+  }
+
+  // 200 OK of a call from SIP, but not its retransmissions
+  return_if_not (MSG_IS_STATUS_2XX(response));
+  struct SIPLeelenSession *session = tr->reserved1;
+  return_if (session == NULL || session->answer_start == 0);
+  unsigned long long latency = now - session->answer_start;
+  session->answer_start = 0;
+  Histogram_add(&self->answer_latency, latency);
+  atomic_store_explicit(&session->media_start, now, memory_order_relaxed);
+  LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Answered in %llu us",
+      session->leelen.id, latency);
+}
+
+
 /**
  * @relates SIPLeelen
  * @brief Callback for sending SIP messages.
@@ -354,6 +473,9 @@ int SIPLeelen_receive_leelen (
 static int _SIPLeelen_send (
     osip_transaction_t *tr, osip_message_t *msg, char *host, int port,
     int out_socket) {
+  struct SIPLeelen *self = tr->your_instance;
+  // per transaction, since the sweep running the transaction has no ID
+  TRACE_SPAN("sip send", SIPTransactionData_get(tr, trace_id));
   union sockaddr_in46 dst;
   dst.sa_family = SIPTransactionData_get(tr, out_af);
 
@@ -385,6 +507,15 @@ static int _SIPLeelen_send (
     LOG_PERROR(LOG_LEVEL_INFO, "sendto()");
     ret = -1;
   }
+  if likely (ret == 0) {
+    SIPLeelenMetrics_count_sip(&self->metrics, msg, SIPLEELEN_DIRECTION_OUT);
+    if (MSG_IS_RESPONSE(msg) && tr->ctx_type == IST) {
+      SIPLeelen_time_response(self, tr, msg);
+    }
+    if unlikely (self->tap != NULL) {
+      SIPLeelen_tap_sip(self, msg, buf, len, &self->addr.sock, &dst.sock);
+    }
+  }
   osip_free(buf);
   return ret;
 }
@@ -403,21 +534,53 @@ static int SIPLeelen_mainloop (void *arg) {
 
   struct SIPLeelen *self = arg;
 
-  struct pollfd pollfds[] = {
+  struct pollfd pollfds[
+      3 + METRICS_SERVER_NPOLLFD + CONTROL_SERVER_NPOLLFD] = {
     {.fd = self->socket_leelen, .events = POLLIN},
     {.fd = self->socket_sip, .events = POLLIN},
+    {.fd = self->socket_wakeup, .events = POLLIN},
   };
+  // negative descriptors are ignored by poll()
+  for (int i = 3; i < (int) arraysize(pollfds); i++) {
+    pollfds[i].fd = -1;
+  }
 
   for (unsigned int t = 1; ; t++) {
+    // retransmit unacknowledged LEELEN messages
+    mtx_lock(&self->mtx_sessions);
+    forindex (int, i, self->sessions, self->n_session) {
+      struct SIPLeelenSession *session = self->sessions[i];
+      SIPLeelenSession_retransmit_ring(session);
+      continue_if (single_still_running(&session->invite_state));
+      should (SIPLeelenSession_open_gate(session) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+                   ": Cannot open gate", session->leelen.id);
+      }
+      should (LeelenDialog_retransmit(
+          &session->leelen, self->socket_leelen) >= 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+                   ": Cannot retransmit LEELEN message", session->leelen.id);
+      }
+    }
+    mtx_unlock(&self->mtx_sessions);
+
     // for every ~800ms
     if (t % 8 == 0) {
       time_t now = time(NULL);
 
+      // reload dial plan
+      if unlikely (atomic_exchange(&self->reload, false)) {
+        SIPLeelen_load_dial_plan(self);
+      }
+
       // process SIP timeout
-      osip_timers_ict_execute(self->osip);
-      osip_timers_ist_execute(self->osip);
-      osip_timers_nict_execute(self->osip);
-      osip_timers_nist_execute(self->osip);
+      {
+        TRACE_SPAN("osip timers", 0);
+        osip_timers_ict_execute(self->osip);
+        osip_timers_ist_execute(self->osip);
+        osip_timers_nict_execute(self->osip);
+        osip_timers_nist_execute(self->osip);
+      }
 
       // process session timeout
       mtx_lock(&self->mtx_sessions);
@@ -429,12 +592,37 @@ static int SIPLeelen_mainloop (void *arg) {
         leelen_id_t id = session->leelen.id;
         int state = session->leelen.state;
 
+        if (session->ring != NULL) {
+          int n_open = SIPLeelenSession_expire_ring(session, now);
+          if (id == 0) {
+            // does nothing if ringing
+            continue_if (n_open > 0);
+
+            osip_transaction_t *tr = session->transaction;
+            if (tr != NULL && tr->ctx_type == IST &&
+                tr->state == IST_PROCEEDING) {
+              int trid = tr->transactionid;
+              LOG(LOG_LEVEL_DEBUG, "Transaction %d: No answer", trid);
+              CdrRecord_set_reason(&session->cdr, CDR_REASON_NO_ANSWER);
+              should (osip_transaction_response(
+                  tr, 480, self->ua, true) == OSIP_SUCCESS) otherwise {
+                LOG(LOG_LEVEL_WARNING,
+                    "Transaction %d: Out of memory, reply not sent", trid);
+              }
+            }
+          } else {
+            // does nothing if others are waiting for ack of BYE
+            continue_if (n_open > 0 && state == LEELEN_DIALOG_DISCONNECTED);
+          }
+        }
+
         if (state == LEELEN_DIALOG_CONNECTING) {
           // does nothing if waiting for ack
           continue_if (!LeelenDialog_ack_timeout(&session->leelen));
           osip_transaction_t *tr = session->transaction;
           int trid = tr->transactionid;
           LOG(LOG_LEVEL_DEBUG, "Transaction %d: Dial timeout", trid);
+          CdrRecord_set_reason(&session->cdr, CDR_REASON_DIAL_TIMEOUT);
 
           // need 2 references to keep session alive, we have 1
           SIPLeelenSession_incref(session);
@@ -459,6 +647,7 @@ static int SIPLeelen_mainloop (void *arg) {
           continue_if (session->transaction != NULL);
           continue_if (!LeelenDialog_dialog_timeout(&session->leelen, now));
           LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Session timeout", id);
+          CdrRecord_set_reason(&session->cdr, CDR_REASON_SESSION_TIMEOUT);
 
           int res = SIPLeelenSession_bye(session, true);
           should ((res & 1) == 0) otherwise {
@@ -467,8 +656,7 @@ static int SIPLeelen_mainloop (void *arg) {
         } else {
           if (state == LEELEN_DIALOG_DISCONNECTING) {
             // does nothing if waiting for ack
-            continue_if (session->leelen.last_sent.tv_sec +
-                         2 * session->leelen.timeout / 1000 < now);
+            continue_if (!LeelenDialog_ack_timeout(&session->leelen));
           }
           LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Session end", id);
           ptrvsteal(&self->sessions, &self->n_session, i);
@@ -480,15 +668,30 @@ static int SIPLeelen_mainloop (void *arg) {
       }
       mtx_unlock(&self->mtx_sessions);
 
-      // process SIP events
-      osip_ict_execute(self->osip);
-      osip_ist_execute(self->osip);
-      osip_nict_execute(self->osip);
-      osip_nist_execute(self->osip);
+      // process SIP events, left by timers and INVITE threads of any session
+      {
+        TRACE_SPAN("osip", 0);
+        osip_ict_execute(self->osip);
+        osip_ist_execute(self->osip);
+        osip_nict_execute(self->osip);
+        osip_nist_execute(self->osip);
+      }
+    }
+
+    // publish statistics
+    if (self->stats_writer != NULL) {
+      SIPLeelen_publish_stats(self, self->stats_writer);
     }
 
     // poll
-    int pollres = poll(pollfds, 2, 100);
+    if (self->metrics_server != NULL) {
+      MetricsServer_pollfds(self->metrics_server, &pollfds[3]);
+    }
+    if (self->control_server != NULL) {
+      ControlServer_pollfds(
+        self->control_server, &pollfds[3 + METRICS_SERVER_NPOLLFD]);
+    }
+    int pollres = poll(pollfds, arraysize(pollfds), 100);
     break_if_fail (single_continue(&self->state));
     should (pollres >= 0) otherwise {
       LOG_PERROR(LOG_LEVEL_WARNING, "poll() failed");
@@ -496,6 +699,23 @@ static int SIPLeelen_mainloop (void *arg) {
     }
     continue_if (likely (pollres <= 0));
 
+    // woken up by forwarder threads, sessions are checked on next iteration
+    if (pollfds[2].revents != 0) {
+      eventfd_t value;
+      eventfd_read(self->socket_wakeup, &value);
+    }
+
+    // scrape
+    if (self->metrics_server != NULL) {
+      MetricsServer_process(self->metrics_server, &pollfds[3]);
+    }
+
+    // control
+    if (self->control_server != NULL) {
+      ControlServer_process(
+        self->control_server, &pollfds[3 + METRICS_SERVER_NPOLLFD]);
+    }
+
     // process received packets
     for (int i = 0; i < 2; i++) {
       continue_if (pollfds[i].revents == 0);
@@ -532,6 +752,49 @@ static int SIPLeelen_mainloop (void *arg) {
 }
 
 
+int SIPLeelen_load_dial_plan (struct SIPLeelen *self) {
+  return_if_fail (self->dial_plan != NULL) 0;
+
+  FILE *file = fopen(self->dial_plan, "r");
+  should (file != NULL) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Cannot open dial plan %s", self->dial_plan);
+    return -1;
+  }
+  struct LeelenDialPlan *plan = malloc(sizeof(*plan));
+  should (plan != NULL) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Cannot load dial plan");
+    fclose(file);
+    return -1;
+  }
+  LeelenDialPlan_init(plan);
+
+  const struct LeelenNumber *base = &self->leelen.config->number;
+  unsigned int lineno = 0;
+  int res = LeelenDialPlan_load(
+    plan, file, base->str[0] == '\0' ? NULL : base, &lineno);
+  fclose(file);
+  if (res == 0) {
+    res = LeelenDialPlan_compile(plan);
+  }
+  should (res == 0) otherwise {
+    if (res > 0) {
+      LOG(LOG_LEVEL_WARNING, "%s:%u: Invalid dial plan rule",
+          self->dial_plan, lineno);
+    } else {
+      LOG_PERROR(LOG_LEVEL_WARNING, "Cannot load dial plan");
+    }
+    LeelenDialPlan_destroy(plan);
+    free(plan);
+    return res;
+  }
+
+  LOG(LOG_LEVEL_INFO, "Dial plan %s: %u routes", self->dial_plan,
+      plan->n_route);
+  LeelenRouter_swap(&self->router, plan);
+  return 0;
+}
+
+
 int SIPLeelen_run (struct SIPLeelen *self) {
   return_if_fail (self->socket_leelen >= 0 && self->socket_sip >= 0) 255;
   return_nonzero (LeelenDiscovery_start(&self->leelen));
@@ -593,12 +856,38 @@ int SIPLeelen_connect (struct SIPLeelen *self) {
 void SIPLeelen_destroy (struct SIPLeelen *self) {
   SIPLeelen_stop(self);
 
+  LOGEVENT (LOG_LEVEL_DEBUG) {
+    char s_latency[128];
+    Histogram_tostring(
+      &self->open_gate_latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG("Open gate latency (us): %s", s_latency);
+    Histogram_tostring(&self->ring_latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG("Ring latency (us): %s", s_latency);
+    Histogram_tostring(&self->trying_latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG("Trying latency (us): %s", s_latency);
+    Histogram_tostring(
+      &self->call_ack_latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG("LEELEN call ACK latency (us): %s", s_latency);
+    Histogram_tostring(&self->answer_latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG("Answer latency (us): %s", s_latency);
+    Histogram_tostring(&self->media_latency, s_latency, sizeof(s_latency));
+    LOGEVENT_LOG("First media latency (us): %s", s_latency);
+    if (self->relay_timestamps) {
+      Histogram_tostring(&self->relay_latency, s_latency, sizeof(s_latency));
+      LOGEVENT_LOG("Relay latency (us): %s", s_latency);
+    }
+  }
+
   LeelenDiscovery_destroy(&self->leelen);
   free(self->ua);
+  LeelenRouter_destroy(&self->router);
+  free(self->dial_plan);
+  free(self->trace_dir);
   osip_release(self->osip);
   free(self->client);
   if likely (self->sessions != NULL) {
     forindex (int, i, self->sessions, self->n_session) {
+      CdrRecord_set_reason(&self->sessions[i]->cdr, CDR_REASON_SHUTDOWN);
       SIPLeelenSession_destroy(self->sessions[i]);
     }
     free(self->sessions);
@@ -609,6 +898,7 @@ void SIPLeelen_destroy (struct SIPLeelen *self) {
   if likely (self->socket_leelen >= 0) {
     close(self->socket_leelen);
   }
+  close(self->socket_wakeup);
   mtx_destroy(&self->mtx_sessions);
 
   single_join(&self->state);
@@ -622,8 +912,15 @@ int SIPLeelen_init (struct SIPLeelen *self, const struct LeelenConfig *config) {
     saved_errno = errno;
     goto fail_mtx;
   }
+  self->socket_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  should (self->socket_wakeup >= 0) otherwise {
+    saved_errno = errno;
+    goto fail_eventfd;
+  }
   should (osip_init(&self->osip) == OSIP_SUCCESS) otherwise {
     saved_errno = errno;
+    close(self->socket_wakeup);
+fail_eventfd:
     mtx_destroy(&self->mtx_sessions);
 fail_mtx:
     LeelenDiscovery_destroy(&self->leelen);
@@ -635,6 +932,7 @@ fail_mtx:
   osip_set_cb_send_message(self->osip, _SIPLeelen_send);
 
   SIPLeelen_set_uax_callbacks(self);
+  SIPLeelen_set_uac_callbacks(self);
   SIPLeelen_set_uas_callbacks(self);
 
   self->ua = NULL;
@@ -642,6 +940,24 @@ fail_mtx:
   self->addr.sa_family = AF_INET6;
   self->addr.sa_port = htons(SIPLEELEN_PORT);
   self->mtu = SIPLEELEN_MAX_MESSAGE_LENGTH;
+  LeelenRouter_init(&self->router);
+  self->dial_plan = NULL;
+  self->trace_dir = NULL;
+  self->open_gate_event = -1;
+  Histogram_reset(&self->open_gate_latency);
+  Histogram_reset(&self->ring_latency);
+  Histogram_reset(&self->trying_latency);
+  Histogram_reset(&self->call_ack_latency);
+  Histogram_reset(&self->answer_latency);
+  Histogram_reset(&self->media_latency);
+  self->relay_timestamps = false;
+  Histogram_reset(&self->relay_latency);
+  self->tap = NULL;
+  SIPLeelenMetrics_reset(&self->metrics);
+  self->metrics_server = NULL;
+  self->control_server = NULL;
+  self->stats_writer = NULL;
+  self->cdr = NULL;
 
   self->client = NULL;
   self->clients.sa_family = AF_UNSPEC;
@@ -650,5 +966,6 @@ fail_mtx:
   self->socket_sip = -1;
   self->socket_leelen = -1;
   self->state = SINGLE_FLAG_INIT;
+  atomic_init(&self->reload, false);
   return 0;
 }
@@ -5,17 +5,29 @@
 extern "C" {
 #endif
 
+#include <stdatomic.h>
 #include <sys/time.h>  // osip
 
 #include <inet46i/sockaddr46.h>
 #include <osip2/osip.h>
 
+#include "utils/histogram.h"
 #include "utils/single.h"
 // #include "leelen/config.h"
 struct LeelenConfig;
 #include "leelen/discovery/discovery.h"
+#include "leelen/route.h"
+#include "metrics.h"
+// #include "utils/control.h"
+struct ControlServer;
+// #include "utils/pcaptap.h"
+struct PcapTap;
 // #include "session.h"
 struct SIPLeelenSession;
+// #include "shmstats.h"
+struct ShmStatsWriter;
+// #include "cdr.h"
+struct CdrWriter;
 
 /**
  * @ingroup leelen2sip
@@ -49,6 +61,49 @@ struct SIPLeelen {
   union sockaddr_in46 addr;
   /// maximum transmission unit for UDP packet
   unsigned short mtu;
+  /// call routing
+  struct LeelenRouter router;
+  /// path of dial plan file, or @c NULL if none
+  char *dial_plan;
+  /// directory written by the @c trace control command, or @c NULL if the
+  /// command is disabled
+  char *trace_dir;
+  /// telephone event (DTMF digit) that opens the gate, or -1 if disabled
+  int open_gate_event;
+  /// histogram of latency from DTMF digit to LEELEN ack of opening the gate,
+  /// in microseconds
+  struct Histogram open_gate_latency;
+  /// histogram of latency from LEELEN invitation to SIP client ringing, in
+  /// microseconds
+  struct Histogram ring_latency;
+  /// histogram of latency from SIP INVITE to 100 Trying sent, in microseconds
+  struct Histogram trying_latency;
+  /// histogram of latency from LEELEN invitation sent to its ACK, in
+  /// microseconds
+  struct Histogram call_ack_latency;
+  /// histogram of latency from LEELEN answer to SIP 200 OK sent, in
+  /// microseconds
+  struct Histogram answer_latency;
+  /// histogram of latency from SIP 200 OK to the first relayed media packet,
+  /// in microseconds
+  struct Histogram media_latency;
+  /// whether to timestamp media sockets and fill SIPLeelen::relay_latency
+  bool relay_timestamps;
+  /// histogram of latency from kernel receive to send of relayed media
+  /// packets, in microseconds
+  struct Histogram relay_latency;
+  /// packet capture tap, or @c NULL if disabled
+  struct PcapTap *tap;
+  /// counters
+  struct SIPLeelenMetrics metrics;
+  /// scrape endpoint served by executer thread, or @c NULL if disabled
+  struct MetricsServer *metrics_server;
+  /// control endpoint served by executer thread, or @c NULL if disabled
+  struct ControlServer *control_server;
+  /// statistics segment published by executer thread, or @c NULL if disabled
+  struct ShmStatsWriter *stats_writer;
+  /// writer of call detail records, or @c NULL if disabled
+  struct CdrWriter *cdr;
 
   /** @privatesection */
   /// OSIP stack
@@ -69,9 +124,13 @@ struct SIPLeelen {
   int socket_sip;
   /// socket for LEELEN VoIP
   int socket_leelen;
+  /// eventfd to wake up executer thread
+  int socket_wakeup;
 
   /// executer thread state
   single_flag state;
+  /// @c true if SIPLeelen::dial_plan should be reloaded by executer thread
+  atomic_bool reload;
 };
 
 __attribute__((nonnull))
@@ -102,6 +161,21 @@ void SIPLeelen_decref_session (
   struct SIPLeelen *self, struct SIPLeelenSession *session, int index,
   int lock);
 
+__attribute__((nonnull(1, 3)))
+/**
+ * @memberof SIPLeelen
+ * @brief Capture a SIP message if SIPLeelen::tap wants it.
+ *
+ * @param self LEELEN2SIP object.
+ * @param msg Parsed message, for Call-ID filter. Can be @c NULL.
+ * @param buf Message.
+ * @param len Length of message.
+ * @param src Source address of the message. Can be @c NULL.
+ * @param dst Destination address of the message. Can be @c NULL.
+ */
+void SIPLeelen_tap_sip (
+  const struct SIPLeelen *self, const osip_message_t *msg, const void *buf,
+  unsigned int len, const struct sockaddr *src, const struct sockaddr *dst);
 __attribute__((nonnull(1, 2), access(read_only, 5), access(read_only, 6)))
 /**
  * @memberof SIPLeelen
@@ -136,6 +210,31 @@ int SIPLeelen_receive_leelen (
   struct SIPLeelen *self, char *buf, int len, int sockfd,
   const struct sockaddr *src);
 
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelen
+ * @brief Load dial plan from SIPLeelen::dial_plan, and replace the active one.
+ *
+ * On error, the active dial plan is kept.
+ *
+ * @param self LEELEN2SIP object.
+ * @return 0 on success, 1 if dial plan is malformed, -1 on error and @c errno
+ *  is set appropriately.
+ */
+int SIPLeelen_load_dial_plan (struct SIPLeelen *self);
+__attribute__((nonnull))
+/**
+ * @memberof SIPLeelen
+ * @brief Ask executer thread to reload dial plan.
+ *
+ * This function is async-signal-safe.
+ *
+ * @param self LEELEN2SIP object.
+ */
+static inline void SIPLeelen_reload (struct SIPLeelen *self) {
+  atomic_store(&self->reload, true);
+}
+
 __attribute__((nonnull))
 /**
  * @memberof SIPLeelen
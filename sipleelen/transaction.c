@@ -1,10 +1,14 @@
 #include <ctype.h>
 #include <stdatomic.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <netinet/in.h>
 #include <sys/time.h>  // osip
 
+#include <inet46i/in46.h>
+#include <inet46i/inet46.h>
+#include <inet46i/sockaddr46.h>
 #include <osip2/osip.h>
 #include <osipparser2/sdp_message.h>
 
@@ -13,6 +17,7 @@
 #include "utils/log.h"
 #include "utils/sdp_message.h"
 #include "utils/osip.h"
+#include "utils/rtp.h"
 #include "leelen/config.h"
 #include "session.h"
 #include "sipleelen.h"
@@ -68,10 +73,20 @@ int _SIPLeelen_encode_media_formats (
       med, type, "rtpmap", format) == OSIP_SUCCESS) fail;
   }
 
-  goto_if_fail (sdp_media_add_attribute(
-    med, 127, "rtpmap", "telephone-event/8000") == OSIP_SUCCESS) fail;
-  goto_if_fail (sdp_media_add_attribute(
-    med, 127, "fmtp", "0-15") == OSIP_SUCCESS) fail;
+  // DTMF
+  if (media_type == 0) {
+    char *m_payload = osip_strdup(STR(RTP_TELEPHONE_EVENT_TYPE));
+    goto_if_fail (m_payload != NULL) fail;
+    should (osip_list_add(&med->m_payloads, m_payload, -1) > 0) otherwise {
+      osip_free(m_payload);
+      goto fail;
+    }
+    goto_if_fail (sdp_media_add_attribute(
+      med, RTP_TELEPHONE_EVENT_TYPE, "rtpmap", "telephone-event/8000"
+    ) == OSIP_SUCCESS) fail;
+    goto_if_fail (sdp_media_add_attribute(
+      med, RTP_TELEPHONE_EVENT_TYPE, "fmtp", "0-15") == OSIP_SUCCESS) fail;
+  }
 
   goto_if_fail (osip_list_add(&sdp->m_medias, med, -1) > 0) fail;
   return 0;
@@ -142,6 +157,45 @@ int _SIPLeelen_extract_media_formats (
 }
 
 
+int _SIPLeelen_extract_media_addrs (
+    osip_message_t *message, union sockaddr_in46 *audio,
+    union sockaddr_in46 *video) {
+  audio->sa_family = AF_UNSPEC;
+  video->sa_family = AF_UNSPEC;
+
+  sdp_message_t *sdp;
+  return_if_fail (osip_message_get_sdp(message, &sdp) == OSIP_SUCCESS) 1;
+
+  for (int i = 0;; i++) {
+    sdp_media_t *media = osip_list_get(&sdp->m_medias, i);
+    break_if_fail (media != NULL);
+
+    continue_if_not (media->m_media != NULL && media->m_port != NULL);
+    union sockaddr_in46 *addr =
+      strcmp(media->m_media, "audio") == 0 ? audio :
+      strcmp(media->m_media, "video") == 0 ? video : NULL;
+    continue_if (addr == NULL || addr->sa_family != AF_UNSPEC);
+
+    // port 0 means the stream is rejected
+    int port = atoi(media->m_port);
+    continue_if_not (port > 0 && port <= 65535);
+
+    const char *host = sdp_message_c_addr_get(sdp, i, 0);
+    if (host == NULL) {
+      host = sdp_message_c_addr_get(sdp, -1, 0);
+    }
+    continue_if (host == NULL);
+    struct in64_addr in;
+    int af = inet_aton64(host, &in);
+    continue_if (af == AF_UNSPEC);
+    sockaddr46_set(addr, af, in64_get(af, &in), port);
+  }
+
+  sdp_message_free(sdp);
+  return 0;
+}
+
+
 /**
  * @relates SIPTransactionData
  * @brief Callback called when a SIP transaction is terminated.
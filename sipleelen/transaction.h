@@ -6,9 +6,11 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #include <sys/time.h>  // osip
 
+#include <inet46i/sockaddr46.h>
 #include <osip2/osip.h>
 #include <osipparser2/sdp_message.h>
 
@@ -28,6 +30,12 @@ struct SIPTransactionData {
   struct SIPLeelenSession *session;
   /// address family of osip_transaction_t::out_socket
   unsigned char out_af;
+  /// correlation ID of trace spans, SIPLeelenSession::trace_id of
+  /// SIPTransactionData::session, or 0 if none
+  uint32_t trace_id;
+  /// monotonic time when the request of server transaction arrived, in
+  /// microseconds, or 0 if a response has been sent
+  unsigned long long received;
 };
 
 _Static_assert(sizeof(struct SIPTransactionData) <= sizeof(void *) + 5 * 4,
@@ -70,6 +78,19 @@ __attribute__((nonnull(1), access(write_only, 2), access(write_only, 3)))
  */
 int _SIPLeelen_extract_media_formats (
   osip_message_t *request, char ***audio_formats, char ***video_formats);
+__attribute__((nonnull, access(write_only, 2), access(write_only, 3)))
+/**
+ * @relates SIPTransactionData
+ * @brief Get audio and video transport addresses from SDP in message.
+ *
+ * @param message OSIP message.
+ * @param[out] audio Audio address, or @c AF_UNSPEC if none.
+ * @param[out] video Video address, or @c AF_UNSPEC if none.
+ * @return 0 on success, 1 if no SDP in message.
+ */
+int _SIPLeelen_extract_media_addrs (
+  osip_message_t *message, union sockaddr_in46 *audio,
+  union sockaddr_in46 *video);
 
 __attribute__((nonnull))
 /**
@@ -1,7 +1,11 @@
 #include <endian.h>
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 
@@ -10,22 +14,374 @@
 
 #include "utils/macro.h"
 #include "utils/array.h"
+#include "utils/histogram.h"
 #include "utils/log.h"
 #include "utils/osip.h"
 #include "utils/sdp_message.h"
 #include "utils/single.h"
+#include "utils/timeval.h"
 #include "leelen/config.h"
+#include "leelen/voip/message.h"
 #include "leelen/voip/protocol.h"
 #include "../leelen2sip.h"
+#include "cdr.h"
+#include "metrics.h"
 #include "session.h"
 #include "sipleelen.h"
 #include "transaction.h"
 #include "uac.h"
 
 
+/**
+ * @memberof SIPLeelenSession
+ * @private
+ * @brief Answer the SIP INVITE transaction after LEELEN dialog is connected.
+ *
+ * @param self LEELEN2SIP session.
+ * @param audio_formats Audio description of peer device.
+ * @param video_formats Video description of peer device.
+ * @return 0 on success, 1 if no SIP INVITE transaction, otherwise status code
+ *  to reply.
+ */
+static int SIPLeelenSession_answer (
+    struct SIPLeelenSession *self, char * const *audio_formats,
+    char * const *video_formats) {
+  leelen_id_t id = self->leelen.id;
+  osip_transaction_t *tr = self->transaction;
+
+  should (tr != NULL && tr->ctx_type == IST) otherwise {
+    LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
+        ": connection establish without SIP transaction", id);
+    return 1;
+  }
+
+  osip_message_t *request = tr->orig_request;
+
+  // open sockets
+  in_port_t audio;
+  if unlikely (audio_formats[0] == NULL) {
+    audio = 0;
+  }
+  in_port_t video;
+  if (video_formats[0] == NULL) {
+    video = 0;
+  }
+  should (SIPLeelenSession_connect(
+      self, audio_formats[0] == NULL ? NULL : &audio,
+      video_formats[0] == NULL ? NULL : &video) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
+               ": Cannot open sockets", id);
+    return 500;
+  }
+
+  // set local tag
+  {
+    osip_generic_param_t *tag;
+    if likely (osip_to_get_tag(request->to, &tag) != OSIP_SUCCESS) {
+      char *local_tag = osip_malloc(9);
+      goto_if_fail (local_tag != NULL) fail_ist_oom;
+      snprintf(local_tag, 9, PRI_LEELEN_ID, id);
+      should (osip_to_set_tag(
+          request->to, local_tag) == OSIP_SUCCESS) otherwise {
+        free(local_tag);
+        goto fail_ist_oom;
+      }
+    }
+  }
+
+  int res;
+
+  // prepare sdp
+  sdp_message_t *sdp;
+  char s_id[sizeof("4294967295")];
+  snprintf(s_id, sizeof(s_id), "%" PRIu32, id);
+  goto_if_fail (sdp_message_create(
+    &sdp, SIPTransactionData_get(tr, out_af), &self->ours, s_id,
+    LEELEN2SIP_NAME
+  ) == OSIP_SUCCESS) fail_ist_oom;
+
+  if (audio != 0) {
+    goto_if_fail (_SIPLeelen_encode_media_formats(
+      sdp, "audio", audio, audio_formats) == 0) fail_ist_sdp;
+  }
+  if (video != 0) {
+    goto_if_fail (_SIPLeelen_encode_media_formats(
+      sdp, "video", video, video_formats) == 0) fail_ist_sdp;
+  }
+
+  char *body;
+  res = sdp_message_to_str(sdp, &body);
+  sdp_message_free(sdp);
+  if (0) {
+fail_ist_sdp:
+    sdp_message_free(sdp);
+    goto fail_ist_oom;
+  }
+  should (res == OSIP_SUCCESS) otherwise {
+    goto_if (res == OSIP_NOMEM) fail_ist_oom;
+    LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
+        ": Cannot create SDP message: %d", id, res);
+    return 500;
+  }
+
+  // create response
+  osip_message_t *response;
+  goto_if_fail (osip_message_response(
+    &response, request, 200, self->device->ua
+  ) == OSIP_SUCCESS) fail_ist_body;
+
+  res = osip_message_set_body(response, body, strlen(body));
+  osip_free(body);
+  if (0) {
+fail_ist_body:
+    osip_free(body);
+    goto fail_ist_oom;
+  }
+  goto_if_fail (res == OSIP_SUCCESS) fail_ist_response;
+
+  goto_if_fail (osip_message_set_content_type(
+    response, "application/sdp") == OSIP_SUCCESS) fail_ist_response;
+  goto_if_fail (osip_message_set_expires(
+    response, "5;refresher=uac") == OSIP_SUCCESS) fail_ist_response;
+
+  // create dialog
+  if (self->sip == NULL) {
+    goto_if_fail (osip_dialog_init_as_uas(
+      &self->sip, request, response) == OSIP_SUCCESS) fail_ist_response;
+  }
+
+  // send reply
+  goto_if_fail (osip_transaction_send_sipmessage(
+      tr, response, true) == OSIP_SUCCESS) fail_ist_response;
+
+  if (0) {
+fail_ist_response:
+    osip_message_free(response);
+    goto fail_ist_oom;
+  }
+
+  // relay media
+  should (SIPLeelenSession_start_forward(self) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+               ": Cannot start forwarders", id);
+  }
+  return 0;
+
+fail_ist_oom:
+  LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID ": Out of memory", id);
+  return 500;
+}
+
+
+/**
+ * @memberof SIPLeelenSession
+ * @private
+ * @brief Forward LEELEN invitation to the SIP client.
+ *
+ * Media sockets are opened before the INVITE is sent, so that relaying can
+ * start as soon as the call is answered.
+ *
+ * @param self LEELEN2SIP session.
+ * @param audio_formats Audio description of peer device.
+ * @param video_formats Video description of peer device.
+ * @return 0 on success, -1 on error.
+ */
+static int SIPLeelenSession_invite (
+    struct SIPLeelenSession *self, char * const *audio_formats,
+    char * const *video_formats) {
+  const struct SIPLeelen *device = self->device;
+  leelen_id_t id = self->leelen.id;
+  union sockaddr_in46 client = device->clients;
+  int af = client.sa_family;
+
+  // find our address facing the client
+  union sockaddr_in46 ours;
+  {
+    int sockfd = socket(af, SOCK_DGRAM, 0);
+    return_if_fail (sockfd >= 0) -1;
+    socklen_t ourslen = sizeof(ours);
+    int res = connect(sockfd, &client.sock, sizeof(client)) == 0 &&
+      getsockname(sockfd, &ours.sock, &ourslen) == 0 ? 0 : -1;
+    close(sockfd);
+    return_if_fail (res == 0) -1;
+  }
+  memcpy(&self->ours, sockaddr_addr(&ours.sock),
+         af == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+  ours.sa_port = device->addr.sa_port;
+  char s_ours[SOCKADDR_STRLEN];
+  sockaddr_toa(&ours.sock, s_ours, sizeof(s_ours));
+  char s_client[SOCKADDR_STRLEN];
+  sockaddr_toa(&client.sock, s_client, sizeof(s_client));
+
+  // open sockets
+  in_port_t audio = 0;
+  in_port_t video = 0;
+  should (SIPLeelenSession_connect(
+      self, audio_formats[0] == NULL ? NULL : &audio,
+      video_formats[0] == NULL ? NULL : &video) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
+               ": Cannot open sockets", id);
+    return -1;
+  }
+
+  // prepare headers
+  const char *number =
+    self->leelen.their.str[0] != '\0' ? self->leelen.their.str : "leelen";
+  char req_uri[256];
+  char to[256];
+  {
+    osip_uri_t *uri;
+    return_if_fail (osip_uri_init(&uri) == OSIP_SUCCESS) -1;
+    // request goes to where the client registered from
+    const char *username = NULL;
+    if likely (osip_uri_parse(uri, device->client) == OSIP_SUCCESS) {
+      username = osip_uri_get_username(uri);
+    }
+    snprintf(req_uri, sizeof(req_uri), "sip:%s%s%s",
+             username == NULL ? "" : username, username == NULL ? "" : "@",
+             s_client);
+    osip_uri_free(uri);
+  }
+  snprintf(to, sizeof(to), "<%s>", device->client);
+  char from[128];
+  snprintf(from, sizeof(from), "<sip:%s@%s>", number, s_ours);
+
+  // prepare sdp
+  sdp_message_t *sdp;
+  char s_id[sizeof("4294967295")];
+  snprintf(s_id, sizeof(s_id), "%" PRIu32, id);
+  goto_if_fail (sdp_message_create(
+    &sdp, af, &self->ours, s_id, LEELEN2SIP_NAME) == OSIP_SUCCESS) fail_oom;
+
+  int res;
+  if (audio != 0) {
+    goto_if_fail (_SIPLeelen_encode_media_formats(
+      sdp, "audio", audio, audio_formats) == 0) fail_sdp;
+  }
+  if (video != 0) {
+    goto_if_fail (_SIPLeelen_encode_media_formats(
+      sdp, "video", video, video_formats) == 0) fail_sdp;
+  }
+
+  char *body;
+  res = sdp_message_to_str(sdp, &body);
+  sdp_message_free(sdp);
+  if (0) {
+fail_sdp:
+    sdp_message_free(sdp);
+    goto fail_oom;
+  }
+  goto_if_fail (res == OSIP_SUCCESS) fail_oom;
+
+  // create request
+  osip_message_t *request;
+  res = osip_message_new_request(
+    &request, "INVITE", req_uri, from, to, from, s_ours, device->ua);
+  should (res == OSIP_SUCCESS) otherwise {
+    osip_free(body);
+    goto_if (res == OSIP_NOMEM) fail_oom;
+    LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+        ": Cannot create INVITE to %s: %d", id, req_uri, res);
+    return -1;
+  }
+
+  res = osip_message_set_body(request, body, strlen(body));
+  osip_free(body);
+  goto_if_fail (res == OSIP_SUCCESS) fail_request;
+  goto_if_fail (osip_message_set_content_type(
+    request, "application/sdp") == OSIP_SUCCESS) fail_request;
+  // Call-ID known now
+  SIPLeelenSession_tap(self, &self->leelen, request->call_id);
+  SIPLeelenSession_set_cdr(self, request, true);
+
+  // create transaction
+  osip_event_t *event = osip_new_outgoing_sipmessage(request);
+  goto_if_fail (event != NULL) fail_request;
+  osip_transaction_t *tr = osip_create_transaction(device->osip, event);
+  should (tr != NULL) otherwise {
+    osip_event_free(event);
+    goto fail_oom;
+  }
+
+  LOG(LOG_LEVEL_DEBUG, "Transaction %d: Create %s transaction for "
+      PRI_LEELEN_ID ", calling %s", tr->transactionid,
+      osip_fsm_type_names[tr->ctx_type], id, req_uri);
+
+  osip_transaction_t *old_tr = NULL;
+  atomic_compare_exchange_strong(&self->transaction, &old_tr, tr);
+
+  tr->your_instance = (void *) device;
+  tr->out_socket = device->socket_sip;
+  tr->reserved1 = self;
+  SIPTransactionData_get(tr, out_af) = device->addr.sa_family;
+  SIPTransactionData_get(tr, trace_id) = self->trace_id;
+
+  // transaction needs one reference
+  SIPLeelenSession_incref(self);
+  // osip_transaction_execute returns 1 if event got consumed
+  osip_transaction_execute(tr, event);
+  return 0;
+
+  if (0) {
+fail_request:
+    osip_message_free(request);
+  }
+fail_oom:
+  LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID ": Out of memory", id);
+  return -1;
+}
+
+
+/**
+ * @memberof SIPLeelenSession
+ * @private
+ * @brief Send ACK for 2XX response of our INVITE.
+ *
+ * ACK is not a transaction, thus sent directly to the client.
+ *
+ * @param self LEELEN2SIP session.
+ * @return 0 on success, -1 on error.
+ */
+static int SIPLeelenSession_ack (struct SIPLeelenSession *self) {
+  const struct SIPLeelen *device = self->device;
+
+  osip_message_t *ack;
+  return_if_fail (osip_message_request(
+    &ack, self->sip, "ACK", device->ua) == OSIP_SUCCESS) -1;
+  char *buf;
+  size_t len;
+  should (osip_message_to_str(ack, &buf, &len) == OSIP_SUCCESS) otherwise {
+    osip_message_free(ack);
+    return -1;
+  }
+
+  // only support single user, so the remote target is where it registered
+  union sockaddr_in46 dst = device->clients;
+  if (device->addr.sa_family == AF_INET6) {
+    sockaddr_to6(&dst.sock);
+  }
+  ssize_t sent = sendto(
+    device->socket_sip, buf, len, 0, &dst.sock, dst.sa_family == AF_INET ?
+      sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+  if likely (sent == (ssize_t) len) {
+    // counters are thread-safe
+    SIPLeelenMetrics_count_sip(
+      (struct SIPLeelenMetrics *) &device->metrics, ack,
+      SIPLEELEN_DIRECTION_OUT);
+    if unlikely (device->tap != NULL) {
+      SIPLeelen_tap_sip(device, ack, buf, len, &device->addr.sock, &dst.sock);
+    }
+  }
+  osip_message_free(ack);
+  osip_free(buf);
+  return sent == (ssize_t) len ? 0 : -1;
+}
+
+
 int SIPLeelenSession_receive (
     struct SIPLeelenSession *self, char *msg, int sockfd,
     const struct sockaddr *src) {
+  unsigned long long arrival = monotonic_us();
   leelen_id_t id = self->leelen.id;
   enum LeelenCode code = le32toh(LEELEN_MESSAGE_CODE(msg));
   return_if_fail (code != LEELEN_CODE_OPEN_GATE) 255;
@@ -46,10 +402,12 @@ int SIPLeelenSession_receive (
 
   // process message
   enum LeelenDialogState old_state = self->leelen.state;
-  char **audio_formats;
-  char **video_formats;
+  bool open_gate_acked =
+    code == LEELEN_CODE_OK && self->leelen.last_code == LEELEN_CODE_OPEN_GATE;
+  char *audio_formats[LEELEN_MESSAGE_MAX_FORMATS + 1] = {0};
+  char *video_formats[LEELEN_MESSAGE_MAX_FORMATS + 1] = {0};
   switch (LeelenDialog_receive(
-      &self->leelen, msg, sockfd, &audio_formats, &video_formats)) {
+      &self->leelen, msg, sockfd, audio_formats, video_formats)) {
     case -1:
       LOG_PERROR(
         LOG_LEVEL_WARNING,
@@ -59,6 +417,21 @@ int SIPLeelenSession_receive (
       LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
           ": LEELEN ACK got, but timeout reached", id);
       return 1;
+    case 253:
+      LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID
+          ": Duplicated LEELEN message, ACKed again", id);
+      return 0;
+  }
+
+  if (open_gate_acked) {
+    unsigned long long start = atomic_exchange(&self->open_gate_start, 0);
+    if likely (start != 0) {
+      unsigned long long latency = monotonic_us() - start;
+      Histogram_add(
+        (struct Histogram *) &self->device->open_gate_latency, latency);
+      LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID
+          ": Gate opened in %llu us", id, latency);
+    }
   }
 
   int status_code;
@@ -70,8 +443,11 @@ int SIPLeelenSession_receive (
     case LEELEN_CODE_BYE:
       // no need to handle disconnected session
       goto_if (old_state == LEELEN_DIALOG_DISCONNECTED) end;
+      CdrRecord_set_reason(&self->cdr, CDR_REASON_LEELEN_BYE);
 
-      should (old_state != LEELEN_DIALOG_CONNECTING) otherwise {
+      // a call from LEELEN not answered yet is cancelled by bye_sip()
+      should (old_state != LEELEN_DIALOG_CONNECTING ||
+              (tr != NULL && tr->ctx_type == ICT)) otherwise {
         should (tr != NULL && tr->ctx_type == IST) otherwise {
           LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
               ": connection establish without SIP transaction", id);
@@ -97,135 +473,27 @@ int SIPLeelenSession_receive (
       goto_if_fail (self->device->client != NULL &&
                     self->device->clients.sa_family != AF_UNSPEC) fail;
 
-      // create dialog
-
-      // create transaction
-      SIPLeelenSession_incref(self);
-
-      goto end;
-    case LEELEN_CODE_OK: {
-      // only handle connection event
-      goto_if_fail (old_state == LEELEN_DIALOG_CONNECTING) end;
-
-connecting:
-      should (tr != NULL && tr->ctx_type == IST) otherwise {
-        LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
-            ": connection establish without SIP transaction", id);
+      // LEELEN ack has been sent; invite the SIP client in the same turn
+      self->invite_start = arrival;
+      should (SIPLeelenSession_invite(
+          self, audio_formats, video_formats) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+                   ": Cannot send SIP INVITE", id);
         goto fail;
       }
-
-      osip_message_t *request = tr->orig_request;
-      status_code = 500;
-
-      // open sockets
-      in_port_t audio;
-      if unlikely (audio_formats == NULL) {
-        audio = 0;
-      }
-      in_port_t video;
-      if (video_formats == NULL) {
-        video = 0;
-      }
-      should (SIPLeelenSession_connect(
-          self, audio_formats == NULL ? NULL : &audio,
-          video_formats == NULL ? NULL : &video) == 0) otherwise {
-        LOG_PERROR(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
-                   ": Cannot open sockets", id);
-        break;
-      }
-
-      // set local tag
-      {
-        osip_generic_param_t *tag;
-        if likely (osip_to_get_tag(request->to, &tag) != OSIP_SUCCESS) {
-          char *local_tag = osip_malloc(9);
-          goto_if_fail (local_tag != NULL) fail_ist_oom;
-          snprintf(local_tag, 9, PRI_LEELEN_ID, id);
-          should (osip_to_set_tag(
-              request->to, local_tag) == OSIP_SUCCESS) otherwise {
-            free(local_tag);
-            goto fail_ist_oom;
-          }
-        }
-      }
-
-      int res;
-
-      // prepare sdp
-      sdp_message_t *sdp;
-      char s_id[sizeof("4294967295")];
-      snprintf(s_id, sizeof(s_id), "%" PRIu32, id);
-      goto_if_fail (sdp_message_create(
-        &sdp, SIPTransactionData_get(tr, out_af), &self->ours, s_id,
-        LEELEN2SIP_NAME
-      ) == OSIP_SUCCESS) fail_ist_oom;
-
-      if (audio != 0) {
-        goto_if_fail (_SIPLeelen_encode_media_formats(
-          sdp, "audio", audio, audio_formats) == 0) fail_ist_sdp;
-      }
-      if (video != 0) {
-        goto_if_fail (_SIPLeelen_encode_media_formats(
-          sdp, "video", video, video_formats) == 0) fail_ist_sdp;
-      }
-
-      char *body;
-      res = sdp_message_to_str(sdp, &body);
-      sdp_message_free(sdp);
-      if (0) {
-fail_ist_sdp:
-        sdp_message_free(sdp);
-        goto fail_ist_oom;
-      }
-      should (res == OSIP_SUCCESS) otherwise {
-        goto_if (res == OSIP_NOMEM) fail_ist_oom;
-        LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
-            ": Cannot create SDP message: %d", id, res);
-        break;
-      }
-
-      // create response
-      osip_message_t *response;
-      goto_if_fail (osip_message_response(
-        &response, request, 200, self->device->ua
-      ) == OSIP_SUCCESS) fail_ist_body;
-
-      res = osip_message_set_body(response, body, strlen(body));
-      osip_free(body);
-      if (0) {
-fail_ist_body:
-        osip_free(body);
-        goto fail_ist_oom;
-      }
-      goto_if_fail (res == OSIP_SUCCESS) fail_ist_response;
-
-      goto_if_fail (osip_message_set_content_type(
-        response, "application/sdp") == OSIP_SUCCESS) fail_ist_response;
-      goto_if_fail (osip_message_set_expires(
-        response, "5;refresher=uac") == OSIP_SUCCESS) fail_ist_response;
-
-      // create dialog
-      if (self->sip == NULL) {
-        goto_if_fail (osip_dialog_init_as_uas(
-          &self->sip, request, response) == OSIP_SUCCESS) fail_ist_response;
-      }
-
-      // send reply
-      goto_if_fail (osip_transaction_send_sipmessage(
-          tr, response, true) == OSIP_SUCCESS) fail_ist_response;
-
-      if (0) {
-fail_ist_response:
-        osip_message_free(response);
-        goto fail_ist_oom;
-      }
-
       goto end;
+    case LEELEN_CODE_OK:
+      // only handle connection event, and SIP half of calls from LEELEN is
+      // already established
+      goto_if_fail (old_state == LEELEN_DIALOG_CONNECTING &&
+                    self->sip == NULL) end;
 
-fail_ist_oom:
-      LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID ": Out of memory", id);
+connecting:
+      self->answer_start = arrival;
+      status_code = SIPLeelenSession_answer(self, audio_formats, video_formats);
+      goto_if (status_code == 0) end;
+      goto_if (status_code == 1) fail;
       break;
-    }
   }
 
   should (osip_transaction_response(
@@ -251,12 +519,105 @@ neutral:
 end:
     res = 0;
   }
-  strvfree(audio_formats);
-  strvfree(video_formats);
   return res;
 }
 
 
+int SIPLeelenSession_receive_ring (
+    struct SIPLeelenSession *self, leelen_id_t id, char *msg, int sockfd,
+    const struct sockaddr *src) {
+  unsigned long long arrival = monotonic_us();
+  enum LeelenCode code = le32toh(LEELEN_MESSAGE_CODE(msg));
+
+  mtx_lock(&self->mtx);
+  struct LeelenDialog *dialog = SIPLeelenSession_find_ring(self, id);
+  should (dialog != NULL && code != LEELEN_CODE_OPEN_GATE) otherwise {
+    mtx_unlock(&self->mtx);
+    return 255;
+  }
+
+  if unlikely (!sockaddr_same(&dialog->theirs.sock, src)) {
+    dialog->theirs = *(union sockaddr_in46 *) src;
+  }
+
+  // process message
+  enum LeelenDialogState old_state = dialog->state;
+  char *audio_formats[LEELEN_MESSAGE_MAX_FORMATS + 1] = {0};
+  char *video_formats[LEELEN_MESSAGE_MAX_FORMATS + 1] = {0};
+  int ret = 0;
+  switch (LeelenDialog_receive(
+      dialog, msg, sockfd, audio_formats, video_formats)) {
+    case -1:
+      LOG_PERROR(
+        LOG_LEVEL_WARNING,
+        "Dialog " PRI_LEELEN_ID ": Cannot process LEELEN SIP message", id);
+      ret = 1;
+      goto end;
+    case 254:
+      LOG(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
+          ": LEELEN ACK got, but timeout reached", id);
+      ret = 1;
+      goto end;
+    case 253:
+      goto end;
+  }
+
+  switch (code) {
+    default:
+      // OK of CALL only means ringing
+      goto end;
+    case LEELEN_CODE_BYE:
+      LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Ring declined", id);
+      goto end;
+    case LEELEN_CODE_ACCEPTED:
+      break;
+  }
+
+  // late answer
+  should (old_state != LEELEN_DIALOG_DISCONNECTING &&
+          self->leelen.id == 0) otherwise {
+    LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID
+        ": Ring accepted, but already answered", id);
+    should (LeelenDialog_may_bye(dialog, sockfd) >= 0) otherwise {
+      LeelenDialog_destroy(dialog);
+    }
+    goto end;
+  }
+
+  // bind SIP dialog to the first one, and close others
+  LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Ring accepted", id);
+  self->leelen = *dialog;
+  LeelenDialog_destroy(dialog);
+  should (SIPLeelenSession_bye_ring(self, NULL) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+               ": Cannot close other ring group dialogs", id);
+  }
+  mtx_unlock(&self->mtx);
+
+  self->answer_start = arrival;
+  int status_code = SIPLeelenSession_answer(
+    self, audio_formats, video_formats);
+  return_if (status_code == 0) 0;
+  if (status_code != 1) {
+    should (osip_transaction_response(
+        self->transaction, status_code, self->device->ua, true
+    ) == OSIP_SUCCESS) otherwise {
+      LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+          ": Out of memory, reply not sent", id);
+    }
+  }
+  should (SIPLeelenSession_bye_leelen(self) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+               ": Cannot close LEELEN session", id);
+  }
+  return 1;
+
+end:
+  mtx_unlock(&self->mtx);
+  return ret;
+}
+
+
 /**
  * @relates SIPTransactionData
  * @private
@@ -264,10 +625,90 @@ end:
  *
  * @param type Transaction type.
  * @param tr Transaction.
- * @param request OSIP Request.
+ * @param response OSIP response.
  */
 static void _SIPLeelen_ict_connect (
-    int type, osip_transaction_t *tr, osip_message_t *request) {
+    int type, osip_transaction_t *tr, osip_message_t *response) {
+  struct SIPLeelen *self = tr->your_instance;
+  int trid = tr->transactionid;
+  struct SIPLeelenSession *session = tr->reserved1;
+  return_if_fail (session != NULL);
+  leelen_id_t id = session->leelen.id;
+
+  // door-press-to-ring latency
+  if (session->invite_start != 0 && response->status_code > 100) {
+    unsigned long long latency = monotonic_us() - session->invite_start;
+    session->invite_start = 0;
+    Histogram_add(&self->ring_latency, latency);
+    LOG(LOG_LEVEL_DEBUG, "Dialog " PRI_LEELEN_ID ": Ringing in %llu us",
+        id, latency);
+  }
+  return_if (type == OSIP_ICT_STATUS_1XX_RECEIVED);
+
+  // answered
+  if (session->sip == NULL) {
+    should (osip_dialog_init_as_uac(
+        &session->sip, response) == OSIP_SUCCESS) otherwise {
+      LOG(LOG_LEVEL_WARNING, "Transaction %d: Out of memory", trid);
+      goto fail;
+    }
+  }
+  should (SIPLeelenSession_ack(session) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Transaction %d: Cannot send ACK", trid);
+  }
+  return_if (type == OSIP_ICT_STATUS_2XX_RECEIVED_AGAIN);
+  atomic_store_explicit(
+    &session->media_start, monotonic_us(), memory_order_relaxed);
+
+  // relay media, sockets were opened when inviting
+  union sockaddr_in46 addrs[2];
+  if (_SIPLeelen_extract_media_addrs(response, &addrs[0], &addrs[1]) == 0) {
+    struct Forwarder *forwarders[2] = {&session->audio, &session->video};
+    for (int i = 0; i < 2; i++) {
+      continue_if (addrs[i].sa_family == AF_UNSPEC);
+      continue_if (forwarders[i]->socket2 < 0);
+      if (self->addr.sa_family == AF_INET6) {
+        sockaddr_to6(&addrs[i].sock);
+      }
+      // otherwise learnt from the first packet
+      should (connect(
+          forwarders[i]->socket2, &addrs[i].sock, sizeof(addrs[i])
+      ) == 0) otherwise {
+        LOG_PERROR(LOG_LEVEL_INFO, "Dialog " PRI_LEELEN_ID
+                   ": Cannot connect media socket", id);
+      }
+    }
+  }
+  should (SIPLeelenSession_start_forward(session) == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+               ": Cannot start forwarders", id);
+  }
+
+  // accept LEELEN call
+  char **audio_formats = NULL;
+  char **video_formats = NULL;
+  should (_SIPLeelen_extract_media_formats(
+      response, &audio_formats, &video_formats) >= 0) otherwise {
+    LOG(LOG_LEVEL_WARNING, "Transaction %d: Out of memory", trid);
+    goto fail;
+  }
+  int res = LeelenDialog_send(
+    &session->leelen, LEELEN_CODE_ACCEPTED, self->socket_leelen,
+    audio_formats, video_formats);
+  strvfree(audio_formats);
+  strvfree(video_formats);
+  should (res == 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+               ": Cannot accept LEELEN call", id);
+    goto fail;
+  }
+  return;
+
+fail:
+  should (SIPLeelenSession_bye(session, false) == 0) otherwise {
+    LOG(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
+        ": Cannot close session", id);
+  }
 }
 
 
@@ -288,6 +729,7 @@ static void _SIPLeelen_ict_terminate (
   struct SIPLeelenSession *session = tr->reserved1;
   leelen_id_t id = session->leelen.id;
 
+  CdrRecord_set_reason(&session->cdr, CDR_REASON_SIP_REJECT);
   should (SIPLeelenSession_bye_leelen(session) == 0) otherwise {
     LOG_PERROR(LOG_LEVEL_WARNING, "Dialog " PRI_LEELEN_ID
                 ": Cannot close LEELEN session", id);
@@ -8,6 +8,7 @@ extern "C" {
 // #include <sys/socket.h>
 struct sockaddr;
 
+#include "leelen/voip/protocol.h"
 // #include "session.h"
 struct SIPLeelenSession;
 // #include "sipleelen.h"
@@ -28,6 +29,24 @@ __attribute__((nonnull, access(read_only, 4)))
 int SIPLeelenSession_receive (
   struct SIPLeelenSession *self, char *msg, int sockfd,
   const struct sockaddr *src);
+__attribute__((nonnull, access(read_only, 5)))
+/**
+ * @memberof SIPLeelenSession
+ * @brief Process incoming LEELEN message of a ring group dialog.
+ *
+ * The first dialog that accepts the call is moved to SIPLeelenSession::leelen
+ * and answers the SIP transaction, and other dialogs are closed.
+ *
+ * @param self LEELEN2SIP session.
+ * @param id Dialog ID.
+ * @param msg Message.
+ * @param sockfd Socket that received the message.
+ * @param src Source address of the message.
+ * @return 0 on success, 255 if no ring group dialog matched, otherwise error.
+ */
+int SIPLeelenSession_receive_ring (
+  struct SIPLeelenSession *self, leelen_id_t id, char *msg, int sockfd,
+  const struct sockaddr *src);
 
 __attribute__((nonnull))
 /**
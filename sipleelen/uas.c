@@ -21,18 +21,180 @@
 #include "utils/osip.h"
 #include "utils/single.h"
 #include "utils/threadname.h"
+#include "utils/trace.h"
 #include "leelen/config.h"
 #include "leelen/number.h"
 #include "leelen/discovery/host.h"
+#include "leelen/route.h"
 #include "leelen/voip/dialog.h"
 #include "leelen/voip/message.h"
 #include "leelen/voip/protocol.h"
+#include "cdr.h"
 #include "session.h"
 #include "sipleelen.h"
 #include "transaction.h"
 #include "uas.h"
 
 
+/**
+ * @relates SIPTransactionData
+ * @private
+ * @brief Ring group state of INVITE main thread.
+ */
+struct SIPLeelenRing {
+  /// LEELEN2SIP object
+  struct SIPLeelen *device;
+  /// LEELEN2SIP session
+  struct SIPLeelenSession *session;
+  /// SIP transaction ID
+  int trid;
+  /// audio description of caller
+  char * const *audio_formats;
+  /// video description of caller
+  char * const *video_formats;
+  /// SIP Call-ID of caller
+  const osip_call_id_t *call_id;
+};
+
+
+/**
+ * @relates SIPLeelenRing
+ * @private
+ * @brief Call a host found by ring group discovery.
+ *
+ * @param arg Ring group state.
+ * @param host Host object.
+ * @return 0 to continue discovery, 1 if someone has accepted.
+ */
+static int _SIPLeelen_ring_found (void *arg, struct LeelenHost *host) {
+  struct SIPLeelenRing *ring = arg;
+  struct SIPLeelen *self = ring->device;
+  struct SIPLeelenSession *session = ring->session;
+  int trid = ring->trid;
+
+  LOGEVENT (LOG_LEVEL_DEBUG) {
+    char s_addr[SOCKADDR_STRLEN];
+    sockaddr_toa(&host->sock, s_addr, sizeof(s_addr));
+    LOGEVENT_LOG("Transaction %d: Extension of %s is at %s", trid,
+                 session->number.str, s_addr);
+  }
+
+  // convert address if needed
+  union sockaddr_in46 addr;
+  memcpy(&addr, &host->sock, sizeof(addr));
+  if (self->leelen.config->addr.sa_family != addr.sa_family) {
+    if (self->leelen.config->addr.sa_family == AF_INET6) {
+      sockaddr_to6(&addr.sock);
+    } else {
+      should (sockaddr_to4(&addr.sock) != NULL) otherwise {
+        LOG(LOG_LEVEL_INFO,
+            "Transaction %d: Cannot connect to IPv6 address from IPv4 socket",
+            trid);
+        return 0;
+      }
+    }
+  }
+
+  mtx_lock(&session->mtx);
+  int ret = session->leelen.id != 0;
+  if (!ret && session->n_ring < SIPLEELEN_RING_SIZE) {
+    struct LeelenDialog *dialog = &session->ring[session->n_ring];
+    LeelenDialog_init(
+      dialog, self->leelen.config, &addr.sock, &session->number, 0);
+    SIPLeelenSession_tap(session, dialog, ring->call_id);
+    // tie thread of transaction to dialog
+    TRACE_MARK("dialog", dialog->id);
+    dialog->ack_latency = &self->call_ack_latency;
+    should (LeelenDialog_send(
+        dialog, LEELEN_CODE_CALL, self->socket_leelen,
+        ring->audio_formats, ring->video_formats) == 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING,
+                 "Transaction %d: Cannot send LEELEN invite", trid);
+      LeelenDialog_destroy(dialog);
+      goto end;
+    }
+    LOG(LOG_LEVEL_DEBUG, "Transaction %d: Ring LEELEN dialog " PRI_LEELEN_ID,
+        trid, dialog->id);
+    session->n_ring++;
+  }
+end:
+  mtx_unlock(&session->mtx);
+  return ret;
+}
+
+
+/**
+ * @relates SIPTransactionData
+ * @private
+ * @brief Call all extensions of a room in parallel.
+ *
+ * @param tr Transaction.
+ * @param audio_formats Audio description of caller.
+ * @param video_formats Video description of caller.
+ * @return 0 on success, otherwise SIP status code to reply.
+ */
+static int _SIPLeelen_ist_invite_ring (
+    osip_transaction_t *tr, char * const *audio_formats,
+    char * const *video_formats) {
+  struct SIPLeelen *self = tr->your_instance;
+  int trid = tr->transactionid;
+  struct SIPLeelenSession *session = tr->reserved1;
+
+  struct LeelenDialog *dialogs = malloc(SIPLEELEN_RING_SIZE * sizeof(*dialogs));
+  should (dialogs != NULL) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Transaction %d: malloc()", trid);
+    return 500;
+  }
+  mtx_lock(&session->mtx);
+  session->ring = dialogs;
+  session->n_ring = 0;
+  mtx_unlock(&session->mtx);
+
+  // solicit every extension
+  struct LeelenNumber numbers[SIPLEELEN_RING_SIZE];
+  const char *phones[SIPLEELEN_RING_SIZE];
+  for (int i = 0; i < SIPLEELEN_RING_SIZE; i++) {
+    numbers[i] = session->number;
+    numbers[i].sep2 = '-';
+    numbers[i].extension = '0' + i;
+    numbers[i].sep3 = '\0';
+    phones[i] = numbers[i].str;
+  }
+
+  struct SIPLeelenRing ring = {
+    .device = self, .session = session, .trid = trid,
+    .audio_formats = audio_formats, .video_formats = video_formats,
+    .call_id = tr->orig_request->call_id,
+  };
+  struct LeelenHost hosts[SIPLEELEN_RING_SIZE];
+  session->transaction = tr;
+  int n_host = LeelenDiscovery_discovery_group(
+    &self->leelen, phones, SIPLEELEN_RING_SIZE, hosts, SIPLEELEN_RING_SIZE,
+    _SIPLeelen_ring_found, &ring, session->trace_id);
+  for (int i = 0; i < n_host; i++) {
+    LeelenHost_destroy(&hosts[i]);
+  }
+
+  should (n_host > 0) otherwise {
+    if (n_host < 0) {
+      LOG_PERROR(
+        LOG_LEVEL_WARNING, "Transaction %d: Cannot send discovery", trid);
+      return 500;
+    }
+    LOG(LOG_LEVEL_DEBUG, "Transaction %d: Cannot find any extension of %s",
+        trid, session->number.str);
+    return 404;
+  }
+  // the ring group is freed by main loop once all dialogs end
+  should (session->n_ring > 0) otherwise {
+    return 500;
+  }
+  LOG(LOG_LEVEL_DEBUG, "Transaction %d: Ringing %d extensions of %s",
+      trid, session->n_ring, session->number.str);
+  return 0;
+}
+
+
 /**
  * @relates SIPTransactionData
  * @private
@@ -47,15 +209,47 @@ static int _SIPLeelen_ist_invite_process (void *arg) {
   int trid = tr->transactionid;
   struct SIPLeelenSession *session = tr->reserved1;
   int status_code;
+  int ret = 0;
 
   threadname_format("INVITE %d", trid);
 
   // discover if new session
   if (session->leelen.id == 0) {
-    // discovery
     struct LeelenHost host;
+    if (session->route.action == LEELEN_ROUTE_ADDRESS) {
+      // routed by dial plan
+      memcpy(&host, &session->route.addr, sizeof(session->route.addr));
+      host.desc = NULL;
+      goto found;
+    }
+
+    // ring all extensions if not specified
+    if (!LeelenNumber_has_extension(&session->number)) {
+      char **audio_formats;
+      char **video_formats;
+      switch (_SIPLeelen_extract_media_formats(
+          request, &audio_formats, &video_formats)) {
+        case 1:
+          LOG(LOG_LEVEL_INFO, "Transaction %d: Cannot parse SDP", trid);
+          status_code = 400;
+          goto reply;
+        case -1:
+          LOG(LOG_LEVEL_INFO,
+              "Transaction %d: Out of memory during parsing SDP", trid);
+          status_code = 500;
+          goto reply;
+      }
+      status_code = _SIPLeelen_ist_invite_ring(
+        tr, audio_formats, video_formats);
+      free(audio_formats);
+      free(video_formats);
+      goto_if (status_code != 0) reply;
+      goto end;
+    }
+
+    // discovery
     int res = LeelenDiscovery_discovery(
-      &self->leelen, &host, session->number.str);
+      &self->leelen, &host, session->number.str, session->trace_id);
     should (res == 0) otherwise {
       switch (res) {
         case -1:
@@ -76,6 +270,7 @@ static int _SIPLeelen_ist_invite_process (void *arg) {
       }
       goto reply;
     }
+found:
     LOGEVENT (LOG_LEVEL_DEBUG) {
       char s_addr[SOCKADDR_STRLEN];
       sockaddr_toa(&host.sock, s_addr, sizeof(s_addr));
@@ -101,7 +296,12 @@ static int _SIPLeelen_ist_invite_process (void *arg) {
 
     // connect
     LeelenDialog_init(
-      &session->leelen, self->leelen.config, &host.sock, &session->number, 0);
+      &session->leelen, self->leelen.config, &host.sock, &session->number,
+      session->trace_id);
+    SIPLeelenSession_tap(session, &session->leelen, request->call_id);
+    // tie thread of transaction to dialog
+    TRACE_MARK("dialog", session->leelen.id);
+    session->leelen.ack_latency = &self->call_ack_latency;
     LeelenHost_destroy(&host);
     LOG(LOG_LEVEL_DEBUG, "Transaction %d: Start LEELEN dialog " PRI_LEELEN_ID,
         trid, session->leelen.id);
@@ -137,8 +337,6 @@ static int _SIPLeelen_ist_invite_process (void *arg) {
     goto reply;
   }
 
-  int ret = 0;
-
   // send fail SIP message
   if (0) {
 reply:
@@ -150,6 +348,7 @@ reply:
     ret = 1;
   }
 
+end:
   single_finish(&session->invite_state);
   SIPLeelenSession_decref(session);
   return ret;
@@ -211,6 +410,30 @@ static void _SIPLeelen_ist_invite (
         trid, username, number.str);
   }
 
+  // route
+  struct LeelenRoute route;
+  if (!LeelenRouter_lookup(&self->router, &number, &route)) {
+    route.action = LEELEN_ROUTE_DISCOVER;
+  }
+  switch (route.action) {
+    case LEELEN_ROUTE_REJECT:
+      LOG(LOG_LEVEL_DEBUG, "Transaction %d: %s rejected by dial plan",
+          trid, number.str);
+      status_code = 403;
+      goto reply;
+    case LEELEN_ROUTE_REDIRECT:
+      LOG(LOG_LEVEL_DEBUG, "Transaction %d: Redirect %s to %s",
+          trid, number.str, route.target);
+      should (osip_transaction_redirect(
+          tr, 302, self->ua, route.target, false) == OSIP_SUCCESS) otherwise {
+        LOG(LOG_LEVEL_WARNING, "Transaction %d: Cannot redirect to %s",
+            trid, route.target);
+        status_code = 500;
+        goto reply;
+      }
+      return;
+  }
+
   // start thread if not
   if unlikely (single_is_running(&session->invite_state)) {
     should (LeelenNumber_equal(&session->number, &number)) otherwise {
@@ -224,6 +447,8 @@ static void _SIPLeelen_ist_invite (
     single_join(&session->invite_state);
 
     session->number = number;
+    session->route = route;
+    SIPLeelenSession_set_cdr(session, request, false);
 
     SIPLeelenSession_incref(session);
     should (single_start(
@@ -273,9 +498,15 @@ static void _SIPLeelen_nist_bye (
   }
 
   status_code = 200;
-
-  if (session->leelen.state == LEELEN_DIALOG_CONNECTING) {
-    osip_transaction_t *orig_tr = session->transaction;
+  CdrRecord_set_reason(
+    &session->cdr, type == OSIP_NIST_CANCEL_RECEIVED ?
+      CDR_REASON_SIP_CANCEL : CDR_REASON_SIP_BYE);
+
+  osip_transaction_t *orig_tr = session->transaction;
+  // calls from LEELEN have our INVITE (ICT) instead
+  if ((session->leelen.state == LEELEN_DIALOG_CONNECTING ||
+       SIPLeelenSession_ringing(session)) &&
+      orig_tr != NULL && orig_tr->ctx_type == IST) {
 
     // CANCEL if only INVITE not finished, or BYE if only INVITE finished
     should (
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils/macro.h"
+#include "utils/arg.h"
+#include "utils/timeval.h"
+#include "leelen/voip/dialog.h"
+#include "sipleelen/shmstats.h"
+
+/**
+ * @file
+ * Live view of the statistics segment published by `leelen2sip --stats-shm`.
+ *
+ * Usage: leelen2sip-top [-i <ms>] [-n <count>] [<name>]
+ *
+ * The segment is mapped read-only, so refreshing costs the gateway nothing.
+ * Rates are computed from the difference between two refreshes. When the
+ * gateway restarts, the new segment is picked up once the old one stops
+ * updating.
+ */
+
+
+#define TOP_NAME "leelen2sip-top"
+/// default segment name
+#define TOP_SEGMENT "/leelen2sip"
+/// default refresh interval, in milliseconds
+#define TOP_INTERVAL 1000
+/// maximum refresh interval, in milliseconds
+#define TOP_INTERVAL_MAX 3600000
+/// a segment not updated for this long is considered stale, in microseconds
+#define TOP_STALE 3000000
+
+
+/// names of ::ShmStatsLatency
+static const char * const top_latency_names[SHM_STATS_LATENCY_COUNT] = {
+  "discovery", "trying", "call ack", "ring", "answer", "media", "open gate",
+  "relay",
+};
+
+
+/**
+ * @brief Snapshot of statistics segment.
+ */
+struct TopSnapshot {
+  /// global statistics
+  struct ShmStatsGlobal global;
+  /// session slots
+  struct ShmStatsSession sessions[SHM_STATS_SESSIONS];
+};
+
+
+/**
+ * @brief Map statistics segment read-only.
+ *
+ * @param name Segment name.
+ * @param[out] st Status of the segment object, telling one run of the gateway
+ *  from another.
+ * @return Segment, or @c NULL on error and @c errno is set appropriately.
+ */
+static const struct ShmStats *top_open (const char *name, struct stat *st) {
+  int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  return_if_fail (fd >= 0) NULL;
+  const struct ShmStats *stats = MAP_FAILED;
+  if likely (fstat(fd, st) == 0) {
+    if (st->st_size < (off_t) sizeof(struct ShmStats)) {
+      errno = EPROTO;
+    } else {
+      stats = mmap(NULL, sizeof(struct ShmStats), PROT_READ, MAP_SHARED, fd, 0);
+    }
+  }
+  close(fd);
+  return_if_fail (stats != MAP_FAILED) NULL;
+
+  should (atomic_load_explicit(
+      &stats->magic, memory_order_acquire) == SHM_STATS_MAGIC &&
+          stats->version == SHM_STATS_VERSION &&
+          stats->size == sizeof(struct ShmStats)) otherwise {
+    munmap((void *) stats, sizeof(struct ShmStats));
+    errno = EPROTO;
+    return NULL;
+  }
+  return stats;
+}
+
+
+/**
+ * @brief Take a snapshot of statistics segment.
+ *
+ * @param[out] snap Snapshot.
+ * @param stats Segment.
+ * @return @c true on success, @c false if a section is being written for too
+ *  long.
+ */
+static bool top_read (struct TopSnapshot *snap, const struct ShmStats *stats) {
+  return_if_fail (shm_stats_read(
+    &snap->global, &stats->global, sizeof(snap->global), &stats->global_seq
+  )) false;
+  for (int i = 0; i < SHM_STATS_SESSIONS; i++) {
+    return_if_fail (shm_stats_read(
+      &snap->sessions[i], &stats->sessions[i].data,
+      sizeof(snap->sessions[i]), &stats->sessions[i].seq)) false;
+  }
+  return true;
+}
+
+
+/**
+ * @brief Compute rate of a counter.
+ *
+ * @param cur Current value.
+ * @param prev Previous value.
+ * @param dt Elapsed time, in seconds.
+ * @return Rate per second.
+ */
+static double top_rate (uint64_t cur, uint64_t prev, double dt) {
+  return dt <= 0 || cur < prev ? 0 : (cur - prev) / dt;
+}
+
+
+/**
+ * @brief Print a view of statistics.
+ *
+ * @param stats Segment.
+ * @param cur Current snapshot.
+ * @param prev Previous snapshot, or @c NULL if none.
+ */
+static void top_print (
+    const struct ShmStats *stats, const struct TopSnapshot *cur,
+    const struct TopSnapshot *prev) {
+  const struct ShmStatsGlobal *g = &cur->global;
+  const struct ShmStatsGlobal *pg = prev == NULL ? g : &prev->global;
+  double dt = (g->published - pg->published) / 1e6;
+  bool stale = monotonic_us() - g->published > TOP_STALE;
+
+  printf("%s - pid %d, sessions %u, ringing %u, forwarders %u%s\n",
+         TOP_NAME, stats->pid, g->n_session, g->n_ringing, g->n_forwarder,
+         stale ? " (stale)" : "");
+  printf("States:");
+  for (int i = 0; i < LEELEN_DIALOG_STATE_COUNT; i++) {
+    printf(" %s %u", LeelenDialogState_names[i], g->n_state[i]);
+  }
+  printf("\nSIP/s: requests in %.1f out %.1f, responses in %.1f out %.1f\n",
+         top_rate(g->sip_requests[0], pg->sip_requests[0], dt),
+         top_rate(g->sip_requests[1], pg->sip_requests[1], dt),
+         top_rate(g->sip_responses[0], pg->sip_responses[0], dt),
+         top_rate(g->sip_responses[1], pg->sip_responses[1], dt));
+  printf("Discovery: found %llu, timeout %llu\n\n",
+         (unsigned long long) g->discoveries[0],
+         (unsigned long long) g->discoveries[1]);
+
+  // relay
+  static const char * const media_names[2] = {"audio", "video"};
+  printf("%-10s %10s %10s %12s %12s\n",
+         "Relay", "pps L>S", "pps S>L", "kbit/s L>S", "kbit/s S>L");
+  for (int i = 0; i < 2; i++) {
+    printf("%-10s %10.0f %10.0f %12.1f %12.1f\n", media_names[i],
+           top_rate(g->relay_packets[i][0], pg->relay_packets[i][0], dt),
+           top_rate(g->relay_packets[i][1], pg->relay_packets[i][1], dt),
+           top_rate(g->relay_bytes[i][0], pg->relay_bytes[i][0], dt) / 125,
+           top_rate(g->relay_bytes[i][1], pg->relay_bytes[i][1], dt) / 125);
+  }
+
+  // latency
+  printf("\n%-10s %10s %10s %10s %10s %10s\n",
+         "Latency ms", "count", "avg", "p50", "p99", "max");
+  for (int i = 0; i < SHM_STATS_LATENCY_COUNT; i++) {
+    const struct ShmStatsHistogram *h = &g->latency[i];
+    printf("%-10s %10llu %10.3f %10.3f %10.3f %10.3f\n", top_latency_names[i],
+           (unsigned long long) h->count,
+           h->count == 0 ? 0 : h->sum / 1e3 / h->count,
+           h->p50 / 1e3, h->p99 / 1e3, h->max / 1e3);
+  }
+
+  // sessions
+  printf("\n%-8s %-13s %-12s %-21s %8s %9s %9s\n",
+         "ID", "STATE", "NUMBER", "PEER", "AGE", "A pps", "V pps");
+  for (int i = 0; i < SHM_STATS_SESSIONS; i++) {
+    const struct ShmStatsSession *s = &cur->sessions[i];
+    continue_if (s->started == 0);
+    const struct ShmStatsSession *ps =
+      prev != NULL && prev->sessions[i].started == s->started ?
+        &prev->sessions[i] : s;
+
+    unsigned long long age = (g->published - s->started) / 1000000;
+    char s_age[16];
+    snprintf(s_age, sizeof(s_age), "%llu:%02llu:%02llu",
+             age / 3600 % 100, age / 60 % 60, age % 60);
+    char s_pps[2][16];
+    for (int j = 0; j < 2; j++) {
+      if (s->running[j]) {
+        snprintf(s_pps[j], sizeof(s_pps[j]), "%.0f/%.0f",
+                 top_rate(s->packets[j][0], ps->packets[j][0], dt),
+                 top_rate(s->packets[j][1], ps->packets[j][1], dt));
+      } else {
+        strcpy(s_pps[j], "-");
+      }
+    }
+    printf("%08x %-13s %-12s %-21s %8s %9s %9s\n", s->id,
+           s->state < LEELEN_DIALOG_STATE_COUNT ?
+             LeelenDialogState_names[s->state] : "unknown",
+           s->number, s->peer, s_age, s_pps[0], s_pps[1]);
+  }
+}
+
+
+static void top_help (const char *progname) {
+  fprintf(stderr, "Usage: %s [-i <ms>] [-n <count>] [<name>]\n", progname);
+}
+
+
+int main (int argc, char **argv) {
+  unsigned int interval_ms = TOP_INTERVAL;
+  unsigned long count = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+    switch (opt) {
+      case 'i': {
+        int res;
+        goto_if_fail (argtoi(
+          optarg, &res, 1, TOP_INTERVAL_MAX, "-i", NULL) == 0) usage;
+        interval_ms = res;
+        break;
+      }
+      case 'n': {
+        int res;
+        goto_if_fail (argtoi(optarg, &res, 0, INT_MAX, "-n", NULL) == 0) usage;
+        count = res;
+        break;
+      }
+      case 'h':
+        top_help(argv[0]);
+        return 0;
+      default:
+usage:
+        top_help(argv[0]);
+        return 255;
+    }
+  }
+  const char *name = optind < argc ? argv[optind] : TOP_SEGMENT;
+
+  struct stat st;
+  const struct ShmStats *stats = top_open(name, &st);
+  should (stats != NULL) otherwise {
+    perror(name);
+    return 1;
+  }
+
+  bool tty = isatty(STDOUT_FILENO);
+  static struct TopSnapshot snaps[2];
+  bool has_prev = false;
+  for (unsigned long n = 0; count == 0 || n < count; n++) {
+    if (n != 0) {
+      struct timespec ts = {
+        .tv_sec = interval_ms / 1000,
+        .tv_nsec = interval_ms % 1000 * 1000000,
+      };
+      nanosleep(&ts, NULL);
+    }
+
+    struct TopSnapshot *cur = &snaps[n % 2];
+    struct TopSnapshot *prev = &snaps[(n + 1) % 2];
+    should (top_read(cur, stats)) otherwise {
+      has_prev = false;
+      continue;
+    }
+
+    // gateway restarted, pick up the new segment; it is always created anew,
+    // and the mapped old one keeps its inode number from being reused
+    if (monotonic_us() - cur->global.published > TOP_STALE) {
+      struct stat fresh_st;
+      const struct ShmStats *fresh = top_open(name, &fresh_st);
+      if (fresh != NULL && (fresh_st.st_dev != st.st_dev ||
+                            fresh_st.st_ino != st.st_ino)) {
+        munmap((void *) stats, sizeof(struct ShmStats));
+        stats = fresh;
+        st = fresh_st;
+        has_prev = false;
+        continue_if_fail (top_read(cur, stats));
+      } else if (fresh != NULL) {
+        munmap((void *) fresh, sizeof(struct ShmStats));
+      }
+    }
+
+    if (tty) {
+      // home and clear screen
+      fputs("\033[H\033[2J", stdout);
+    }
+    top_print(stats, cur, has_prev ? prev : NULL);
+    fflush(stdout);
+    has_prev = true;
+  }
+
+  munmap((void *) stats, sizeof(struct ShmStats));
+  return 0;
+}
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include <inet46i/sockaddr46.h>
+
+#include "utils/macro.h"
+#include "leelen/family.h"
+#include "leelen/number.h"
+#include "leelen/discovery/host.h"
+#include "leelen/discovery/protocol.h"
+#include "leelen/voip/message.h"
+#include "leelen/voip/protocol.h"
+
+/**
+ * @file
+ * Microbenchmarks of LEELEN wire format parsers and builders.
+ *
+ * Usage: leelenbench [-o <json>] [-t <ms>] <corpus>...
+ *
+ * Corpus files are raw packets like the `.dat` files in `tests`: VoIP messages
+ * (8-byte header followed by `From=`), discovery reports (containing `?`), or
+ * phone numbers (anything else). Synthesized worst cases are always added.
+ *
+ * Each benchmark is warmed up, then run in batches until the time budget is
+ * spent. Results are printed as a table to stderr, and as JSON to stdout or
+ * the `-o` file, for comparison between commits.
+ */
+
+
+#define LEELENBENCH_NAME "leelenbench"
+/// maximum number of inputs per corpus
+#define LEELENBENCH_CORPUS 64
+/// warmup iterations per input
+#define LEELENBENCH_WARMUP 1000
+/// default time budget per benchmark, in milliseconds
+#define LEELENBENCH_TIME 200
+
+
+/* allocation counter, interposed on glibc malloc */
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+
+static unsigned long bench_allocs;
+
+void *malloc (size_t size) {
+  bench_allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc (size_t nmemb, size_t size) {
+  bench_allocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc (void *ptr, size_t size) {
+  bench_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+void free (void *ptr) {
+  __libc_free(ptr);
+}
+
+
+/**
+ * @brief Benchmark input.
+ */
+struct BenchInput {
+  /// raw bytes, null-terminated
+  char *data;
+  /// length of BenchInput::data
+  unsigned int len;
+};
+
+
+/**
+ * @brief Set of benchmark inputs.
+ */
+struct BenchCorpus {
+  /// inputs
+  struct BenchInput inputs[LEELENBENCH_CORPUS];
+  /// number of inputs
+  int n_input;
+};
+
+
+static struct BenchCorpus corpus_message;
+static struct BenchCorpus corpus_report;
+static struct BenchCorpus corpus_number;
+
+/// sink to keep results alive
+static volatile unsigned long bench_sink;
+
+
+static int BenchCorpus_add (
+    struct BenchCorpus *self, const char *data, unsigned int len) {
+  return_if_fail (self->n_input < LEELENBENCH_CORPUS) 1;
+  char *copy = __libc_malloc(len + 1);
+  return_if_fail (copy != NULL) -1;
+  memcpy(copy, data, len);
+  copy[len] = '\0';
+  self->inputs[self->n_input].data = copy;
+  self->inputs[self->n_input].len = len;
+  self->n_input++;
+  return 0;
+}
+
+
+static void BenchCorpus_destroy (struct BenchCorpus *self) {
+  for (int i = 0; i < self->n_input; i++) {
+    __libc_free(self->inputs[i].data);
+  }
+}
+
+
+static int bench_load (const char *path) {
+  FILE *f = fopen(path, "rb");
+  return_if_fail (f != NULL) -1;
+  char buf[LEELEN_MAX_MESSAGE_LENGTH + 1];
+  unsigned int len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  // payloads may or may not be null-terminated
+  while (len > 0 && buf[len - 1] == '\0') {
+    len--;
+  }
+  buf[len] = '\0';
+
+  if (len > LEELEN_MESSAGE_HEADER_SIZE &&
+      memcmp(buf + LEELEN_MESSAGE_HEADER_SIZE, "From=", 5) == 0) {
+    return BenchCorpus_add(&corpus_message, buf, len);
+  }
+  if (Leelen_discovery_is_advertisement(buf)) {
+    return BenchCorpus_add(&corpus_report, buf, len);
+  }
+  return BenchCorpus_add(&corpus_number, buf, len);
+}
+
+
+static int bench_synthesize (void) {
+  char buf[LEELEN_MAX_MESSAGE_LENGTH + 1];
+  unsigned int len;
+
+  // message with the most formats fitting in the MTU
+  memset(buf, 0, LEELEN_MESSAGE_HEADER_SIZE);
+  LEELEN_MESSAGE_CODE(buf) = LEELEN_CODE_CALL;
+  len = LEELEN_MESSAGE_HEADER_SIZE;
+  len += sprintf(buf + len, "From=9999-0001-1?127\nTo=9999-0002-1\n");
+  for (int i = 0; len + 64 < sizeof(buf); i++) {
+    len += sprintf(buf + len, "%s=X-DYNAMIC-%d/90000\nResolution=4,3,2,1,0\n",
+                   i % 2 == 0 ? "Audio" : "Video", i);
+  }
+  len += sprintf(buf + len, "AudioPort=7078\nVideoPort=9078\n");
+  return_nonzero (BenchCorpus_add(&corpus_message, buf, len));
+
+  // message of unknown descriptions only
+  len = LEELEN_MESSAGE_HEADER_SIZE;
+  len += sprintf(buf + len, "From=9999-0001?1\nTo=9999-0002\n");
+  while (len + 32 < sizeof(buf)) {
+    len += sprintf(buf + len, "AudioCodecPreference=none\n");
+  }
+  return_nonzero (BenchCorpus_add(&corpus_message, buf, len));
+
+  // report with the longest description
+  len = sprintf(buf, "ffff:ffff:ffff:ffff:ffff:ffff:255.255.255.255?127*");
+  memset(buf + len, 'D', LEELEN_MAX_MESSAGE_LENGTH - len);
+  len = LEELEN_MAX_MESSAGE_LENGTH;
+  return_nonzero (BenchCorpus_add(&corpus_report, buf, len));
+  // report with malformed address and type
+  len = sprintf(buf, "not-an-address?x*");
+  return_nonzero (BenchCorpus_add(&corpus_report, buf, len));
+
+  // numbers in every accepted form
+  static const char *const numbers[] = {
+    "9999-0001", "9999-0001-1", "0001", "1-1", "99990001", "999900011",
+    "9999 0001 1", "x9999-0001", "99999-00001-1",
+  };
+  for (unsigned int i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+    return_nonzero (BenchCorpus_add(
+      &corpus_number, numbers[i], strlen(numbers[i])));
+  }
+  // long solicitation without '?'
+  memset(buf, '9', LEELEN_MAX_MESSAGE_LENGTH);
+  return_nonzero (BenchCorpus_add(
+    &corpus_report, buf, LEELEN_MAX_MESSAGE_LENGTH));
+  return 0;
+}
+
+
+/* benchmarks */
+
+static char bench_scratch[LEELEN_MAX_MESSAGE_LENGTH + 1];
+static const struct LeelenNumber bench_base = {.str = "9999-0009"};
+
+
+static void bench_message_init (const struct BenchInput *input) {
+  // the parser writes in place, so it works on a copy
+  memcpy(bench_scratch, input->data, input->len + 1);
+  char *audio_formats[LEELEN_MESSAGE_MAX_FORMATS + 1];
+  char *video_formats[LEELEN_MESSAGE_MAX_FORMATS + 1];
+  struct LeelenMessage message;
+  bench_sink += LeelenMessage_init(
+    &message, bench_scratch, audio_formats, video_formats);
+  bench_sink += message.audio_port;
+}
+
+
+static void bench_message_copy (const struct BenchInput *input) {
+  memcpy(bench_scratch, input->data, input->len + 1);
+  bench_sink += bench_scratch[input->len / 2];
+}
+
+
+static void bench_message_tostring (const struct BenchInput *input) {
+  (void) input;
+  static char *const audio_formats[] = {"PCMA/8000", "PCMU/8000", NULL};
+  static char *const video_formats[] = {"H264/90000", NULL};
+  static const struct LeelenMessage message = {
+    .id = 0x12345678, .code = LEELEN_CODE_CALL,
+    .from = {.str = "9999-0001"}, .from_type = 1, .to = {.str = "9999-0002"},
+    .audio_port = 7078, .video_port = 9078,
+    .audio_formats = (char **) audio_formats,
+    .video_formats = (char **) video_formats,
+  };
+  bench_sink += LeelenMessage_tostring(
+    &message, bench_scratch, sizeof(bench_scratch));
+}
+
+
+static void bench_host_init (const struct BenchInput *input) {
+  struct LeelenHost host;
+  bench_sink += LeelenHost_init(&host, input->data, NULL);
+  LeelenHost_destroy(&host);
+}
+
+
+static void bench_number_init (const struct BenchInput *input) {
+  struct LeelenNumber number;
+  bench_sink += LeelenNumber_init(&number, input->data, &bench_base);
+}
+
+
+static void bench_is_advertisement (const struct BenchInput *input) {
+  bench_sink += Leelen_discovery_is_advertisement(input->data);
+}
+
+
+/**
+ * @brief Benchmark.
+ */
+struct Bench {
+  /// name
+  const char *name;
+  /// function to run on one input
+  void (*func) (const struct BenchInput *input);
+  /// inputs
+  const struct BenchCorpus *corpus;
+};
+
+
+/**
+ * @brief Benchmark result.
+ */
+struct BenchResult {
+  /// number of operations
+  unsigned long ops;
+  /// time per operation, in nanoseconds
+  double ns_per_op;
+  /// allocations per operation
+  double allocs_per_op;
+};
+
+
+static unsigned long long bench_now_ns (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void Bench_run (
+    const struct Bench *self, unsigned int budget_ms,
+    struct BenchResult *result) {
+  const struct BenchCorpus *corpus = self->corpus;
+
+  for (int i = 0; i < LEELENBENCH_WARMUP; i++) {
+    for (int j = 0; j < corpus->n_input; j++) {
+      self->func(&corpus->inputs[j]);
+    }
+  }
+
+  unsigned long ops = 0;
+  unsigned long allocs = bench_allocs;
+  unsigned long long budget = budget_ms * 1000000ull;
+  unsigned long long start = bench_now_ns();
+  unsigned long long elapsed;
+  unsigned int batch = 64;
+  do {
+    for (unsigned int i = 0; i < batch; i++) {
+      for (int j = 0; j < corpus->n_input; j++) {
+        self->func(&corpus->inputs[j]);
+      }
+    }
+    ops += (unsigned long) batch * corpus->n_input;
+    elapsed = bench_now_ns() - start;
+    if (batch < 65536) {
+      batch *= 2;
+    }
+  } while (elapsed < budget);
+
+  result->ops = ops;
+  result->ns_per_op = (double) elapsed / ops;
+  result->allocs_per_op = (double) (bench_allocs - allocs) / ops;
+}
+
+
+static void bench_help (const char *progname) {
+  fprintf(stderr, "Usage: %s [-o <json>] [-t <ms>] <corpus>...\n", progname);
+}
+
+
+int main (int argc, char **argv) {
+  const char *json_path = NULL;
+  unsigned int budget_ms = LEELENBENCH_TIME;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:t:h")) != -1) {
+    switch (opt) {
+      case 'o':
+        json_path = optarg;
+        break;
+      case 't':
+        budget_ms = atoi(optarg);
+        break;
+      case 'h':
+        bench_help(argv[0]);
+        return 0;
+      default:
+        bench_help(argv[0]);
+        return 255;
+    }
+  }
+
+  for (int i = optind; i < argc; i++) {
+    should (bench_load(argv[i]) >= 0) otherwise {
+      perror(argv[i]);
+      return 1;
+    }
+  }
+  should (bench_synthesize() == 0) otherwise {
+    fprintf(stderr, "Cannot synthesize corpus\n");
+    return 1;
+  }
+
+  static const struct BenchInput one = {.data = "", .len = 0};
+  static struct BenchCorpus corpus_none = {.inputs = {one}, .n_input = 1};
+
+  const struct Bench benches[] = {
+    {"LeelenMessage_init", bench_message_init, &corpus_message},
+    {"LeelenMessage_init.copy", bench_message_copy, &corpus_message},
+    {"LeelenMessage_tostring", bench_message_tostring, &corpus_none},
+    {"LeelenHost_init", bench_host_init, &corpus_report},
+    {"LeelenNumber_init", bench_number_init, &corpus_number},
+    {"Leelen_discovery_is_advertisement", bench_is_advertisement,
+     &corpus_report},
+  };
+
+  FILE *json = stdout;
+  if (json_path != NULL) {
+    json = fopen(json_path, "w");
+    should (json != NULL) otherwise {
+      perror(json_path);
+      return 1;
+    }
+  }
+
+  fprintf(stderr, "%-36s %8s %12s %10s %10s\n",
+          "benchmark", "inputs", "ops", "ns/op", "allocs/op");
+  fprintf(json, "{\n  \"budget_ms\": %u,\n  \"benchmarks\": [", budget_ms);
+  for (unsigned int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    const struct Bench *bench = &benches[i];
+    struct BenchResult result;
+    Bench_run(bench, budget_ms, &result);
+    fprintf(stderr, "%-36s %8d %12lu %10.1f %10.3f\n",
+            bench->name, bench->corpus->n_input, result.ops,
+            result.ns_per_op, result.allocs_per_op);
+    fprintf(json,
+            "%s\n    {\"name\": \"%s\", \"inputs\": %d, \"ops\": %lu, "
+            "\"ns_per_op\": %.2f, \"allocs_per_op\": %.4f}",
+            i == 0 ? "" : ",", bench->name, bench->corpus->n_input,
+            result.ops, result.ns_per_op, result.allocs_per_op);
+  }
+  fprintf(json, "\n  ]\n}\n");
+
+  if (json != stdout) {
+    fclose(json);
+  }
+  BenchCorpus_destroy(&corpus_message);
+  BenchCorpus_destroy(&corpus_report);
+  BenchCorpus_destroy(&corpus_number);
+  return 0;
+}
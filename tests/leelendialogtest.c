@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <inet46i/sockaddr46.h>
+
+#include "utils/macro.h"
+#include "leelen/config.h"
+#include "leelen/voip/dialog.h"
+#include "leelen/voip/protocol.h"
+
+/**
+ * @file
+ * Test of duplicate detection of LEELEN VoIP dialogs.
+ *
+ * Usage: leelendialogtest
+ *
+ * A retransmitted request must be ACKed again and dropped, while a new request
+ * with the same code but another body must be delivered.
+ *
+ * Exits with 0 if every check passed, 1 otherwise.
+ */
+
+
+#define LEELENDIALOGTEST_NAME "leelendialogtest"
+/// dialog ID used by the test
+#define LEELENDIALOGTEST_ID 0x4a794734
+
+
+static unsigned int failures;
+
+
+/**
+ * @brief Feed a message to a dialog, and check the result.
+ *
+ * @param dialog Dialog.
+ * @param sockfd Socket to send ACKs.
+ * @param code Message code.
+ * @param body Message body.
+ * @param expected Expected result of LeelenDialog_receive().
+ * @param what Description of the check.
+ */
+static void dialogtest_receive (
+    struct LeelenDialog *dialog, int sockfd, enum LeelenCode code,
+    const char *body, int expected, const char *what) {
+  // LeelenDialog_receive() terminates lines in place, so use a fresh copy
+  char msg[LEELEN_MAX_MESSAGE_LENGTH];
+  LEELEN_MESSAGE_CODE(msg) = htole32(code);
+  LEELEN_MESSAGE_ID(msg) = LEELENDIALOGTEST_ID;
+  strcpy(msg + LEELEN_MESSAGE_HEADER_SIZE, body);
+
+  int res = LeelenDialog_receive(dialog, msg, sockfd, NULL, NULL);
+  should (res == expected) otherwise {
+    fprintf(stderr, "%s: expected %d, got %d\n", what, expected, res);
+    failures++;
+  }
+}
+
+
+int main (int argc, char **argv) {
+  (void) argv;
+  should (argc <= 1) otherwise {
+    fprintf(stderr, "Usage: " LEELENDIALOGTEST_NAME "\n");
+    return 255;
+  }
+
+  // ACKs are sent to ourselves
+  union sockaddr_in46 peer = {.v4 = {
+    .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)}};
+  socklen_t peer_len = sizeof(peer.v4);
+  int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  should (sockfd >= 0 && bind(sockfd, &peer.sock, peer_len) == 0 &&
+          getsockname(sockfd, &peer.sock, &peer_len) == 0) otherwise {
+    perror("socket");
+    return 1;
+  }
+
+  struct LeelenConfig config;
+  LeelenConfig_init(&config);
+  struct LeelenDialog dialog;
+  LeelenDialog_init(&dialog, &config, &peer.sock, NULL, LEELENDIALOGTEST_ID);
+
+  static const char first[] = "From=9999-0001?1\nTo=9999-0002\n";
+  static const char second[] =
+    "From=9999-0001?1\nTo=9999-0002\nAudioPort=7078\n";
+  dialogtest_receive(
+    &dialog, sockfd, LEELEN_CODE_OPEN_GATE, first, 0, "first request");
+  dialogtest_receive(
+    &dialog, sockfd, LEELEN_CODE_OPEN_GATE, first, 253, "retransmission");
+  dialogtest_receive(
+    &dialog, sockfd, LEELEN_CODE_OPEN_GATE, second, 0, "new request");
+  dialogtest_receive(
+    &dialog, sockfd, LEELEN_CODE_BYE, second, 0, "new code");
+  should (dialog.duplicates == 1) otherwise {
+    fprintf(stderr, "expected 1 duplicate, got %u\n", dialog.duplicates);
+    failures++;
+  }
+
+  LeelenDialog_destroy(&dialog);
+  LeelenConfig_destroy(&config);
+  close(sockfd);
+
+  fprintf(stderr, "%u failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,805 @@
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <inet46i/recvfromto.h>
+#include <inet46i/sockaddr46.h>
+#include <inet46i/socket46.h>
+
+#include "utils/macro.h"
+#include "utils/log.h"
+#include "utils/timeval.h"
+#include "leelen/config.h"
+#include "leelen/family.h"
+#include "leelen/number.h"
+#include "leelen/discovery/advertiser.h"
+#include "leelen/discovery/protocol.h"
+#include "leelen/voip/dialog.h"
+#include "leelen/voip/message.h"
+#include "leelen/voip/protocol.h"
+
+/**
+ * @file
+ * Simulate a LEELEN building on loopback aliases, for load testing.
+ *
+ * Every simulated device owns a loopback address (127.x.y.z, no interface
+ * configuration needed on Linux) and a LEELEN VoIP socket on it. A shared
+ * socket answers discovery solicitations for all devices. Devices accept calls
+ * after a configurable delay, originate calls to the gateway, stream RTP while
+ * connected, and drop a configurable ratio of incoming packets.
+ *
+ * Scenario file, one directive per line, `#` starts a comment:
+ *
+ *     gateway <address> <number>     LEELEN address and number of the gateway
+ *     devices <number> <count> <address> [<type> [<desc>]]
+ *                                    add devices with consecutive numbers and
+ *                                    addresses; can be repeated
+ *     answer <delay> [<jitter>]      answer delay in ms, -1 to never answer
+ *     hangup <ms>                    hang up connected calls after this long
+ *     originate <calls/s>            rate of calls originated to the gateway
+ *     loss <permille>                incoming packet loss
+ *     rtp <interval> <size>          RTP packet interval (ms) and payload size
+ *     duration <ms>                  length of the simulation
+ *     seed <n>                       random seed
+ */
+
+
+#define LEELENSIM_NAME "leelensim"
+/// event loop tick, in milliseconds
+#define LEELENSIM_TICK 5
+/// RTP payload type of PCMA
+#define LEELENSIM_RTP_PCMA 8
+
+
+/**
+ * @brief Simulation scenario.
+ */
+struct SimScenario {
+  /// LEELEN VoIP address of the gateway
+  union sockaddr_in46 gateway;
+  /// phone number of the gateway
+  struct LeelenNumber gateway_number;
+  /// answer delay, in milliseconds, or negative to never answer
+  int answer_delay;
+  /// maximum random jitter added to answer delay, in milliseconds
+  unsigned int answer_jitter;
+  /// call duration before hanging up, in milliseconds
+  unsigned int hangup;
+  /// originated calls per second
+  unsigned int originate;
+  /// incoming packet loss, in permille
+  unsigned int loss;
+  /// RTP packet interval, in milliseconds
+  unsigned int rtp_interval;
+  /// RTP payload size, in bytes
+  unsigned int rtp_size;
+  /// simulation length, in milliseconds
+  unsigned int duration;
+  /// random seed
+  unsigned int seed;
+};
+
+
+/**
+ * @brief Next scheduled action of a device.
+ */
+enum SimAction {
+  /// nothing to do
+  SIM_ACTION_NONE = 0,
+  /// send ACCEPTED to an incoming call
+  SIM_ACTION_ANSWER,
+  /// send BYE
+  SIM_ACTION_HANGUP,
+};
+
+
+/**
+ * @brief Simulated LEELEN device.
+ */
+struct SimDevice {
+  /// device config, LeelenConfig::desc is shared
+  struct LeelenConfig config;
+  /// VoIP socket
+  int sockfd;
+  /// RTP socket, or -1 if not streaming
+  int audiofd;
+  /// current dialog; LeelenDialog::id is 0 if idle
+  struct LeelenDialog dialog;
+  /// @c true if current dialog was originated by this device
+  bool outgoing;
+
+  /// scheduled action
+  enum SimAction action;
+  /// time of scheduled action, in milliseconds
+  unsigned long long action_at;
+  /// time of next RTP packet, in milliseconds
+  unsigned long long rtp_at;
+  /// RTP sequence number
+  uint16_t rtp_seq;
+  /// RTP timestamp
+  uint32_t rtp_ts;
+};
+
+
+/**
+ * @brief Simulation counters.
+ */
+struct SimStats {
+  unsigned long solicitations;
+  unsigned long advertisements;
+  unsigned long calls_in;
+  unsigned long calls_out;
+  unsigned long answered;
+  unsigned long connected;
+  unsigned long hangups;
+  unsigned long byes;
+  unsigned long busy;
+  unsigned long timeouts;
+  unsigned long retransmits;
+  unsigned long duplicates;
+  unsigned long lost;
+  unsigned long rtp_sent;
+  unsigned long rtp_received;
+  unsigned long errors;
+};
+
+
+/**
+ * @brief Simulated building.
+ */
+struct Sim {
+  struct SimScenario scenario;
+  /// devices
+  struct SimDevice *devices;
+  /// number of devices
+  int n_device;
+  /// config shared by discovery
+  struct LeelenConfig config;
+  /// answers discovery for all devices
+  struct LeelenAdvertiser advertiser;
+  /// discovery socket
+  int discoveryfd;
+  /// epoll instance
+  int epollfd;
+  struct SimStats stats;
+};
+
+
+/// epoll tag of the discovery socket
+#define SIM_TAG_DISCOVERY UINT32_MAX
+/// epoll tag flag of RTP sockets
+#define SIM_TAG_AUDIO (UINT32_C(1) << 31)
+
+
+static unsigned int sim_random (unsigned int n) {
+  return n == 0 ? 0 : (unsigned int) rand() % n;
+}
+
+
+static bool Sim_lose (const struct Sim *self) {
+  return self->scenario.loss > 0 && sim_random(1000) < self->scenario.loss;
+}
+
+
+static char *sim_fromkey (struct LeelenNumber *dest, uint32_t key) {
+  snprintf(dest->str, sizeof(dest->str), "%04u-%04u",
+           (key / 10000) % 10000, key % 10000);
+  return dest->str;
+}
+
+
+static int Sim_add_devices (
+    struct Sim *self, const struct LeelenNumber *first, int count,
+    const struct in_addr *addr, unsigned char type, char *desc) {
+  struct SimDevice *devices = realloc(
+    self->devices, sizeof(devices[0]) * (self->n_device + count));
+  should (devices != NULL) otherwise {
+    free(desc);
+    return -1;
+  }
+  self->devices = devices;
+
+  uint32_t key = LeelenNumber_key(first);
+  in_addr_t host = ntohl(addr->s_addr);
+  for (int i = 0; i < count; i++) {
+    struct SimDevice *device = &self->devices[self->n_device];
+    LeelenConfig_init(&device->config);
+    sim_fromkey(&device->config.number, key + i);
+    device->config.type = type;
+    device->config.desc = desc;
+    struct in_addr device_addr = {.s_addr = htonl(host + i)};
+    sockaddr46_set(&device->config.addr, AF_INET, &device_addr, 0);
+    device->sockfd = -1;
+    device->audiofd = -1;
+    device->dialog.id = 0;
+    device->action = SIM_ACTION_NONE;
+    self->n_device++;
+
+    // advertise
+    char s_addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &device_addr, s_addr, sizeof(s_addr));
+    char spec[64 + strlen(desc)];
+    snprintf(spec, sizeof(spec), "%s,%d,%s,%s", device->config.number.str,
+             type, desc, s_addr);
+    return_nonzero (LeelenAdvertiser_add_identity(
+      &self->advertiser, spec, NULL));
+  }
+  return 0;
+}
+
+
+static int Sim_load (struct Sim *self, const char *path) {
+  FILE *f = fopen(path, "r");
+  return_if_fail (f != NULL) -1;
+
+  int ret = 0;
+  char line[1024];
+  for (int lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char *saveptr;
+    char *argv[8];
+    int argc = 0;
+    for (char *tok = strtok_r(line, " \t\r\n", &saveptr);
+         tok != NULL && argc < 8; tok = strtok_r(NULL, " \t\r\n", &saveptr)) {
+      argv[argc++] = tok;
+    }
+    continue_if (argc == 0);
+
+    const char *cmd = argv[0];
+    bool ok = true;
+    if (strcmp(cmd, "gateway") == 0 && argc == 3) {
+      ok = inet_pton(AF_INET, argv[1], &self->scenario.gateway.v4.sin_addr) ==
+             1 &&
+           LeelenNumber_init(
+             &self->scenario.gateway_number, argv[2], NULL) == 0;
+      self->scenario.gateway.sa_family = AF_INET;
+    } else if (strcmp(cmd, "devices") == 0 && argc >= 4) {
+      struct LeelenNumber first;
+      struct in_addr addr;
+      int count = atoi(argv[2]);
+      int type = argc > 4 ? atoi(argv[4]) : LEELEN_DEVICE_BASIC;
+      ok = LeelenNumber_init(&first, argv[1], NULL) == 0 && count > 0 &&
+           inet_pton(AF_INET, argv[3], &addr) == 1 && type > 0 && type < 128;
+      if (ok) {
+        char *desc = strdup(argc > 5 ? argv[5] : "SIM-0-0-0");
+        ok = desc != NULL && Sim_add_devices(
+          self, &first, count, &addr, type, desc) == 0;
+      }
+    } else if (strcmp(cmd, "answer") == 0 && argc >= 2) {
+      self->scenario.answer_delay = atoi(argv[1]);
+      self->scenario.answer_jitter = argc > 2 ? atoi(argv[2]) : 0;
+    } else if (strcmp(cmd, "hangup") == 0 && argc == 2) {
+      self->scenario.hangup = atoi(argv[1]);
+    } else if (strcmp(cmd, "originate") == 0 && argc == 2) {
+      self->scenario.originate = atoi(argv[1]);
+    } else if (strcmp(cmd, "loss") == 0 && argc == 2) {
+      self->scenario.loss = atoi(argv[1]);
+    } else if (strcmp(cmd, "rtp") == 0 && argc == 3) {
+      self->scenario.rtp_interval = atoi(argv[1]);
+      self->scenario.rtp_size = atoi(argv[2]);
+    } else if (strcmp(cmd, "duration") == 0 && argc == 2) {
+      self->scenario.duration = atoi(argv[1]);
+    } else if (strcmp(cmd, "seed") == 0 && argc == 2) {
+      self->scenario.seed = atoi(argv[1]);
+    } else {
+      ok = false;
+    }
+    should (ok) otherwise {
+      fprintf(stderr, "%s:%d: invalid directive '%s'\n", path, lineno, cmd);
+      ret = 1;
+      break;
+    }
+  }
+
+  fclose(f);
+  return ret;
+}
+
+
+static int Sim_epoll_add (struct Sim *self, int fd, uint32_t tag) {
+  struct epoll_event event = {.events = EPOLLIN, .data.u32 = tag};
+  return epoll_ctl(self->epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+
+static int Sim_connect (struct Sim *self) {
+  self->epollfd = epoll_create1(0);
+  return_if_fail (self->epollfd >= 0) -1;
+
+  // discovery
+  union sockaddr_in46 addr;
+  sockaddr46_set(&addr, AF_INET, NULL, self->config.discovery);
+  addr.sa_scope_id = 0;
+  self->discoveryfd = openaddr46(&addr, SOCK_DGRAM, OPENADDR_REUSEADDR);
+  return_if_fail (self->discoveryfd >= 0) -1;
+  const int on = 1;
+  return_if_fail (setsockopt(
+    self->discoveryfd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) == 0) -1;
+  struct ip_mreq mreq = {
+    .imr_multiaddr = leelen_discovery_groupaddr,
+    .imr_interface.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  if (setsockopt(self->discoveryfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                 sizeof(mreq)) != 0) {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Cannot join discovery group on loopback");
+  }
+  return_if_fail (Sim_epoll_add(self, self->discoveryfd, SIM_TAG_DISCOVERY) ==
+                  0) -1;
+
+  // devices
+  for (int i = 0; i < self->n_device; i++) {
+    struct SimDevice *device = &self->devices[i];
+    addr = device->config.addr;
+    addr.sa_port = htons(device->config.voip);
+    device->sockfd = openaddr46(&addr, SOCK_DGRAM, OPENADDR_REUSEADDR);
+    should (device->sockfd >= 0) otherwise {
+      LOG_PERROR(LOG_LEVEL_ERROR, "Cannot open VoIP socket for %s",
+                 device->config.number.str);
+      return -1;
+    }
+    return_if_fail (Sim_epoll_add(self, device->sockfd, i) == 0) -1;
+  }
+  return 0;
+}
+
+
+static void SimDevice_rtp_start (
+    struct SimDevice *self, struct Sim *sim, int i, unsigned long long now) {
+  return_if_fail (self->audiofd < 0);
+  union sockaddr_in46 addr = self->config.addr;
+  addr.sa_port = htons(self->config.audio);
+  self->audiofd = openaddr46(&addr, SOCK_DGRAM, OPENADDR_REUSEADDR);
+  should (self->audiofd >= 0) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "Cannot open RTP socket for %s",
+               self->config.number.str);
+    sim->stats.errors++;
+    return;
+  }
+  Sim_epoll_add(sim, self->audiofd, i | SIM_TAG_AUDIO);
+  self->rtp_at = now;
+  self->rtp_seq = rand();
+  self->rtp_ts = rand();
+}
+
+
+static void SimDevice_rtp_stop (struct SimDevice *self) {
+  return_if_fail (self->audiofd >= 0);
+  close(self->audiofd);
+  self->audiofd = -1;
+}
+
+
+static void SimDevice_rtp_send (
+    struct SimDevice *self, struct Sim *sim, unsigned long long now) {
+  return_if_fail (self->audiofd >= 0 && self->dialog.their_audio_port != 0);
+  return_if_fail (sim->scenario.rtp_interval > 0 && now >= self->rtp_at);
+
+  unsigned char pkt[12 + sim->scenario.rtp_size];
+  pkt[0] = 0x80;
+  pkt[1] = LEELENSIM_RTP_PCMA;
+  *(uint16_t *) (pkt + 2) = htons(self->rtp_seq);
+  *(uint32_t *) (pkt + 4) = htonl(self->rtp_ts);
+  *(uint32_t *) (pkt + 8) = htonl(self->dialog.id);
+  memset(pkt + 12, 0xd5, sim->scenario.rtp_size);
+
+  union sockaddr_in46 dst = self->dialog.theirs;
+  dst.sa_port = htons(self->dialog.their_audio_port);
+  if (sendto(self->audiofd, pkt, sizeof(pkt), 0, &dst.sock,
+             sizeof(struct sockaddr_in)) == (ssize_t) sizeof(pkt)) {
+    sim->stats.rtp_sent++;
+  }
+  self->rtp_seq++;
+  self->rtp_ts += sim->scenario.rtp_interval * 8;
+  self->rtp_at += sim->scenario.rtp_interval;
+}
+
+
+static void SimDevice_end (struct SimDevice *self) {
+  SimDevice_rtp_stop(self);
+  LeelenDialog_destroy(&self->dialog);
+  self->action = SIM_ACTION_NONE;
+}
+
+
+static void SimDevice_connected (
+    struct SimDevice *self, struct Sim *sim, int i, unsigned long long now) {
+  sim->stats.connected++;
+  SimDevice_rtp_start(self, sim, i, now);
+  self->action = SIM_ACTION_HANGUP;
+  self->action_at = now + sim->scenario.hangup;
+}
+
+
+static void Sim_receive_voip (struct Sim *self, int i, unsigned long long now) {
+  struct SimDevice *device = &self->devices[i];
+  char buf[LEELEN_MAX_MESSAGE_LENGTH + 1];
+  union sockaddr_in46 src;
+  socklen_t srclen = sizeof(src);
+  int buflen = recvfrom(device->sockfd, buf, sizeof(buf) - 1, 0, &src.sock,
+                        &srclen);
+  return_if_fail (buflen > 0);
+  buf[buflen] = '\0';
+  return_if_fail (buflen > LEELEN_MESSAGE_HEADER_SIZE);
+  if (Sim_lose(self)) {
+    self->stats.lost++;
+    return;
+  }
+
+  leelen_id_t id = LEELEN_MESSAGE_ID(buf);
+  enum LeelenCode code = le32toh(LEELEN_MESSAGE_CODE(buf));
+  if (code == LEELEN_CODE_CALL || code == LEELEN_CODE_VIEW) {
+    if (device->dialog.id != 0 && device->dialog.id != id) {
+      // busy, ignore
+      self->stats.busy++;
+      return;
+    }
+    if (device->dialog.id == 0) {
+      LeelenDialog_init(&device->dialog, &device->config, &src.sock, NULL, id);
+      device->outgoing = false;
+      self->stats.calls_in++;
+      if (self->scenario.answer_delay >= 0) {
+        device->action = SIM_ACTION_ANSWER;
+        device->action_at = now + self->scenario.answer_delay +
+          sim_random(self->scenario.answer_jitter + 1);
+      }
+    }
+  }
+  return_if_fail (device->dialog.id == id);
+
+  enum LeelenDialogState state = device->dialog.state;
+  char *audio_formats[LEELEN_MESSAGE_MAX_FORMATS + 1];
+  int res = LeelenDialog_receive(
+    &device->dialog, buf, device->sockfd, audio_formats, NULL);
+  should (res == 0) otherwise {
+    if (res == 254) {
+      self->stats.timeouts++;
+    } else if (res == 253) {
+      self->stats.duplicates++;
+    } else {
+      self->stats.errors++;
+    }
+    return;
+  }
+
+  switch (code) {
+    case LEELEN_CODE_ACCEPTED:
+      SimDevice_connected(device, self, i, now);
+      break;
+    case LEELEN_CODE_BYE:
+      self->stats.byes++;
+      SimDevice_end(device);
+      break;
+    case LEELEN_CODE_OK:
+      if (state == LEELEN_DIALOG_CONNECTING &&
+          device->dialog.state == LEELEN_DIALOG_CONNECTED &&
+          !device->outgoing) {
+        // our ACCEPTED acked
+        SimDevice_connected(device, self, i, now);
+      } else if (state == LEELEN_DIALOG_DISCONNECTING &&
+                 device->dialog.state == LEELEN_DIALOG_DISCONNECTED) {
+        SimDevice_end(device);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+
+static void Sim_receive_discovery (struct Sim *self) {
+  char buf[LEELEN_MAX_MESSAGE_LENGTH + 1];
+  union sockaddr_in46 src;
+  socklen_t srclen = sizeof(src);
+  union sockaddr_in46 dst;
+  struct in_addr recv_dst;
+  int buflen = recvfromto(self->discoveryfd, buf, sizeof(buf) - 1, 0,
+                          &src.sock, &srclen, &dst, &recv_dst);
+  return_if_fail (buflen > 0);
+  buf[buflen] = '\0';
+  return_if (Leelen_discovery_is_advertisement(buf));
+  self->stats.solicitations++;
+  if (Sim_lose(self)) {
+    self->stats.lost++;
+    return;
+  }
+  if (LeelenAdvertiser_receive(&self->advertiser, buf, self->discoveryfd,
+                               &src.sock, &recv_dst, dst.sa_scope_id) == 0) {
+    self->stats.advertisements++;
+  }
+}
+
+
+static void Sim_originate (struct Sim *self, unsigned long long now) {
+  // pick an idle device
+  for (int tries = 0; tries < 8; tries++) {
+    struct SimDevice *device = &self->devices[sim_random(self->n_device)];
+    continue_if (device->dialog.id != 0);
+
+    LeelenDialog_init(&device->dialog, &device->config,
+                      &self->scenario.gateway.sock,
+                      &self->scenario.gateway_number, 0);
+    device->outgoing = true;
+    char *audio_formats[] = {"PCMA/8000", NULL};
+    should (LeelenDialog_send(&device->dialog, LEELEN_CODE_CALL,
+                              device->sockfd, audio_formats, NULL) == 0
+    ) otherwise {
+      LOG_PERROR(LOG_LEVEL_WARNING, "Cannot originate call");
+      self->stats.errors++;
+      LeelenDialog_destroy(&device->dialog);
+      return;
+    }
+    self->stats.calls_out++;
+    // no answer from the gateway in time ends the call
+    device->action = SIM_ACTION_HANGUP;
+    device->action_at = now + self->scenario.hangup +
+      self->config.duration * 1000;
+    return;
+  }
+}
+
+
+static void Sim_tick (struct Sim *self, unsigned long long now) {
+  for (int i = 0; i < self->n_device; i++) {
+    struct SimDevice *device = &self->devices[i];
+    continue_if (device->dialog.id == 0);
+
+    // lost message or ACK
+    if (LeelenDialog_retransmit(&device->dialog, device->sockfd) > 0) {
+      self->stats.retransmits++;
+    }
+    if ((device->dialog.state == LEELEN_DIALOG_CONNECTING ||
+         device->dialog.state == LEELEN_DIALOG_DISCONNECTING) &&
+        LeelenDialog_ack_timeout(&device->dialog)) {
+      self->stats.timeouts++;
+      if (device->dialog.state == LEELEN_DIALOG_DISCONNECTED) {
+        SimDevice_end(device);
+        continue;
+      }
+    }
+
+    if (device->action != SIM_ACTION_NONE && now >= device->action_at) {
+      enum SimAction action = device->action;
+      device->action = SIM_ACTION_NONE;
+      switch (action) {
+        case SIM_ACTION_ANSWER: {
+          char *audio_formats[] = {"PCMA/8000", NULL};
+          if (LeelenDialog_send(&device->dialog, LEELEN_CODE_ACCEPTED,
+                                device->sockfd, audio_formats, NULL) == 0) {
+            self->stats.answered++;
+          } else {
+            self->stats.errors++;
+          }
+          break;
+        }
+        case SIM_ACTION_HANGUP:
+          self->stats.hangups++;
+          if (LeelenDialog_may_bye(&device->dialog, device->sockfd) != 0) {
+            SimDevice_end(device);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    SimDevice_rtp_send(device, self, now);
+  }
+}
+
+
+static int Sim_run (struct Sim *self) {
+  unsigned long long start = monotonic_ms();
+  unsigned long long last = start;
+  unsigned long long originate_budget = 0;
+
+  while (true) {
+    unsigned long long now = monotonic_ms();
+    break_if (now - start >= self->scenario.duration);
+
+    struct epoll_event events[64];
+    int n_event = epoll_wait(self->epollfd, events, 64, LEELENSIM_TICK);
+    should (n_event >= 0 || errno == EINTR) otherwise {
+      LOG_PERROR(LOG_LEVEL_ERROR, "epoll_wait()");
+      return -1;
+    }
+    now = monotonic_ms();
+
+    for (int j = 0; j < n_event; j++) {
+      uint32_t tag = events[j].data.u32;
+      if (tag == SIM_TAG_DISCOVERY) {
+        Sim_receive_discovery(self);
+      } else if (tag & SIM_TAG_AUDIO) {
+        struct SimDevice *device = &self->devices[tag & ~SIM_TAG_AUDIO];
+        char buf[2048];
+        while (device->audiofd >= 0 && recv(
+            device->audiofd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+          self->stats.rtp_received++;
+        }
+      } else {
+        Sim_receive_voip(self, tag, now);
+      }
+    }
+
+    // originate calls, in 1/1000 calls
+    if (self->scenario.originate > 0 &&
+        self->scenario.gateway.sa_family != AF_UNSPEC) {
+      originate_budget += (now - last) * self->scenario.originate;
+      while (originate_budget >= 1000) {
+        originate_budget -= 1000;
+        Sim_originate(self, now);
+      }
+    }
+    last = now;
+
+    Sim_tick(self, now);
+  }
+  return 0;
+}
+
+
+static void Sim_report (const struct Sim *self) {
+  const struct SimStats *stats = &self->stats;
+  fprintf(stdout,
+    "devices        %d\n"
+    "solicitations  %lu\n"
+    "advertisements %lu\n"
+    "calls in       %lu\n"
+    "calls out      %lu\n"
+    "answered       %lu\n"
+    "connected      %lu\n"
+    "hangups        %lu\n"
+    "byes received  %lu\n"
+    "busy           %lu\n"
+    "ack timeouts   %lu\n"
+    "retransmits    %lu\n"
+    "duplicates     %lu\n"
+    "lost           %lu\n"
+    "rtp sent       %lu\n"
+    "rtp received   %lu\n"
+    "errors         %lu\n",
+    self->n_device, stats->solicitations, stats->advertisements,
+    stats->calls_in, stats->calls_out, stats->answered, stats->connected,
+    stats->hangups, stats->byes, stats->busy, stats->timeouts,
+    stats->retransmits, stats->duplicates, stats->lost, stats->rtp_sent,
+    stats->rtp_received, stats->errors);
+}
+
+
+static void Sim_destroy (struct Sim *self) {
+  char *desc = NULL;
+  for (int i = 0; i < self->n_device; i++) {
+    struct SimDevice *device = &self->devices[i];
+    SimDevice_rtp_stop(device);
+    if (device->sockfd >= 0) {
+      close(device->sockfd);
+    }
+    if (device->config.desc != desc) {
+      desc = device->config.desc;
+      free(desc);
+    }
+  }
+  free(self->devices);
+  if (self->discoveryfd >= 0) {
+    close(self->discoveryfd);
+  }
+  if (self->epollfd >= 0) {
+    close(self->epollfd);
+  }
+  LeelenAdvertiser_destroy(&self->advertiser);
+  self->config.desc = NULL;
+  LeelenConfig_destroy(&self->config);
+}
+
+
+static void Sim_init (struct Sim *self) {
+  memset(self, 0, sizeof(*self));
+  self->scenario.answer_delay = 500;
+  self->scenario.hangup = 5000;
+  self->scenario.rtp_interval = 20;
+  self->scenario.rtp_size = 160;
+  self->scenario.duration = 10000;
+  self->scenario.seed = time(NULL);
+  self->scenario.gateway.sa_family = AF_UNSPEC;
+  self->discoveryfd = -1;
+  self->epollfd = -1;
+  LeelenConfig_init(&self->config);
+  LeelenAdvertiser_init(&self->advertiser, &self->config);
+}
+
+
+static void usage (const char progname[]) {
+  fprintf(stdout, "Usage: %s [OPTIONS...] <scenario>\n", progname);
+  fprintf(stdout,
+"Simulate a LEELEN building on loopback aliases\n"
+"\n"
+"  -d, --debug        enable debugging messages\n"
+"  -h, --help         print this help text\n");
+}
+
+
+int main (int argc, char *argv[]) {
+  static const struct option long_options[] = {
+    {"debug", no_argument, 0, 'd'},
+    {"help", no_argument, 0, 'h'},
+    {0}
+  };
+  while (1) {
+    int index = getopt_long(argc, argv, "dh", long_options, NULL);
+    break_if_fail (index >= 0);
+    switch (index) {
+      case 'd':
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-write-to-const"
+        LOGGER_SET_ATTRIBUTE(level, max(LOG_LEVEL_DEBUG, app_logger.level + 1));
+#pragma GCC diagnostic pop
+        break;
+      case 'h':
+        usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        return EXIT_FAILURE;
+    }
+  }
+  should (optind == argc - 1) otherwise {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // one socket per device, and one more when streaming
+  struct rlimit rlim;
+  if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+    rlim.rlim_cur = rlim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rlim);
+  }
+
+  int ret = EXIT_FAILURE;
+  struct Sim sim;
+  Sim_init(&sim);
+  switch (Sim_load(&sim, argv[optind])) {
+    case 0:
+      break;
+    case 1:
+      goto end;
+    default:
+      perror(argv[optind]);
+      goto end;
+  }
+  should (LeelenAdvertiser_compile(&sim.advertiser) == 0) otherwise {
+    fprintf(stderr, "error: failed to set up identities\n");
+    goto end;
+  }
+  sim.scenario.gateway.sa_port = htons(sim.config.voip);
+  srand(sim.scenario.seed);
+
+  should (Sim_connect(&sim) == 0) otherwise {
+    perror("error: failed to open sockets");
+    goto end;
+  }
+  LOG(LOG_LEVEL_NOTICE, "Start " LEELENSIM_NAME " with %d devices, seed %u",
+      sim.n_device, sim.scenario.seed);
+  if (Sim_run(&sim) == 0) {
+    ret = EXIT_SUCCESS;
+  }
+  Sim_report(&sim);
+
+end:
+  Sim_destroy(&sim);
+  return ret;
+}
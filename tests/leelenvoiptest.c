@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <inet46i/sockaddr46.h>
+
+#include "utils/macro.h"
+#include "leelen/config.h"
+#include "leelen/voip/dialog.h"
+#include "leelen/voip/protocol.h"
+#include "leelen/voip/voip.h"
+
+/**
+ * @file
+ * Stress test of the LEELEN VoIP dialog index.
+ *
+ * Usage: leelenvoiptest
+ *
+ * Writer threads connect and close dialogs while reader threads look up
+ * dialogs that must stay visible, so that lookups race with index growth and
+ * backward shift deletion. The main thread repeatedly inserts dialogs hashing
+ * around the end of the index and closes the first of them, so that deletion
+ * shifts some of the others back across the end of the table and keeps the
+ * rest in place.
+ *
+ * Exits with 0 if every lookup succeeded, 1 otherwise.
+ */
+
+
+#define LEELENVOIPTEST_NAME "leelenvoiptest"
+/// number of dialogs alive for the whole test
+#define LEELENVOIPTEST_PINNED 16
+/// number of writer threads
+#define LEELENVOIPTEST_WRITERS 2
+/// number of reader threads
+#define LEELENVOIPTEST_READERS 2
+/// maximum number of dialogs alive per writer, enough for several grows
+#define LEELENVOIPTEST_CHURN 400
+/// number of operations per writer
+#define LEELENVOIPTEST_OPS 200000
+/// number of dialogs in a wrap-around round
+#define LEELENVOIPTEST_WRAP 4
+
+
+static struct LeelenConfig config;
+static struct LeelenVoIP voip;
+static union sockaddr_in46 peer;
+
+/// dialogs never closed while threads run
+static leelen_id_t pinned[LEELENVOIPTEST_PINNED];
+/// dialogs readers must find, or 0; cleared before the dialog is closed
+static _Atomic leelen_id_t watched[LEELENVOIPTEST_WRAP];
+/// number of writers still running
+static atomic_int n_writer;
+/// number of failed checks
+static atomic_ulong failures;
+
+
+/**
+ * @brief Report a failed check.
+ *
+ * @param what Description.
+ * @param id Dialog ID.
+ */
+static void voiptest_fail (const char *what, leelen_id_t id) {
+  if (atomic_fetch_add(&failures, 1) < 10) {
+    fprintf(stderr, "%s: %08x\n", what, id);
+  }
+}
+
+
+/**
+ * @brief Test if a dialog can be found by ID.
+ *
+ * @param id Dialog ID.
+ * @return @c true if found.
+ */
+static bool voiptest_found (leelen_id_t id) {
+  struct LeelenDialog *dialog = LeelenVoIP_find(&voip, id);
+  return dialog != NULL && dialog->id == id;
+}
+
+
+/**
+ * @brief Hash slot of a dialog ID, as computed by the index.
+ *
+ * @param id Dialog ID.
+ * @param mask Index mask.
+ * @return Home slot.
+ */
+static unsigned int voiptest_home (leelen_id_t id, unsigned int mask) {
+  return (id * 2654435761u) & mask;
+}
+
+
+static int voiptest_reader (void *arg) {
+  (void) arg;
+  while (atomic_load(&n_writer) > 0) {
+    for (int i = 0; i < LEELENVOIPTEST_PINNED; i++) {
+      if unlikely (!voiptest_found(pinned[i])) {
+        voiptest_fail("pinned dialog lost", pinned[i]);
+      }
+    }
+    for (int i = 0; i < LEELENVOIPTEST_WRAP; i++) {
+      leelen_id_t id = atomic_load(&watched[i]);
+      continue_if (id == 0);
+      // the dialog may have been closed after it was loaded
+      if unlikely (!voiptest_found(id) && atomic_load(&watched[i]) == id) {
+        voiptest_fail("shifted dialog lost", id);
+      }
+    }
+  }
+  return 0;
+}
+
+
+static int voiptest_writer (void *arg) {
+  unsigned int seed = (uintptr_t) arg;
+  struct LeelenDialog **dialogs =
+    malloc(sizeof(dialogs[0]) * LEELENVOIPTEST_CHURN);
+  int n = 0;
+
+  if likely (dialogs != NULL) {
+    for (int op = 0; op < LEELENVOIPTEST_OPS; op++) {
+      // grow to the limit first, then churn around it
+      bool connect = n < LEELENVOIPTEST_CHURN &&
+        (op < LEELENVOIPTEST_CHURN || rand_r(&seed) % 2 == 0);
+      if (connect) {
+        struct LeelenDialog *dialog =
+          LeelenVoIP_connect(&voip, &peer.sock, NULL, 0);
+        should (dialog != NULL) otherwise {
+          voiptest_fail("connect failed", 0);
+          break;
+        }
+        if unlikely (!voiptest_found(dialog->id)) {
+          voiptest_fail("new dialog not found", dialog->id);
+        }
+        dialogs[n] = dialog;
+        n++;
+      } else if (n > 0) {
+        int i = rand_r(&seed) % n;
+        LeelenVoIP_close(&voip, dialogs[i]);
+        n--;
+        dialogs[i] = dialogs[n];
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      LeelenVoIP_close(&voip, dialogs[i]);
+    }
+  } else {
+    voiptest_fail("out of memory", 0);
+  }
+
+  free(dialogs);
+  atomic_fetch_sub(&n_writer, 1);
+  return 0;
+}
+
+
+/**
+ * @brief Insert dialogs hashing around the end of the index, and close the
+ *  first one.
+ *
+ * @param[in,out] next Next candidate dialog ID. IDs above @c RAND_MAX never
+ *  collide with random IDs of writers.
+ * @return @c true if the index did not grow meanwhile, so the dialogs did
+ *  wrap around.
+ */
+static bool voiptest_wrap (leelen_id_t *next) {
+  // home slots after the last one; with the first closed, the second stays
+  // in slot 0, the third moves back to the last slot, and the fourth to the
+  // one left by the third
+  static const unsigned int offsets[LEELENVOIPTEST_WRAP] = {0, 1, 0, 2};
+  unsigned int mask = atomic_load(&voip.index)->mask;
+
+  leelen_id_t ids[LEELENVOIPTEST_WRAP];
+  for (int i = 0; i < LEELENVOIPTEST_WRAP; i++) {
+    while (voiptest_home(*next, mask) != ((mask + offsets[i]) & mask)) {
+      (*next)++;
+    }
+    ids[i] = *next;
+    (*next)++;
+  }
+
+  struct LeelenDialog *dialogs[LEELENVOIPTEST_WRAP];
+  for (int i = 0; i < LEELENVOIPTEST_WRAP; i++) {
+    dialogs[i] = LeelenVoIP_connect(&voip, &peer.sock, NULL, ids[i]);
+    should (dialogs[i] != NULL && dialogs[i]->id == ids[i]) otherwise {
+      voiptest_fail("connect with ID failed", ids[i]);
+      for (int j = 0; j < i; j++) {
+        LeelenVoIP_close(&voip, dialogs[j]);
+      }
+      return false;
+    }
+  }
+  for (int i = 1; i < LEELENVOIPTEST_WRAP; i++) {
+    atomic_store(&watched[i], ids[i]);
+  }
+
+  // shift the rest across the end of the index
+  LeelenVoIP_close(&voip, dialogs[0]);
+  if unlikely (voiptest_found(ids[0])) {
+    voiptest_fail("closed dialog found", ids[0]);
+  }
+  for (int i = 1; i < LEELENVOIPTEST_WRAP; i++) {
+    if unlikely (!voiptest_found(ids[i])) {
+      voiptest_fail("shifted dialog lost", ids[i]);
+    }
+  }
+
+  for (int i = 1; i < LEELENVOIPTEST_WRAP; i++) {
+    atomic_store(&watched[i], 0);
+    LeelenVoIP_close(&voip, dialogs[i]);
+  }
+  return atomic_load(&voip.index)->mask == mask;
+}
+
+
+int main (int argc, char **argv) {
+  (void) argv;
+  should (argc <= 1) otherwise {
+    fprintf(stderr, "Usage: " LEELENVOIPTEST_NAME "\n");
+    return 255;
+  }
+
+  LeelenConfig_init(&config);
+  peer.sa_family = AF_INET;
+  peer.v4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  should (LeelenVoIP_init(&voip, &config) == 0) otherwise {
+    perror("LeelenVoIP_init");
+    return 1;
+  }
+
+  for (int i = 0; i < LEELENVOIPTEST_PINNED; i++) {
+    struct LeelenDialog *dialog =
+      LeelenVoIP_connect(&voip, &peer.sock, NULL, 0);
+    should (dialog != NULL) otherwise {
+      perror("LeelenVoIP_connect");
+      return 1;
+    }
+    pinned[i] = dialog->id;
+  }
+  unsigned int initial_mask = atomic_load(&voip.index)->mask;
+
+  thrd_t writers[LEELENVOIPTEST_WRITERS];
+  thrd_t readers[LEELENVOIPTEST_READERS];
+  atomic_store(&n_writer, LEELENVOIPTEST_WRITERS);
+  for (int i = 0; i < LEELENVOIPTEST_WRITERS; i++) {
+    should (thrd_create(
+        &writers[i], voiptest_writer, (void *) (uintptr_t) (i + 1)
+    ) == thrd_success) otherwise {
+      fprintf(stderr, "Cannot create writer thread\n");
+      return 1;
+    }
+  }
+  for (int i = 0; i < LEELENVOIPTEST_READERS; i++) {
+    should (thrd_create(
+        &readers[i], voiptest_reader, NULL) == thrd_success) otherwise {
+      fprintf(stderr, "Cannot create reader thread\n");
+      return 1;
+    }
+  }
+
+  leelen_id_t next = (leelen_id_t) RAND_MAX + 1;
+  unsigned long n_wrap = 0;
+  while (atomic_load(&n_writer) > 0) {
+    n_wrap += voiptest_wrap(&next);
+  }
+
+  for (int i = 0; i < LEELENVOIPTEST_WRITERS; i++) {
+    thrd_join(writers[i], NULL);
+  }
+  for (int i = 0; i < LEELENVOIPTEST_READERS; i++) {
+    thrd_join(readers[i], NULL);
+  }
+
+  unsigned int final_mask = atomic_load(&voip.index)->mask;
+  if (voip.n_dialog != LEELENVOIPTEST_PINNED) {
+    voiptest_fail("dialogs leaked", voip.n_dialog);
+  }
+  for (int i = 0; i < LEELENVOIPTEST_PINNED; i++) {
+    struct LeelenDialog *dialog = LeelenVoIP_find(&voip, pinned[i]);
+    if likely (dialog != NULL) {
+      LeelenVoIP_close(&voip, dialog);
+    }
+  }
+  if (voip.n_dialog != 0) {
+    voiptest_fail("dialogs leaked", voip.n_dialog);
+  }
+  LeelenVoIP_destroy(&voip);
+  LeelenConfig_destroy(&config);
+
+  unsigned long n_failure = atomic_load(&failures);
+  fprintf(stderr, "index %u -> %u slots, %lu wrap-around rounds, %lu "
+          "failures\n", initial_mask + 1, final_mask + 1, n_wrap, n_failure);
+  // both code paths must have been exercised
+  return n_failure == 0 && n_wrap > 0 && final_mask > initial_mask ? 0 : 1;
+}
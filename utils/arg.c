@@ -2,6 +2,8 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <netinet/in.h>
 
 #include <inet46i/in46.h>
@@ -60,3 +62,17 @@ int argtosockaddr (const char s[], union sockaddr_in46 *addr) {
   }
   return domain;
 }
+
+
+char *argtoabspath (const char s[]) {
+  // absolute path, as daemon() changes directory
+  return_if (s[0] == '/') strdup(s);
+  char *cwd = getcwd(NULL, 0);
+  return_if_fail (cwd != NULL) NULL;
+  char *path = malloc(strlen(cwd) + 1 + strlen(s) + 1);
+  if likely (path != NULL) {
+    sprintf(path, "%s/%s", cwd, s);
+  }
+  free(cwd);
+  return path;
+}
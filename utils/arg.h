@@ -32,6 +32,8 @@ int argtoifaceip (const char s[], struct in46i_addr *addr);
 __attribute__((warn_unused_result, nonnull,
                access(read_only, 1), access(write_only, 2)))
 int argtosockaddr (const char s[], union sockaddr_in46 *addr);
+__attribute__((warn_unused_result, malloc, nonnull, access(read_only, 1)))
+char *argtoabspath (const char s[]);
 
 
 #ifdef __cplusplus
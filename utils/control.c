@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "macro.h"
+#include "log.h"
+#include "control.h"
+
+
+void control_write_string (FILE *f, const char *str) {
+  fputc('"', f);
+  for (; *str != '\0'; str++) {
+    unsigned char c = *str;
+    switch (c) {
+      case '"':
+      case '\\':
+        fputc('\\', f);
+        fputc(c, f);
+        break;
+      case '\n':
+        fputs("\\n", f);
+        break;
+      case '\r':
+        fputs("\\r", f);
+        break;
+      case '\t':
+        fputs("\\t", f);
+        break;
+      default:
+        if unlikely (c < 0x20) {
+          fprintf(f, "\\u%04x", c);
+        } else {
+          fputc(c, f);
+        }
+    }
+  }
+  fputc('"', f);
+}
+
+
+/**
+ * @memberof ControlServer
+ * @private
+ * @brief Answer a command line.
+ *
+ * The answer must fit into socket buffer, since the polling thread does not
+ * wait for slow clients; the connection is closed otherwise.
+ *
+ * @param self Control endpoint.
+ * @param i Index of connection.
+ * @param line Command line, without new-line.
+ * @return 0 on success, -1 if the connection is closed.
+ */
+static int ControlServer_respond (
+    struct ControlServer *self, int i, char *line) {
+  char *body = NULL;
+  size_t body_len = 0;
+  FILE *f = open_memstream(&body, &body_len);
+  should (f != NULL) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "open_memstream() failed");
+    StreamServer_close((struct StreamServer *) self, i);
+    return -1;
+  }
+  self->handle(self->handle_arg, f, line);
+  fputc('\n', f);
+  fclose(f);
+
+  int ret = 0;
+  should (send(
+      self->clients[i], body, body_len, MSG_DONTWAIT | MSG_NOSIGNAL
+  ) == (ssize_t) body_len) otherwise {
+    LOG_PERROR(LOG_LEVEL_INFO, "Cannot send control answer");
+    StreamServer_close((struct StreamServer *) self, i);
+    ret = -1;
+  }
+  free(body);
+  return ret;
+}
+
+
+void ControlServer_process (
+    struct ControlServer *self, const struct pollfd *pollfds) {
+  // read commands
+  for (int i = 0; i < CONTROL_CLIENTS; i++) {
+    continue_if (pollfds[1 + i].revents == 0 || self->clients[i] < 0);
+
+    char *buf = self->lines[i];
+    unsigned int received = self->received[i];
+    ssize_t len = recv(
+      self->clients[i], buf + received, CONTROL_LINE_SIZE - received,
+      MSG_DONTWAIT);
+    if (len <= 0) {
+      continue_if (len < 0 && (errno == EAGAIN || errno == EINTR));
+      StreamServer_close((struct StreamServer *) self, i);
+      continue;
+    }
+    received += len;
+
+    // answer complete lines
+    unsigned int begin = 0;
+    for (unsigned int j = 0; j < received; j++) {
+      continue_if (buf[j] != '\n');
+      buf[j] = '\0';
+      if (j > begin && buf[j - 1] == '\r') {
+        buf[j - 1] = '\0';
+      }
+      if (buf[begin] != '\0') {
+        break_if_fail (ControlServer_respond(self, i, buf + begin) == 0);
+      }
+      begin = j + 1;
+    }
+    continue_if (self->clients[i] < 0);
+    received -= begin;
+    memmove(buf, buf + begin, received);
+
+    should (received < CONTROL_LINE_SIZE) otherwise {
+      static const char answer[] = "{\"error\":\"line too long\"}\n";
+      send(self->clients[i], answer, sizeof(answer) - 1,
+           MSG_DONTWAIT | MSG_NOSIGNAL);
+      StreamServer_close((struct StreamServer *) self, i);
+      continue;
+    }
+    self->received[i] = received;
+  }
+
+  // accept new connection
+  int i = StreamServer_accept(
+    (struct StreamServer *) self, pollfds, "control");
+  if (i >= 0) {
+    self->received[i] = 0;
+  }
+}
+
+
+int ControlServer_init (
+    struct ControlServer *self, const char *path,
+    void (*handle) (void *arg, FILE *f, char *line), void *arg) {
+  // commands can end calls, keep others out
+  return_nonzero (StreamServer_init_unix(
+    (struct StreamServer *) self, path, S_IRUSR | S_IWUSR));
+
+  self->handle = handle;
+  self->handle_arg = arg;
+  for (int i = 0; i < CONTROL_CLIENTS; i++) {
+    self->received[i] = 0;
+  }
+  return 0;
+}
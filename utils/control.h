@@ -0,0 +1,121 @@
+#ifndef UTILS_CONTROL_H
+#define UTILS_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+// #include <poll.h>
+struct pollfd;
+#include "streamserver.h"
+
+/**
+ * @file
+ * Line-oriented control socket answering in JSON lines.
+ */
+
+
+/// maximum number of control connections served at the same time
+#define CONTROL_CLIENTS STREAM_SERVER_CLIENTS
+/// maximum length of a command line, including the new-line
+#define CONTROL_LINE_SIZE 256
+
+
+/**
+ * @extends StreamServer
+ * @brief Control endpoint on a Unix socket.
+ *
+ * Each line received is a command, whose answer is written as a single line
+ * of JSON. Connections are kept open, so that scripts can poll cheaply.
+ *
+ * Like MetricsServer, the server is driven by the caller's poll loop: add
+ * #CONTROL_SERVER_NPOLLFD entries with ControlServer_pollfds(), and pass them
+ * back to ControlServer_process() after @c poll(). The handler runs in the
+ * polling thread.
+ */
+struct ControlServer {
+  struct StreamServer;
+  /// answer a command line, without new-line, by writing a JSON value into
+  /// output; the line can be modified
+  void (*handle) (void *arg, FILE *f, char *line);
+  /// argument of ControlServer::handle
+  void *handle_arg;
+
+  /** @privatesection */
+  /// length of buffered partial line of each connection
+  unsigned short received[CONTROL_CLIENTS];
+  /// buffered partial line of each connection
+  char lines[CONTROL_CLIENTS][CONTROL_LINE_SIZE];
+};
+
+/// number of @c pollfd entries used by ControlServer
+#define CONTROL_SERVER_NPOLLFD STREAM_SERVER_NPOLLFD
+
+__attribute__((nonnull))
+/**
+ * @brief Write a JSON string, with quotes.
+ *
+ * @param f Output.
+ * @param str String.
+ */
+void control_write_string (FILE *f, const char *str);
+
+__attribute__((nonnull))
+/**
+ * @memberof ControlServer
+ * @brief Fill @c pollfd entries.
+ *
+ * @param self Control endpoint.
+ * @param[out] pollfds Array of #CONTROL_SERVER_NPOLLFD entries.
+ */
+static inline void ControlServer_pollfds (
+    const struct ControlServer *self, struct pollfd *pollfds) {
+  StreamServer_pollfds((const struct StreamServer *) self, pollfds);
+}
+__attribute__((nonnull))
+/**
+ * @memberof ControlServer
+ * @brief Accept connections and answer commands after @c poll().
+ *
+ * @param self Control endpoint.
+ * @param pollfds Array of #CONTROL_SERVER_NPOLLFD entries.
+ */
+void ControlServer_process (
+  struct ControlServer *self, const struct pollfd *pollfds);
+
+__attribute__((nonnull))
+/**
+ * @memberof ControlServer
+ * @brief Close all sockets and destroy the endpoint.
+ *
+ * @param self Control endpoint.
+ */
+static inline void ControlServer_destroy (struct ControlServer *self) {
+  StreamServer_destroy((struct StreamServer *) self);
+}
+__attribute__((warn_unused_result, nonnull(1, 2)))
+/**
+ * @memberof ControlServer
+ * @brief Initialize a control endpoint and start listening.
+ *
+ * The socket is only accessible by the owner.
+ *
+ * @param[out] self Control endpoint.
+ * @param path Path of Unix socket.
+ * @param handle Function to answer a command.
+ * @param arg Argument of @p handle.
+ * @return 0 on success, 1 if @p path too long, -1 on error and @c errno is
+ *  set appropriately.
+ */
+int ControlServer_init (
+  struct ControlServer *self, const char *path,
+  void (*handle) (void *arg, FILE *f, char *line), void *arg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_CONTROL_H */
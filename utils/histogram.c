@@ -0,0 +1,45 @@
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "macro.h"
+#include "histogram.h"
+
+
+unsigned long Histogram_percentile (
+    const struct Histogram *self, unsigned int permille) {
+  unsigned long count =
+    atomic_load_explicit(&self->count, memory_order_relaxed);
+  return_if_fail (count > 0) 0;
+
+  unsigned long max = atomic_load_explicit(&self->max, memory_order_relaxed);
+  unsigned long rank = (count * permille + 999) / 1000;
+  unsigned long seen = 0;
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+    seen += atomic_load_explicit(&self->buckets[i], memory_order_relaxed);
+    return_if (seen >= rank) i == 0 ? 0 : min((1ul << i) - 1, max);
+  }
+  return max;
+}
+
+
+int Histogram_tostring (const struct Histogram *self, char *buf, int size) {
+  unsigned long count =
+    atomic_load_explicit(&self->count, memory_order_relaxed);
+  unsigned long long sum =
+    atomic_load_explicit(&self->sum, memory_order_relaxed);
+  return snprintf(
+    buf, size, "n=%lu avg=%llu p50<=%lu p90<=%lu p99<=%lu max=%lu",
+    count, count == 0 ? 0 : sum / count, Histogram_percentile(self, 500),
+    Histogram_percentile(self, 900), Histogram_percentile(self, 990),
+    atomic_load_explicit(&self->max, memory_order_relaxed));
+}
+
+
+void Histogram_reset (struct Histogram *self) {
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    atomic_init(&self->buckets[i], 0);
+  }
+  atomic_init(&self->count, 0);
+  atomic_init(&self->sum, 0);
+  atomic_init(&self->max, 0);
+}
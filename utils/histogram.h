@@ -0,0 +1,113 @@
+#ifndef UTILS_HISTOGRAM_H
+#define UTILS_HISTOGRAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * @file
+ * Lock-free log2-bucketed histogram.
+ */
+
+
+/// number of buckets in a histogram
+#define HISTOGRAM_BUCKETS 32
+
+/**
+ * @brief Lock-free histogram with power-of-two buckets.
+ *
+ * Bucket @c i counts values in `[2^(i-1), 2^i)`, bucket 0 counts value 0, and
+ * the last bucket also counts everything above.
+ */
+struct Histogram {
+  /// bucket counters
+  atomic_ulong buckets[HISTOGRAM_BUCKETS];
+  /// number of samples
+  atomic_ulong count;
+  /// sum of samples
+  atomic_ullong sum;
+  /// largest sample
+  atomic_ulong max;
+};
+
+/// ::Histogram initializer
+#define HISTOGRAM_INIT {0}
+
+__attribute__((const, warn_unused_result))
+/**
+ * @brief Get bucket index for a value.
+ *
+ * @param value Value.
+ * @return Bucket index.
+ */
+static inline unsigned int histogram_bucket (unsigned long value) {
+  unsigned int i = value == 0 ? 0 :
+    sizeof(unsigned long) * 8 - __builtin_clzl(value);
+  return i < HISTOGRAM_BUCKETS ? i : HISTOGRAM_BUCKETS - 1;
+}
+
+__attribute__((nonnull))
+/**
+ * @memberof Histogram
+ * @brief Add a sample.
+ *
+ * This function is thread-safe.
+ *
+ * @param self Histogram.
+ * @param value Sample.
+ */
+static inline void Histogram_add (struct Histogram *self, unsigned long value) {
+  atomic_fetch_add_explicit(
+    &self->buckets[histogram_bucket(value)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&self->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&self->sum, value, memory_order_relaxed);
+  unsigned long max = atomic_load_explicit(&self->max, memory_order_relaxed);
+  while (value > max && !atomic_compare_exchange_weak_explicit(
+      &self->max, &max, value, memory_order_relaxed, memory_order_relaxed)) { }
+}
+
+__attribute__((pure, warn_unused_result, nonnull))
+/**
+ * @memberof Histogram
+ * @brief Estimate a percentile.
+ *
+ * @param self Histogram.
+ * @param permille Percentile, in permille (e.g. 990 for p99).
+ * @return Upper bound of the bucket containing the percentile, or 0 if no
+ *  samples.
+ */
+unsigned long Histogram_percentile (
+  const struct Histogram *self, unsigned int permille);
+
+__attribute__((nonnull, access(write_only, 2, 3)))
+/**
+ * @memberof Histogram
+ * @brief Format histogram summary.
+ *
+ * @param self Histogram.
+ * @param[out] buf Buffer.
+ * @param size Size of the buffer.
+ * @return The number of characters that would have been written if buffer had
+ *  been sufficiently large, not counting the terminating null character.
+ */
+int Histogram_tostring (const struct Histogram *self, char *buf, int size);
+
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof Histogram
+ * @brief Reset a histogram.
+ *
+ * @param[out] self Histogram.
+ */
+void Histogram_reset (struct Histogram *self);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_HISTOGRAM_H */
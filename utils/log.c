@@ -4,6 +4,7 @@
 #include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -27,6 +28,10 @@ extern inline int LogLevel_clamp (int level);
 extern inline bool Logger_would_log (
   const struct Logger * __restrict self, int level);
 
+extern inline int LoggerLine_write (
+  struct LoggerLine * __restrict self, const char * __restrict str,
+  size_t len);
+
 extern inline int LoggerEvent_log_va_func (
   const struct LoggerEvent * __restrict self,
   const char * __restrict format, va_list ap);
@@ -198,42 +203,94 @@ const char * const LogLevel_names[9] = {
  ******************************************************************************/
 
 
-static int logger_stream_std_begin (
-    struct LoggerEvent * __restrict self, const char * __restrict domain,
+/**
+ * @brief Get current time formatted as `[%b %e %T]`.
+ *
+ * The string is cached per thread and only rebuilt when the second changes,
+ * saving the @c localtime_r() call for most lines.
+ *
+ * @return Time string.
+ */
+static const char *logger_timestamp (void) {
+  static _Thread_local time_t cached_sec = -1;
+  static _Thread_local char cached_str[32];
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  if unlikely (ts.tv_sec != cached_sec) {
+    struct tm timeinfo;
+    localtime_r(&ts.tv_sec, &timeinfo);
+    strftime(cached_str, sizeof(cached_str), "[%b %e %T]", &timeinfo);
+    cached_sec = ts.tv_sec;
+  }
+  return cached_str;
+}
+
+
+/**
+ * @brief Format heading of a log line.
+ *
+ * @param[out] buf Buffer.
+ * @param size Size of buffer.
+ * @param domain Log domain. Can be @c NULL.
+ * @param level Log level.
+ * @param file File name at which logger is called. Can be @c NULL.
+ * @param line Line number at which logger is called.
+ * @param func Function name at which logger is called. Can be @c NULL.
+ * @param sgr Select Graphic Rendition parameter. Can be @c NULL.
+ * @return Length of heading, truncated to @p size - 1.
+ */
+static int logger_format_heading (
+    char * __restrict buf, size_t size, const char * __restrict domain,
     unsigned char level, const char * __restrict file, int line,
     const char * __restrict func, const char * __restrict sgr) {
-  int ret;
-  int fd = self->stream->fd;
+  const char *timestamp = logger_timestamp();
+  const char *level_name = LogLevel_names[level];
 
-  time_t curtime = time(NULL);
-  struct tm timeinfo;
-  localtime_r(&curtime, &timeinfo);
-  char timebuf[64];
-  strftime(
-    timebuf, sizeof(timebuf), sgr != NULL ?
-      COLOR_SEQ(COLOR_FOREGROUND_GREEN) "[%b %e %T]" RESET_SEQ : "[%b %e %T]",
-    &timeinfo);
+  int ret;
+  if likely (sgr != NULL) {
+    ret = snprintf(buf, size, COLOR_SEQ(COLOR_FOREGROUND_GREEN) "%s" RESET_SEQ,
+                   timestamp);
+  } else {
+    ret = snprintf(buf, size, "%s", timestamp);
+  }
 
   if unlikely (file == NULL) {
-    ret = dprintf(fd, "%s: ", timebuf);
+    ret += snprintf(buf + ret, size - ret, ": ");
   } else if unlikely (func == NULL) {
-    ret = dprintf(fd, "%s (%s:%d): ", timebuf, file, line);
+    ret += snprintf(buf + ret, size - ret, " (%s:%d): ", file, line);
   } else {
-    ret = dprintf(fd, "%s (%s:%d %s): ", timebuf, file, line, func);
+    ret += snprintf(buf + ret, size - ret, " (%s:%d %s): ", file, line, func);
+  }
+  if ((size_t) ret >= size) {
+    return size - 1;
   }
 
   if likely (domain != NULL) {
-    ret += dprintf(fd, "%s-", domain);
+    ret += snprintf(buf + ret, size - ret, "%s-", domain);
+    if ((size_t) ret >= size) {
+      return size - 1;
+    }
   }
-  const char *level_name = LogLevel_names[level];
   if likely (sgr != NULL) {
-    ret += dprintf(fd, SGR_FORMAT_SEQ_START "%s" RESET_SEQ " **: ",
-                   sgr, level_name);
+    ret += snprintf(buf + ret, size - ret,
+                    SGR_FORMAT_SEQ_START "%s" RESET_SEQ " **: ",
+                    sgr, level_name);
   } else {
-    ret += dprintf(fd, "%s **: ", level_name);
+    ret += snprintf(buf + ret, size - ret, "%s **: ", level_name);
   }
+  return (size_t) ret >= size ? (int) size - 1 : ret;
+}
 
-  return ret;
+
+static int logger_stream_std_begin (
+    struct LoggerEvent * __restrict self, const char * __restrict domain,
+    unsigned char level, const char * __restrict file, int line,
+    const char * __restrict func, const char * __restrict sgr) {
+  char buf[512];
+  int len = logger_format_heading(
+    buf, sizeof(buf), domain, level, file, line, func, sgr);
+  return write(self->stream->fd, buf, len);
 }
 
 
@@ -264,6 +321,8 @@ const struct LoggerStream logger_stream_stderr_nocolor = {
 
 struct Logger app_logger = {LOGGER_INIT};
 
+_Thread_local struct LoggerLine logger_line;
+
 
 void Logger_set_stream (
     struct Logger * __restrict self, int level,
@@ -274,6 +333,48 @@ void Logger_set_stream (
 }
 
 
+/******************************************************************************
+ * LoggerLine
+ ******************************************************************************/
+
+
+int LoggerLine_vprintf (
+    struct LoggerLine * __restrict self, const char * __restrict format,
+    va_list ap) {
+  size_t room = sizeof(self->buf) - self->len;
+  int len = vsnprintf(self->buf + self->len, room, format, ap);
+  return_if_fail (len >= 0) 0;
+  // keep room for new-line
+  if unlikely ((size_t) len >= room - 1) {
+    len = room - 1;
+  }
+  self->len += len;
+  return len;
+}
+
+
+int LoggerLine_printf (
+    struct LoggerLine * __restrict self, const char * __restrict format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  int res = LoggerLine_vprintf(self, format, ap);
+  va_end(ap);
+  return res;
+}
+
+
+int LoggerLine_begin (
+    struct LoggerEvent * __restrict self, const char * __restrict domain,
+    unsigned char level, const char * __restrict file, int line,
+    const char * __restrict func, const char * __restrict sgr) {
+  (void) self;
+  logger_line.len = logger_format_heading(
+    logger_line.buf, sizeof(logger_line.buf), domain, level, file, line, func,
+    sgr);
+  return logger_line.len;
+}
+
+
 /******************************************************************************
  * LoggerEvent
  ******************************************************************************/
@@ -316,19 +417,23 @@ int LoggerEvent_perror_func (
 
 int LoggerEvent_backtrace_func (
     const struct LoggerEvent * __restrict self, int skip) {
-  print_backtrace(self->stream->fd, self->skip + skip + 1, true);
+  print_backtrace(
+    self->stream->fd < 0 ? STDERR_FILENO : self->stream->fd,
+    self->skip + skip + 1, true);
   return 0;
 }
 
 
 int LoggerEvent_destroy_func (const struct LoggerEvent * __restrict self) {
-  int res = write(self->stream->fd, "\n", 1);
-  if unlikely (self->backtrace) {
-    print_backtrace(self->stream->fd, self->skip + 1, true);
-  }
+  int res = LoggerEvent_write_func(self, "\n", 1);
   if unlikely (self->stream->end != NULL) {
     res += self->stream->end(self);
   }
+  if unlikely (self->backtrace) {
+    print_backtrace(
+      self->stream->fd < 0 ? STDERR_FILENO : self->stream->fd,
+      self->skip + 1, true);
+  }
   if unlikely (self->fatal) {
     exit_debug(
       self->exit_status == 0 ? EXIT_FAILURE : self->exit_status, self->debug);
@@ -342,6 +447,27 @@ int LoggerEvent_destroy_func (const struct LoggerEvent * __restrict self) {
  ******************************************************************************/
 
 
+long LoggerLimiter_take (struct LoggerLimiter *self) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while (atomic_flag_test_and_set_explicit(
+      &self->lock, memory_order_acquire)) { }
+  long res;
+  if (TokenBucket_consume(
+        &self->bucket, now.tv_sec * 1000ull + now.tv_nsec / 1000000,
+        LOGGER_LIMIT_RATE, LOGGER_LIMIT_BURST)) {
+    res = self->suppressed;
+    self->suppressed = 0;
+  } else {
+    self->suppressed++;
+    res = -1;
+  }
+  atomic_flag_clear_explicit(&self->lock, memory_order_release);
+  return res;
+}
+
+
 int Logger_log_func (
     const struct Logger * __restrict self, int level,
     const char * __restrict file, int line, const char * __restrict func,
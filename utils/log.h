@@ -9,12 +9,15 @@ extern "C" {
 // #include <signal.h>
 struct sigaction;
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "tokenbucket.h"
+
 /**
  * @file
  * Log utility functions.
@@ -106,7 +109,8 @@ typedef int (*LoggerStreamFunc) ();
 
 /// Log stream.
 struct LoggerStream {
-  /// output file descriptor
+  /// output file descriptor, or -1 to build the line in @ref logger_line and
+  /// leave the output to LoggerStream::end
   int fd;
   /// user data
   void *userdata;
@@ -149,6 +153,94 @@ extern const struct LoggerStream logger_stream_stdout_nocolor;
 extern const struct LoggerStream logger_stream_stderr_nocolor;
 
 
+/******************************************************************************
+ * LoggerLine
+ ******************************************************************************/
+
+/// size of the line buffer of a thread
+#define LOGGER_LINE_SIZE 1024
+
+/// Log line being built, for streams without file descriptor.
+struct LoggerLine {
+  /// length of content
+  unsigned int len;
+  /// content, not null-terminated
+  char buf[LOGGER_LINE_SIZE];
+};
+
+/// log line of the current thread
+extern _Thread_local struct LoggerLine logger_line;
+
+__attribute__((nonnull, access(read_only, 2, 3)))
+/**
+ * @memberof LoggerLine
+ * @brief Append string to log line.
+ *
+ * Long lines are truncated, leaving room for the new-line.
+ *
+ * @param self Log line.
+ * @param str String.
+ * @param len Length of string.
+ * @return Number of bytes appended.
+ */
+inline int LoggerLine_write (
+    struct LoggerLine * __restrict self, const char * __restrict str,
+    size_t len) {
+  size_t room = sizeof(self->buf) - 1 - self->len;
+  if (__builtin_expect(len > room, 0)) {
+    len = room;
+  }
+  memcpy(self->buf + self->len, str, len);
+  self->len += len;
+  return len;
+}
+__attribute__((nonnull, access(read_only, 2)))
+/**
+ * @memberof LoggerLine
+ * @brief Append formatted string to log line.
+ *
+ * @param self Log line.
+ * @param format Format string.
+ * @param ap Variable argument list.
+ * @return Number of bytes appended.
+ */
+int LoggerLine_vprintf (
+  struct LoggerLine * __restrict self, const char * __restrict format,
+  va_list ap);
+__attribute__((nonnull, access(read_only, 2), format(printf, 2, 3)))
+/**
+ * @memberof LoggerLine
+ * @brief Append formatted string to log line.
+ *
+ * @param self Log line.
+ * @param format Format string.
+ * @param ... Format arguments.
+ * @return Number of bytes appended.
+ */
+int LoggerLine_printf (
+  struct LoggerLine * __restrict self, const char * __restrict format, ...);
+__attribute__((nonnull(1), access(read_only, 2), access(read_only, 4),
+               access(read_only, 6), access(read_only, 7)))
+/**
+ * @relates LoggerLine
+ * @brief LoggerStream::begin function that starts @ref logger_line with the
+ *  heading.
+ *
+ * @param self Log event.
+ * @param domain Log domain.
+ * @param level Log level.
+ * @param file File name at which logger is called. Can be @c NULL.
+ * @param line Line number at which logger is called.
+ * @param func Function name at which logger is called. Can be @c NULL.
+ * @param sgr Select Graphic Rendition parameter.
+ * @return Number of bytes written.
+ */
+int LoggerLine_begin (
+  struct LoggerEvent * __restrict self, const char * __restrict domain,
+  unsigned char level, const char * __restrict file, int line,
+  const char * __restrict func, const char * __restrict sgr);
+
+
 /******************************************************************************
  * LoggerFormattedStream
  ******************************************************************************/
@@ -361,7 +453,9 @@ __attribute__((nonnull, access(read_only, 1), access(read_only, 2)))
 inline int LoggerEvent_log_va_func (
     const struct LoggerEvent * __restrict self,
     const char * __restrict format, va_list ap) {
-  return vdprintf(self->stream->fd, format, ap);
+  return __builtin_expect(self->stream->fd < 0, 0) ?
+    LoggerLine_vprintf(&logger_line, format, ap) :
+    vdprintf(self->stream->fd, format, ap);
 }
 #ifndef LOGGER_NO_OPTIMIZATION
 /**
@@ -449,7 +543,9 @@ __attribute__((nonnull, access(read_only, 1), access(read_only, 2, 3)))
 inline int LoggerEvent_write_func (
     const struct LoggerEvent * __restrict self,
     const char * __restrict str, size_t len) {
-  return write(self->stream->fd, str, len);
+  return __builtin_expect(self->stream->fd < 0, 0) ?
+    LoggerLine_write(&logger_line, str, len) :
+    write(self->stream->fd, str, len);
 }
 #ifndef LOGGER_NO_OPTIMIZATION
 /**
@@ -637,7 +733,7 @@ __attribute__((always_inline, access(read_only, 1)))
  */
 #define LoggerEvent_destroy_inline(self) __builtin_expect((self)->flags, 0) ? \
   LoggerEvent_destroy_func(self) : \
-  write((self)->stream->fd, "\n", 1) + ( \
+  LoggerEvent_write_func(self, "\n", 1) + ( \
     __builtin_expect((self)->stream->end != NULL, 0) ? \
       (self)->stream->end(self) : 0)
 #ifndef LOGGER_NO_OPTIMIZATION
@@ -789,6 +885,81 @@ inline int LoggerEvent_init_func (
 #define LOGEVENT(level) logevent(&CURRENT_LOGGER, level)
 
 
+/******************************************************************************
+ * LoggerLimiter
+ ******************************************************************************/
+
+/// number of messages a call site can log in a burst
+#define LOGGER_LIMIT_BURST 10
+/// number of messages per second a call site can log after a burst
+#define LOGGER_LIMIT_RATE 1
+
+/**
+ * @brief Rate limiter of a log call site.
+ *
+ * #LOG and #LOG_PERROR keep one zero-initialized static limiter per call site,
+ * so a failing loop logs a burst, then at most #LOGGER_LIMIT_RATE messages
+ * per second, each preceded by the number of messages suppressed before it.
+ */
+struct LoggerLimiter {
+  /// spin lock protecting the other fields
+  atomic_flag lock;
+  /// token bucket
+  struct TokenBucket bucket;
+  /// number of messages suppressed since the last one logged
+  unsigned long suppressed;
+};
+
+/**
+ * @relates LoggerLimiter
+ * @brief Test whether messages of a log level are rate limited.
+ *
+ * Fatal messages are never suppressed, neither debug messages, which are
+ * enabled on purpose.
+ *
+ * @param level Log level.
+ * @return @c true if rate limited.
+ */
+#define LoggerLimiter_would_limit(level) \
+  ((level) > LOG_LEVEL_CRITICAL && (level) <= LOG_LEVEL_INFO)
+
+__attribute__((nonnull))
+/**
+ * @memberof LoggerLimiter
+ * @brief Try to take a token for a message.
+ *
+ * This function is thread-safe.
+ *
+ * @param self Rate limiter.
+ * @return Number of messages suppressed before this one, or -1 if this one
+ *  should be suppressed.
+ */
+long LoggerLimiter_take (struct LoggerLimiter *self);
+
+/**
+ * @relates LoggerLimiter
+ * @brief Evaluate a logging expression, unless the call site is rate limited.
+ *
+ * @param self Log controller.
+ * @param level Log level.
+ * @param expr Expression which logs the message.
+ * @return Value of @p expr, or -1 if suppressed.
+ */
+#define Logger_limit(self, level, expr) __extension__ ({ \
+  static struct LoggerLimiter __logger_limiter; \
+  long __logger_suppressed = LoggerLimiter_would_limit(level) ? \
+    LoggerLimiter_take(&__logger_limiter) : 0; \
+  if (__builtin_expect(__logger_suppressed > 0, 0)) { \
+    int __logger_errno = errno; \
+    Logger_log_explicit( \
+      self, level, LOGGER_EVENT_FILE_NAME, __LINE__, LOGGER_EVENT_FUNC_NAME, \
+      "%ld similar messages suppressed", __logger_suppressed); \
+    errno = __logger_errno; \
+  } \
+  __builtin_expect(__logger_suppressed < 0, 0) ? -1 : (expr); \
+})
+
+
 /******************************************************************************
  * Log
  ******************************************************************************/
@@ -897,7 +1068,9 @@ int Logger_log_func (
     int res = LoggerEvent_init_func( \
       &__logger_event, self, level, file, line, func); \
     LOGGER_EVENT_GUARD_BEGIN(&__logger_event); \
-    res += dprintf(__logger_event.stream->fd, __VA_ARGS__); \
+    res += __builtin_expect(__logger_event.stream->fd < 0, 0) ? \
+      LoggerLine_printf(&logger_line, __VA_ARGS__) : \
+      dprintf(__logger_event.stream->fd, __VA_ARGS__); \
     res += LoggerEvent_destroy_inline(&__logger_event); \
     LOGGER_EVENT_GUARD_END(&__logger_event); \
     res; \
@@ -909,6 +1082,8 @@ int Logger_log_func (
  * @relates Logger
  * @brief Write a log message, followed by a new-line.
  *
+ * Messages of the same call site are rate limited, see ::LoggerLimiter.
+ *
  * @param self Log controller.
  * @param level Log level.
  * @param format Format string.
@@ -916,9 +1091,10 @@ int Logger_log_func (
  * @return Number of bytes written, or -1 if no logging happens.
  */
 #define Logger_log(self, level, ...) ( \
-  !Logger_would_log(self, level) ? -1 : Logger_log_explicit( \
-    self, level, LOGGER_EVENT_FILE_NAME, __LINE__, LOGGER_EVENT_FUNC_NAME, \
-    __VA_ARGS__))
+  !Logger_would_log(self, level) ? -1 : Logger_limit( \
+    self, level, Logger_log_explicit( \
+      self, level, LOGGER_EVENT_FILE_NAME, __LINE__, LOGGER_EVENT_FUNC_NAME, \
+      __VA_ARGS__)))
 /**
  * @relates Logger
  * @brief Write a log message using #CURRENT_LOGGER, followed by a new-line.
@@ -973,7 +1149,9 @@ int Logger_log_perror_func (
     int res = LoggerEvent_init_func( \
       &__logger_event, self, level, file, line, func); \
     LOGGER_EVENT_GUARD_BEGIN(&__logger_event); \
-    res += dprintf(__logger_event.stream->fd, __VA_ARGS__); \
+    res += __builtin_expect(__logger_event.stream->fd < 0, 0) ? \
+      LoggerLine_printf(&logger_line, __VA_ARGS__) : \
+      dprintf(__logger_event.stream->fd, __VA_ARGS__); \
     res += LoggerEvent_perror_func(&__logger_event, errnum, true); \
     LOGGER_EVENT_GUARD_END(&__logger_event); \
     res += LoggerEvent_destroy_inline(&__logger_event); \
@@ -988,6 +1166,8 @@ int Logger_log_perror_func (
  * @brief Write a log message, followed by a colon and a blank, then an error
  *  message corresponding to the current value of @c errno and a new-line.
  *
+ * Messages of the same call site are rate limited, see ::LoggerLimiter.
+ *
  * @param self Log controller.
  * @param level Log level.
  * @param format Format string.
@@ -995,9 +1175,10 @@ int Logger_log_perror_func (
  * @return Number of bytes written, or -1 if no logging happens.
  */
 #define Logger_log_perror(self, level, ...) ( \
-  !Logger_would_log(self, level) ? -1 : Logger_log_perror_explicit( \
-    self, level, LOGGER_EVENT_FILE_NAME, __LINE__, LOGGER_EVENT_FUNC_NAME, \
-    __VA_ARGS__))
+  !Logger_would_log(self, level) ? -1 : Logger_limit( \
+    self, level, Logger_log_perror_explicit( \
+      self, level, LOGGER_EVENT_FILE_NAME, __LINE__, LOGGER_EVENT_FUNC_NAME, \
+      __VA_ARGS__)))
 /**
  * @relates Logger
  * @brief Write a log message using #CURRENT_LOGGER, followed by a colon and a
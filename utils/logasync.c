@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "macro.h"
+#include "log.h"
+#include "single.h"
+#include "threadname.h"
+#include "logasync.h"
+
+
+/// maximum number of lines in one @c writev() call
+#define LOGGER_ASYNC_BATCH 64
+
+
+/**
+ * @memberof LoggerAsync
+ * @private
+ * @brief Write a batch of ready lines.
+ *
+ * Caller must hold LoggerAsync::writing.
+ *
+ * @param self Async log stream.
+ * @return Number of lines written.
+ */
+static int LoggerAsync_write (struct LoggerAsync *self) {
+  struct iovec iov[LOGGER_ASYNC_BATCH];
+  unsigned int tail = self->tail;
+
+  int n = 0;
+  for (; n < LOGGER_ASYNC_BATCH; n++) {
+    struct LoggerAsyncRecord *record = &self->records[(tail + n) & self->mask];
+    break_if (atomic_load_explicit(
+      &record->seq, memory_order_acquire) != tail + n + 1);
+    iov[n].iov_base = record->buf;
+    iov[n].iov_len = record->len;
+  }
+  return_if_fail (n > 0) 0;
+
+  // writev() may write partially
+  struct iovec *cur = iov;
+  int cnt = n;
+  while (cnt > 0) {
+    ssize_t written = writev(self->fd, cur, cnt);
+    if unlikely (written < 0) {
+      continue_if (errno == EINTR);
+      break;
+    }
+    while (cnt > 0 && (size_t) written >= cur->iov_len) {
+      written -= cur->iov_len;
+      cur++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      cur->iov_base = (char *) cur->iov_base + written;
+      cur->iov_len -= written;
+    }
+  }
+
+  // release slots
+  for (int i = 0; i < n; i++) {
+    atomic_store_explicit(
+      &self->records[(tail + i) & self->mask].seq, tail + i + self->mask + 1,
+      memory_order_release);
+  }
+  self->tail = tail + n;
+  return n;
+}
+
+
+int LoggerAsync_flush (struct LoggerAsync *self) {
+  while (atomic_flag_test_and_set_explicit(
+      &self->writing, memory_order_acquire)) {
+    thrd_yield();
+  }
+
+  int res = 0;
+  int n;
+  while ((n = LoggerAsync_write(self)) > 0) {
+    res += n;
+  }
+
+  atomic_flag_clear_explicit(&self->writing, memory_order_release);
+  return res;
+}
+
+
+/**
+ * @memberof LoggerAsync
+ * @private
+ * @brief Enqueue a line.
+ *
+ * @param self Async log stream.
+ * @param buf Line.
+ * @param len Length of line.
+ * @return @c true if enqueued, @c false if dropped.
+ */
+static bool LoggerAsync_push (
+    struct LoggerAsync *self, const char *buf, unsigned int len) {
+  unsigned int pos = atomic_load_explicit(&self->head, memory_order_relaxed);
+  struct LoggerAsyncRecord *record;
+  while (true) {
+    record = &self->records[pos & self->mask];
+    int diff = (int) (atomic_load_explicit(
+      &record->seq, memory_order_acquire) - pos);
+    if likely (diff == 0) {
+      break_if (atomic_compare_exchange_weak_explicit(
+        &self->head, &pos, pos + 1, memory_order_relaxed,
+        memory_order_relaxed));
+    } else if (diff < 0) {
+      // full
+      atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+      return false;
+    } else {
+      pos = atomic_load_explicit(&self->head, memory_order_relaxed);
+    }
+  }
+
+  memcpy(record->buf, buf, len);
+  record->len = len;
+  atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+
+  // pairs with the fence in LoggerAsync_mainloop()
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&self->sleeping, memory_order_relaxed) &&
+      atomic_exchange(&self->sleeping, false)) {
+    eventfd_write(self->wakeup, 1);
+  }
+  return true;
+}
+
+
+/**
+ * @memberof LoggerAsync
+ * @private
+ * @brief LoggerStream::end function that enqueues @ref logger_line.
+ *
+ * @param event Log event.
+ * @return 0.
+ */
+static int LoggerAsync_end (const struct LoggerEvent * __restrict event) {
+  struct LoggerAsync *self = event->stream->userdata;
+  struct LoggerLine *line = &logger_line;
+
+  // new-line may have been truncated
+  if unlikely (line->len == 0 || line->buf[line->len - 1] != '\n') {
+    line->buf[line->len++] = '\n';
+  }
+  LoggerAsync_push(self, line->buf, line->len);
+  line->len = 0;
+
+  if unlikely (event->fatal) {
+    LoggerAsync_flush(self);
+  }
+  return 0;
+}
+
+
+/**
+ * @memberof LoggerAsync
+ * @private
+ * @brief Writer thread.
+ *
+ * @param arg Async log stream.
+ * @return 0.
+ */
+static int LoggerAsync_mainloop (void *arg) {
+  struct LoggerAsync *self = arg;
+  threadname_set("Logger");
+
+  unsigned long reported = 0;
+  while (single_is_running(&self->state)) {
+    continue_if (LoggerAsync_flush(self) > 0);
+
+    unsigned long dropped =
+      atomic_load_explicit(&self->dropped, memory_order_relaxed);
+    if unlikely (dropped != reported) {
+      LOG(LOG_LEVEL_WARNING, "%lu log lines dropped", dropped - reported);
+      reported = dropped;
+      continue;
+    }
+
+    // sleep until woken up by producers
+    atomic_store(&self->sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    should (LoggerAsync_flush(self) == 0) otherwise {
+      atomic_store(&self->sleeping, false);
+      continue;
+    }
+    struct pollfd pollfd = {.fd = self->wakeup, .events = POLLIN};
+    if (poll(&pollfd, 1, 1000) > 0) {
+      eventfd_t value;
+      eventfd_read(self->wakeup, &value);
+    }
+    atomic_store(&self->sleeping, false);
+  }
+
+  LoggerAsync_flush(self);
+  single_finish(&self->state);
+  return 0;
+}
+
+
+int LoggerAsync_start (struct LoggerAsync *self) {
+  return single_start(&self->state, LoggerAsync_mainloop, self);
+}
+
+
+void LoggerAsync_destroy (struct LoggerAsync *self) {
+  single_stop(&self->state);
+  eventfd_write(self->wakeup, 1);
+  single_join(&self->state);
+
+  LoggerAsync_flush(self);
+  close(self->wakeup);
+  free(self->records);
+}
+
+
+int LoggerAsync_init (struct LoggerAsync *self, int fd, unsigned int capacity) {
+  unsigned int size = 2;
+  while (size < capacity && size < UINT_MAX / 2) {
+    size *= 2;
+  }
+
+  self->records = malloc(sizeof(self->records[0]) * size);
+  return_if_fail (self->records != NULL) -1;
+  self->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  should (self->wakeup >= 0) otherwise {
+    int saved_errno = errno;
+    free(self->records);
+    errno = saved_errno;
+    return -1;
+  }
+  for (unsigned int i = 0; i < size; i++) {
+    atomic_init(&self->records[i].seq, i);
+  }
+
+  self->stream.fd = -1;
+  self->stream.userdata = self;
+  self->stream.begin = LoggerLine_begin;
+  self->stream.end = LoggerAsync_end;
+  self->fd = fd;
+  atomic_init(&self->dropped, 0);
+  self->mask = size - 1;
+  atomic_init(&self->head, 0);
+  self->tail = 0;
+  atomic_init(&self->sleeping, false);
+  self->state = SINGLE_FLAG_INIT;
+  atomic_flag_clear(&self->writing);
+  return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef UTILS_LOGASYNC_H
+#define UTILS_LOGASYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "log.h"
+#include "single.h"
+
+/**
+ * @file
+ * Log stream written by a background thread.
+ */
+
+
+/**
+ * @brief Slot of LoggerAsync ring.
+ *
+ * LoggerAsyncRecord::seq equals to the position that may claim the slot when
+ * free, or the position plus 1 when the record is ready to be written.
+ */
+struct LoggerAsyncRecord {
+  /// sequence number
+  atomic_uint seq;
+  /// length of record
+  unsigned int len;
+  /// content
+  char buf[LOGGER_LINE_SIZE];
+};
+
+/**
+ * @brief Log stream whose lines are written by a background thread.
+ *
+ * Lines are built in @ref logger_line by the logging thread, then copied into
+ * a bounded lock-free ring at the end of the event. Producers never block;
+ * when the ring is full, the line is dropped and counted. The writer thread
+ * writes the ring in batches with @c writev(), and only sleeps when the ring
+ * is empty, so an idle writer costs producers a single atomic load.
+ *
+ * Fatal events are flushed synchronously by the logging thread before the
+ * program terminates, and backtraces are printed to @c stderr.
+ */
+struct LoggerAsync {
+  /// log stream to be used with Logger_set_stream()
+  struct LoggerStream stream;
+  /// output file descriptor
+  int fd;
+  /// number of dropped lines
+  atomic_ulong dropped;
+
+  /** @privatesection */
+  /// ring slots
+  struct LoggerAsyncRecord *records;
+  /// number of slots minus 1
+  unsigned int mask;
+  /// next position to claim
+  atomic_uint head;
+  /// next position to write, used by writer thread only
+  unsigned int tail;
+  /// @c true if writer thread may be sleeping
+  atomic_bool sleeping;
+  /// eventfd to wake up writer thread
+  int wakeup;
+  /// writer thread state
+  single_flag state;
+  /// lock of output file descriptor, held when writing
+  atomic_flag writing;
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof LoggerAsync
+ * @brief Write all ready lines now.
+ *
+ * This function is thread-safe; only one thread writes at the same time, and
+ * the others wait for it.
+ *
+ * @param self Async log stream.
+ * @return Number of lines written.
+ */
+int LoggerAsync_flush (struct LoggerAsync *self);
+__attribute__((nonnull))
+/**
+ * @memberof LoggerAsync
+ * @brief Start writer thread.
+ *
+ * Call it after @c daemon(), as threads do not survive @c fork().
+ *
+ * @param self Async log stream.
+ * @return 0 on success, -1 on error.
+ */
+int LoggerAsync_start (struct LoggerAsync *self);
+
+__attribute__((nonnull))
+/**
+ * @memberof LoggerAsync
+ * @brief Stop writer thread, write remaining lines, and destroy the stream.
+ *
+ * The stream must not be used by any logger after this call.
+ *
+ * @param self Async log stream.
+ */
+void LoggerAsync_destroy (struct LoggerAsync *self);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof LoggerAsync
+ * @brief Initialize an async log stream.
+ *
+ * @param[out] self Async log stream.
+ * @param fd Output file descriptor.
+ * @param capacity Number of lines in ring, rounded up to power of 2.
+ * @return 0 on success, -1 on error.
+ */
+int LoggerAsync_init (struct LoggerAsync *self, int fd, unsigned int capacity);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_LOGASYNC_H */
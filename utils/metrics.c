@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "macro.h"
+#include "histogram.h"
+#include "log.h"
+#include "metrics.h"
+
+
+_Thread_local int metrics_shard = -1;
+
+
+int metrics_shard_assign (void) {
+  static atomic_uint next = 0;
+  metrics_shard = atomic_fetch_add_explicit(&next, 1, memory_order_relaxed) &
+    (METRICS_SHARDS - 1);
+  return metrics_shard;
+}
+
+
+unsigned long MetricCounter_get (const struct MetricCounter *self) {
+  unsigned long value = 0;
+  for (int i = 0; i < METRICS_SHARDS; i++) {
+    value += atomic_load_explicit(&self->shards[i].value, memory_order_relaxed);
+  }
+  return value;
+}
+
+
+long MetricGauge_get (const struct MetricGauge *self) {
+  return MetricCounter_get((const struct MetricCounter *) self);
+}
+
+
+void MetricCounter_reset (struct MetricCounter *self) {
+  for (int i = 0; i < METRICS_SHARDS; i++) {
+    atomic_init(&self->shards[i].value, 0);
+  }
+}
+
+
+void metrics_write_family (
+    FILE *f, const char *name, const char *type, const char *help) {
+  fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+void metrics_write_sample (
+    FILE *f, const char *name, const char *labels, long long value) {
+  if (labels == NULL || labels[0] == '\0') {
+    fprintf(f, "%s %lld\n", name, value);
+  } else {
+    fprintf(f, "%s{%s} %lld\n", name, labels, value);
+  }
+}
+
+
+void metrics_write_histogram (
+    FILE *f, const char *name, const char *help, const struct Histogram *hist) {
+  metrics_write_family(f, name, "histogram", help);
+
+  // bucket i holds [2^(i-1), 2^i), thus its upper bound is 2^i - 1
+  unsigned long cumulative = 0;
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+    cumulative +=
+      atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    fprintf(f, "%s_bucket{le=\"%lu\"} %lu\n",
+            name, i == 0 ? 0 : (1ul << i) - 1, cumulative);
+  }
+  // from the buckets just written, so that +Inf never falls below them under
+  // concurrent updates
+  cumulative += atomic_load_explicit(
+    &hist->buckets[HISTOGRAM_BUCKETS - 1], memory_order_relaxed);
+  fprintf(f, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+  fprintf(f, "%s_sum %llu\n", name,
+          atomic_load_explicit(&hist->sum, memory_order_relaxed));
+  fprintf(f, "%s_count %lu\n", name, cumulative);
+}
+
+
+/**
+ * @memberof MetricsServer
+ * @private
+ * @brief Send metrics to a connection, and close it.
+ *
+ * The response must fit into socket buffer, since the polling thread does not
+ * wait for slow clients.
+ *
+ * @param self Scrape endpoint.
+ * @param i Index of connection.
+ */
+static void MetricsServer_respond (struct MetricsServer *self, int i) {
+  char *body = NULL;
+  size_t body_len = 0;
+  FILE *f = open_memstream(&body, &body_len);
+  should (f != NULL) otherwise {
+    LOG_PERROR(LOG_LEVEL_WARNING, "open_memstream() failed");
+    StreamServer_close((struct StreamServer *) self, i);
+    return;
+  }
+  self->collect(self->collect_arg, f);
+  fclose(f);
+
+  char head[128];
+  int head_len = snprintf(
+    head, sizeof(head),
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: %zu\r\n"
+    "Connection: close\r\n\r\n", body_len);
+  struct iovec iov[2] = {
+    {.iov_base = head, .iov_len = head_len},
+    {.iov_base = body, .iov_len = body_len},
+  };
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+  should (sendmsg(
+      self->clients[i], &msg, MSG_DONTWAIT | MSG_NOSIGNAL
+  ) == (ssize_t) (head_len + body_len)) otherwise {
+    LOG_PERROR(LOG_LEVEL_INFO, "Cannot send metrics");
+  }
+  free(body);
+  shutdown(self->clients[i], SHUT_WR);
+  StreamServer_close((struct StreamServer *) self, i);
+}
+
+
+void MetricsServer_process (
+    struct MetricsServer *self, const struct pollfd *pollfds) {
+  // read requests
+  for (int i = 0; i < METRICS_CLIENTS; i++) {
+    continue_if (pollfds[1 + i].revents == 0 || self->clients[i] < 0);
+
+    char buf[512];
+    ssize_t len = recv(self->clients[i], buf, sizeof(buf), MSG_DONTWAIT);
+    if (len < 0) {
+      continue_if (errno == EAGAIN || errno == EINTR);
+      StreamServer_close((struct StreamServer *) self, i);
+      continue;
+    }
+    // the request is not inspected; end of headers or EOF triggers response
+    bool end = len == 0;
+    for (ssize_t j = 0; j < len && !end; j++) {
+      static const char eoh[] = "\r\n\r\n";
+      if (buf[j] == eoh[self->matched[i]]) {
+        self->matched[i]++;
+      } else {
+        self->matched[i] = buf[j] == '\r';
+      }
+      end = self->matched[i] == sizeof(eoh) - 1;
+    }
+    should (self->received[i] + len <= METRICS_REQUEST_SIZE) otherwise {
+      StreamServer_close((struct StreamServer *) self, i);
+      continue;
+    }
+    self->received[i] += len;
+    if (end) {
+      MetricsServer_respond(self, i);
+    }
+  }
+
+  // accept new connection
+  int i = StreamServer_accept(
+    (struct StreamServer *) self, pollfds, "scrape");
+  if (i >= 0) {
+    self->received[i] = 0;
+    self->matched[i] = 0;
+  }
+}
+
+
+int MetricsServer_init (
+    struct MetricsServer *self, const char *spec,
+    void (*collect) (void *arg, FILE *f), void *arg) {
+  int res;
+  if (strchr(spec, '/') == NULL) {
+    char *end;
+    unsigned long port = strtoul(spec, &end, 10);
+    return_if_fail (spec[0] != '\0' && *end == '\0' && port > 0 &&
+                    port <= 65535) 1;
+    res = StreamServer_init_loopback((struct StreamServer *) self, port);
+  } else {
+    res = StreamServer_init_unix((struct StreamServer *) self, spec, 0);
+  }
+  return_nonzero (res);
+
+  self->collect = collect;
+  self->collect_arg = arg;
+  for (int i = 0; i < METRICS_CLIENTS; i++) {
+    self->received[i] = 0;
+    self->matched[i] = 0;
+  }
+  return 0;
+}
@@ -0,0 +1,285 @@
+#ifndef UTILS_METRICS_H
+#define UTILS_METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+// #include <poll.h>
+struct pollfd;
+// #include "histogram.h"
+struct Histogram;
+#include "streamserver.h"
+
+/**
+ * @file
+ * Sharded metrics and Prometheus text exposition.
+ */
+
+
+/// number of shards of a metric, must be a power of 2
+#define METRICS_SHARDS 8
+/// maximum number of scrape connections served at the same time
+#define METRICS_CLIENTS STREAM_SERVER_CLIENTS
+/// maximum length of scrape request
+#define METRICS_REQUEST_SIZE 2048
+
+
+/**
+ * @brief Shard of a metric, on its own cache line.
+ */
+struct MetricShard {
+  /// value
+  _Alignas(64) atomic_long value;
+};
+
+/**
+ * @brief Monotonic counter, sharded by thread.
+ *
+ * Each thread adds to its own shard, so that hot paths of different threads
+ * never share a cache line. Shards are only summed when read.
+ */
+struct MetricCounter {
+  /// shards
+  struct MetricShard shards[METRICS_SHARDS];
+};
+
+/**
+ * @brief Gauge which is increased and decreased, sharded by thread.
+ *
+ * A shard may go negative when a thread decreases what another one increased;
+ * only the sum is meaningful.
+ */
+struct MetricGauge {
+  /// shards
+  struct MetricShard shards[METRICS_SHARDS];
+};
+
+/// shard of current thread, or -1 if not yet assigned
+extern _Thread_local int metrics_shard;
+
+__attribute__((warn_unused_result))
+/**
+ * @brief Assign a shard to current thread.
+ *
+ * @return Shard index.
+ */
+int metrics_shard_assign (void);
+
+__attribute__((warn_unused_result))
+/**
+ * @brief Get shard of current thread.
+ *
+ * @return Shard index.
+ */
+static inline int metrics_shard_get (void) {
+  int shard = metrics_shard;
+  return __builtin_expect(shard >= 0, 1) ? shard : metrics_shard_assign();
+}
+
+__attribute__((nonnull))
+/**
+ * @memberof MetricCounter
+ * @brief Add to a counter.
+ *
+ * This function is thread-safe.
+ *
+ * @param self Counter.
+ * @param n Value to add.
+ */
+static inline void MetricCounter_add (
+    struct MetricCounter *self, unsigned long n) {
+  atomic_fetch_add_explicit(
+    &self->shards[metrics_shard_get()].value, n, memory_order_relaxed);
+}
+
+__attribute__((nonnull))
+/**
+ * @memberof MetricCounter
+ * @brief Increase a counter by 1.
+ *
+ * This function is thread-safe.
+ *
+ * @param self Counter.
+ */
+static inline void MetricCounter_inc (struct MetricCounter *self) {
+  MetricCounter_add(self, 1);
+}
+
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof MetricCounter
+ * @brief Get value of a counter.
+ *
+ * @param self Counter.
+ * @return Value.
+ */
+unsigned long MetricCounter_get (const struct MetricCounter *self);
+
+__attribute__((nonnull))
+/**
+ * @memberof MetricGauge
+ * @brief Add to a gauge.
+ *
+ * This function is thread-safe.
+ *
+ * @param self Gauge.
+ * @param n Value to add, can be negative.
+ */
+static inline void MetricGauge_add (struct MetricGauge *self, long n) {
+  atomic_fetch_add_explicit(
+    &self->shards[metrics_shard_get()].value, n, memory_order_relaxed);
+}
+
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof MetricGauge
+ * @brief Get value of a gauge.
+ *
+ * @param self Gauge.
+ * @return Value.
+ */
+long MetricGauge_get (const struct MetricGauge *self);
+
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof MetricCounter
+ * @brief Reset a counter.
+ *
+ * @param[out] self Counter.
+ */
+void MetricCounter_reset (struct MetricCounter *self);
+
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof MetricGauge
+ * @brief Reset a gauge.
+ *
+ * @param[out] self Gauge.
+ */
+static inline void MetricGauge_reset (struct MetricGauge *self) {
+  MetricCounter_reset((struct MetricCounter *) self);
+}
+
+
+__attribute__((nonnull(1, 2, 3, 4)))
+/**
+ * @brief Write @c HELP and @c TYPE lines of a metric family.
+ *
+ * @param f Output.
+ * @param name Metric name.
+ * @param type Metric type, e.g. @c counter or @c gauge.
+ * @param help Help text.
+ */
+void metrics_write_family (
+  FILE *f, const char *name, const char *type, const char *help);
+__attribute__((nonnull(1, 2)))
+/**
+ * @brief Write a sample.
+ *
+ * @param f Output.
+ * @param name Metric name.
+ * @param labels Labels without braces, e.g. `method="INVITE"`. Can be
+ *  @c NULL.
+ * @param value Value.
+ */
+void metrics_write_sample (
+  FILE *f, const char *name, const char *labels, long long value);
+__attribute__((nonnull(1, 2, 3, 4)))
+/**
+ * @brief Write a histogram as Prometheus histogram, including its @c HELP and
+ *  @c TYPE lines.
+ *
+ * @param f Output.
+ * @param name Metric name.
+ * @param help Help text.
+ * @param hist Histogram.
+ */
+void metrics_write_histogram (
+  FILE *f, const char *name, const char *help, const struct Histogram *hist);
+
+
+/**
+ * @extends StreamServer
+ * @brief Scrape endpoint serving Prometheus text over HTTP.
+ *
+ * The server is driven by the caller's poll loop: add
+ * #METRICS_SERVER_NPOLLFD entries with MetricsServer_pollfds(), and pass them
+ * back to MetricsServer_process() after @c poll(). No thread is created; the
+ * collect callback runs in the polling thread.
+ */
+struct MetricsServer {
+  struct StreamServer;
+  /// write metrics into output
+  void (*collect) (void *arg, FILE *f);
+  /// argument of MetricsServer::collect
+  void *collect_arg;
+
+  /** @privatesection */
+  /// length of received request of each connection
+  unsigned short received[METRICS_CLIENTS];
+  /// number of matched characters of end of request headers
+  unsigned char matched[METRICS_CLIENTS];
+};
+
+/// number of @c pollfd entries used by MetricsServer
+#define METRICS_SERVER_NPOLLFD STREAM_SERVER_NPOLLFD
+
+__attribute__((nonnull))
+/**
+ * @memberof MetricsServer
+ * @brief Fill @c pollfd entries.
+ *
+ * @param self Scrape endpoint.
+ * @param[out] pollfds Array of #METRICS_SERVER_NPOLLFD entries.
+ */
+static inline void MetricsServer_pollfds (
+    const struct MetricsServer *self, struct pollfd *pollfds) {
+  StreamServer_pollfds((const struct StreamServer *) self, pollfds);
+}
+__attribute__((nonnull))
+/**
+ * @memberof MetricsServer
+ * @brief Accept connections and answer requests after @c poll().
+ *
+ * @param self Scrape endpoint.
+ * @param pollfds Array of #METRICS_SERVER_NPOLLFD entries.
+ */
+void MetricsServer_process (
+  struct MetricsServer *self, const struct pollfd *pollfds);
+
+__attribute__((nonnull))
+/**
+ * @memberof MetricsServer
+ * @brief Close all sockets and destroy the endpoint.
+ *
+ * @param self Scrape endpoint.
+ */
+static inline void MetricsServer_destroy (struct MetricsServer *self) {
+  StreamServer_destroy((struct StreamServer *) self);
+}
+__attribute__((warn_unused_result, nonnull(1, 2)))
+/**
+ * @memberof MetricsServer
+ * @brief Initialize a scrape endpoint and start listening.
+ *
+ * @param[out] self Scrape endpoint.
+ * @param spec TCP port on loopback, or path of Unix socket if containing @c /.
+ * @param collect Function to write metrics.
+ * @param arg Argument of @p collect.
+ * @return 0 on success, 1 if @p spec malformed, -1 on error and @c errno is
+ *  set appropriately.
+ */
+int MetricsServer_init (
+  struct MetricsServer *self, const char *spec,
+  void (*collect) (void *arg, FILE *f), void *arg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_METRICS_H */
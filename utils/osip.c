@@ -255,6 +255,150 @@ fail:
 }
 
 
+int osip_message_new_request (
+    osip_message_t **request, const char *method, const char *req_uri,
+    const char *from, const char *to, const char *contact, const char *host,
+    const char *ua) {
+  int res = osip_message_init(request);
+  return_if_fail (res == OSIP_SUCCESS) res;
+
+  {
+    char *method_ = osip_strdup(method);
+    goto_if_fail (method_ != NULL) fail;
+    (*request)->sip_method = method_;
+  }
+  {
+    char *version = osip_strdup("SIP/2.0");
+    goto_if_fail (version != NULL) fail;
+    (*request)->sip_version = version;
+  }
+  goto_if_fail (osip_uri_init(&(*request)->req_uri) == OSIP_SUCCESS) fail;
+  res = osip_uri_parse((*request)->req_uri, req_uri);
+  goto_if_fail (res == OSIP_SUCCESS) fail_res;
+
+  {
+    char via[128];
+    snprintf(
+      via, sizeof(via), "SIP/2.0/UDP %s;rport;branch=z9hG4bK%u", host,
+      osip_build_random_number());
+    goto_if_fail (osip_message_set_via(*request, via) == OSIP_SUCCESS) fail;
+  }
+  res = osip_message_set_from(*request, from);
+  goto_if_fail (res == OSIP_SUCCESS) fail_res;
+  {
+    static const int tag_size = sizeof("4294967295");
+    char *tag = osip_malloc(tag_size);
+    goto_if_fail (tag != NULL) fail;
+    snprintf(tag, tag_size, "%u", osip_build_random_number());
+    should (osip_from_set_tag((*request)->from, tag) == OSIP_SUCCESS) otherwise {
+      osip_free(tag);
+      goto fail;
+    }
+  }
+  res = osip_message_set_to(*request, to);
+  goto_if_fail (res == OSIP_SUCCESS) fail_res;
+  res = osip_message_set_contact(*request, contact);
+  goto_if_fail (res == OSIP_SUCCESS) fail_res;
+
+  {
+    char call_id[128];
+    snprintf(call_id, sizeof(call_id), "%u@%s", osip_build_random_number(),
+             host);
+    goto_if_fail (osip_message_set_call_id(
+      *request, call_id) == OSIP_SUCCESS) fail;
+  }
+  {
+    char cseq[64];
+    snprintf(cseq, sizeof(cseq), "1 %s", method);
+    goto_if_fail (osip_message_set_cseq(*request, cseq) == OSIP_SUCCESS) fail;
+  }
+
+  goto_if_fail (
+    osip_message_set_now(*request) == OSIP_SUCCESS) fail;
+  goto_if_fail (
+    osip_message_set_max_forwards(*request, "70") == OSIP_SUCCESS) fail;
+  if (ua != NULL) {
+    goto_if_fail (
+      osip_message_set_user_agent(*request, ua) == OSIP_SUCCESS) fail;
+  }
+  return OSIP_SUCCESS;
+
+fail:
+  res = OSIP_NOMEM;
+fail_res:
+  osip_message_free(*request);
+  *request = NULL;
+  return res;
+}
+
+
+int osip_message_cancel (
+    osip_message_t **request, const osip_message_t *invite, const char *ua) {
+  return_if_fail (invite->req_uri != NULL) OSIP_SYNTAXERROR;
+  return_if_fail (invite->from != NULL) OSIP_SYNTAXERROR;
+  return_if_fail (invite->to != NULL) OSIP_SYNTAXERROR;
+  return_if_fail (invite->call_id != NULL) OSIP_SYNTAXERROR;
+  return_if_fail (invite->cseq != NULL) OSIP_SYNTAXERROR;
+  const osip_via_t *via = osip_list_get(&invite->vias, 0);
+  return_if_fail (via != NULL) OSIP_SYNTAXERROR;
+
+  int res = osip_message_init(request);
+  return_if_fail (res == OSIP_SUCCESS) res;
+
+  // Section 9.1: same Request-URI, Call-ID, To, From, CSeq number and top Via
+  {
+    char *method = osip_strdup("CANCEL");
+    goto_if_fail (method != NULL) fail;
+    (*request)->sip_method = method;
+  }
+  {
+    char *version = osip_strdup("SIP/2.0");
+    goto_if_fail (version != NULL) fail;
+    (*request)->sip_version = version;
+  }
+  goto_if_fail (osip_uri_clone(
+    invite->req_uri, &(*request)->req_uri) == OSIP_SUCCESS) fail;
+  {
+    osip_via_t *via_;
+    goto_if_fail (osip_via_clone(via, &via_) == OSIP_SUCCESS) fail;
+    should (osip_list_add(&(*request)->vias, via_, -1) >= 0) otherwise {
+      osip_via_free(via_);
+      goto fail;
+    }
+  }
+  goto_if_fail (osip_from_clone(
+    invite->from, &(*request)->from) == OSIP_SUCCESS) fail;
+  goto_if_fail (
+    osip_to_clone(invite->to, &(*request)->to) == OSIP_SUCCESS) fail;
+  goto_if_fail (osip_call_id_clone(
+    invite->call_id, &(*request)->call_id) == OSIP_SUCCESS) fail;
+  goto_if_fail (osip_cseq_init(&(*request)->cseq) == OSIP_SUCCESS) fail;
+  {
+    char *number = osip_strdup(invite->cseq->number);
+    goto_if_fail (number != NULL) fail;
+    osip_cseq_set_number((*request)->cseq, number);
+  }
+  {
+    char *method = osip_strdup("CANCEL");
+    goto_if_fail (method != NULL) fail;
+    osip_cseq_set_method((*request)->cseq, method);
+  }
+
+  goto_if_fail (
+    osip_message_set_max_forwards(*request, "70") == OSIP_SUCCESS) fail;
+  if (ua != NULL) {
+    goto_if_fail (
+      osip_message_set_user_agent(*request, ua) == OSIP_SUCCESS) fail;
+  }
+  return OSIP_SUCCESS;
+
+fail:
+  osip_message_free(*request);
+  *request = NULL;
+  return OSIP_NOMEM;
+}
+
+
 bool osip_transaction_match (
     osip_transaction_t *transaction, osip_message_t *message) {
   osip_generic_param_t *tr_br;
@@ -294,6 +438,25 @@ fail:
 }
 
 
+int osip_transaction_redirect (
+    osip_transaction_t *transaction, int status_code, const char *ua,
+    const char *contact, bool now) {
+  osip_message_t *response;
+  int res = osip_message_response(
+    &response, transaction->orig_request, status_code, ua);
+  return_if_fail (res == OSIP_SUCCESS) res;
+  res = osip_message_set_contact(response, contact);
+  goto_if_fail (res == OSIP_SUCCESS) fail;
+  res = osip_transaction_send_sipmessage(transaction, response, now);
+  goto_if_fail (res == OSIP_SUCCESS) fail;
+  return OSIP_SUCCESS;
+
+fail:
+  osip_message_free(response);
+  return res;
+}
+
+
 int osip_dialog_set_local_tag (osip_dialog_t *dialog, const char *local_tag) {
   osip_free(dialog->local_tag);
 
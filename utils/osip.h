@@ -40,6 +40,18 @@ __attribute__((nonnull(1, 2, 3), access(write_only, 1), access(read_only, 3),
 int osip_message_request (
   osip_message_t **request, osip_dialog_t *dialog, const char *method,
   const char *ua);
+__attribute__((nonnull(1, 2, 3, 4, 5, 6, 7), access(write_only, 1),
+               access(read_only, 2), access(read_only, 3), access(read_only, 4),
+               access(read_only, 5), access(read_only, 6),
+               access(read_only, 8)))
+int osip_message_new_request (
+  osip_message_t **request, const char *method, const char *req_uri,
+  const char *from, const char *to, const char *contact, const char *host,
+  const char *ua);
+__attribute__((nonnull(1, 2), access(write_only, 1), access(read_only, 2),
+               access(read_only, 3)))
+int osip_message_cancel (
+  osip_message_t **request, const osip_message_t *invite, const char *ua);
 
 // transaction
 
@@ -70,6 +82,11 @@ static inline int osip_transaction_send_sipmessage (
 __attribute__((warn_unused_result, nonnull(1), access(read_only, 3)))
 int osip_transaction_response (
   osip_transaction_t *transaction, int status_code, const char *ua, bool now);
+__attribute__((warn_unused_result, nonnull(1, 4), access(read_only, 3),
+               access(read_only, 4)))
+int osip_transaction_redirect (
+  osip_transaction_t *transaction, int status_code, const char *ua,
+  const char *contact, bool now);
 
 // dialog
 
@@ -0,0 +1,380 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "macro.h"
+#include "pcaptap.h"
+
+
+/// pcapng Section Header Block type
+#define PCAPNG_SHB_TYPE 0x0a0d0d0a
+/// pcapng Interface Description Block type
+#define PCAPNG_IDB_TYPE 1
+/// pcapng Enhanced Packet Block type
+#define PCAPNG_EPB_TYPE 6
+/// link type of raw IPv4/IPv6 packets
+#define PCAPNG_LINKTYPE_RAW 101
+
+/// length of Section Header Block and Interface Description Block
+#define PCAPNG_HEADER_SIZE (28 + 20)
+/// length of Enhanced Packet Block without packet data
+#define PCAPNG_EPB_SIZE 32
+
+
+/**
+ * @brief Endpoint of a captured packet.
+ */
+struct PcapTapAddr {
+  /// address, IPv4 in the last 4 bytes
+  unsigned char addr[16];
+  /// port, in network byte order
+  uint16_t port;
+  /// address family, or @c AF_UNSPEC if unknown
+  unsigned char af;
+};
+
+
+/**
+ * @brief Convert socket address to endpoint of captured packet.
+ *
+ * @param[out] self Endpoint.
+ * @param addr Socket address. Can be @c NULL.
+ */
+static void PcapTapAddr_set (
+    struct PcapTapAddr *self, const struct sockaddr *addr) {
+  memset(self->addr, 0, sizeof(self->addr));
+  self->port = 0;
+  self->af = AF_UNSPEC;
+  return_if (addr == NULL);
+
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *addr4 = (const struct sockaddr_in *) addr;
+    memcpy(self->addr + 12, &addr4->sin_addr, 4);
+    self->port = addr4->sin_port;
+    self->af = AF_INET;
+  } else if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *) addr;
+    memcpy(self->addr, &addr6->sin6_addr, 16);
+    self->port = addr6->sin6_port;
+    self->af = IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr) ? AF_INET : AF_INET6;
+  }
+}
+
+
+/**
+ * @brief Write synthesized IP and UDP headers.
+ *
+ * @param[out] buf Buffer.
+ * @param v6 Whether to write IPv6 header.
+ * @param src Source endpoint.
+ * @param dst Destination endpoint.
+ * @param len Length of UDP payload.
+ * @return Length of headers.
+ */
+static unsigned int pcap_udp_header (
+    unsigned char *buf, bool v6, const struct PcapTapAddr *src,
+    const struct PcapTapAddr *dst, unsigned int len) {
+  unsigned int udp_len = 8 + len;
+  unsigned int off;
+
+  if (v6) {
+    buf[0] = 0x60;
+    memset(buf + 1, 0, 3);
+    buf[4] = udp_len >> 8;
+    buf[5] = udp_len;
+    buf[6] = IPPROTO_UDP;
+    buf[7] = 64;
+    memcpy(buf + 8, src->addr, 16);
+    memcpy(buf + 24, dst->addr, 16);
+    // IPv4 addresses become IPv4-mapped
+    for (int i = 0; i < 2; i++) {
+      const struct PcapTapAddr *addr = i == 0 ? src : dst;
+      if (addr->af == AF_INET) {
+        memset(buf + 8 + i * 16, 0, 10);
+        memset(buf + 8 + i * 16 + 10, 0xff, 2);
+      }
+    }
+    off = 40;
+  } else {
+    unsigned int ip_len = 20 + udp_len;
+    buf[0] = 0x45;
+    buf[1] = 0;
+    buf[2] = ip_len >> 8;
+    buf[3] = ip_len;
+    memset(buf + 4, 0, 4);
+    buf[8] = 64;
+    buf[9] = IPPROTO_UDP;
+    buf[10] = 0;
+    buf[11] = 0;
+    memcpy(buf + 12, src->addr + 12, 4);
+    memcpy(buf + 16, dst->addr + 12, 4);
+    uint32_t sum = 0;
+    for (int i = 0; i < 20; i += 2) {
+      sum += (buf[i] << 8) | buf[i + 1];
+    }
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = ~((sum & 0xffff) + (sum >> 16));
+    buf[10] = sum >> 8;
+    buf[11] = sum;
+    off = 20;
+  }
+
+  // UDP checksum is optional
+  memcpy(buf + off, &src->port, 2);
+  memcpy(buf + off + 2, &dst->port, 2);
+  buf[off + 4] = udp_len >> 8;
+  buf[off + 5] = udp_len;
+  buf[off + 6] = 0;
+  buf[off + 7] = 0;
+  return off + 8;
+}
+
+
+/**
+ * @memberof PcapTap
+ * @private
+ * @brief Create current capture file and write pcapng header.
+ *
+ * @param self Capture tap.
+ * @return 0 on success, -1 on error.
+ */
+static int PcapTap_open (struct PcapTap *self) {
+  char path[strlen(self->path) + 12];
+  if (self->n_file > 1) {
+    snprintf(path, sizeof(path), "%s.%u", self->path, self->index);
+  } else {
+    strcpy(path, self->path);
+  }
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  return_if_fail (fd >= 0) -1;
+  unsigned char *map = MAP_FAILED;
+  if likely (ftruncate(fd, self->size) == 0) {
+    map = mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  should (map != MAP_FAILED) otherwise {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  // Section Header Block
+  uint32_t shb[7] = {
+    PCAPNG_SHB_TYPE, 28, 0x1a2b3c4d, 1, 0xffffffff, 0xffffffff, 28};
+  memcpy(map, shb, sizeof(shb));
+  // Interface Description Block, microsecond resolution by default
+  uint32_t idb[5] = {PCAPNG_IDB_TYPE, 20, PCAPNG_LINKTYPE_RAW, 0, 20};
+  memcpy(map + sizeof(shb), idb, sizeof(idb));
+
+  self->fd = fd;
+  atomic_store(&self->map, map);
+  atomic_store(&self->offset, PCAPNG_HEADER_SIZE);
+  return 0;
+}
+
+
+/**
+ * @memberof PcapTap
+ * @private
+ * @brief Close current capture file, cutting unused space.
+ *
+ * Writers must have been drained.
+ *
+ * @param self Capture tap.
+ * @param used Used length of file.
+ */
+static void PcapTap_close (struct PcapTap *self, unsigned int used) {
+  unsigned char *map = atomic_exchange(&self->map, NULL);
+  return_if (map == NULL);
+  munmap(map, self->size);
+  should (ftruncate(self->fd, used) == 0) otherwise { }
+  close(self->fd);
+}
+
+
+/**
+ * @memberof PcapTap
+ * @private
+ * @brief Start next capture file.
+ *
+ * @param self Capture tap.
+ * @param generation Generation seen by caller.
+ */
+static void PcapTap_rotate (struct PcapTap *self, unsigned int generation) {
+  mtx_lock(&self->mtx);
+  // someone else has rotated
+  goto_if (atomic_load(&self->generation) != generation) end;
+
+  // stop new reservations, then wait for pending copies
+  unsigned int used = atomic_exchange(&self->offset, self->size);
+  while (atomic_load(&self->writers) != 0) {
+    thrd_yield();
+  }
+  if (used > self->size) {
+    used = self->size;
+  }
+  PcapTap_close(self, used);
+
+  self->index = (self->index + 1) % self->n_file;
+  // on failure, map stays NULL and packets are dropped
+  PcapTap_open(self);
+  atomic_fetch_add(&self->generation, 1);
+
+end:
+  mtx_unlock(&self->mtx);
+}
+
+
+bool PcapTap_match (
+    const struct PcapTap *self, uint32_t id, const char *call_id_number,
+    const char *call_id_host) {
+  return_if (self->filter_id == 0 && self->filter_call_id == NULL) true;
+  return_if (id != 0 && id == self->filter_id) true;
+  return_if (self->filter_call_id == NULL || call_id_number == NULL) false;
+
+  // either "number" or "number@host"
+  const char *filter = self->filter_call_id;
+  size_t len = strlen(call_id_number);
+  return_if_fail (strncmp(filter, call_id_number, len) == 0) false;
+  return filter[len] == '\0' || (
+    filter[len] == '@' && call_id_host != NULL &&
+    strcmp(filter + len + 1, call_id_host) == 0);
+}
+
+
+bool PcapTap_writev (
+    struct PcapTap *self, const struct iovec *iov, int iovcnt,
+    const struct sockaddr *src, const struct sockaddr *dst) {
+  return_if (atomic_load_explicit(&self->paused, memory_order_relaxed)) false;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  struct PcapTapAddr src_addr;
+  PcapTapAddr_set(&src_addr, src);
+  struct PcapTapAddr dst_addr;
+  PcapTapAddr_set(&dst_addr, dst);
+  bool v6 = src_addr.af == AF_INET6 || dst_addr.af == AF_INET6;
+
+  size_t caplen = (v6 ? 40 : 20) + 8 + len;
+  size_t block_len = PCAPNG_EPB_SIZE + ((caplen + 3) & ~(size_t) 3);
+  should (block_len <= self->size - PCAPNG_HEADER_SIZE) otherwise {
+    atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+    return false;
+  }
+
+  // reserve space
+  unsigned char *map;
+  unsigned int off;
+  while (true) {
+    unsigned int generation = atomic_load(&self->generation);
+    atomic_fetch_add(&self->writers, 1);
+    if unlikely (atomic_load(&self->map) == NULL) {
+      atomic_fetch_sub(&self->writers, 1);
+      // wait for rotation in progress
+      mtx_lock(&self->mtx);
+      bool failed = atomic_load(&self->map) == NULL;
+      mtx_unlock(&self->mtx);
+      continue_if_not (failed);
+      // no file, since previous rotation failed
+      atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+      return false;
+    }
+    off = atomic_load(&self->offset);
+    bool reserved = false;
+    while (off + block_len <= self->size && !(
+      reserved = atomic_compare_exchange_weak(
+        &self->offset, &off, off + block_len))) { }
+    if likely (reserved) {
+      // the file reserved in, which is mapped before offset reset
+      map = atomic_load(&self->map);
+      break;
+    }
+    atomic_fetch_sub(&self->writers, 1);
+    PcapTap_rotate(self, generation);
+  }
+
+  // Enhanced Packet Block
+  unsigned char *block = map + off;
+  uint64_t ts = now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+  uint32_t head[7] = {
+    PCAPNG_EPB_TYPE, block_len, 0, ts >> 32, ts, caplen, caplen};
+  memcpy(block, head, sizeof(head));
+  unsigned char *p = block + sizeof(head);
+  p += pcap_udp_header(p, v6, &src_addr, &dst_addr, len);
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+  while ((p - block) % 4 != 0) {
+    *p++ = 0;
+  }
+  uint32_t tail = block_len;
+  memcpy(p, &tail, sizeof(tail));
+
+  atomic_fetch_sub(&self->writers, 1);
+  return true;
+}
+
+
+void PcapTap_destroy (struct PcapTap *self) {
+  unsigned int used = atomic_load(&self->offset);
+  PcapTap_close(self, used < self->size ? used : self->size);
+  mtx_destroy(&self->mtx);
+  free(self->path);
+  free(self->filter_call_id);
+}
+
+
+int PcapTap_init (
+    struct PcapTap *self, const char *path, unsigned int size,
+    unsigned int n_file) {
+  self->path = strdup(path);
+  return_if_fail (self->path != NULL) -1;
+  self->classes = PCAP_TAP_ALL;
+  self->filter_id = 0;
+  self->filter_call_id = NULL;
+  atomic_init(&self->dropped, 0);
+  atomic_init(&self->paused, false);
+  self->size = size;
+  self->n_file = n_file < 1 ? 1 : n_file;
+  self->index = 0;
+  atomic_init(&self->map, NULL);
+  atomic_init(&self->offset, 0);
+  atomic_init(&self->writers, 0);
+  atomic_init(&self->generation, 0);
+
+  int saved_errno;
+  should (mtx_init(&self->mtx, mtx_plain) == thrd_success) otherwise {
+    saved_errno = errno;
+    goto fail_mtx;
+  }
+  should (PcapTap_open(self) == 0) otherwise {
+    saved_errno = errno;
+    mtx_destroy(&self->mtx);
+fail_mtx:
+    free(self->path);
+    errno = saved_errno;
+    return -1;
+  }
+  return 0;
+}
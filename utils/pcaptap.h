@@ -0,0 +1,160 @@
+#ifndef UTILS_PCAPTAP_H
+#define UTILS_PCAPTAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+#include <sys/uio.h>
+
+// #include <sys/socket.h>
+struct sockaddr;
+
+/**
+ * @file
+ * Packet capture into pcapng files.
+ */
+
+
+/// Traffic class of captured packets.
+enum PcapTapClass {
+  /// SIP messages
+  PCAP_TAP_SIP = 1 << 0,
+  /// LEELEN VoIP messages
+  PCAP_TAP_LEELEN = 1 << 1,
+  /// audio and video
+  PCAP_TAP_MEDIA = 1 << 2,
+  /// all traffic
+  PCAP_TAP_ALL = PCAP_TAP_SIP | PCAP_TAP_LEELEN | PCAP_TAP_MEDIA,
+};
+
+
+/**
+ * @brief Packet capture tap.
+ *
+ * Packets are written as pcapng Enhanced Packet Blocks of raw IP, with UDP/IP
+ * headers synthesized from the socket addresses, into a memory-mapped file of
+ * fixed size. Writers reserve space with an atomic add and copy the payload
+ * straight into the mapping. When a file is full, the next one of
+ * PcapTap::n_file files is started, overwriting the oldest.
+ */
+struct PcapTap {
+  /// traffic classes to capture, see ::PcapTapClass
+  unsigned char classes;
+  /// capture only the session with this LEELEN dialog ID, or 0
+  uint32_t filter_id;
+  /// capture only the session with this SIP Call-ID, or @c NULL
+  char *filter_call_id;
+  /// number of packets not captured, since too large or no file
+  atomic_ulong dropped;
+  /// @c true if capturing is paused, packets are ignored without counting
+  atomic_bool paused;
+
+  /** @privatesection */
+  /// path of capture file
+  char *path;
+  /// size of each file
+  unsigned int size;
+  /// number of files
+  unsigned int n_file;
+  /// index of current file
+  unsigned int index;
+  /// current file
+  int fd;
+  /// mapping of current file, or @c NULL if none
+  unsigned char * _Atomic map;
+  /// next free offset in current file
+  atomic_uint offset;
+  /// number of writers copying into current file
+  atomic_uint writers;
+  /// incremented on rotation
+  atomic_uint generation;
+  /// mutex for rotation
+  mtx_t mtx;
+};
+
+__attribute__((warn_unused_result, nonnull(1)))
+/**
+ * @memberof PcapTap
+ * @brief Test if a session should be captured.
+ *
+ * @param self Capture tap.
+ * @param id LEELEN dialog ID, or 0 if unknown.
+ * @param call_id_number Number part of SIP Call-ID. Can be @c NULL.
+ * @param call_id_host Host part of SIP Call-ID. Can be @c NULL.
+ * @return @c true if no filter set or the session matches.
+ */
+bool PcapTap_match (
+  const struct PcapTap *self, uint32_t id, const char *call_id_number,
+  const char *call_id_host);
+__attribute__((nonnull(1, 2)))
+/**
+ * @memberof PcapTap
+ * @brief Capture a UDP packet.
+ *
+ * This function is thread-safe and lock-free, unless the file is rotated.
+ *
+ * @param self Capture tap.
+ * @param iov Parts of UDP payload.
+ * @param iovcnt Number of parts.
+ * @param src Source address. Can be @c NULL.
+ * @param dst Destination address. Can be @c NULL.
+ * @return @c true if captured, @c false if dropped or paused.
+ */
+bool PcapTap_writev (
+  struct PcapTap *self, const struct iovec *iov, int iovcnt,
+  const struct sockaddr *src, const struct sockaddr *dst);
+__attribute__((nonnull(1, 2)))
+/**
+ * @memberof PcapTap
+ * @brief Capture a UDP packet.
+ *
+ * @param self Capture tap.
+ * @param buf UDP payload.
+ * @param len Length of payload.
+ * @param src Source address. Can be @c NULL.
+ * @param dst Destination address. Can be @c NULL.
+ * @return @c true if captured.
+ */
+static inline bool PcapTap_write (
+    struct PcapTap *self, const void *buf, unsigned int len,
+    const struct sockaddr *src, const struct sockaddr *dst) {
+  struct iovec iov = {.iov_base = (void *) buf, .iov_len = len};
+  return PcapTap_writev(self, &iov, 1, src, dst);
+}
+
+__attribute__((nonnull))
+/**
+ * @memberof PcapTap
+ * @brief Close capture file and destroy the tap.
+ *
+ * @param self Capture tap.
+ */
+void PcapTap_destroy (struct PcapTap *self);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof PcapTap
+ * @brief Initialize a capture tap and create the first file.
+ *
+ * If @p n_file is greater than 1, files are named `<path>.<index>`.
+ *
+ * @param[out] self Capture tap.
+ * @param path Path of capture file.
+ * @param size Size of each file, in bytes.
+ * @param n_file Number of files to rotate.
+ * @return 0 on success, -1 on error and @c errno is set appropriately.
+ */
+int PcapTap_init (
+  struct PcapTap *self, const char *path, unsigned int size,
+  unsigned int n_file);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_PCAPTAP_H */
@@ -0,0 +1,67 @@
+#ifndef UTILS_RTP_H
+#define UTILS_RTP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * @file
+ * Minimal RTP header inspection.
+ */
+
+
+/// payload type we advertise for `telephone-event/8000` (RFC 4733)
+#define RTP_TELEPHONE_EVENT_TYPE 127
+/// DTMF digits, indexed by telephone event code
+#define RTP_DTMF_DIGITS "0123456789*#ABCD"
+
+__attribute__((warn_unused_result, nonnull(1), access(read_only, 1, 2),
+               access(write_only, 4)))
+/**
+ * @brief Test if a packet is an RTP telephone event, and get the event code.
+ *
+ * Only the fixed header, the CSRC list and the header extension are skipped;
+ * nothing else is validated, so that audio packets are rejected with a couple
+ * of comparisons.
+ *
+ * @param buf Packet.
+ * @param len Length of packet.
+ * @param type Payload type of telephone event.
+ * @param[out] timestamp RTP timestamp, which is the same for all packets of
+ *  one event. Can be @c NULL.
+ * @return Event code, or -1 if not a telephone event.
+ */
+static inline int rtp_telephone_event (
+    const void *buf, int len, int type, uint32_t *timestamp) {
+  const unsigned char *p = buf;
+  if (len < 12 + 4 || (p[0] & 0xc0) != 0x80 || (p[1] & 0x7f) != type) {
+    return -1;
+  }
+
+  int off = 12 + (p[0] & 0x0f) * 4;
+  if (p[0] & 0x10) {
+    if (len < off + 4) {
+      return -1;
+    }
+    off += 4 + ((p[off + 2] << 8) | p[off + 3]) * 4;
+  }
+  if (len < off + 4) {
+    return -1;
+  }
+
+  if (timestamp != NULL) {
+    *timestamp = ((uint32_t) p[4] << 24) | ((uint32_t) p[5] << 16) |
+                 ((uint32_t) p[6] << 8) | p[7];
+  }
+  return p[off];
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_RTP_H */
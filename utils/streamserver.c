@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "macro.h"
+#include "arg.h"
+#include "log.h"
+#include "streamserver.h"
+
+
+void StreamServer_pollfds (
+    const struct StreamServer *self, struct pollfd *pollfds) {
+  pollfds[0].fd = self->sockfd;
+  pollfds[0].events = POLLIN;
+  for (int i = 0; i < STREAM_SERVER_CLIENTS; i++) {
+    pollfds[1 + i].fd = self->clients[i];
+    pollfds[1 + i].events = POLLIN;
+  }
+}
+
+
+int StreamServer_accept (
+    struct StreamServer *self, const struct pollfd *pollfds, const char *what) {
+  return_if (pollfds[0].revents == 0) -1;
+
+  int sockfd = accept4(self->sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  should (sockfd >= 0) otherwise {
+    if (errno != EAGAIN && errno != EINTR) {
+      LOG_PERROR(LOG_LEVEL_WARNING, "accept() failed");
+    }
+    return -1;
+  }
+  int i = 0;
+  for (; i < STREAM_SERVER_CLIENTS; i++) {
+    break_if (self->clients[i] < 0);
+  }
+  should (i < STREAM_SERVER_CLIENTS) otherwise {
+    LOG(LOG_LEVEL_INFO, "Too many %s connections", what);
+    close(sockfd);
+    return -1;
+  }
+  self->clients[i] = sockfd;
+  return i;
+}
+
+
+void StreamServer_close (struct StreamServer *self, int i) {
+  close(self->clients[i]);
+  self->clients[i] = -1;
+}
+
+
+void StreamServer_destroy (struct StreamServer *self) {
+  for (int i = 0; i < STREAM_SERVER_CLIENTS; i++) {
+    if (self->clients[i] >= 0) {
+      StreamServer_close(self, i);
+    }
+  }
+  if likely (self->sockfd >= 0) {
+    close(self->sockfd);
+  }
+  if (self->path != NULL) {
+    unlink(self->path);
+    free(self->path);
+  }
+}
+
+
+/**
+ * @memberof StreamServer
+ * @private
+ * @brief Create the listening socket, and initialize connections.
+ *
+ * @param[out] self Server.
+ * @param addr Address to bind.
+ * @param addrlen Length of @p addr.
+ * @param path Path of Unix socket, owned by @p self on success, or @c NULL.
+ * @param mode Permissions of socket file, or 0 to keep the umask default.
+ * @return 0 on success, -1 on error and @c errno is set appropriately.
+ * @note With @p mode, the process umask is changed while binding.
+ */
+static int StreamServer_listen (
+    struct StreamServer *self, const struct sockaddr *addr,
+    socklen_t addrlen, char *path, mode_t mode) {
+  int sockfd = socket(
+    addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  return_if_fail (sockfd >= 0) -1;
+  if (addr->sa_family == AF_INET) {
+    int on = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  }
+  // create the socket file no more permissive than mode, so that nobody else
+  // can connect before chmod()
+  mode_t old_mask = mode == 0 ? 0 : umask(~mode & 0777);
+  int bound = bind(sockfd, addr, addrlen);
+  if (mode != 0) {
+    umask(old_mask);
+  }
+  should (bound == 0 &&
+          (mode == 0 || chmod(path, mode) == 0) &&
+          listen(sockfd, STREAM_SERVER_CLIENTS) == 0) otherwise {
+    int saved_errno = errno;
+    close(sockfd);
+    if (path != NULL) {
+      unlink(path);
+    }
+    errno = saved_errno;
+    return -1;
+  }
+
+  self->sockfd = sockfd;
+  self->path = path;
+  for (int i = 0; i < STREAM_SERVER_CLIENTS; i++) {
+    self->clients[i] = -1;
+  }
+  return 0;
+}
+
+
+int StreamServer_init_loopback (struct StreamServer *self, in_port_t port) {
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  return StreamServer_listen(
+    self, (const struct sockaddr *) &addr, sizeof(addr), NULL, 0);
+}
+
+
+int StreamServer_init_unix (
+    struct StreamServer *self, const char *path, mode_t mode) {
+  char *abspath = argtoabspath(path);
+  return_if_fail (abspath != NULL) -1;
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  should (strlen(abspath) < sizeof(addr.sun_path)) otherwise {
+    free(abspath);
+    return 1;
+  }
+  strcpy(addr.sun_path, abspath);
+  // stale socket of previous run
+  unlink(abspath);
+
+  should (StreamServer_listen(
+      self, (const struct sockaddr *) &addr, sizeof(addr), abspath, mode
+  ) == 0) otherwise {
+    int saved_errno = errno;
+    free(abspath);
+    errno = saved_errno;
+    return -1;
+  }
+  return 0;
+}
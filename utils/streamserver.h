@@ -0,0 +1,113 @@
+#ifndef UTILS_STREAMSERVER_H
+#define UTILS_STREAMSERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+// #include <poll.h>
+struct pollfd;
+
+/**
+ * @file
+ * Listening stream socket with a fixed set of connections, driven by the
+ * caller's poll loop.
+ */
+
+
+/// maximum number of connections served at the same time
+#define STREAM_SERVER_CLIENTS 4
+/// number of @c pollfd entries used by StreamServer
+#define STREAM_SERVER_NPOLLFD (1 + STREAM_SERVER_CLIENTS)
+
+
+/**
+ * @brief Listening stream socket on loopback or a Unix socket.
+ *
+ * Add #STREAM_SERVER_NPOLLFD entries with StreamServer_pollfds(); after
+ * @c poll(), entry 0 is the listening socket, passed to StreamServer_accept(),
+ * and entry 1 + @c i is StreamServer::clients[@c i].
+ */
+struct StreamServer {
+  /// listening socket, or -1 if disabled
+  int sockfd;
+  /// path of Unix socket, unlinked when destroyed, or @c NULL
+  char *path;
+  /// accepted connections, -1 if unused
+  int clients[STREAM_SERVER_CLIENTS];
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof StreamServer
+ * @brief Fill @c pollfd entries.
+ *
+ * @param self Server.
+ * @param[out] pollfds Array of #STREAM_SERVER_NPOLLFD entries.
+ */
+void StreamServer_pollfds (
+  const struct StreamServer *self, struct pollfd *pollfds);
+__attribute__((nonnull))
+/**
+ * @memberof StreamServer
+ * @brief Accept a new connection if the listening socket is ready.
+ *
+ * @param self Server.
+ * @param pollfds Array of #STREAM_SERVER_NPOLLFD entries.
+ * @param what Name of connections, for logging.
+ * @return Index of the new connection, or -1 if none.
+ */
+int StreamServer_accept (
+  struct StreamServer *self, const struct pollfd *pollfds, const char *what);
+__attribute__((nonnull))
+/**
+ * @memberof StreamServer
+ * @brief Close a connection.
+ *
+ * @param self Server.
+ * @param i Index of connection.
+ */
+void StreamServer_close (struct StreamServer *self, int i);
+
+__attribute__((nonnull))
+/**
+ * @memberof StreamServer
+ * @brief Close all sockets, and unlink the Unix socket.
+ *
+ * @param self Server.
+ */
+void StreamServer_destroy (struct StreamServer *self);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof StreamServer
+ * @brief Listen on a TCP port of loopback.
+ *
+ * @param[out] self Server.
+ * @param port Port number, in host byte order.
+ * @return 0 on success, -1 on error and @c errno is set appropriately.
+ */
+int StreamServer_init_loopback (struct StreamServer *self, in_port_t port);
+__attribute__((warn_unused_result, nonnull))
+/**
+ * @memberof StreamServer
+ * @brief Listen on a Unix socket, replacing any stale socket file.
+ *
+ * @param[out] self Server.
+ * @param path Path of Unix socket, made absolute.
+ * @param mode Permissions of socket file, applied from its creation, or 0 to
+ *  keep the umask default.
+ * @return 0 on success, 1 if @p path too long, -1 on error and @c errno is
+ *  set appropriately.
+ */
+int StreamServer_init_unix (
+  struct StreamServer *self, const char *path, mode_t mode);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_STREAMSERVER_H */
@@ -40,6 +40,84 @@ static inline bool timeout_reached (
       tv_sec_interval == tv_sec_timeout && tv_nsec_interval >= tv_nsec_timeout);
 }
 
+__attribute__((nonnull))
+/**
+ * @brief Add milliseconds to a time.
+ *
+ * @param[in,out] ts Time.
+ * @param ms Milliseconds.
+ */
+static inline void timespec_add_ms (struct timespec *ts, unsigned int ms) {
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000l;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+__attribute__((pure, warn_unused_result, nonnull))
+/**
+ * @brief Get interval between two times.
+ *
+ * @param end End time.
+ * @param beg Begin time.
+ * @return Interval in microseconds.
+ */
+static inline long long timespec_diff_us (
+    const struct timespec *end, const struct timespec *beg) {
+  return (end->tv_sec - beg->tv_sec) * 1000000ll +
+         (end->tv_nsec - beg->tv_nsec) / 1000;
+}
+
+__attribute__((warn_unused_result))
+/**
+ * @brief Get current monotonic time.
+ *
+ * @return Monotonic time in milliseconds.
+ */
+static inline unsigned long long monotonic_ms (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+__attribute__((warn_unused_result))
+/**
+ * @brief Get current monotonic time.
+ *
+ * @return Monotonic time in microseconds.
+ */
+static inline unsigned long long monotonic_us (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+__attribute__((warn_unused_result))
+/**
+ * @brief Get current monotonic time.
+ *
+ * @return Monotonic time in nanoseconds.
+ */
+static inline unsigned long long monotonic_ns (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+__attribute__((warn_unused_result))
+/**
+ * @brief Get current real time.
+ *
+ * @return Real time since the Epoch in microseconds.
+ */
+static inline unsigned long long realtime_us (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
 
 #ifdef __cplusplus
 }
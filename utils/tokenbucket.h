@@ -0,0 +1,75 @@
+#ifndef UTILS_TOKENBUCKET_H
+#define UTILS_TOKENBUCKET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+/**
+ * @file
+ * Token bucket rate limiter.
+ */
+
+
+/**
+ * @brief Token bucket.
+ *
+ * Tokens are counted in 1/1000, so that refilling with a rate in tokens per
+ * second over an interval in milliseconds is exact.
+ */
+struct TokenBucket {
+  /// available tokens, in 1/1000 tokens
+  unsigned long tokens;
+  /// time of last refill, in milliseconds
+  unsigned long long last;
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof TokenBucket
+ * @brief Refill the bucket and try to take a token.
+ *
+ * @param[in,out] self Token bucket.
+ * @param now Current time, in milliseconds, monotonic.
+ * @param rate Refill rate, in tokens per second.
+ * @param burst Bucket capacity, in tokens.
+ * @return @c true if a token is taken.
+ */
+static inline bool TokenBucket_consume (
+    struct TokenBucket *self, unsigned long long now, unsigned int rate,
+    unsigned int burst) {
+  if (now > self->last) {
+    unsigned long long tokens = self->tokens + (now - self->last) * rate;
+    self->tokens = tokens > burst * 1000ull ? burst * 1000ul : tokens;
+    self->last = now;
+  }
+  if (self->tokens < 1000) {
+    return false;
+  }
+  self->tokens -= 1000;
+  return true;
+}
+
+__attribute__((nonnull, access(write_only, 1)))
+/**
+ * @memberof TokenBucket
+ * @brief Initialize a full token bucket.
+ *
+ * @param[out] self Token bucket.
+ * @param now Current time, in milliseconds, monotonic.
+ * @param burst Bucket capacity, in tokens.
+ */
+static inline void TokenBucket_init (
+    struct TokenBucket *self, unsigned long long now, unsigned int burst) {
+  self->tokens = burst * 1000ul;
+  self->last = now;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_TOKENBUCKET_H */
@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "macro.h"
+#include "control.h"
+#include "threadname.h"
+#include "trace.h"
+
+
+/**
+ * @brief Recorded trace event.
+ */
+struct TraceEvent {
+  /// event name
+  const char *name;
+  /// correlation ID
+  uint32_t id;
+  /// start time, in nanoseconds
+  unsigned long long start;
+  /// end time, in nanoseconds, or 0 if instant
+  unsigned long long end;
+};
+
+/**
+ * @brief Event ring of a thread.
+ *
+ * Only TraceBuffer::head and TraceBuffer::events are written without holding
+ * @ref trace_mutex, by the owner thread.
+ */
+struct TraceBuffer {
+  /// events, allocated on first claim
+  struct TraceEvent *events;
+  /// number of events ever recorded
+  atomic_ulong head;
+  /// TraceBuffer::head when claimed by current owner
+  unsigned long first;
+  /// whether owned by a running thread
+  bool used;
+  /// sequence number of last release, to recycle the oldest ring first
+  unsigned long released;
+  /// thread ID of owner, or 0 if never claimed
+  pid_t tid;
+  /// thread name of owner
+  char thread_name[THREADNAME_SIZE];
+};
+
+static struct TraceBuffer trace_buffers[TRACE_THREADS];
+/// protects ownership of @ref trace_buffers
+static mtx_t trace_mutex;
+/// releases ring of exiting thread
+static tss_t trace_key;
+static once_flag trace_once = ONCE_FLAG_INIT;
+/// number of releases
+static unsigned long trace_n_release;
+/// ring of current thread, or @c NULL if not claimed
+static _Thread_local struct TraceBuffer *trace_buffer;
+/// whether current thread failed to claim a ring
+static _Thread_local bool trace_failed;
+
+
+/**
+ * @relates TraceBuffer
+ * @private
+ * @brief Release ring of exiting thread.
+ *
+ * @param arg Ring.
+ */
+static void trace_release (void *arg) {
+  struct TraceBuffer *buffer = arg;
+  mtx_lock(&trace_mutex);
+  buffer->used = false;
+  buffer->released = ++trace_n_release;
+  mtx_unlock(&trace_mutex);
+}
+
+
+/**
+ * @relates TraceBuffer
+ * @private
+ * @brief Initialize global states.
+ */
+static void trace_init (void) {
+  mtx_init(&trace_mutex, mtx_plain);
+  tss_create(&trace_key, trace_release);
+}
+
+
+/**
+ * @relates TraceBuffer
+ * @private
+ * @brief Claim the ring released the longest ago for current thread.
+ *
+ * @return Ring, or @c NULL if all rings are in use or out of memory.
+ */
+static struct TraceBuffer *trace_claim (void) {
+  return_if (trace_failed) NULL;
+  call_once(&trace_once, trace_init);
+
+  struct TraceBuffer *buffer = NULL;
+  mtx_lock(&trace_mutex);
+  for (int i = 0; i < TRACE_THREADS; i++) {
+    continue_if (trace_buffers[i].used);
+    if (buffer == NULL || trace_buffers[i].released < buffer->released) {
+      buffer = &trace_buffers[i];
+    }
+  }
+  if likely (buffer != NULL && buffer->events == NULL) {
+    buffer->events = malloc(sizeof(buffer->events[0]) * TRACE_EVENTS);
+    // analyzer false positive: the events are reachable from trace_buffers
+    // and kept for the life of the process, as rings are recycled but never
+    // freed
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wanalyzer-malloc-leak"
+    if unlikely (buffer->events == NULL) {
+      buffer = NULL;
+    }
+#pragma GCC diagnostic pop
+  }
+  if likely (buffer != NULL) {
+    buffer->used = true;
+    buffer->first =
+      atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    buffer->tid = gettid();
+    if (threadname_get(buffer->thread_name, THREADNAME_SIZE) != 0) {
+      buffer->thread_name[0] = '\0';
+    }
+  }
+  mtx_unlock(&trace_mutex);
+
+  should (buffer != NULL &&
+          tss_set(trace_key, buffer) == thrd_success) otherwise {
+    if (buffer != NULL) {
+      trace_release(buffer);
+    }
+    trace_failed = true;
+    return NULL;
+  }
+  trace_buffer = buffer;
+  return buffer;
+}
+
+
+/**
+ * @relates TraceBuffer
+ * @private
+ * @brief Record an event in ring of current thread.
+ *
+ * @param name Event name.
+ * @param id Correlation ID.
+ * @param start Start time, in nanoseconds.
+ * @param end End time, in nanoseconds, or 0 if instant.
+ */
+static void trace_record (
+    const char *name, uint32_t id, unsigned long long start,
+    unsigned long long end) {
+  struct TraceBuffer *buffer = trace_buffer;
+  if unlikely (buffer == NULL) {
+    buffer = trace_claim();
+    return_if_fail (buffer != NULL);
+  }
+
+  // single writer
+  unsigned long head =
+    atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  struct TraceEvent *event = &buffer->events[head & (TRACE_EVENTS - 1)];
+  event->name = name;
+  event->id = id;
+  event->start = start;
+  event->end = end;
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+
+void TraceSpan_end (const struct TraceSpan *self) {
+  trace_record(self->name, self->id, self->start, monotonic_ns());
+}
+
+
+void trace_mark (const char *name, uint32_t id) {
+  trace_record(name, id, monotonic_ns(), 0);
+}
+
+
+_Static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0,
+               "TRACE_EVENTS must be power of 2");
+
+
+/**
+ * @brief Ring of a thread, as seen when exporting started.
+ */
+struct TraceSnapshot {
+  /// ring, whose events are kept for the life of the process
+  const struct TraceBuffer *buffer;
+  /// TraceBuffer::head when exporting started
+  unsigned long head;
+  /// TraceBuffer::first of the owner
+  unsigned long first;
+  /// thread ID of owner
+  pid_t tid;
+  /// thread name of owner
+  char thread_name[THREADNAME_SIZE];
+};
+
+
+long trace_export (FILE *f) {
+  struct TraceEvent *events = malloc(sizeof(events[0]) * TRACE_EVENTS);
+  return_if_fail (events != NULL) -1;
+
+  call_once(&trace_once, trace_init);
+  pid_t pid = getpid();
+  long n_event = 0;
+
+  // only take owners under the lock, so that threads can claim rings while
+  // the file is written; events recorded after this point are left out
+  struct TraceSnapshot rings[TRACE_THREADS];
+  int n_ring = 0;
+  mtx_lock(&trace_mutex);
+  for (int i = 0; i < TRACE_THREADS; i++) {
+    const struct TraceBuffer *buffer = &trace_buffers[i];
+    continue_if (buffer->tid == 0);
+    struct TraceSnapshot *ring = &rings[n_ring];
+    n_ring++;
+    ring->buffer = buffer;
+    ring->head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    ring->first = buffer->first;
+    ring->tid = buffer->tid;
+    memcpy(ring->thread_name, buffer->thread_name, THREADNAME_SIZE);
+  }
+  mtx_unlock(&trace_mutex);
+
+  fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", f);
+  for (int i = 0; i < n_ring; i++) {
+    const struct TraceSnapshot *ring = &rings[i];
+
+    // copy, then drop events overwritten meanwhile, possibly by a new owner
+    memcpy(events, ring->buffer->events, sizeof(events[0]) * TRACE_EVENTS);
+    atomic_thread_fence(memory_order_acquire);
+    // the slot of the event being recorded is also dirty
+    unsigned long overwritten =
+      atomic_load_explicit(&ring->buffer->head, memory_order_relaxed) -
+      TRACE_EVENTS + 1;
+    unsigned long begin = ring->first;
+    if ((long) (overwritten - begin) > 0) {
+      begin = overwritten;
+    }
+
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%d,\"args\":{\"name\":", i == 0 ? "" : ",", pid,
+            ring->tid);
+    control_write_string(f, ring->thread_name);
+    fputs("}}", f);
+
+    for (unsigned long j = begin; (long) (ring->head - j) > 0; j++) {
+      const struct TraceEvent *event = &events[j & (TRACE_EVENTS - 1)];
+      // timestamps in microseconds
+      fprintf(f, ",{\"name\":\"%s\",\"cat\":\"leelen2sip\","
+              "\"ts\":%llu.%03llu,", event->name,
+              event->start / 1000, event->start % 1000);
+      if (event->end == 0) {
+        // thread-scoped instant event
+        fputs("\"ph\":\"i\",\"s\":\"t\",", f);
+      } else {
+        unsigned long long dur = event->end - event->start;
+        fprintf(f, "\"ph\":\"X\",\"dur\":%llu.%03llu,",
+                dur / 1000, dur % 1000);
+      }
+      fprintf(f, "\"pid\":%d,\"tid\":%d,\"args\":{\"id\":\"%08" PRIx32
+              "\"}}", pid, ring->tid, event->id);
+      n_event++;
+    }
+  }
+  fputs("]}\n", f);
+
+  free(events);
+  return n_event;
+}
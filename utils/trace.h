@@ -0,0 +1,114 @@
+#ifndef UTILS_TRACE_H
+#define UTILS_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Trace spans, exported as Chrome trace JSON.
+ *
+ * Spans are recorded only if @c USE_TRACE is defined (<tt>make TRACE=1</tt>);
+ * otherwise TRACE_SPAN() and TRACE_MARK() expand to nothing but the
+ * evaluation of the correlation ID.
+ *
+ * Each thread records into its own ring of #TRACE_EVENTS events, so recording
+ * takes no lock. Rings are recycled after their threads exit, keeping the
+ * history of the last #TRACE_THREADS threads.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "timeval.h"
+
+
+#ifndef TRACE_THREADS
+/// maximum number of threads recorded
+#define TRACE_THREADS 64
+#endif
+#ifndef TRACE_EVENTS
+/// number of events recorded per thread, must be power of 2
+#define TRACE_EVENTS 4096
+#endif
+
+
+/**
+ * @brief Running trace span.
+ */
+struct TraceSpan {
+  /// span name, must be a string literal
+  const char *name;
+  /// correlation ID, usually LEELEN dialog ID, or 0 if none
+  uint32_t id;
+  /// start time, in nanoseconds
+  unsigned long long start;
+};
+
+__attribute__((nonnull))
+/**
+ * @memberof TraceSpan
+ * @brief End a trace span and record it.
+ *
+ * @param self Trace span.
+ */
+void TraceSpan_end (const struct TraceSpan *self);
+
+__attribute__((nonnull))
+/**
+ * @brief Record an instant event.
+ *
+ * @param name Event name, must be a string literal.
+ * @param id Correlation ID, or 0 if none.
+ */
+void trace_mark (const char *name, uint32_t id);
+
+__attribute__((nonnull))
+/**
+ * @brief Write recorded events as Chrome trace JSON, which can be loaded by
+ *  @c chrome://tracing or Perfetto.
+ *
+ * Recording threads are not blocked.
+ *
+ * @param f Output.
+ * @return Number of events written, or -1 if out of memory.
+ */
+long trace_export (FILE *f);
+
+
+#ifdef USE_TRACE
+
+#define TRACE_CONCAT_HELPER(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_HELPER(a, b)
+
+/**
+ * @brief Record a trace span until the end of current block.
+ *
+ * @param name Span name, must be a string literal.
+ * @param id Correlation ID, or 0 if none.
+ */
+#define TRACE_SPAN(name, id) \
+  __attribute__((cleanup(TraceSpan_end))) const struct TraceSpan \
+    TRACE_CONCAT(trace_span_, __LINE__) = {(name), (id), monotonic_ns()}
+/**
+ * @brief Record an instant event.
+ *
+ * @param name Event name, must be a string literal.
+ * @param id Correlation ID, or 0 if none.
+ */
+#define TRACE_MARK(name, id) trace_mark((name), (id))
+
+#else
+
+#define TRACE_SPAN(name, id) ((void) (id))
+#define TRACE_MARK(name, id) ((void) (id))
+
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UTILS_TRACE_H */